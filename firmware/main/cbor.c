@@ -0,0 +1,268 @@
+/**
+ * @file cbor.c
+ * @author Dorian Benech
+ * @brief Minimal CBOR (RFC 8949) encoder for the Linky payloads
+ * @version 1.0
+ * @date 2024-07-22
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "cbor.h"
+#include <string.h>
+#include "esp_log.h"
+#include "gpio.h"
+#include "exporter.h"
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define TAG "CBOR"
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_SIMPLE 7
+
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_NULL 0xF6
+#define CBOR_BREAK 0xFF
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static void cbor_write(cbor_writer_t *writer, const void *data, size_t len);
+static void cbor_write_head(cbor_writer_t *writer, uint8_t major, uint64_t value);
+static void cbor_add_value(cbor_writer_t *writer, const exporter_value_t *value);
+static void cbor_encode_linky_root(cbor_writer_t *writer, const char *token, uint8_t content_key);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+static void cbor_write(cbor_writer_t *writer, const void *data, size_t len)
+{
+    if (writer->overflow || writer->len + len > writer->size)
+    {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->buffer + writer->len, data, len);
+    writer->len += len;
+}
+
+/**
+ * @brief Write the initial byte and the shortest big endian argument
+ */
+static void cbor_write_head(cbor_writer_t *writer, uint8_t major, uint64_t value)
+{
+    uint8_t head[9];
+    uint8_t len;
+    if (value < 24)
+    {
+        head[0] = (major << 5) | value;
+        len = 1;
+    }
+    else if (value <= UINT8_MAX)
+    {
+        head[0] = (major << 5) | 24;
+        len = 2;
+    }
+    else if (value <= UINT16_MAX)
+    {
+        head[0] = (major << 5) | 25;
+        len = 3;
+    }
+    else if (value <= UINT32_MAX)
+    {
+        head[0] = (major << 5) | 26;
+        len = 5;
+    }
+    else
+    {
+        head[0] = (major << 5) | 27;
+        len = 9;
+    }
+    for (uint8_t i = len - 1; i > 0; i--)
+    {
+        head[i] = value & 0xFF;
+        value >>= 8;
+    }
+    cbor_write(writer, head, len);
+}
+
+void cbor_init(cbor_writer_t *writer, uint8_t *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->len = 0;
+    writer->overflow = false;
+}
+
+void cbor_add_uint(cbor_writer_t *writer, uint64_t value)
+{
+    cbor_write_head(writer, CBOR_MAJOR_UINT, value);
+}
+
+void cbor_add_text(cbor_writer_t *writer, const char *text)
+{
+    size_t len = strlen(text);
+    cbor_write_head(writer, CBOR_MAJOR_TEXT, len);
+    cbor_write(writer, text, len);
+}
+
+void cbor_add_bool(cbor_writer_t *writer, bool value)
+{
+    uint8_t byte = value ? CBOR_TRUE : CBOR_FALSE;
+    cbor_write(writer, &byte, 1);
+}
+
+void cbor_add_null(cbor_writer_t *writer)
+{
+    uint8_t byte = CBOR_NULL;
+    cbor_write(writer, &byte, 1);
+}
+
+void cbor_add_bytes(cbor_writer_t *writer, const uint8_t *data, size_t len)
+{
+    cbor_write_head(writer, CBOR_MAJOR_BYTES, len);
+    cbor_write(writer, data, len);
+}
+
+void cbor_open_array(cbor_writer_t *writer, size_t count)
+{
+    cbor_write_head(writer, CBOR_MAJOR_ARRAY, count);
+}
+
+void cbor_open_map(cbor_writer_t *writer, size_t count)
+{
+    cbor_write_head(writer, CBOR_MAJOR_MAP, count);
+}
+
+void cbor_open_map_indefinite(cbor_writer_t *writer)
+{
+    uint8_t byte = (CBOR_MAJOR_MAP << 5) | 31;
+    cbor_write(writer, &byte, 1);
+}
+
+void cbor_close_indefinite(cbor_writer_t *writer)
+{
+    uint8_t byte = CBOR_BREAK;
+    cbor_write(writer, &byte, 1);
+}
+
+/**
+ * @brief Add "id: value" to the current map
+ */
+static void cbor_add_value(cbor_writer_t *writer, const exporter_value_t *value)
+{
+    cbor_add_uint(writer, value->label->id);
+    switch (value->label->type)
+    {
+    case STRING:
+        cbor_add_text(writer, value->text);
+        break;
+    case BOOL:
+        cbor_add_bool(writer, value->number);
+        break;
+    default:
+        cbor_add_uint(writer, value->number);
+        break;
+    }
+}
+
+/**
+ * @brief Encode the root map up to the key of the content: CBOR_KEY_DATA or CBOR_KEY_COLUMNS
+ */
+static void cbor_encode_linky_root(cbor_writer_t *writer, const char *token, uint8_t content_key)
+{
+    cbor_open_map(writer, token ? 4 : 3);
+    cbor_add_uint(writer, CBOR_KEY_VERSION);
+    cbor_add_uint(writer, CBOR_SCHEMA_VERSION);
+    if (token)
+    {
+        cbor_add_uint(writer, CBOR_KEY_TOKEN);
+        cbor_add_text(writer, token);
+    }
+    cbor_add_uint(writer, CBOR_KEY_VCONDO);
+    cbor_add_uint(writer, (uint32_t)(gpio_get_vcondo() * 1000));
+
+    cbor_add_uint(writer, content_key);
+}
+
+void cbor_encode_linky_head(cbor_writer_t *writer, uint8_t count, const char *token)
+{
+    cbor_encode_linky_root(writer, token, CBOR_KEY_DATA);
+    cbor_open_array(writer, count);
+}
+
+void cbor_encode_linky_columns_head(cbor_writer_t *writer, const char *token)
+{
+    cbor_encode_linky_root(writer, token, CBOR_KEY_COLUMNS);
+    cbor_open_array(writer, 3);
+}
+
+void cbor_encode_linky_sample(cbor_writer_t *writer, linky_data_t *sample)
+{
+    cbor_encode_linky_sample_filter(writer, sample, NULL);
+}
+
+void cbor_encode_linky_sample_filter(cbor_writer_t *writer, linky_data_t *sample, bool (*filter)(const linky_value_t *label))
+{
+    cbor_open_map_indefinite(writer);
+    cbor_add_uint(writer, CBOR_KEY_TIMESTAMP);
+    cbor_add_uint(writer, sample->timestamp);
+    exporter_iter_t iter;
+    exporter_value_t value;
+    exporter_iter_init(&iter, sample, 0);
+    while (exporter_iter_next(&iter, &value))
+    {
+        if (filter == NULL || filter(value.label))
+        {
+            cbor_add_value(writer, &value);
+        }
+    }
+    cbor_close_indefinite(writer);
+}
+
+size_t cbor_encode_linky(linky_data_t *data, uint8_t count, const char *token, uint8_t *buffer, size_t size)
+{
+    cbor_writer_t writer;
+    cbor_init(&writer, buffer, size);
+
+    cbor_encode_linky_head(&writer, count, token);
+    for (int i = 0; i < count; i++)
+    {
+        cbor_encode_linky_sample(&writer, &data[i]);
+    }
+
+    if (writer.overflow)
+    {
+        ESP_LOGE(TAG, "Buffer too small: %d bytes", size);
+        return 0;
+    }
+    ESP_LOGI(TAG, "Encoded %d samples in %d bytes", count, writer.len);
+    return writer.len;
+}
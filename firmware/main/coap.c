@@ -0,0 +1,865 @@
+/**
+ * @file coap.c
+ * @author Dorian Benech
+ * @brief Minimal CoAP (RFC 7252) client and server with Observe (RFC 7641)
+ * @version 1.0
+ * @date 2024-08-12
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "coap.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "json_writer.h"
+#include "config.h"
+#include "cbor.h"
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define TAG "COAP"
+
+#define COAP_VERSION 1
+#define COAP_TYPE_CON 0
+#define COAP_TYPE_NON 1
+#define COAP_TYPE_ACK 2
+#define COAP_TYPE_RST 3
+
+#define COAP_CODE_EMPTY COAP_CODE(0, 0)
+#define COAP_CODE_GET COAP_CODE(0, 1)
+#define COAP_CODE_POST COAP_CODE(0, 2)
+#define COAP_CODE_CONTENT COAP_CODE(2, 5)
+#define COAP_CODE_BAD_OPTION COAP_CODE(4, 2)
+#define COAP_CODE_NOT_FOUND COAP_CODE(4, 4)
+#define COAP_CODE_METHOD_NOT_ALLOWED COAP_CODE(4, 5)
+#define COAP_CODE_INTERNAL_ERROR COAP_CODE(5, 0)
+
+#define COAP_OPTION_URI_HOST 3
+#define COAP_OPTION_OBSERVE 6
+#define COAP_OPTION_URI_PORT 7
+#define COAP_OPTION_URI_PATH 11
+#define COAP_OPTION_CONTENT_FORMAT 12
+#define COAP_OPTION_MAX_AGE 14
+#define COAP_OPTION_URI_QUERY 15
+#define COAP_PAYLOAD_MARKER 0xFF
+
+#define COAP_ACK_TIMEOUT 2000 // ms, RFC 7252 4.8: the first timeout is random in [ACK_TIMEOUT, 1.5 * ACK_TIMEOUT]
+#define COAP_MAX_RETRANSMIT 4
+#define COAP_SEPARATE_TIMEOUT 10000 // ms, wait for the response after an empty ACK
+#define COAP_TOKEN_SIZE 4
+#define COAP_MESSAGE_SIZE 1152 // RFC 7252 4.6
+#define COAP_RESPONSE_SIZE 256 // the response to an upload has no payload
+#define COAP_PATH_SIZE 48
+#define COAP_MAX_OBSERVERS 4
+#define COAP_CON_EVERY 10        // one notification in COAP_CON_EVERY is confirmable, an observer that does not acknowledge it is removed
+#define COAP_OBSERVE_MAX 0xFFFFFF // the Observe option is 3 bytes at most
+#define COAP_SERVER_TIMEOUT 1     // s, the server task checks coap_server_running
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+#define COAP_CODE(class, detail) (((class) << 5) | (detail))
+#define COAP_CLASS(code) ((code) >> 5)
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+typedef struct
+{
+    uint8_t *buffer;
+    size_t size;
+    size_t len;
+    uint16_t last_option; // the options are written by ascending number, as deltas
+    bool overflow;        // set when the buffer is too small, the message is then invalid
+} coap_writer_t;
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t code;
+    uint16_t message_id;
+    uint8_t token[8];
+    uint8_t token_len;
+    char path[COAP_PATH_SIZE]; // the Uri-Path options joined by '/'
+    int32_t observe;           // -1 without Observe option
+    bool bad_option;           // an unknown critical option
+    const uint8_t *payload;
+    size_t payload_len;
+} coap_message_t;
+
+typedef struct
+{
+    const char *path;
+    bool observable;
+    uint16_t content_format;
+    size_t (*content)(uint8_t *buffer, size_t size); // return the length, 0 on error
+} coap_resource_t;
+
+typedef struct
+{
+    bool used;
+    struct sockaddr_in addr;
+    uint8_t token[8];
+    uint8_t token_len;
+    const coap_resource_t *resource;
+    uint16_t message_id; // of the last notification
+    bool pending;        // the last notification is confirmable and not acknowledged yet
+} coap_observer_t;
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static void coap_write(coap_writer_t *writer, const void *data, size_t len);
+static void coap_write_head(coap_writer_t *writer, uint8_t type, uint8_t code, uint16_t message_id, const uint8_t *token, uint8_t token_len);
+static void coap_write_option(coap_writer_t *writer, uint16_t number, const void *value, size_t len);
+static void coap_write_option_uint(coap_writer_t *writer, uint16_t number, uint32_t value);
+static bool coap_parse(const uint8_t *buffer, size_t len, coap_message_t *message);
+
+static bool coap_is_index(const linky_value_t *label);
+static size_t coap_content_core(uint8_t *buffer, size_t size);
+static size_t coap_content_live(uint8_t *buffer, size_t size);
+static size_t coap_content_index(uint8_t *buffer, size_t size);
+static size_t coap_content_config(uint8_t *buffer, size_t size);
+static size_t coap_build_code(uint8_t type, uint8_t code, uint16_t message_id, const uint8_t *token, uint8_t token_len);
+static size_t coap_build_content(uint8_t type, uint16_t message_id, const uint8_t *token, uint8_t token_len, const coap_resource_t *resource, int32_t observe);
+
+static bool coap_same_observer(coap_observer_t *observer, struct sockaddr_in *addr, const uint8_t *token, uint8_t token_len);
+static bool coap_observe_add(struct sockaddr_in *addr, coap_message_t *request, const coap_resource_t *resource);
+static void coap_observe_remove(struct sockaddr_in *addr, coap_message_t *request);
+static void coap_handle_request(coap_message_t *request, struct sockaddr_in *source);
+static void coap_handle_reply(coap_message_t *reply);
+static void coap_server_task(void *pvParameters);
+
+static int coap_wait_response(int sock, uint16_t message_id, const uint8_t *token, uint32_t timeout, bool *acked);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+static const coap_resource_t coap_resources[] = {
+    {".well-known/core", false, COAP_CONTENT_FORMAT_LINK, coap_content_core},
+    {"tic/live", true, COAP_CONTENT_FORMAT_CBOR, coap_content_live},
+    {"tic/index", true, COAP_CONTENT_FORMAT_CBOR, coap_content_index},
+    {"config", false, COAP_CONTENT_FORMAT_JSON, coap_content_config},
+};
+
+// server: the responses and the notifications are built under coap_mutex
+static SemaphoreHandle_t coap_mutex = NULL;
+static uint8_t coap_buffer[COAP_MESSAGE_SIZE];
+static uint8_t coap_rx_buffer[COAP_MESSAGE_SIZE];
+static int coap_server_sock = -1;
+static TaskHandle_t coap_server_task_handle = NULL;
+static volatile bool coap_server_running = false;
+static uint16_t coap_message_id = 0;
+static linky_data_t coap_sample; // the last sample, content of the tic resources
+static coap_observer_t coap_observers[COAP_MAX_OBSERVERS];
+static uint32_t coap_observe_seq = 0;
+static uint32_t coap_notify_count = 0;
+
+// client
+static uint8_t coap_upload_buffer[COAP_MESSAGE_SIZE];
+static uint16_t coap_upload_id = 0;
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+static void coap_write(coap_writer_t *writer, const void *data, size_t len)
+{
+    if (writer->overflow || writer->len + len > writer->size)
+    {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->buffer + writer->len, data, len);
+    writer->len += len;
+}
+
+static void coap_write_head(coap_writer_t *writer, uint8_t type, uint8_t code, uint16_t message_id, const uint8_t *token, uint8_t token_len)
+{
+    uint8_t head[4] = {(COAP_VERSION << 6) | (type << 4) | token_len, code, message_id >> 8, message_id & 0xFF};
+    writer->len = 0;
+    writer->last_option = 0;
+    writer->overflow = false;
+    coap_write(writer, head, sizeof(head));
+    coap_write(writer, token, token_len);
+}
+
+/**
+ * @brief Write an option, the options must be written by ascending number
+ */
+static void coap_write_option(coap_writer_t *writer, uint16_t number, const void *value, size_t len)
+{
+    uint8_t head[5] = {0};
+    uint8_t head_len = 1;
+    uint16_t fields[2] = {number - writer->last_option, len}; // delta, length
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        uint8_t nibble = fields[i];
+        if (fields[i] >= 269)
+        {
+            nibble = 14;
+            head[head_len++] = (fields[i] - 269) >> 8;
+            head[head_len++] = (fields[i] - 269) & 0xFF;
+        }
+        else if (fields[i] >= 13)
+        {
+            nibble = 13;
+            head[head_len++] = fields[i] - 13;
+        }
+        head[0] |= (i == 0) ? nibble << 4 : nibble;
+    }
+    coap_write(writer, head, head_len);
+    coap_write(writer, value, len);
+    writer->last_option = number;
+}
+
+/**
+ * @brief Write an uint option on the shortest big endian length, 0 is an empty option
+ */
+static void coap_write_option_uint(coap_writer_t *writer, uint16_t number, uint32_t value)
+{
+    uint8_t bytes[4];
+    uint8_t len = 0;
+    for (int8_t shift = 24; shift >= 0; shift -= 8)
+    {
+        if (len > 0 || ((value >> shift) & 0xFF) != 0)
+        {
+            bytes[len++] = (value >> shift) & 0xFF;
+        }
+    }
+    coap_write_option(writer, number, bytes, len);
+}
+
+/**
+ * @brief Parse a message, keep only the options used by the resources
+ *
+ * @return false if the message is malformed
+ */
+static bool coap_parse(const uint8_t *buffer, size_t len, coap_message_t *message)
+{
+    memset(message, 0, sizeof(*message));
+    message->observe = -1;
+    if (len < 4 || (buffer[0] >> 6) != COAP_VERSION)
+    {
+        return false;
+    }
+    message->type = (buffer[0] >> 4) & 0x03;
+    message->token_len = buffer[0] & 0x0F;
+    message->code = buffer[1];
+    message->message_id = (buffer[2] << 8) | buffer[3];
+    if (message->token_len > sizeof(message->token) || 4 + message->token_len > len)
+    {
+        return false;
+    }
+    memcpy(message->token, buffer + 4, message->token_len);
+
+    size_t pos = 4 + message->token_len;
+    size_t path_len = 0;
+    uint16_t number = 0;
+    while (pos < len && buffer[pos] != COAP_PAYLOAD_MARKER)
+    {
+        uint32_t fields[2] = {buffer[pos] >> 4, buffer[pos] & 0x0F}; // delta, length
+        pos++;
+        for (uint8_t i = 0; i < 2; i++)
+        {
+            if (fields[i] == 13 && pos + 1 <= len)
+            {
+                fields[i] = buffer[pos] + 13;
+                pos += 1;
+            }
+            else if (fields[i] == 14 && pos + 2 <= len)
+            {
+                fields[i] = ((buffer[pos] << 8) | buffer[pos + 1]) + 269;
+                pos += 2;
+            }
+            else if (fields[i] >= 13)
+            {
+                return false;
+            }
+        }
+        number += fields[0];
+        if (pos + fields[1] > len)
+        {
+            return false;
+        }
+        const uint8_t *value = buffer + pos;
+        pos += fields[1];
+        switch (number)
+        {
+        case COAP_OPTION_URI_PATH:
+            if (path_len + fields[1] + 2 > sizeof(message->path))
+            {
+                return false;
+            }
+            if (path_len > 0)
+            {
+                message->path[path_len++] = '/';
+            }
+            memcpy(message->path + path_len, value, fields[1]);
+            path_len += fields[1];
+            message->path[path_len] = '\0';
+            break;
+        case COAP_OPTION_OBSERVE:
+            if (fields[1] > 3)
+            {
+                return false;
+            }
+            message->observe = 0;
+            for (uint8_t i = 0; i < fields[1]; i++)
+            {
+                message->observe = (message->observe << 8) | value[i];
+            }
+            break;
+        case COAP_OPTION_URI_HOST:
+        case COAP_OPTION_URI_PORT:
+        case COAP_OPTION_URI_QUERY:
+            break; // one host, no query
+        default:
+            if (number & 1)
+            {
+                message->bad_option = true; // critical
+            }
+            break;
+        }
+    }
+    if (pos < len)
+    {
+        pos++; // payload marker
+        if (pos == len)
+        {
+            return false;
+        }
+        message->payload = buffer + pos;
+        message->payload_len = len - pos;
+    }
+    return true;
+}
+
+static bool coap_is_index(const linky_value_t *label)
+{
+    return label->device_class == ENERGY;
+}
+
+/**
+ * @brief The resources in link format: </tic/live>;ct=60;obs,...
+ */
+static size_t coap_content_core(uint8_t *buffer, size_t size)
+{
+    size_t len = 0;
+    for (uint8_t i = 0; i < sizeof(coap_resources) / sizeof(coap_resources[0]); i++)
+    {
+        if (coap_resources[i].content == coap_content_core)
+        {
+            continue;
+        }
+        int n = snprintf((char *)buffer + len, size - len, "%s</%s>;ct=%d%s", len > 0 ? "," : "", coap_resources[i].path,
+                         coap_resources[i].content_format, coap_resources[i].observable ? ";obs" : "");
+        if (n < 0 || len + n >= size)
+        {
+            return 0;
+        }
+        len += n;
+    }
+    return len;
+}
+
+static size_t coap_content_live(uint8_t *buffer, size_t size)
+{
+    cbor_writer_t writer;
+    cbor_init(&writer, buffer, size);
+    cbor_encode_linky_sample(&writer, &coap_sample);
+    return writer.overflow ? 0 : writer.len;
+}
+
+static size_t coap_content_index(uint8_t *buffer, size_t size)
+{
+    cbor_writer_t writer;
+    cbor_init(&writer, buffer, size);
+    cbor_encode_linky_sample_filter(&writer, &coap_sample, coap_is_index);
+    return writer.overflow ? 0 : writer.len;
+}
+
+static size_t coap_content_config(uint8_t *buffer, size_t size)
+{
+    json_writer_t writer;
+    json_init(&writer, (char *)buffer, size);
+    json_open_object(&writer);
+    json_add_key_text(&writer, "mode", config_get_str_mode());
+    json_add_key_uint(&writer, "refresh_rate", config_values.refresh_rate);
+    json_add_key_text(&writer, "version", config_values.version);
+    json_close_object(&writer);
+    return json_end(&writer);
+}
+
+/**
+ * @brief Build a message without payload in coap_buffer
+ *
+ * @return the length of the message
+ */
+static size_t coap_build_code(uint8_t type, uint8_t code, uint16_t message_id, const uint8_t *token, uint8_t token_len)
+{
+    coap_writer_t writer = {.buffer = coap_buffer, .size = sizeof(coap_buffer)};
+    coap_write_head(&writer, type, code, message_id, token, token_len);
+    return writer.len;
+}
+
+/**
+ * @brief Build a 2.05 Content response or notification of a resource in coap_buffer
+ *
+ * @param observe the Observe option, -1 for none
+ * @return the length of the message, 0 if the content does not fit
+ */
+static size_t coap_build_content(uint8_t type, uint16_t message_id, const uint8_t *token, uint8_t token_len, const coap_resource_t *resource, int32_t observe)
+{
+    coap_writer_t writer = {.buffer = coap_buffer, .size = sizeof(coap_buffer)};
+    coap_write_head(&writer, type, COAP_CODE_CONTENT, message_id, token, token_len);
+    if (observe >= 0)
+    {
+        coap_write_option_uint(&writer, COAP_OPTION_OBSERVE, observe);
+    }
+    coap_write_option_uint(&writer, COAP_OPTION_CONTENT_FORMAT, resource->content_format);
+    if (resource->observable)
+    {
+        coap_write_option_uint(&writer, COAP_OPTION_MAX_AGE, config_values.refresh_rate * 2); // one missed sample is fine
+    }
+    uint8_t marker = COAP_PAYLOAD_MARKER;
+    coap_write(&writer, &marker, 1);
+    if (writer.overflow)
+    {
+        return 0;
+    }
+    size_t len = resource->content(coap_buffer + writer.len, sizeof(coap_buffer) - writer.len);
+    return len > 0 ? writer.len + len : 0;
+}
+
+static bool coap_same_observer(coap_observer_t *observer, struct sockaddr_in *addr, const uint8_t *token, uint8_t token_len)
+{
+    return observer->used && observer->addr.sin_addr.s_addr == addr->sin_addr.s_addr && observer->addr.sin_port == addr->sin_port &&
+           observer->token_len == token_len && memcmp(observer->token, token, token_len) == 0;
+}
+
+/**
+ * @return false if there is no room left: the response is then sent without Observe option
+ */
+static bool coap_observe_add(struct sockaddr_in *addr, coap_message_t *request, const coap_resource_t *resource)
+{
+    coap_observer_t *observer = NULL;
+    for (uint8_t i = 0; i < COAP_MAX_OBSERVERS && observer == NULL; i++)
+    {
+        if (coap_same_observer(&coap_observers[i], addr, request->token, request->token_len))
+        {
+            observer = &coap_observers[i]; // registered again
+        }
+    }
+    for (uint8_t i = 0; i < COAP_MAX_OBSERVERS && observer == NULL; i++)
+    {
+        if (!coap_observers[i].used)
+        {
+            observer = &coap_observers[i];
+        }
+    }
+    if (observer == NULL)
+    {
+        ESP_LOGW(TAG, "No room for a new observer of /%s", resource->path);
+        return false;
+    }
+    observer->used = true;
+    observer->addr = *addr;
+    memcpy(observer->token, request->token, request->token_len);
+    observer->token_len = request->token_len;
+    observer->resource = resource;
+    observer->pending = false;
+    ESP_LOGI(TAG, "Observer %s:%d of /%s", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), resource->path);
+    return true;
+}
+
+static void coap_observe_remove(struct sockaddr_in *addr, coap_message_t *request)
+{
+    for (uint8_t i = 0; i < COAP_MAX_OBSERVERS; i++)
+    {
+        if (coap_same_observer(&coap_observers[i], addr, request->token, request->token_len))
+        {
+            ESP_LOGI(TAG, "Observer %s:%d removed", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+            coap_observers[i].used = false;
+        }
+    }
+}
+
+/**
+ * @brief Answer a request: piggybacked in the ACK of a CON request, in a NON message for a NON request
+ */
+static void coap_handle_request(coap_message_t *request, struct sockaddr_in *source)
+{
+    uint8_t type = (request->type == COAP_TYPE_CON) ? COAP_TYPE_ACK : COAP_TYPE_NON;
+    uint16_t message_id = (request->type == COAP_TYPE_CON) ? request->message_id : coap_message_id++;
+    const coap_resource_t *resource = NULL;
+    for (uint8_t i = 0; i < sizeof(coap_resources) / sizeof(coap_resources[0]); i++)
+    {
+        if (strcmp(coap_resources[i].path, request->path) == 0)
+        {
+            resource = &coap_resources[i];
+        }
+    }
+
+    size_t len = 0;
+    if (request->bad_option)
+    {
+        len = coap_build_code(type, COAP_CODE_BAD_OPTION, message_id, request->token, request->token_len);
+    }
+    else if (resource == NULL)
+    {
+        len = coap_build_code(type, COAP_CODE_NOT_FOUND, message_id, request->token, request->token_len);
+    }
+    else if (request->code != COAP_CODE_GET)
+    {
+        len = coap_build_code(type, COAP_CODE_METHOD_NOT_ALLOWED, message_id, request->token, request->token_len);
+    }
+    else
+    {
+        int32_t observe = -1;
+        if (resource->observable && request->observe == 0 && coap_observe_add(source, request, resource))
+        {
+            observe = coap_observe_seq;
+        }
+        else if (resource->observable)
+        {
+            coap_observe_remove(source, request); // Observe: 1 or a plain GET with the same token
+        }
+        len = coap_build_content(type, message_id, request->token, request->token_len, resource, observe);
+        if (len == 0)
+        {
+            len = coap_build_code(type, COAP_CODE_INTERNAL_ERROR, message_id, request->token, request->token_len);
+        }
+    }
+    sendto(coap_server_sock, coap_buffer, len, 0, (struct sockaddr *)source, sizeof(*source));
+}
+
+/**
+ * @brief ACK or RST of a notification
+ */
+static void coap_handle_reply(coap_message_t *reply)
+{
+    for (uint8_t i = 0; i < COAP_MAX_OBSERVERS; i++)
+    {
+        if (!coap_observers[i].used || coap_observers[i].message_id != reply->message_id)
+        {
+            continue;
+        }
+        if (reply->type == COAP_TYPE_RST)
+        {
+            ESP_LOGI(TAG, "Observer %s:%d reset", inet_ntoa(coap_observers[i].addr.sin_addr), ntohs(coap_observers[i].addr.sin_port));
+            coap_observers[i].used = false;
+        }
+        else
+        {
+            coap_observers[i].pending = false;
+        }
+    }
+}
+
+static void coap_server_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "Server started on port %d", COAP_PORT);
+    while (coap_server_running)
+    {
+        struct sockaddr_in source;
+        socklen_t source_len = sizeof(source);
+        int len = recvfrom(coap_server_sock, coap_rx_buffer, sizeof(coap_rx_buffer), 0, (struct sockaddr *)&source, &source_len);
+        if (len < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                ESP_LOGW(TAG, "recvfrom failed: errno %d", errno);
+                vTaskDelay(COAP_SERVER_TIMEOUT * 1000 / portTICK_PERIOD_MS);
+            }
+            continue; // timeout: check coap_server_running
+        }
+        coap_message_t message;
+        if (!coap_parse(coap_rx_buffer, len, &message))
+        {
+            ESP_LOGW(TAG, "Malformed message from %s", inet_ntoa(source.sin_addr));
+            continue;
+        }
+        xSemaphoreTake(coap_mutex, portMAX_DELAY);
+        if (message.type == COAP_TYPE_ACK || message.type == COAP_TYPE_RST)
+        {
+            coap_handle_reply(&message);
+        }
+        else if (message.code == COAP_CODE_EMPTY)
+        {
+            if (message.type == COAP_TYPE_CON)
+            {
+                // CoAP ping
+                len = coap_build_code(COAP_TYPE_RST, COAP_CODE_EMPTY, message.message_id, NULL, 0);
+                sendto(coap_server_sock, coap_buffer, len, 0, (struct sockaddr *)&source, sizeof(source));
+            }
+        }
+        else if (COAP_CLASS(message.code) == 0)
+        {
+            coap_handle_request(&message, &source);
+        }
+        xSemaphoreGive(coap_mutex);
+    }
+    close(coap_server_sock);
+    coap_server_sock = -1;
+    memset(coap_observers, 0, sizeof(coap_observers));
+    ESP_LOGI(TAG, "Server stopped");
+    coap_server_task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
+esp_err_t coap_server_start()
+{
+    if (coap_server_task_handle != NULL)
+    {
+        return ESP_OK;
+    }
+    if (coap_mutex == NULL)
+    {
+        coap_mutex = xSemaphoreCreateMutex();
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(COAP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    struct timeval timeout = {.tv_sec = COAP_SERVER_TIMEOUT};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+    coap_server_sock = sock;
+    coap_message_id = esp_random();
+    coap_server_running = true;
+    if (xTaskCreate(coap_server_task, "coap_server", 4 * 1024, NULL, PRIORITY_COAP, &coap_server_task_handle) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Unable to create the server task");
+        coap_server_running = false;
+        close(sock);
+        coap_server_sock = -1;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void coap_server_stop()
+{
+    if (coap_server_task_handle == NULL)
+    {
+        return;
+    }
+    coap_server_running = false;
+    while (coap_server_task_handle != NULL)
+    {
+        vTaskDelay(100 / portTICK_PERIOD_MS); // the task exits within COAP_SERVER_TIMEOUT
+    }
+}
+
+void coap_notify(linky_data_t *data)
+{
+    if (coap_mutex == NULL)
+    {
+        coap_mutex = xSemaphoreCreateMutex();
+    }
+    xSemaphoreTake(coap_mutex, portMAX_DELAY);
+    coap_sample = *data;
+    if (coap_server_sock >= 0)
+    {
+        coap_observe_seq = (coap_observe_seq + 1) & COAP_OBSERVE_MAX;
+        bool confirmable = (++coap_notify_count % COAP_CON_EVERY) == 0;
+        for (uint8_t i = 0; i < COAP_MAX_OBSERVERS; i++)
+        {
+            coap_observer_t *observer = &coap_observers[i];
+            if (!observer->used)
+            {
+                continue;
+            }
+            if (observer->pending)
+            {
+                ESP_LOGI(TAG, "Observer %s:%d gone", inet_ntoa(observer->addr.sin_addr), ntohs(observer->addr.sin_port));
+                observer->used = false;
+                continue;
+            }
+            observer->message_id = coap_message_id++;
+            observer->pending = confirmable;
+            size_t len = coap_build_content(confirmable ? COAP_TYPE_CON : COAP_TYPE_NON, observer->message_id, observer->token,
+                                            observer->token_len, observer->resource, coap_observe_seq);
+            if (len > 0)
+            {
+                sendto(coap_server_sock, coap_buffer, len, 0, (struct sockaddr *)&observer->addr, sizeof(observer->addr));
+            }
+        }
+    }
+    xSemaphoreGive(coap_mutex);
+}
+
+/**
+ * @brief Wait for the response of a confirmable request on a connected socket
+ *
+ * @param acked set when the server sent an empty ACK: the response then comes in its own message
+ * @return the response code, -1 on timeout, -2 on reset
+ */
+static int coap_wait_response(int sock, uint16_t message_id, const uint8_t *token, uint32_t timeout, bool *acked)
+{
+    uint8_t buffer[COAP_RESPONSE_SIZE];
+    int64_t deadline = esp_timer_get_time() + timeout * 1000LL;
+    while (true)
+    {
+        int64_t remaining = deadline - esp_timer_get_time();
+        if (remaining <= 0)
+        {
+            return -1;
+        }
+        struct timeval tv = {.tv_sec = remaining / 1000000, .tv_usec = remaining % 1000000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        int len = recv(sock, buffer, sizeof(buffer), 0);
+        coap_message_t message;
+        if (len < 0)
+        {
+            return -1;
+        }
+        if (!coap_parse(buffer, len, &message))
+        {
+            continue;
+        }
+        bool our_token = message.token_len == COAP_TOKEN_SIZE && memcmp(message.token, token, COAP_TOKEN_SIZE) == 0;
+        if (message.type == COAP_TYPE_RST && message.message_id == message_id)
+        {
+            return -2;
+        }
+        if (message.type == COAP_TYPE_ACK && message.message_id == message_id)
+        {
+            if (message.code != COAP_CODE_EMPTY)
+            {
+                return message.code; // piggybacked response
+            }
+            *acked = true;
+            deadline = esp_timer_get_time() + COAP_SEPARATE_TIMEOUT * 1000LL;
+        }
+        else if ((message.type == COAP_TYPE_CON || message.type == COAP_TYPE_NON) && our_token && COAP_CLASS(message.code) >= 2)
+        {
+            if (message.type == COAP_TYPE_CON)
+            {
+                uint8_t ack[4] = {(COAP_VERSION << 6) | (COAP_TYPE_ACK << 4), COAP_CODE_EMPTY, message.message_id >> 8, message.message_id & 0xFF};
+                send(sock, ack, sizeof(ack), 0);
+            }
+            return message.code; // separate response
+        }
+    }
+}
+
+esp_err_t coap_send(linky_data_t *data)
+{
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+    struct addrinfo *res = NULL;
+    int err = getaddrinfo(config_values.coap.host, NULL, &hints, &res);
+    if (err != 0 || res == NULL)
+    {
+        ESP_LOGE(TAG, "DNS lookup of %s failed: %d", config_values.coap.host, err);
+        return ESP_FAIL;
+    }
+    struct sockaddr_in dest_addr = *(struct sockaddr_in *)res->ai_addr;
+    dest_addr.sin_port = htons(config_values.coap.port);
+    freeaddrinfo(res);
+
+    if (coap_upload_id == 0)
+    {
+        coap_upload_id = esp_random();
+    }
+    uint16_t message_id = coap_upload_id++;
+    uint8_t token[COAP_TOKEN_SIZE];
+    esp_fill_random(token, sizeof(token));
+
+    // CON POST /<path> Content-Format: application/cbor
+    coap_writer_t writer = {.buffer = coap_upload_buffer, .size = sizeof(coap_upload_buffer)};
+    coap_write_head(&writer, COAP_TYPE_CON, COAP_CODE_POST, message_id, token, sizeof(token));
+    const char *segment = config_values.coap.path;
+    while (*segment)
+    {
+        while (*segment == '/')
+        {
+            segment++;
+        }
+        size_t segment_len = strcspn(segment, "/");
+        if (segment_len > 0)
+        {
+            coap_write_option(&writer, COAP_OPTION_URI_PATH, segment, segment_len);
+        }
+        segment += segment_len;
+    }
+    coap_write_option_uint(&writer, COAP_OPTION_CONTENT_FORMAT, COAP_CONTENT_FORMAT_CBOR);
+    uint8_t marker = COAP_PAYLOAD_MARKER;
+    coap_write(&writer, &marker, 1);
+    if (writer.overflow)
+    {
+        return ESP_FAIL;
+    }
+    cbor_writer_t cbor;
+    cbor_init(&cbor, coap_upload_buffer + writer.len, sizeof(coap_upload_buffer) - writer.len);
+    cbor_encode_linky_head(&cbor, 1, NULL);
+    cbor_encode_linky_sample(&cbor, data);
+    if (cbor.overflow)
+    {
+        ESP_LOGE(TAG, "Sample too big for a message");
+        return ESP_FAIL;
+    }
+    size_t len = writer.len + cbor.len;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+    if (connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0)
+    {
+        ESP_LOGE(TAG, "Unable to connect the socket: errno %d", errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    int code = -1;
+    bool acked = false;
+    uint32_t timeout = COAP_ACK_TIMEOUT + esp_random() % (COAP_ACK_TIMEOUT / 2);
+    uint8_t attempt;
+    for (attempt = 0; attempt <= COAP_MAX_RETRANSMIT && code == -1 && !acked; attempt++, timeout *= 2)
+    {
+        send(sock, coap_upload_buffer, len, 0);
+        code = coap_wait_response(sock, message_id, token, timeout, &acked);
+    }
+    close(sock);
+
+    if (code < 0)
+    {
+        ESP_LOGE(TAG, "POST %s:%d/%s: %s after %d attempt(s)", config_values.coap.host, config_values.coap.port, config_values.coap.path,
+                 code == -2 ? "reset" : "no response", attempt);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "POST %d bytes: %d.%02d in %lld ms, %d attempt(s)", len, COAP_CLASS(code), code & 0x1F,
+             (esp_timer_get_time() - start_time) / 1000, attempt);
+    return COAP_CLASS(code) == 2 ? ESP_OK : ESP_FAIL;
+}
@@ -20,8 +20,13 @@
 #include "esp_efuse_table.h"
 #include "esp_vfs.h"
 #include "esp_spiffs.h"
+#include "esp_littlefs.h"
+#include "storage_update.h"
 #include "esp_hmac.h"
+#include "esp_timer.h"
+#include "esp_crc.h"
 #include "nvs_sec_provider.h"
+#include "freertos/semphr.h"
 /*==============================================================================
  Local Define
 ===============================================================================*/
@@ -30,6 +35,11 @@
 #define CONFIG_NAMESPACE "config"
 #define RO_PARTITION "ro_nvs"
 #define RO_NAMESPACE "ro_config"
+
+#define CONFIG_BLOB_KEY "config"
+#define CONFIG_BLOB_VERSION 1 // layout of config_blob_t, a blob of an other version is not decoded
+
+#define CONFIG_WRITE_DELAY 2000 // ms, the config_write_later() of this delay are written in one pass
 /*==============================================================================
  Local Macro
 ===============================================================================*/
@@ -44,13 +54,34 @@ struct config_item_t
     void *value;
     size_t size;
     nvs_handle_t *handle;
+    uint8_t stored; // the value in flash is known: the same as in config_stored
 };
+
+/*
+ * The items of config_handle are also saved together in one blob, read at boot in a single nvs_get_blob(). The
+ * per-key items stay written: they are read when the blob is missing (config saved by an older firmware), of an other
+ * version or size, or corrupted, and the blob is written again from them.
+ */
+typedef struct
+{
+    uint16_t version; // CONFIG_BLOB_VERSION
+    uint16_t size;    // sizeof(config_t)
+    uint32_t crc;     // esp_crc32_le() of config
+    config_t config;  // the items of config_handle at their place, the rest is 0
+} config_blob_t;
 /*==============================================================================
  Local Function Declaration
 ===============================================================================*/
 static uint8_t config_efuse_init();
 static esp_efuse_coding_scheme_t config_efuse_get_coding_scheme(void);
-static int config_init_spiffs(void);
+static int config_init_storage(void);
+static esp_err_t config_migrate_spiffs(void);
+static void *config_item_stored(const struct config_item_t *item);
+static uint8_t config_item_dirty(const struct config_item_t *item);
+static void config_write_timer_cb(void *arg);
+static void config_write_pending(void);
+static esp_err_t config_read_blob(void);
+static esp_err_t config_write_blob(void);
 static uint8_t config_tuya_rw = 0;
 /*==============================================================================
 Public Variable
@@ -63,6 +94,15 @@ const char *const MODES[] = {
     [MODE_ZIGBEE] = "ZIGBEE",
     [MODE_MATTER] = "MATTER",
     [MODE_TUYA] = "TUYA",
+    [MODE_UDP] = "UDP",
+    [MODE_COAP] = "COAP",
+    [MODE_MODBUS] = "MODBUS",
+};
+
+const char *const ENCODINGS[] = {
+    [ENCODING_JSON] = "JSON",
+    [ENCODING_CBOR] = "CBOR",
+    [ENCODING_INFLUX] = "INFLUX",
 };
 
 config_t config_values = {0};
@@ -96,10 +136,26 @@ static struct config_item_t config_items[] = {
     {"sleep",           UINT8,  &config_values.sleep,           sizeof(config_values.sleep),            &config_handle},
     {"index-offset",    BLOB,   &config_values.index_offset,    sizeof(config_values.index_offset),     &config_handle},
     {"boot-pairing",    UINT8,  &config_values.boot_pairing,    sizeof(config_values.boot_pairing),     &config_handle},
+    {"encoding",        UINT8,  &config_values.encoding,        sizeof(config_values.encoding),         &config_handle},
+    {"gzip",            UINT8,  &config_values.gzip,            sizeof(config_values.gzip),             &config_handle},
+    {"columns",         UINT8,  &config_values.columns,         sizeof(config_values.columns),          &config_handle},
+    {"web-etag",        STRING, &config_values.web_etag,        sizeof(config_values.web_etag),         &config_handle},
+    {"web-ca",          STRING, &config_values.web_ca,          sizeof(config_values.web_ca),           &config_handle},
+    {"mqtt-ca",         STRING, &config_values.mqtt_ca,         sizeof(config_values.mqtt_ca),          &config_handle},
+    {"udp-conf",        BLOB,   &config_values.udp,             sizeof(config_values.udp),              &config_handle},
+    {"coap-conf",       BLOB,   &config_values.coap,            sizeof(config_values.coap),             &config_handle},
+    {"modbus-conf",     BLOB,   &config_values.modbus,          sizeof(config_values.modbus),           &config_handle},
 
 };
 static const int32_t config_items_size = sizeof(config_items) / sizeof(config_items[0]);
 
+// the values as read from or written to the flash, config_write() only writes the items that differ
+static config_t config_stored = {0};
+static SemaphoreHandle_t config_mutex = NULL;
+static esp_timer_handle_t config_write_timer = NULL;
+static config_blob_t config_blob = {0};   // buffer of config_read_blob() and config_write_blob()
+static uint8_t config_blob_stored = 0;    // the blob in flash holds config_stored
+
 // clang-format on
 
 nvs_sec_cfg_t nvs_ro_sec_cfg = {0};
@@ -137,6 +193,15 @@ int8_t config_erase()
         .index_offset = {0},
 
         .web.store_before_send = 3,
+
+        .udp.host = "239.255.84.73", // 'T' 'I'
+        .udp.port = 8473,
+
+        .coap.port = 5683,
+        .coap.path = "tic",
+
+        .modbus.port = 502,
+        .modbus.unit_id = 1,
     };
 
     snprintf(blank_config.mqtt.topic, sizeof(blank_config.mqtt.topic), "TICMeter/%s", efuse_values.mac_address + 6);
@@ -147,8 +212,18 @@ int8_t config_erase()
 int8_t config_begin()
 {
     uint8_t want_init = 0;
+    if (config_mutex == NULL)
+    {
+        config_mutex = xSemaphoreCreateMutex();
+        esp_timer_create_args_t timer_args = {
+            .callback = config_write_timer_cb,
+            .name = "config_write",
+        };
+        esp_timer_create(&timer_args, &config_write_timer);
+        esp_register_shutdown_handler(config_write_pending); // a config_write_later() is not lost by a restart
+    }
     config_efuse_init();
-    config_init_spiffs();
+    config_init_storage();
 
     // -------------------------- NVS init --------------------------
     esp_err_t err = nvs_flash_init();
@@ -307,41 +382,207 @@ int8_t config_begin()
     return 0;
 }
 
-static int config_init_spiffs(void)
+/**
+ * @brief Mount the storage partition: LittleFS, or the SPIFFS of the firmwares before it, copied to LittleFS
+ */
+static int config_init_storage(void)
 {
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = "/spiffs",
-        .partition_label = NULL,
+    storage_update_resume(); // a storage update cut by a reset is finished before the mount
+    esp_vfs_littlefs_conf_t conf = {
+        .base_path = STORAGE_PATH,
+        .partition_label = STORAGE_PARTITION,
+        .format_if_mount_failed = false,
+    };
+    esp_err_t err = esp_vfs_littlefs_register(&conf);
+    if (err == ESP_ERR_NOT_FOUND)
+    {
+        ESP_LOGE(TAG, "Failed to find the storage partition");
+        return 1;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No LittleFS in the storage partition (%s), looking for SPIFFS", esp_err_to_name(err));
+        err = config_migrate_spiffs();
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to mount the storage (%s)", esp_err_to_name(err));
+        return 1;
+    }
+    size_t total = 0;
+    size_t used = 0;
+    if (esp_littlefs_mounted(STORAGE_PARTITION) && esp_littlefs_info(STORAGE_PARTITION, &total, &used) == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Storage: %d / %d bytes used", used, total);
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy the files of a SPIFFS storage to a new LittleFS, through the scratch area of storage_update.h
+ *
+ * The SPIFFS is only read until its files are staged and checked in the scratch area: a reset before leaves it
+ * as it was, a reset after is finished by storage_update_resume() at the next boot. An empty or unreadable partition is
+ * formatted. If the files cannot be staged, the SPIFFS stays mounted at STORAGE_PATH: the storage still works, and
+ * the next storage update brings a LittleFS image.
+ */
+static esp_err_t config_migrate_spiffs(void)
+{
+    esp_vfs_spiffs_conf_t spiffs_conf = {
+        .base_path = STORAGE_PATH,
+        .partition_label = STORAGE_PARTITION,
         .max_files = 5,
-        .format_if_mount_failed = true};
+        .format_if_mount_failed = false,
+    };
+    esp_err_t err = esp_vfs_spiffs_register(&spiffs_conf);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No SPIFFS in the storage partition either, formatting");
+        esp_vfs_littlefs_conf_t conf = {
+            .base_path = STORAGE_PATH,
+            .partition_label = STORAGE_PARTITION,
+            .format_if_mount_failed = true,
+        };
+        esp_littlefs_format(STORAGE_PARTITION);
+        return esp_vfs_littlefs_register(&conf);
+    }
 
-    esp_err_t err = esp_vfs_spiffs_register(&conf);
+    err = storage_update_stage_files();
     if (err != ESP_OK)
     {
-        if (err == ESP_FAIL)
-        {
-            ESP_LOGE(TAG, "Failed to mount or format filesystem");
-        }
-        else if (err == ESP_ERR_NOT_FOUND)
+        ESP_LOGE(TAG, "Failed to stage the SPIFFS files (%s), SPIFFS kept", esp_err_to_name(err));
+        return ESP_OK; // the SPIFFS is still mounted
+    }
+    esp_vfs_spiffs_unregister(STORAGE_PARTITION);
+    err = storage_update_restore_files();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    ESP_LOGI(TAG, "Storage migrated from SPIFFS to LittleFS");
+    esp_vfs_littlefs_conf_t conf = {
+        .base_path = STORAGE_PATH,
+        .partition_label = STORAGE_PARTITION,
+        .format_if_mount_failed = false,
+    };
+    return esp_vfs_littlefs_register(&conf);
+}
+
+char *config_read_cert(const char *name)
+{
+    char path[64];
+    snprintf(path, sizeof(path), STORAGE_PATH "/%s", name);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *cert = malloc(size + 1);
+    if (cert == NULL || fread(cert, 1, size, file) != size)
+    {
+        ESP_LOGE(TAG, "Failed to read %s", path);
+        free(cert);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    cert[size] = '\0';
+    return cert;
+}
+
+/**
+ * @brief Read the items of config_handle from the blob
+ *
+ * @return ESP_OK if the items are in config_values, else the per-key items must be read
+ */
+static esp_err_t config_read_blob(void)
+{
+    size_t size = sizeof(config_blob);
+    esp_err_t err = nvs_get_blob(config_handle, CONFIG_BLOB_KEY, &config_blob, &size);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        ESP_LOGW(TAG, "No config blob, reading the keys");
+        return err;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (0x%x %s) reading the config blob", err, esp_err_to_name(err));
+        return err;
+    }
+    if (size != sizeof(config_blob) || config_blob.version != CONFIG_BLOB_VERSION || config_blob.size != sizeof(config_t))
+    {
+        ESP_LOGW(TAG, "Config blob v%d of %d bytes, expected v%d of %d bytes: reading the keys", config_blob.version, size,
+                 CONFIG_BLOB_VERSION, sizeof(config_blob));
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (esp_crc32_le(0, (const uint8_t *)&config_blob.config, sizeof(config_blob.config)) != config_blob.crc)
+    {
+        ESP_LOGE(TAG, "Config blob corrupted: reading the keys");
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    for (int i = 0; i < config_items_size; i++)
+    {
+        if (config_items[i].handle != &config_handle)
         {
-            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
+            continue;
         }
-        else
+        size_t offset = (uint8_t *)config_items[i].value - (uint8_t *)&config_values;
+        memcpy(config_items[i].value, (uint8_t *)&config_blob.config + offset, config_items[i].size);
+        memcpy(config_item_stored(&config_items[i]), config_items[i].value, config_items[i].size);
+        config_items[i].stored = 1;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Set the blob from the items of config_handle, committed with them
+ */
+static esp_err_t config_write_blob(void)
+{
+    memset(&config_blob, 0, sizeof(config_blob));
+    for (int i = 0; i < config_items_size; i++)
+    {
+        if (config_items[i].handle != &config_handle)
         {
-            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(err));
+            continue;
         }
-        return 1;
+        size_t offset = (uint8_t *)config_items[i].value - (uint8_t *)&config_values;
+        memcpy((uint8_t *)&config_blob.config + offset, config_items[i].value, config_items[i].size);
     }
-    return 0;
+    config_blob.version = CONFIG_BLOB_VERSION;
+    config_blob.size = sizeof(config_t);
+    config_blob.crc = esp_crc32_le(0, (const uint8_t *)&config_blob.config, sizeof(config_blob.config));
+    esp_err_t err = nvs_set_blob(config_handle, CONFIG_BLOB_KEY, &config_blob, sizeof(config_blob));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (0x%x %s) writing the config blob", err, esp_err_to_name(err));
+    }
+    return err;
 }
 
 int8_t config_read()
 {
     esp_err_t err = 0;
     size_t totalBytesRead = 0;
+    config_blob_stored = (config_read_blob() == ESP_OK);
+    if (config_blob_stored)
+    {
+        totalBytesRead += sizeof(config_blob);
+    }
     for (int i = 0; i < config_items_size; i++)
     {
+        if (config_blob_stored && config_items[i].handle == &config_handle)
+        {
+            continue; // read from the blob
+        }
         size_t bytesRead = 0;
+        size_t size = config_items[i].size; // the length read, the size of the item is kept for the next reads
+        config_items[i].stored = 0;
         switch (config_items[i].type)
         {
         case UINT8:
@@ -361,10 +602,14 @@ int8_t config_read()
             bytesRead = sizeof(uint64_t);
             break;
         case STRING:
-            err = nvs_get_str(*config_items[i].handle, config_items[i].name, (char *)config_items[i].value, &config_items[i].size);
+            err = nvs_get_str(*config_items[i].handle, config_items[i].name, (char *)config_items[i].value, &size);
             break;
         case BLOB:
-            err = nvs_get_blob(*config_items[i].handle, config_items[i].name, config_items[i].value, &config_items[i].size);
+            err = nvs_get_blob(*config_items[i].handle, config_items[i].name, config_items[i].value, &size);
+            if (err == ESP_OK && size != config_items[i].size)
+            {
+                continue; // saved by an other version: written again with the current size
+            }
             break;
         default:
             break;
@@ -379,23 +624,63 @@ int8_t config_read()
             ESP_LOGE(TAG, "Error (0x%x %s) reading %s", err, esp_err_to_name(err), config_items[i].name);
             continue;
         }
+        memcpy(config_item_stored(&config_items[i]), config_items[i].value, config_items[i].size);
+        config_items[i].stored = 1;
         totalBytesRead += bytesRead;
     }
 
-    ESP_LOGI(TAG, "Config read %d bytes", totalBytesRead);
+    ESP_LOGI(TAG, "Config read %d bytes%s", totalBytesRead, config_blob_stored ? " from the blob" : "");
     return 0;
 }
 
+/**
+ * @brief The copy of an item in config_stored
+ */
+static void *config_item_stored(const struct config_item_t *item)
+{
+    return (uint8_t *)&config_stored + ((uint8_t *)item->value - (uint8_t *)&config_values);
+}
+
+/**
+ * @brief Check if an item differs from the flash
+ */
+static uint8_t config_item_dirty(const struct config_item_t *item)
+{
+    if (!item->stored)
+    {
+        return 1;
+    }
+    if (item->type == STRING)
+    {
+        return strncmp((char *)item->value, (char *)config_item_stored(item), item->size) != 0;
+    }
+    return memcmp(item->value, config_item_stored(item), item->size) != 0;
+}
+
 int8_t config_write()
 {
+    if (config_write_timer != NULL)
+    {
+        esp_timer_stop(config_write_timer); // a pending config_write_later() is done now
+    }
+    if (config_mutex != NULL)
+    {
+        xSemaphoreTake(config_mutex, portMAX_DELAY);
+    }
+
     esp_err_t err = 0;
     size_t totalBytesWritten = 0;
+    uint8_t written[sizeof(config_items) / sizeof(config_items[0])] = {0};
     for (int i = 0; i < config_items_size; i++)
     {
         if (config_items[i].handle == &ro_config_handle && config_tuya_rw == 0)
         {
             continue;
         }
+        if (!config_item_dirty(&config_items[i]))
+        {
+            continue;
+        }
         size_t bytesWritten = 0;
         switch (config_items[i].type)
         {
@@ -443,20 +728,102 @@ int8_t config_write()
             ESP_LOGE(TAG, "Error (0x%x %s) writing %s", err, esp_err_to_name(err), config_items[i].name);
             continue;
         }
+        // the value set, it is the one in flash once committed
+        memcpy(config_item_stored(&config_items[i]), config_items[i].value, config_items[i].size);
+        config_items[i].stored = 1;
+        written[i] = 1;
+        totalBytesWritten += bytesWritten;
+    }
+
+    // the blob follows the items of config_handle, in the same commit
+    uint8_t blobDirty = !config_blob_stored;
+    for (int i = 0; i < config_items_size; i++)
+    {
+        blobDirty |= (written[i] && config_items[i].handle == &config_handle);
+    }
+    uint8_t blobWritten = 0;
+    if (blobDirty)
+    {
+        config_blob_stored = 0;
+        blobWritten = (config_write_blob() == ESP_OK);
+        totalBytesWritten += blobWritten ? sizeof(config_blob) : 0;
+    }
 
-        err = nvs_commit(*config_items[i].handle);
+    // one commit per partition, for all the items set
+    nvs_handle_t *handles[] = {&config_handle, &ro_config_handle};
+    uint8_t itemsWritten = 0;
+    for (int h = 0; h < sizeof(handles) / sizeof(handles[0]); h++)
+    {
+        uint8_t count = 0;
+        for (int i = 0; i < config_items_size; i++)
+        {
+            count += (written[i] && config_items[i].handle == handles[h]);
+        }
+        uint8_t withBlob = (handles[h] == &config_handle && blobWritten);
+        if (count == 0 && !withBlob)
+        {
+            continue;
+        }
+        err = nvs_commit(*handles[h]);
         if (err != ESP_OK)
         {
-            ESP_LOGE(TAG, "Error (%s) committing %s", esp_err_to_name(err), config_items[i].name);
+            ESP_LOGE(TAG, "Error (%s) committing %d items", esp_err_to_name(err), count);
+            for (int i = 0; i < config_items_size; i++)
+            {
+                if (written[i] && config_items[i].handle == handles[h])
+                {
+                    config_items[i].stored = 0; // written again by the next call
+                }
+            }
             continue;
         }
-        totalBytesWritten += bytesWritten;
+        config_blob_stored |= withBlob;
+        itemsWritten += count;
+    }
+    if (itemsWritten > 0 || (config_blob_stored && blobWritten))
+    {
+        ESP_LOGI(TAG, "Config written %d bytes, %d items%s", totalBytesWritten, itemsWritten,
+                 blobWritten ? " and the blob" : "");
+    }
+    else
+    {
+        ESP_LOGD(TAG, "Config unchanged");
     }
-    ESP_LOGI(TAG, "Config written %d bytes", totalBytesWritten);
 
+    if (config_mutex != NULL)
+    {
+        xSemaphoreGive(config_mutex);
+    }
     return 0;
 }
 
+void config_write_later()
+{
+    if (config_write_timer == NULL)
+    {
+        config_write();
+        return;
+    }
+    esp_timer_stop(config_write_timer); // the delay starts again from the last change
+    esp_timer_start_once(config_write_timer, CONFIG_WRITE_DELAY * 1000);
+}
+
+static void config_write_timer_cb(void *arg)
+{
+    config_write();
+}
+
+/**
+ * @brief Shutdown handler: write a pending config_write_later() before the restart
+ */
+static void config_write_pending(void)
+{
+    if (config_write_timer != NULL && esp_timer_is_active(config_write_timer))
+    {
+        config_write();
+    }
+}
+
 uint8_t config_verify()
 {
     switch (config_values.mode)
@@ -465,6 +832,9 @@ uint8_t config_verify()
     case MODE_MQTT:
     case MODE_MQTT_HA:
     case MODE_TUYA:
+    case MODE_UDP:
+    case MODE_COAP:
+    case MODE_MODBUS:
         if (strlen(config_values.ssid) == 0 || strlen(config_values.password) == 0)
         {
             // No SSID or password
@@ -505,6 +875,27 @@ uint8_t config_verify()
         //     return 0;
         // }
         break;
+    case MODE_UDP:
+        if (strlen(config_values.udp.host) == 0 || config_values.udp.port == 0)
+        {
+            // No destination
+            return 1;
+        }
+        break;
+    case MODE_COAP:
+        if (strlen(config_values.coap.host) == 0 || config_values.coap.port == 0)
+        {
+            // No CoAP server
+            return 1;
+        }
+        break;
+    case MODE_MODBUS:
+        if (config_values.modbus.port == 0)
+        {
+            // No port
+            return 1;
+        }
+        break;
     case MODE_ZIGBEE:
         if (config_values.zigbee.state == ZIGBEE_NOT_CONFIGURED)
         {
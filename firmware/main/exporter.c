@@ -0,0 +1,324 @@
+/**
+ * @file exporter.c
+ * @author Dorian Benech
+ * @brief Common interface of the exporters and the typed walk of a sample shared by all of them
+ * @version 1.0
+ * @date 2024-09-06
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "exporter.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <string.h>
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define TAG "EXPORTER"
+
+// fingerprints of the values which are not numbers or texts
+#define EXPORTER_NOT_EXPORTED UINT64_MAX
+#define EXPORTER_NOT_SET (UINT64_MAX - 1)
+
+#define EXPORTER_FNV_OFFSET 0xcbf29ce484222325ULL
+#define EXPORTER_FNV_PRIME 0x100000001b3ULL
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static uint64_t exporter_hash(uint64_t hash, const void *data, size_t len);
+static uint64_t exporter_fingerprint(const exporter_value_t *value);
+static uint16_t exporter_compute_changed(const exporter_t *exporter, const linky_data_t *sample, exporter_changed_t *changed);
+static esp_err_t exporter_null_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+static exporter_stats_t exporter_null_stats = {0};
+const exporter_t exporter_null = {
+    .name = "NULL",
+    .publish = exporter_null_publish,
+    .stats = &exporter_null_stats,
+};
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+// last published value of each label, to build the changed set of the next publish
+static uint64_t exporter_fingerprints[EXPORTER_LABELS_MAX];
+static uint64_t exporter_pending[EXPORTER_LABELS_MAX]; // kept once the publish succeeds
+static const exporter_t *exporter_owner = NULL;        // exporter of exporter_fingerprints, NULL before the first publish
+
+static uint64_t exporter_null_sum = 0; // the null exporter keeps the values, so the walk is not optimized out
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+bool exporter_value(const linky_data_t *sample, uint32_t index, uint8_t flags, exporter_value_t *value)
+{
+    if (index >= linky_label_list_size)
+    {
+        return false;
+    }
+    const linky_value_t *label = &linky_label_list[index];
+    if (label->data == NULL)
+    {
+        return false;
+    }
+    if (linky_mode != label->mode && label->mode != ANY)
+    {
+        return false;
+    }
+
+    // the same offset in the sample as in linky_data, the other values are device variables
+    const uint8_t *data = label->data;
+    uintptr_t offset = (uintptr_t)label->data - (uintptr_t)&linky_data;
+    if (offset < sizeof(linky_data_t))
+    {
+        data = (const uint8_t *)sample + offset;
+    }
+    else if (!(flags & EXPORTER_DEVICE_VALUES))
+    {
+        return false;
+    }
+
+    value->index = index;
+    value->label = label;
+    value->data = data;
+    value->number = 0;
+    value->time = 0;
+    value->text = NULL;
+    switch (label->type)
+    {
+    case UINT8:
+        value->number = *(const uint8_t *)data;
+        value->present = (value->number != UINT8_MAX);
+        break;
+    case UINT16:
+        value->number = *(const uint16_t *)data;
+        value->present = (value->number != UINT16_MAX);
+        break;
+    case UINT32:
+        value->number = *(const uint32_t *)data;
+        value->present = (value->number != UINT32_MAX) && !(label->device_class == ENERGY && value->number == 0);
+        break;
+    case UINT64:
+        value->number = *(const uint64_t *)data;
+        value->present = (value->number != UINT64_MAX) && !(label->device_class == ENERGY && value->number == 0);
+        break;
+    case UINT32_TIME:
+        value->number = ((const time_label_t *)data)->value;
+        value->time = ((const time_label_t *)data)->time;
+        value->present = (value->number != UINT32_MAX);
+        break;
+    case STRING:
+        value->text = (const char *)data;
+        value->present = (value->text[0] != '\0');
+        break;
+    case BOOL:
+        value->number = *(const bool *)data;
+        value->present = true;
+        break;
+    default:
+        return false; // HA_NUMBER: a command, not a value
+    }
+    return true;
+}
+
+void exporter_iter_init(exporter_iter_t *iter, const linky_data_t *sample, uint8_t flags)
+{
+    iter->sample = sample;
+    iter->flags = flags;
+    iter->index = 0;
+}
+
+bool exporter_iter_next(exporter_iter_t *iter, exporter_value_t *value)
+{
+    while (iter->index < linky_label_list_size)
+    {
+        if (exporter_value(iter->sample, iter->index++, iter->flags, value) && value->present)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool exporter_changed(const exporter_changed_t *changed, uint32_t index)
+{
+    if (changed == NULL || index >= EXPORTER_LABELS_MAX)
+    {
+        return true;
+    }
+    return changed->bits[index / 32] & (1UL << (index % 32));
+}
+
+/**
+ * @brief FNV-1a, for the texts and the UINT32_TIME
+ */
+static uint64_t exporter_hash(uint64_t hash, const void *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ ((const uint8_t *)data)[i]) * EXPORTER_FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief A 64 bits summary of a value: the number itself, or a hash
+ */
+static uint64_t exporter_fingerprint(const exporter_value_t *value)
+{
+    if (!value->present)
+    {
+        return EXPORTER_NOT_SET;
+    }
+    switch (value->label->type)
+    {
+    case STRING:
+        return exporter_hash(EXPORTER_FNV_OFFSET, value->text, strlen(value->text));
+    case UINT32_TIME:
+    {
+        uint64_t hash = exporter_hash(EXPORTER_FNV_OFFSET, &value->number, sizeof(value->number));
+        return exporter_hash(hash, &value->time, sizeof(value->time));
+    }
+    default:
+        return value->number;
+    }
+}
+
+/**
+ * @brief Compare the sample with the last one published by the exporter, the fingerprints of the sample are kept in
+ * exporter_pending
+ *
+ * @return the number of changed labels
+ */
+static uint16_t exporter_compute_changed(const exporter_t *exporter, const linky_data_t *sample, exporter_changed_t *changed)
+{
+    memset(changed, 0, sizeof(*changed));
+    bool all = (exporter_owner != exporter); // nothing published yet by this exporter
+    for (uint32_t i = 0; i < linky_label_list_size && i < EXPORTER_LABELS_MAX; i++)
+    {
+        exporter_value_t value;
+        uint64_t fingerprint = EXPORTER_NOT_EXPORTED;
+        if (sample != NULL && exporter_value(sample, i, EXPORTER_DEVICE_VALUES, &value))
+        {
+            fingerprint = exporter_fingerprint(&value);
+        }
+        exporter_pending[i] = fingerprint;
+        if (fingerprint != EXPORTER_NOT_EXPORTED && (all || fingerprint != exporter_fingerprints[i]))
+        {
+            changed->bits[i / 32] |= 1UL << (i % 32);
+            changed->count++;
+        }
+    }
+    return changed->count;
+}
+
+esp_err_t exporter_init(const exporter_t *exporter)
+{
+    if (linky_label_list_size > EXPORTER_LABELS_MAX)
+    {
+        ESP_LOGW(TAG, "%ld labels, the changed set holds %d", linky_label_list_size, EXPORTER_LABELS_MAX);
+    }
+    if (exporter == NULL || exporter->init == NULL)
+    {
+        return ESP_OK;
+    }
+    return exporter->init();
+}
+
+esp_err_t exporter_connect(const exporter_t *exporter)
+{
+    if (exporter == NULL || exporter->connect == NULL)
+    {
+        return ESP_OK;
+    }
+    return exporter->connect();
+}
+
+esp_err_t exporter_publish(const exporter_t *exporter, linky_data_t *samples, uint8_t count)
+{
+    if (exporter == NULL || exporter->publish == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    exporter_changed_t changed;
+    exporter_compute_changed(exporter, count > 0 ? &samples[count - 1] : NULL, &changed);
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = exporter->publish(samples, count, &changed);
+    int64_t time = esp_timer_get_time() - start;
+
+    if (exporter->stats != NULL)
+    {
+        exporter->stats->publish_count++;
+        exporter->stats->error_count += (err != ESP_OK);
+        exporter->stats->sample_count += count;
+        exporter->stats->changed_count += changed.count;
+        exporter->stats->last_time = time;
+        exporter->stats->total_time += time;
+    }
+    if (err == ESP_OK && count > 0)
+    {
+        memcpy(exporter_fingerprints, exporter_pending, sizeof(exporter_fingerprints));
+        exporter_owner = exporter;
+    }
+    ESP_LOGI(TAG, "%s: %d samples, %d values changed, published in %lld ms: %s", exporter->name, count, changed.count,
+             time / 1000, err == ESP_OK ? "OK" : "FAILED");
+    return err;
+}
+
+void exporter_disconnect(const exporter_t *exporter)
+{
+    if (exporter == NULL || exporter->disconnect == NULL)
+    {
+        return;
+    }
+    exporter->disconnect();
+}
+
+void exporter_print_stats(const exporter_t *exporter)
+{
+    if (exporter == NULL || exporter->stats == NULL)
+    {
+        return;
+    }
+    const exporter_stats_t *stats = exporter->stats;
+    ESP_LOGI(TAG, "%s: %ld publish (%ld failed), %ld samples, %ld values changed, last %lld us, average %lld us",
+             exporter->name, stats->publish_count, stats->error_count, stats->sample_count, stats->changed_count,
+             stats->last_time, stats->publish_count > 0 ? stats->total_time / stats->publish_count : 0);
+}
+
+/**
+ * @brief Read every value of the batch like an exporter does, and send nothing
+ */
+static esp_err_t exporter_null_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        exporter_iter_t iter;
+        exporter_value_t value;
+        exporter_iter_init(&iter, &samples[i], EXPORTER_DEVICE_VALUES);
+        while (exporter_iter_next(&iter, &value))
+        {
+            exporter_null_sum += (value.text != NULL) ? (uint8_t)value.text[0] : value.number;
+        }
+    }
+    return ESP_OK;
+}
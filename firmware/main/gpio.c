@@ -589,6 +589,9 @@ void gpio_start_pariring()
     case MODE_HTTP:
     case MODE_MQTT:
     case MODE_MQTT_HA:
+    case MODE_UDP:
+    case MODE_COAP:
+    case MODE_MODBUS:
         ESP_LOGI(TAG, "Web pairing");
         ESP_LOGI(TAG, "Starting captive portal");
         wifi_start_captive_portal();
@@ -4,15 +4,17 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
-#include "cJSON.h"
+#include "json_writer.h"
+#include "json_reader.h"
 #include "tuya.h"
 #include "mqtt.h"
 #include "mqtt_bind.h"
 
 static const char *TAG = "HTTP"; // TAG for debug
-#define INDEX_HTML_PATH "/spiffs/index.html"
+#define INDEX_HTML_PATH STORAGE_PATH "/index.html"
 
 #define LOCAL_IP "http://4.3.2.1"
+#define HTTP_JSON_CHUNK_SIZE 256 // json responses are sent in chunks of this size
 
 typedef enum
 {
@@ -79,7 +81,7 @@ esp_err_t send_web_page(httpd_req_t *req)
     }
     else
     {
-        strcat(url, "/spiffs");
+        strcat(url, STORAGE_PATH);
         strcat(url, req->uri);
     }
     if (stat(url, &st))
@@ -245,128 +247,120 @@ esp_err_t save_config_handler(httpd_req_t *req)
 
     ESP_LOGI(TAG, "Received data: %s", buf);
 
-    cJSON *jsonObject = cJSON_Parse(buf);
-    if (jsonObject == NULL)
+    size_t len = req->content_len;
+    if (!json_read_object(buf, len))
     {
         ESP_LOGE(TAG, "Failed to parse JSON");
+        free(buf);
         httpd_resp_set_status(req, "400 Bad Request");
         httpd_resp_send(req, "Bad Request", HTTPD_RESP_USE_STRLEN);
         return ESP_FAIL;
     }
 
     uint8_t tuya_edited = 0;
-    cJSON *item = cJSON_GetObjectItem(jsonObject, "wifi-ssid");
-    if (item != NULL)
+    int32_t value;
+    if (json_read_text(buf, len, "wifi-ssid", config_values.ssid, sizeof(config_values.ssid)))
     {
-        strncpy(config_values.ssid, item->valuestring, sizeof(config_values.ssid) - 1);
-        config_values.ssid[sizeof(config_values.ssid) - 1] = '\0';
         ESP_LOGI(TAG, "SSID: %s", config_values.ssid);
     }
-    item = cJSON_GetObjectItem(jsonObject, "wifi-password");
-    if (item != NULL)
+    if (json_read_text(buf, len, "wifi-password", config_values.password, sizeof(config_values.password)))
     {
-        strncpy(config_values.password, item->valuestring, sizeof(config_values.password) - 1);
-        config_values.password[sizeof(config_values.password) - 1] = '\0';
         ESP_LOGI(TAG, "Password: %s", config_values.password);
     }
-    item = cJSON_GetObjectItem(jsonObject, "linky-mode");
-    if (item != NULL)
+    if (json_read_int(buf, len, "linky-mode", &value))
     {
-        config_values.linky_mode = atoi(item->valuestring);
+        config_values.linky_mode = value;
     }
-    item = cJSON_GetObjectItem(jsonObject, "server-mode");
-    if (item != NULL)
+    if (json_read_int(buf, len, "server-mode", &value))
     {
-        config_values.mode = atoi(item->valuestring);
+        config_values.mode = value;
         ESP_LOGI(TAG, "Server mode: %d", config_values.mode);
     }
-    item = cJSON_GetObjectItem(jsonObject, "web-url");
-    if (item != NULL)
+    json_read_text(buf, len, "web-url", config_values.web.host, sizeof(config_values.web.host));
+    json_read_text(buf, len, "web-token", config_values.web.token, sizeof(config_values.web.token));
+    json_read_text(buf, len, "web-post", config_values.web.postUrl, sizeof(config_values.web.postUrl));
+    json_read_text(buf, len, "web-config", config_values.web.configUrl, sizeof(config_values.web.configUrl));
+    json_read_text(buf, len, "mqtt-host", config_values.mqtt.host, sizeof(config_values.mqtt.host));
+    if (json_read_int(buf, len, "mqtt-port", &value))
     {
-        strncpy(config_values.web.host, item->valuestring, sizeof(config_values.web.host) - 1);
-        config_values.web.host[sizeof(config_values.web.host) - 1] = '\0';
-    }
-    item = cJSON_GetObjectItem(jsonObject, "web-token");
-    if (item != NULL)
-    {
-        strncpy(config_values.web.token, item->valuestring, sizeof(config_values.web.token) - 1);
-        config_values.web.token[sizeof(config_values.web.token) - 1] = '\0';
-    }
-    item = cJSON_GetObjectItem(jsonObject, "web-post");
-    if (item != NULL)
-    {
-        strncpy(config_values.web.postUrl, item->valuestring, sizeof(config_values.web.postUrl) - 1);
-        config_values.web.postUrl[sizeof(config_values.web.postUrl) - 1] = '\0';
+        if (value > 0 && value < 65535)
+        {
+            config_values.mqtt.port = value;
+        }
+        else
+        {
+            config_values.mqtt.port = 1883;
+        }
     }
-    item = cJSON_GetObjectItem(jsonObject, "web-config");
-    if (item != NULL)
+    json_read_text(buf, len, "mqtt-user", config_values.mqtt.username, sizeof(config_values.mqtt.username));
+    json_read_text(buf, len, "mqtt-password", config_values.mqtt.password, sizeof(config_values.mqtt.password));
+    json_read_text(buf, len, "mqtt-topic", config_values.mqtt.topic, sizeof(config_values.mqtt.topic));
+    if (json_read_text(buf, len, "tuya-device-uuid", config_values.tuya.device_uuid, sizeof(config_values.tuya.device_uuid)))
     {
-        strncpy(config_values.web.configUrl, item->valuestring, sizeof(config_values.web.configUrl) - 1);
-        config_values.web.configUrl[sizeof(config_values.web.configUrl) - 1] = '\0';
+        tuya_edited = 1;
     }
-    item = cJSON_GetObjectItem(jsonObject, "mqtt-host");
-    if (item != NULL)
+    if (json_read_text(buf, len, "tuya-device-auth", config_values.tuya.device_auth, sizeof(config_values.tuya.device_auth)))
     {
-        strncpy(config_values.mqtt.host, item->valuestring, sizeof(config_values.mqtt.host) - 1);
-        config_values.mqtt.host[sizeof(config_values.mqtt.host) - 1] = '\0';
+        tuya_edited = 1;
     }
-    item = cJSON_GetObjectItem(jsonObject, "mqtt-port");
-    if (item != NULL)
+    if (json_read_int(buf, len, "refresh-rate", &value))
     {
-        uint32_t port = atoi(item->valuestring);
-        if (port > 0 && port < 65535)
-        {
-            config_values.mqtt.port = port;
-        }
-        else
+        config_values.refresh_rate = value;
+        if (config_values.refresh_rate < 30)
         {
-            config_values.mqtt.port = 1883;
+            config_values.refresh_rate = 30;
         }
     }
-    item = cJSON_GetObjectItem(jsonObject, "mqtt-user");
-    if (item != NULL)
+    if (json_read_int(buf, len, "encoding", &value))
     {
-        strncpy(config_values.mqtt.username, item->valuestring, sizeof(config_values.mqtt.username) - 1);
-        config_values.mqtt.username[sizeof(config_values.mqtt.username) - 1] = '\0';
+        config_values.encoding = value;
+        if (config_values.encoding >= ENCODING_LAST)
+        {
+            config_values.encoding = ENCODING_JSON;
+        }
     }
-    item = cJSON_GetObjectItem(jsonObject, "mqtt-password");
-    if (item != NULL)
+    if (json_read_int(buf, len, "web-gzip", &value))
     {
-        strncpy(config_values.mqtt.password, item->valuestring, sizeof(config_values.mqtt.password) - 1);
-        config_values.mqtt.password[sizeof(config_values.mqtt.password) - 1] = '\0';
+        config_values.gzip = value ? 1 : 0;
     }
-    item = cJSON_GetObjectItem(jsonObject, "mqtt-topic");
-    if (item != NULL)
+    json_read_text(buf, len, "web-ca", config_values.web_ca, sizeof(config_values.web_ca));
+    json_read_text(buf, len, "mqtt-ca", config_values.mqtt_ca, sizeof(config_values.mqtt_ca));
+    json_read_text(buf, len, "udp-host", config_values.udp.host, sizeof(config_values.udp.host));
+    if (json_read_int(buf, len, "udp-port", &value))
     {
-        strncpy(config_values.mqtt.topic, item->valuestring, sizeof(config_values.mqtt.topic) - 1);
-        config_values.mqtt.topic[sizeof(config_values.mqtt.topic) - 1] = '\0';
+        if (value > 0 && value < 65535)
+        {
+            config_values.udp.port = value;
+        }
     }
-    item = cJSON_GetObjectItem(jsonObject, "tuya-device-uuid");
-    if (item != NULL)
+    json_read_text(buf, len, "udp-key", config_values.udp.key, sizeof(config_values.udp.key));
+    json_read_text(buf, len, "coap-host", config_values.coap.host, sizeof(config_values.coap.host));
+    if (json_read_int(buf, len, "coap-port", &value))
     {
-        strncpy(config_values.tuya.device_uuid, item->valuestring, sizeof(config_values.tuya.device_uuid) - 1);
-        config_values.tuya.device_uuid[sizeof(config_values.tuya.device_uuid) - 1] = '\0';
-        tuya_edited = 1;
+        if (value > 0 && value < 65535)
+        {
+            config_values.coap.port = value;
+        }
     }
-    item = cJSON_GetObjectItem(jsonObject, "tuya-device-auth");
-    if (item != NULL)
+    json_read_text(buf, len, "coap-path", config_values.coap.path, sizeof(config_values.coap.path));
+    if (json_read_int(buf, len, "modbus-port", &value))
     {
-        strncpy(config_values.tuya.device_auth, item->valuestring, sizeof(config_values.tuya.device_auth) - 1);
-        config_values.tuya.device_auth[sizeof(config_values.tuya.device_auth) - 1] = '\0';
-        tuya_edited = 1;
+        if (value > 0 && value < 65535)
+        {
+            config_values.modbus.port = value;
+        }
     }
-
-    item = cJSON_GetObjectItem(jsonObject, "refresh-rate");
-    if (item != NULL)
+    if (json_read_int(buf, len, "modbus-unit", &value))
     {
-        config_values.refresh_rate = atoi(item->valuestring);
-        if (config_values.refresh_rate < 30)
+        if (value > 0 && value <= 255)
         {
-            config_values.refresh_rate = 30;
+            config_values.modbus.unit_id = value;
         }
     }
-
-    cJSON_Delete(jsonObject);
+    if (json_read_int(buf, len, "web-columns", &value))
+    {
+        config_values.columns = value ? 1 : 0;
+    }
     free(buf);
 
     if (tuya_edited)
@@ -382,56 +376,82 @@ esp_err_t save_config_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+static bool http_json_sink(void *context, const char *data, size_t len)
+{
+    return httpd_resp_send_chunk((httpd_req_t *)context, data, len) == ESP_OK;
+}
+
 esp_err_t get_config_handler(httpd_req_t *req)
 {
-    cJSON *jsonObject = cJSON_CreateObject();
-    cJSON_AddStringToObject(jsonObject, "wifi-ssid", config_values.ssid);
-    cJSON_AddNumberToObject(jsonObject, "wifi-password", strnlen(config_values.password, sizeof(config_values.password)));
-    cJSON_AddNumberToObject(jsonObject, "linky-mode", config_values.mode);
-    cJSON_AddNumberToObject(jsonObject, "server-mode", config_values.mode);
-    cJSON_AddStringToObject(jsonObject, "web-url", config_values.web.host);
-    cJSON_AddStringToObject(jsonObject, "web-token", config_values.web.token);
-    cJSON_AddStringToObject(jsonObject, "web-post", config_values.web.postUrl);
-    cJSON_AddStringToObject(jsonObject, "web-config", config_values.web.configUrl);
-    cJSON_AddStringToObject(jsonObject, "mqtt-host", config_values.mqtt.host);
-    cJSON_AddNumberToObject(jsonObject, "mqtt-port", config_values.mqtt.port);
-    cJSON_AddStringToObject(jsonObject, "mqtt-user", config_values.mqtt.username);
-    cJSON_AddNumberToObject(jsonObject, "mqtt-password", strnlen(config_values.mqtt.password, sizeof(config_values.mqtt.password)));
-    cJSON_AddStringToObject(jsonObject, "mqtt-topic", config_values.mqtt.topic);
-    cJSON_AddStringToObject(jsonObject, "tuya-device-uuid", config_values.tuya.device_uuid);
-    cJSON_AddNumberToObject(jsonObject, "tuya-device-auth", strnlen(config_values.tuya.device_auth, sizeof(config_values.tuya.device_auth)));
-    cJSON_AddNumberToObject(jsonObject, "refresh-rate", config_values.refresh_rate);
-
-    char *jsonString = cJSON_PrintUnformatted(jsonObject);
+    char buffer[HTTP_JSON_CHUNK_SIZE];
+    json_writer_t writer;
+    json_init_sink(&writer, buffer, sizeof(buffer), http_json_sink, req);
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, jsonString, strlen(jsonString));
-    free(jsonString);
-    cJSON_Delete(jsonObject);
-    return ESP_OK;
+    json_open_object(&writer);
+    json_add_key_text(&writer, "wifi-ssid", config_values.ssid);
+    json_add_key_uint(&writer, "wifi-password", strnlen(config_values.password, sizeof(config_values.password)));
+    json_add_key_uint(&writer, "linky-mode", config_values.mode);
+    json_add_key_uint(&writer, "server-mode", config_values.mode);
+    json_add_key_text(&writer, "web-url", config_values.web.host);
+    json_add_key_text(&writer, "web-token", config_values.web.token);
+    json_add_key_text(&writer, "web-post", config_values.web.postUrl);
+    json_add_key_text(&writer, "web-config", config_values.web.configUrl);
+    json_add_key_text(&writer, "mqtt-host", config_values.mqtt.host);
+    json_add_key_uint(&writer, "mqtt-port", config_values.mqtt.port);
+    json_add_key_text(&writer, "mqtt-user", config_values.mqtt.username);
+    json_add_key_uint(&writer, "mqtt-password", strnlen(config_values.mqtt.password, sizeof(config_values.mqtt.password)));
+    json_add_key_text(&writer, "mqtt-topic", config_values.mqtt.topic);
+    json_add_key_text(&writer, "tuya-device-uuid", config_values.tuya.device_uuid);
+    json_add_key_uint(&writer, "tuya-device-auth", strnlen(config_values.tuya.device_auth, sizeof(config_values.tuya.device_auth)));
+    json_add_key_uint(&writer, "refresh-rate", config_values.refresh_rate);
+    json_add_key_uint(&writer, "encoding", config_values.encoding);
+    json_add_key_uint(&writer, "web-gzip", config_values.gzip);
+    json_add_key_uint(&writer, "web-columns", config_values.columns);
+    json_add_key_text(&writer, "web-ca", config_values.web_ca);
+    json_add_key_text(&writer, "mqtt-ca", config_values.mqtt_ca);
+    json_add_key_text(&writer, "udp-host", config_values.udp.host);
+    json_add_key_uint(&writer, "udp-port", config_values.udp.port);
+    json_add_key_uint(&writer, "udp-key", strnlen(config_values.udp.key, sizeof(config_values.udp.key)));
+    json_add_key_text(&writer, "coap-host", config_values.coap.host);
+    json_add_key_uint(&writer, "coap-port", config_values.coap.port);
+    json_add_key_text(&writer, "coap-path", config_values.coap.path);
+    json_add_key_uint(&writer, "modbus-port", config_values.modbus.port);
+    json_add_key_uint(&writer, "modbus-unit", config_values.modbus.unit_id);
+    json_close_object(&writer);
+    if (json_end(&writer) == 0)
+    {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 esp_err_t wifi_scan_handler(httpd_req_t *req)
 {
     uint16_t ap_num = 0;
     wifi_scan(&ap_num);
-    cJSON *jsonObject = cJSON_CreateObject();
-    cJSON *jsonArray = cJSON_CreateArray();
+    char buffer[HTTP_JSON_CHUNK_SIZE];
+    json_writer_t writer;
+    json_init_sink(&writer, buffer, sizeof(buffer), http_json_sink, req);
+    httpd_resp_set_type(req, "application/json");
+    json_open_object(&writer);
+    json_add_key(&writer, "ap");
+    json_open_array(&writer);
     for (int i = 0; i < ap_num; i++)
     {
-        cJSON *item = cJSON_CreateObject();
-        cJSON_AddStringToObject(item, "ssid", (const char *)wifi_ap_list[i].ssid);
-        cJSON_AddNumberToObject(item, "rssi", wifi_ap_list[i].rssi);
-        cJSON_AddNumberToObject(item, "channel", wifi_ap_list[i].primary);
-        cJSON_AddNumberToObject(item, "auth", wifi_ap_list[i].authmode);
-        cJSON_AddItemToArray(jsonArray, item);
+        json_open_object(&writer);
+        json_add_key_text(&writer, "ssid", (const char *)wifi_ap_list[i].ssid);
+        json_add_key_int(&writer, "rssi", wifi_ap_list[i].rssi);
+        json_add_key_uint(&writer, "channel", wifi_ap_list[i].primary);
+        json_add_key_uint(&writer, "auth", wifi_ap_list[i].authmode);
+        json_close_object(&writer);
     }
-    cJSON_AddItemToObject(jsonObject, "ap", jsonArray);
-    char *jsonString = cJSON_PrintUnformatted(jsonObject);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, jsonString, strlen(jsonString));
-    free(jsonString);
-    cJSON_Delete(jsonObject);
-    return ESP_OK;
+    json_close_array(&writer);
+    json_close_object(&writer);
+    if (json_end(&writer) == 0)
+    {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 const char *str_wifi_error[] = {
@@ -595,13 +615,7 @@ esp_err_t test_start_handler(httpd_req_t *req)
         }
 
         ESP_LOGI(TAG, "Waiting for MQTT send done, outbox size: %d", esp_mqtt_client_get_outbox_size(mqtt_client));
-        time_t mqtt_send_timeout = MILLIS + 10000;
-        while ((mqtt_send_timeout > MILLIS) && /*mqtt_sent_count < mqtt_sensors_count*/ esp_mqtt_client_get_outbox_size(mqtt_client) > 0)
-        {
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            ESP_LOGD(TAG, "Outbox size: %d", esp_mqtt_client_get_outbox_size(mqtt_client));
-        }
-        if (esp_mqtt_client_get_outbox_size(mqtt_client) > 0)
+        if (mqtt_flush(10000) != ESP_OK)
         {
             ESP_LOGE(TAG, "Failed to send all messages");
             mqtt_deinit();
@@ -0,0 +1,134 @@
+/**
+ * @file cbor.h
+ * @author Dorian Benech
+ * @brief Minimal CBOR (RFC 8949) encoder for the Linky payloads
+ * @version 1.0
+ * @date 2024-07-22
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef CBOR_H
+#define CBOR_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "linky.h"
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * Payload schema, version 1:
+ * {
+ *   0: schema version (uint)
+ *   1: token (text, HTTP only)
+ *   2: VCondo in mV (uint)
+ *   3: [ { 0: timestamp, <linky_label_list[].id>: value, ... }, ... ]
+ * }
+ * Values are uint, text or bool, cleared values are omitted like in the JSON payload.
+ *
+ * A batch can be sent by columns instead, with the key 4 in place of the key 3:
+ *   4: [ [ids...], timestamps (bytes), [column, ...] ]
+ * - timestamps: one zigzag varint per sample, the delta from the previous timestamp (from 0 for the first)
+ * - a numeric column is bytes with one varint per sample: 0 if the value is cleared,
+ *   else zigzag(delta from the previous set value of the column, from 0 for the first) + 1
+ * - a text column is an array with one item per sample: null if cleared, "" if unchanged, else the text
+ * Bool values are numeric columns of 0 and 1.
+ */
+#define CBOR_SCHEMA_VERSION 1
+
+#define CBOR_KEY_VERSION 0
+#define CBOR_KEY_TOKEN 1
+#define CBOR_KEY_VCONDO 2
+#define CBOR_KEY_DATA 3
+#define CBOR_KEY_COLUMNS 4
+#define CBOR_KEY_TIMESTAMP 0 // in a sample, label ids start at 1
+
+#define CBOR_CONTENT_TYPE "application/cbor"
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+typedef struct
+{
+    uint8_t *buffer;
+    size_t size;
+    size_t len;
+    bool overflow; // set when the buffer is too small, the content is then invalid
+} cbor_writer_t;
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+void cbor_init(cbor_writer_t *writer, uint8_t *buffer, size_t size);
+void cbor_add_uint(cbor_writer_t *writer, uint64_t value);
+void cbor_add_text(cbor_writer_t *writer, const char *text);
+void cbor_add_bool(cbor_writer_t *writer, bool value);
+void cbor_add_null(cbor_writer_t *writer);
+void cbor_add_bytes(cbor_writer_t *writer, const uint8_t *data, size_t len);
+void cbor_open_array(cbor_writer_t *writer, size_t count);
+void cbor_open_map(cbor_writer_t *writer, size_t count);
+void cbor_open_map_indefinite(cbor_writer_t *writer);
+void cbor_close_indefinite(cbor_writer_t *writer);
+
+/**
+ * @brief Encode Linky samples with the schema CBOR_SCHEMA_VERSION
+ *
+ * @param data the Array of data to encode
+ * @param count the number of samples
+ * @param token the token to add, NULL to skip it
+ * @param buffer the destination
+ * @param size the size of the destination
+ * @return the encoded length, 0 if the buffer is too small
+ */
+size_t cbor_encode_linky(linky_data_t *data, uint8_t count, const char *token, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Encode the root of the schema up to the samples array, to stream the samples one by one
+ *
+ * @param writer the destination
+ * @param count the number of samples that will follow
+ * @param token the token to add, NULL to skip it
+ */
+void cbor_encode_linky_head(cbor_writer_t *writer, uint8_t count, const char *token);
+
+/**
+ * @brief Encode the root of the schema up to the columns array, the caller adds the 3 items
+ *
+ * @param writer the destination
+ * @param token the token to add, NULL to skip it
+ */
+void cbor_encode_linky_columns_head(cbor_writer_t *writer, const char *token);
+
+/**
+ * @brief Encode one sample of the samples array
+ *
+ * @param writer the destination
+ * @param sample the sample to encode
+ */
+void cbor_encode_linky_sample(cbor_writer_t *writer, linky_data_t *sample);
+
+/**
+ * @brief Encode one sample with only the labels accepted by filter
+ *
+ * @param writer the destination
+ * @param sample the sample to encode
+ * @param filter return true to encode the label, NULL for all the labels
+ */
+void cbor_encode_linky_sample_filter(cbor_writer_t *writer, linky_data_t *sample, bool (*filter)(const linky_value_t *label));
+
+#endif /* CBOR_H */
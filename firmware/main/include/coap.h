@@ -0,0 +1,84 @@
+/**
+ * @file coap.h
+ * @author Dorian Benech
+ * @brief Minimal CoAP (RFC 7252) client and server with Observe (RFC 7641)
+ * @version 1.0
+ * @date 2024-08-12
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef COAP_H
+#define COAP_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include "esp_err.h"
+#include "linky.h"
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * Upload: confirmable POST coap://<host>:<port>/<path> of the CBOR payload of cbor.h with one sample and
+ * without token, retransmitted like RFC 7252 4.8 until the server acknowledges it with a 2.xx.
+ *
+ * Resources of the device, served on COAP_PORT while it is on USB power (the wifi stays on):
+ *   /.well-known/core  link format (RFC 6690)
+ *   /tic/live          the last sample, CBOR sample map of cbor.h, observable
+ *   /tic/index         the energy indexes of the last sample, CBOR sample map of cbor.h, observable
+ *   /config            mode, refresh rate and version in json
+ * The observers get a notification for each new sample.
+ */
+#define COAP_PORT 5683
+#define COAP_CONTENT_FORMAT_LINK 40
+#define COAP_CONTENT_FORMAT_JSON 50
+#define COAP_CONTENT_FORMAT_CBOR 60
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+
+/**
+ * @brief POST one sample to config_values.coap, the wifi must be connected
+ *
+ * @param data the sample to send
+ * @return ESP_OK if the server acknowledged the sample
+ */
+esp_err_t coap_send(linky_data_t *data);
+
+/**
+ * @brief Keep the sample for the resources and notify the observers if the server is running
+ *
+ * @param data the new sample
+ */
+void coap_notify(linky_data_t *data);
+
+/**
+ * @brief Start the CoAP server task, the wifi must be connected
+ *
+ * @return ESP_OK if the server is running
+ */
+esp_err_t coap_server_start();
+
+/**
+ * @brief Stop the CoAP server task and forget the observers, before the wifi is disconnected
+ */
+void coap_server_stop();
+
+#endif /* COAP_H */
@@ -36,6 +36,9 @@
 #define AP_PASS ""
 #define HOSTNAME "TICMeter"
 
+#define STORAGE_PARTITION "storage"
+#define STORAGE_PATH "/storage" // LittleFS of the storage partition: web page, ota_versions.csv, certificates
+
 // smaller number = smaller priority
 
 #define PRIORITY_TEST 1
@@ -47,6 +50,8 @@
 #define PRIORITY_FETCH_LINKY 1
 #define PRIORITY_PAIRING 1
 #define PRIORITY_DNS 16
+#define PRIORITY_COAP 5
+#define PRIORITY_MODBUS 5
 
 #define PRIORITY_LED 5
 #define PRIORITY_LED_PATTERN 5
@@ -72,11 +77,22 @@ typedef enum
     MODE_MQTT_HA,
     MODE_ZIGBEE,
     MODE_TUYA,
+    MODE_UDP,
+    MODE_COAP,
+    MODE_MODBUS,
     MODE_LAST,
     // later
     MODE_MATTER,
 } connectivity_t;
 
+typedef enum
+{
+    ENCODING_JSON,
+    ENCODING_CBOR,
+    ENCODING_INFLUX, // InfluxDB line protocol, HTTP only: MQTT sends json
+    ENCODING_LAST,
+} payload_encoding_t;
+
 typedef struct
 {
     char host[100];
@@ -95,6 +111,26 @@ typedef struct
     char topic[101];
 } mqtt_config_t;
 
+typedef struct
+{
+    char host[40];  // multicast group or broadcast address
+    uint16_t port;
+    char key[65];   // HMAC-SHA256 key of the datagrams, empty for unsigned datagrams
+} udp_config_t;
+
+typedef struct
+{
+    char host[100];
+    uint16_t port;
+    char path[50]; // Uri-Path of the POST, segments separated by '/'
+} coap_config_t;
+
+typedef struct
+{
+    uint16_t port;
+    uint8_t unit_id; // 255 is answered too
+} modbus_config_t;
+
 typedef enum
 {
     TUYA_NOT_CONFIGURED,
@@ -154,6 +190,15 @@ typedef struct
     uint8_t sleep;
     index_offset_t index_offset;
     uint8_t boot_pairing;
+    payload_encoding_t encoding;
+    uint8_t gzip; // Content-Encoding: gzip for the HTTP POST
+    uint8_t columns; // HTTP batches by columns instead of one object per sample
+    char web_etag[34]; // ETag of the last config received from the server
+    char web_ca[32];   // CA in /storage pinned for https, empty for http
+    char mqtt_ca[32];  // CA in /storage pinned for mqtts, empty for mqtt
+    udp_config_t udp;
+    coap_config_t coap;
+    modbus_config_t modbus;
 } config_t;
 
 typedef struct
@@ -169,6 +214,7 @@ typedef struct
  Public Variables Declaration
 ==============================================================================*/
 extern const char *const MODES[];
+extern const char *const ENCODINGS[];
 
 #ifdef GIT_TAG
 #define PRODUCTION 1
@@ -183,7 +229,17 @@ extern efuse_t efuse_values;
 int8_t config_erase();
 int8_t config_begin();
 int8_t config_read();
+
+/**
+ * @brief Write the items of config_values that differ from the flash, with one commit
+ */
 int8_t config_write();
+
+/**
+ * @brief Write the config after a short delay: the changes asked in this delay are written in one pass. For the
+ * frequent changes (auto TIC mode, Home Assistant numbers), a restart still writes them.
+ */
+void config_write_later();
 uint8_t config_verify();
 uint8_t config_rw();
 uint8_t config_efuse_read();
@@ -193,4 +249,12 @@ esp_err_t config_erase_partition(const char *partition_label);
 uint32_t config_get_hw_version();
 const char *config_get_str_mode();
 
+/**
+ * @brief Read a PEM certificate stored in /storage
+ *
+ * @param name the file name, e.g. ISRG_root_x1.pem
+ * @return the NUL-terminated PEM to free, NULL on error
+ */
+char *config_read_cert(const char *name);
+
 #endif /* CONFIG_H */
\ No newline at end of file
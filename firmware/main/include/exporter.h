@@ -0,0 +1,152 @@
+/**
+ * @file exporter.h
+ * @author Dorian Benech
+ * @brief Common interface of the exporters and the typed walk of a sample shared by all of them
+ * @version 1.0
+ * @date 2024-09-06
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "linky.h"
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * A sample is read label by label with exporter_iter_next() or exporter_value(): the offset of the label in the
+ * sample, the type and the "not set" rules (UINTn_MAX, empty string, energy index at 0) are handled here only, an
+ * exporter gets a number or a text.
+ *
+ * The values kept outside linky_data (refresh rate, TIC mode, grid, update available) are not in a copy of the sample:
+ * they are skipped, unless EXPORTER_DEVICE_VALUES is set, then they are read from the live variables.
+ */
+#define EXPORTER_DEVICE_VALUES 0x01
+
+#define EXPORTER_LABELS_MAX 160 // size of the changed set, the labels after it are always seen as changed
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+typedef struct
+{
+    uint32_t index;             // in linky_label_list
+    const linky_value_t *label;
+    const void *data;           // the raw value, in the sample or in the live variable
+    bool present;               // false if the value is not set in this sample
+    uint64_t number;            // UINT8, UINT16, UINT32, UINT64, BOOL, the value of a UINT32_TIME
+    time_t time;                // UINT32_TIME
+    const char *text;           // STRING
+} exporter_value_t;
+
+typedef struct
+{
+    const linky_data_t *sample;
+    uint8_t flags;
+    uint32_t index; // next label to read
+} exporter_iter_t;
+
+// labels whose value changed since the previous successful publish of the exporter
+typedef struct
+{
+    uint32_t bits[(EXPORTER_LABELS_MAX + 31) / 32];
+    uint16_t count;
+} exporter_changed_t;
+
+typedef struct
+{
+    uint32_t publish_count; // calls to publish
+    uint32_t error_count;   // publish that failed
+    uint32_t sample_count;  // samples given to publish
+    uint32_t changed_count; // changed values, summed over the publish
+    int64_t last_time;      // us spent in the last publish
+    int64_t total_time;     // us spent in publish since the boot
+} exporter_stats_t;
+
+typedef struct
+{
+    const char *name;
+    esp_err_t (*init)(void);    // once at boot, NULL if there is nothing to do
+    esp_err_t (*connect)(void); // the network is up: open the session with the server, NULL if there is none
+    esp_err_t (*publish)(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed);
+    void (*disconnect)(void);   // close the session, NULL if there is nothing to close
+    exporter_stats_t *stats;
+} exporter_t;
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+extern const exporter_t exporter_null; // walks every value and sends nothing: the cost of the shared part
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+
+/**
+ * @brief Read one label of a sample
+ *
+ * @param sample a copy of linky_data, or &linky_data
+ * @param flags EXPORTER_DEVICE_VALUES or 0
+ * @return false if the label is not exported: no data, an other TIC mode, a type without value (HA_NUMBER) or a
+ * device value without EXPORTER_DEVICE_VALUES. value->present tells if an exported label is set.
+ */
+bool exporter_value(const linky_data_t *sample, uint32_t index, uint8_t flags, exporter_value_t *value);
+
+/**
+ * @brief Start a walk on the set values of a sample
+ */
+void exporter_iter_init(exporter_iter_t *iter, const linky_data_t *sample, uint8_t flags);
+
+/**
+ * @brief Get the next set value, in the order of linky_label_list
+ *
+ * @return false at the end of the sample
+ */
+bool exporter_iter_next(exporter_iter_t *iter, exporter_value_t *value);
+
+/**
+ * @brief Check if a label is in the changed set
+ */
+bool exporter_changed(const exporter_changed_t *changed, uint32_t index);
+
+/**
+ * @brief Call the init of the exporter
+ */
+esp_err_t exporter_init(const exporter_t *exporter);
+
+/**
+ * @brief Call the connect of the exporter
+ */
+esp_err_t exporter_connect(const exporter_t *exporter);
+
+/**
+ * @brief Publish a batch of samples: compute the changed set of the last sample, call publish and count it in the
+ * stats. The changed set is kept only if the publish succeeds.
+ */
+esp_err_t exporter_publish(const exporter_t *exporter, linky_data_t *samples, uint8_t count);
+
+/**
+ * @brief Call the disconnect of the exporter
+ */
+void exporter_disconnect(const exporter_t *exporter);
+
+/**
+ * @brief Log the stats of the exporter
+ */
+void exporter_print_stats(const exporter_t *exporter);
+
+#endif /* EXPORTER_H */
@@ -8,7 +8,7 @@
 #include "esp_system.h"
 #include "spi_flash_mmap.h"
 #include <esp_http_server.h>
-#include "esp_spiffs.h"
+#include "esp_littlefs.h"
 #include "esp_log.h"
 #include <fcntl.h>
 #include <sys/types.h>
@@ -25,15 +25,13 @@
 #include "esp_log.h"
 
 #include "esp_vfs.h"
-#include "esp_spiffs.h"
 #include "esp_http_server.h"
 
-void config_init_spiffs(void);
 httpd_handle_t setup_server(void);
 /* Scratch buffer size */
 #define SCRATCH_BUFSIZE 8192
 /* Max length a file path can have on storage */
-#define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
+#define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_LITTLEFS_OBJ_NAME_LEN)
 
 struct file_server_data
 {
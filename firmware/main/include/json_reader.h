@@ -0,0 +1,92 @@
+/**
+ * @file json_reader.h
+ * @author Dorian Benech
+ * @brief JSON lookups without heap on a received buffer, for the config, the OTA manifest and the commands
+ * @version 1.0
+ * @date 2024-09-04
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * Thin layer over coreJSON (vendored by the Tuya SDK component): no tree is built, each lookup walks the received
+ * buffer and copies the value to the caller. The buffer is never modified and needs no '\0'.
+ *
+ * A path is a list of keys and array indexes joined by '.': "version", "builds[1].parts[0].type". The keys must not
+ * contain '.' or '['.
+ *
+ * json_read_object() validates the whole document once, with the bracket checks coreJSON v2.0.0 misses: the lookups
+ * only check the part they walk, call it first on untrusted input.
+ */
+#define JSON_READ_PATH_SIZE 48 // enough for the paths built with an index
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+
+/**
+ * @brief Check that the buffer holds one valid JSON object
+ *
+ * @return false for an invalid document, a scalar or an array
+ */
+bool json_read_object(const char *json, size_t len);
+
+/**
+ * @brief Check that the path exists, whatever its value: the end of an array
+ */
+bool json_read_exists(const char *json, size_t len, const char *path);
+
+/**
+ * @brief Find an object or an array, the next lookups can run inside it instead of walking the whole document again
+ *
+ * @param value the first character of the object or the array, in json
+ * @param value_len its length, brackets included
+ * @return false if the path is not found or is not an object or an array
+ */
+bool json_read_span(const char *json, size_t len, const char *path, const char **value, size_t *value_len);
+
+/**
+ * @brief Copy a string value, unescaped, with its '\0'
+ *
+ * @param out the destination, left untouched if the function fails
+ * @param size the size of out
+ * @return false if the path is not found, is not a string or does not fit in out
+ */
+bool json_read_text(const char *json, size_t len, const char *path, char *out, size_t size);
+
+/**
+ * @brief Read an integer, sent as a JSON number or as a string (the forms of the web UI send strings)
+ *
+ * A number is truncated like cJSON valueint, a string is read like atoi(), both saturate to the int32_t range.
+ *
+ * @return false if the path is not found or is neither a number nor a string
+ */
+bool json_read_int(const char *json, size_t len, const char *path, int32_t *value);
+
+#endif /* JSON_READER_H */
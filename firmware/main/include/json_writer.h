@@ -0,0 +1,102 @@
+/**
+ * @file json_writer.h
+ * @author Dorian Benech
+ * @brief Streaming JSON writer without heap, for the export payloads
+ * @version 1.0
+ * @date 2024-09-02
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * Compact output like cJSON_PrintUnformatted(): the items are written in the order of the calls, the writer only adds
+ * the ',' between the items of a container. Numbers are integers, a fraction is written with a fixed number of
+ * decimals (json_add_decimal), never with a double.
+ *
+ * Two destinations:
+ * - json_init(): a fixed buffer, the document must fit, json_end() adds the final '\0'
+ * - json_init_sink(): the buffer is handed to the sink each time it is full and by json_end(), the document can be
+ *   bigger than the buffer (chunked HTTP response, HTTP client body...)
+ */
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+/**
+ * @brief Receive a part of the document
+ *
+ * @return false to stop the document: the writer overflows
+ */
+typedef bool (*json_sink_t)(void *context, const char *data, size_t len);
+
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t len;        // pending length in buffer
+    size_t total;      // length of the document, sent parts included
+    bool overflow;     // set when the buffer is too small or the sink failed, the content is then invalid
+    bool comma;        // the current container has an item: the next one needs a ','
+    json_sink_t sink;  // NULL for a fixed buffer
+    void *context;     // of the sink
+} json_writer_t;
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+void json_init(json_writer_t *writer, char *buffer, size_t size);
+void json_init_sink(json_writer_t *writer, char *buffer, size_t size, json_sink_t sink, void *context);
+void json_open_object(json_writer_t *writer);
+void json_close_object(json_writer_t *writer);
+void json_open_array(json_writer_t *writer);
+void json_close_array(json_writer_t *writer);
+void json_add_key(json_writer_t *writer, const char *key);
+void json_add_uint(json_writer_t *writer, uint64_t value);
+void json_add_int(json_writer_t *writer, int64_t value);
+void json_add_text(json_writer_t *writer, const char *text);
+void json_add_bool(json_writer_t *writer, bool value);
+void json_add_null(json_writer_t *writer);
+
+/**
+ * @brief Add a fixed point number: json_add_decimal(writer, 3521, 3) gives 3.521
+ *
+ * @param value the number multiplied by 10^decimals
+ * @param decimals the number of decimals, up to 9
+ */
+void json_add_decimal(json_writer_t *writer, int64_t value, uint8_t decimals);
+
+void json_add_key_uint(json_writer_t *writer, const char *key, uint64_t value);
+void json_add_key_int(json_writer_t *writer, const char *key, int64_t value);
+void json_add_key_text(json_writer_t *writer, const char *key, const char *text);
+void json_add_key_bool(json_writer_t *writer, const char *key, bool value);
+
+/**
+ * @brief Finish the document: send the rest to the sink, or terminate the buffer with '\0'
+ *
+ * @return the length of the document, 0 if it overflowed
+ */
+size_t json_end(json_writer_t *writer);
+
+#endif /* JSON_WRITER_H */
@@ -0,0 +1,89 @@
+/**
+ * @file matter_map.h
+ * @author Dorian Benech
+ * @brief Mapping of the TIC labels to the Matter electrical measurement attributes
+ * @version 1.0
+ * @date 2024-08-26
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef MATTER_MAP_H
+#define MATTER_MAP_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "linky.h"
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * Endpoints, device type Electrical Sensor (0x0510):
+ *   1  the meter: apparent power of all the phases, current and voltage of phase 1, energy, TIC indexes
+ *   2  phase 2: apparent power, current and voltage, null on a single phase meter
+ *   3  phase 3: same as phase 2
+ * Units of Matter: mVA, mA, mV, mWh. A label missing from the sample is null.
+ */
+#define MATTER_ENDPOINT_METER 1
+#define MATTER_ENDPOINT_PHASE_2 2
+#define MATTER_ENDPOINT_PHASE_3 3
+
+#define MATTER_CLUSTER_POWER 0x0090  // Electrical Power Measurement
+#define MATTER_CLUSTER_ENERGY 0x0091 // Electrical Energy Measurement
+#define MATTER_CLUSTER_TIC 0xFFF1FC42 // manufacturer specific, like TICMETER_CLUSTER_ID of the Zigbee mode
+
+#define MATTER_ATTRIBUTE_APPARENT_POWER 0x000A
+#define MATTER_ATTRIBUTE_RMS_VOLTAGE 0x000B
+#define MATTER_ATTRIBUTE_RMS_CURRENT 0x000C
+#define MATTER_ATTRIBUTE_ENERGY_IMPORTED 0x0001 // CumulativeEnergyImported
+#define MATTER_ATTRIBUTE_ENERGY_EXPORTED 0x0002 // CumulativeEnergyExported
+#define MATTER_ATTRIBUTE_TARIFF 0x0000          // index of the current tariff, NTARF
+#define MATTER_ATTRIBUTE_INDEX(n) (n)           // supplier index n in mWh, 1 to 10: EASFnn, historique indexes in the same order
+
+#define MATTER_MAP_SIZE 22
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+typedef struct
+{
+    uint16_t endpoint;
+    uint32_t cluster;
+    uint32_t attribute;
+    bool null;
+    int64_t value;
+} matter_value_t;
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+
+/**
+ * @brief Compute the attributes of a sample and keep the ones that changed since the last call
+ *
+ * @param sample the sample, from the decoder or a copy of linky_data
+ * @param mode the TIC mode of the sample
+ * @param changes the attributes that changed, MATTER_MAP_SIZE entries
+ * @return the number of changes: every attribute the first time and after matter_map_reset()
+ */
+uint8_t matter_map_update(const linky_data_t *sample, linky_mode_t mode, matter_value_t *changes);
+
+/**
+ * @brief Forget the last values: the next update returns every attribute
+ */
+void matter_map_reset();
+
+#endif /* MATTER_MAP_H */
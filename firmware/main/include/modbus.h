@@ -0,0 +1,88 @@
+/**
+ * @file modbus.h
+ * @author Dorian Benech
+ * @brief Modbus TCP server of the TIC registers
+ * @version 1.0
+ * @date 2024-08-19
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef MODBUS_H
+#define MODBUS_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include "esp_err.h"
+#include "linky.h"
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * Read only map, the same for the input registers (function 0x04) and the holding registers (function 0x03).
+ * Values wider than 16 bits are big endian: the high register first.
+ *
+ * Header:
+ *   0: map version (MODBUS_MAP_VERSION)
+ *   1: TIC mode of the sample: 0 historique, 1 standard, 3 unknown
+ *   2: timestamp of the sample, UNIX time (2 registers)
+ *   4: sequence of the sample (2 registers), +1 per sample, 0 before the first sample
+ *   6: first register of the labels (MODBUS_LABEL_START)
+ *   7: number of label registers
+ *   8 to MODBUS_LABEL_START - 1: reserved, read as 0
+ *
+ * Labels: from MODBUS_LABEL_START, every label of linky_label_list stored in linky_data, historique and standard, in
+ * the order of the table, without gap:
+ *   UINT8, UINT16  1 register
+ *   UINT32         2 registers
+ *   UINT64         4 registers
+ *   UINT32_TIME    4 registers: the value (2), then its date, UNIX time (2)
+ *   STRING         (size + 1) / 2 registers, 2 characters per register, first character in the high byte, padded with 0
+ * A label not in the sample (other TIC mode, other contract, not received) reads as the maximum of its type (0x00FF for
+ * UINT8), a string as 0.
+ * The map of a firmware is generated from the table by scripts/modbus_map.py.
+ */
+#define MODBUS_PORT 502
+#define MODBUS_MAP_VERSION 1
+#define MODBUS_LABEL_START 100
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+
+/**
+ * @brief Keep a copy of the sample: the registers are read from this copy, never from the decoder
+ *
+ * @param data the new sample
+ */
+void modbus_update(linky_data_t *data);
+
+/**
+ * @brief Start the Modbus TCP server task on config_values.modbus.port, the wifi must be connected
+ *
+ * @return ESP_OK if the server is running
+ */
+esp_err_t modbus_server_start();
+
+/**
+ * @brief Stop the Modbus TCP server task and close the connections, before the wifi is disconnected
+ */
+void modbus_server_stop();
+
+#endif /* MODBUS_H */
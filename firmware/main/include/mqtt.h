@@ -28,6 +28,7 @@
 
 #include "esp_log.h"
 #include "linky.h"
+#include "exporter.h"
 
 /*==============================================================================
  Public Defines
@@ -40,11 +41,20 @@
 /*==============================================================================
  Public Type
 ==============================================================================*/
+typedef enum
+{
+    MQTT_CLASS_ALERT,      // ADPS, ADIRx, PEJP...
+    MQTT_CLASS_INDEX,      // energy indexes
+    MQTT_CLASS_REALTIME,   // power, current, voltage...
+    MQTT_CLASS_DIAGNOSTIC, // everything else
+    MQTT_CLASS_COUNT,
+} mqtt_class_t;
 
 /*==============================================================================
  Public Variables Declaration
 ==============================================================================*/
 extern esp_mqtt_client_handle_t mqtt_client;
+extern const exporter_t mqtt_exporter;
 
 /*==============================================================================
  Public Functions Declaration
@@ -83,6 +93,14 @@ extern int mqtt_send();
 
 extern uint8_t mqtt_prepare_publish(linky_data_t *linky);
 
+/**
+ * @brief Move the scheduled messages to the outbox by priority and wait for them to be acknowledged
+ *
+ * @param timeout in ms
+ * @return ESP_OK if all messages have been sent, ESP_ERR_TIMEOUT or ESP_FAIL otherwise
+ */
+esp_err_t mqtt_flush(uint32_t timeout);
+
 esp_err_t mqtt_test(esp_mqtt_error_type_t *type, esp_mqtt_connect_return_code_t *return_code);
 
 #endif /* MQTT_H */
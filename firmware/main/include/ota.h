@@ -36,6 +36,9 @@ typedef struct
     char hwVersion[16];
     char app_url[256];
     char storage_url[256];
+    char storage_sha256[65];
+    char delta_url[256]; // patch from the running version, empty if none
+    char ota_url[256];   // zlib-compressed storage and app (TICMeter.ota), empty if none
     char md5[33];
 } ota_version_t;
 
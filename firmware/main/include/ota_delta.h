@@ -0,0 +1,136 @@
+/**
+ * @file ota_delta.h
+ * @author Dorian Benech
+ * @brief Apply a binary patch to the running firmware: the new image is rebuilt while the patch is downloaded
+ * @version 1.0
+ * @date 2024-09-12
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef OTA_DELTA_H
+#define OTA_DELTA_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "zlib.h"
+#include "mbedtls/sha256.h"
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * Patch made by scripts/create_delta.py, bsdiff-like but in one stream so it can be applied while it is received.
+ * The whole patch is deflated with a 4 KB window (OTA_DELTA_WINDOW_BITS), inflated it is:
+ *
+ *   header: "TDLT", old size (u32 le), new size (u32 le), SHA-256 of the old image, SHA-256 of the new image
+ *   records until the new image is complete:
+ *     diff length (varint), diff bytes: new = old + diff, byte by byte, from the old position
+ *     extra length (varint), extra bytes: copied to the new image
+ *     seek (zigzag varint): added to the old position
+ *
+ * The old image is read at random positions, the new one is written in order: the running partition and the next
+ * OTA partition. The SHA-256 of the old image is checked before the first byte is written, the one of the new image at
+ * the end.
+ */
+#define OTA_DELTA_MAGIC "TDLT"
+#define OTA_DELTA_WINDOW_BITS 12
+#define OTA_DELTA_SHA256_SIZE 32
+#define OTA_DELTA_HEADER_SIZE (4 + 4 + 4 + 2 * OTA_DELTA_SHA256_SIZE)
+
+#define OTA_DELTA_INFLATE_SIZE 1024 // inflated patch, parsed
+#define OTA_DELTA_OLD_SIZE 256      // old image bytes read at once
+#define OTA_DELTA_WRITE_SIZE 1024   // new image bytes written at once
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+typedef esp_err_t (*ota_delta_read_t)(void *context, uint32_t offset, void *data, size_t len);   // old image
+typedef esp_err_t (*ota_delta_write_t)(void *context, const void *data, size_t len);             // new image, in order
+
+typedef enum
+{
+    OTA_DELTA_HEADER,
+    OTA_DELTA_DIFF_LEN,
+    OTA_DELTA_DIFF,
+    OTA_DELTA_EXTRA_LEN,
+    OTA_DELTA_EXTRA,
+    OTA_DELTA_SEEK,
+    OTA_DELTA_DONE,
+} ota_delta_state_t;
+
+typedef struct
+{
+    ota_delta_read_t read;
+    ota_delta_write_t write;
+    void *context;
+
+    z_stream zlib;
+    bool zlib_end; // the deflate stream is complete
+    esp_err_t err; // first error, the next calls do nothing
+    ota_delta_state_t state;
+
+    uint8_t header[OTA_DELTA_HEADER_SIZE];
+    uint32_t old_size;
+    uint32_t new_size;
+    uint32_t old_pos;  // next old byte of the diff
+    uint32_t new_pos;  // new bytes given to write, buffered included
+    uint32_t remaining; // bytes of the current header, diff or extra
+    uint64_t varint;
+    uint8_t varint_shift;
+
+    mbedtls_sha256_context sha; // of the new image
+    uint8_t inflated[OTA_DELTA_INFLATE_SIZE];
+    uint8_t old[OTA_DELTA_OLD_SIZE];
+    uint8_t out[OTA_DELTA_WRITE_SIZE];
+    uint16_t out_len;
+} ota_delta_t;
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+
+/**
+ * @brief Start a patch
+ *
+ * @param read reads the running image
+ * @param write writes the new image, in order
+ */
+esp_err_t ota_delta_init(ota_delta_t *delta, ota_delta_read_t read, ota_delta_write_t write, void *context);
+
+/**
+ * @brief Apply the next part of the patch, as received
+ *
+ * @return the first error of the patch: ESP_ERR_INVALID_VERSION if it is not made from the running image,
+ * ESP_ERR_INVALID_RESPONSE if it is malformed, or the error of read or write
+ */
+esp_err_t ota_delta_feed(ota_delta_t *delta, const uint8_t *data, size_t len);
+
+/**
+ * @brief Write the last bytes and check the new image
+ *
+ * @return ESP_ERR_INVALID_SIZE if the patch is incomplete, ESP_ERR_INVALID_CRC if the SHA-256 of the new image does not
+ * match, or the first error of ota_delta_feed()
+ */
+esp_err_t ota_delta_finish(ota_delta_t *delta);
+
+/**
+ * @brief Free the patch, after ota_delta_finish() or to drop it
+ */
+void ota_delta_free(ota_delta_t *delta);
+
+#endif /* OTA_DELTA_H */
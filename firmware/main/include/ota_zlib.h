@@ -36,10 +36,24 @@
  Public Functions Declaration
 ==============================================================================*/
 
+/**
+ * @brief Start an OTA file of create-ota.py: zlib-compressed storage and app sub-elements, used by Zigbee, Tuya and HTTP
+ */
 esp_err_t ota_zlib_init();
 
+/**
+ * @brief Inflate the next part of the file to the storage and OTA partitions, parts may be cut anywhere
+ */
 esp_err_t ota_zlib_write(const uint8_t *data, size_t len);
 
+/**
+ * @brief Check the app, set it as the boot partition and restart in 10 s
+ */
 esp_err_t ota_zlib_end();
 
+/**
+ * @brief Drop the file after an error, the boot partition is not changed
+ */
+void ota_zlib_abort();
+
 #endif /* TEMPLATE_H */
\ No newline at end of file
@@ -0,0 +1,110 @@
+/**
+ * @file storage_update.h
+ * @author Dorian Benech
+ * @brief Streamed update of the storage partition, staged in a scratch area so a power loss cannot leave it half written
+ * @version 1.0
+ * @date 2024-09-10
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef STORAGE_UPDATE_H
+#define STORAGE_UPDATE_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * The partition table cannot change with an OTA, so there is no second storage partition: the scratch area is the end
+ * of the next OTA app partition, one header sector followed by room for the whole storage image. The app OTA comes
+ * after the storage update and overwrites it.
+ *
+ * - storage_update_begin() erases the scratch area
+ * - storage_update_write() appends the received data to the scratch area and to a SHA-256, nothing is kept in RAM
+ * - storage_update_end() checks the size and the SHA-256, writes the header, then copies the image to the storage
+ *   partition sector by sector and reads it back. The header is marked done once the copy is checked.
+ * - storage_update_resume(), at boot before the mount: a header not marked done is a copy cut by a reset, it is done
+ *   again from the scratch area
+ *
+ * The files of the SPIFFS of the older firmwares go the same way to LittleFS: storage_update_stage_files() copies them
+ * to the scratch area, the SPIFFS untouched, then storage_update_restore_files() formats the partition and writes
+ * them back. A reset in between is finished by storage_update_resume().
+ */
+#define STORAGE_UPDATE_SHA256_SIZE 32
+#define STORAGE_UPDATE_NAME_SIZE 33 // SPIFFS name length of the sdkconfig, with its '\0'
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+
+/**
+ * @brief Erase the scratch area and start a new image
+ *
+ * @return ESP_ERR_NOT_FOUND without storage or OTA partition, ESP_ERR_INVALID_SIZE if the OTA partition is too small
+ */
+esp_err_t storage_update_begin(void);
+
+/**
+ * @brief Append a part of the image, in the order of the download
+ *
+ * @return the first error of the update: once a write failed, the next ones are ignored and storage_update_end() fails
+ */
+esp_err_t storage_update_write(const void *data, size_t len);
+
+/**
+ * @brief Check the image and copy it to the storage partition. The storage is unmounted: restart after it.
+ *
+ * @param sha256 expected SHA-256 of the image, NULL if the manifest has none
+ * @return ESP_ERR_INVALID_SIZE if the image is not the size of the partition, ESP_ERR_INVALID_CRC if the SHA-256 does not
+ * match: the storage partition is not touched
+ */
+esp_err_t storage_update_end(const uint8_t *sha256);
+
+/**
+ * @brief Drop the image, the storage partition is not touched
+ */
+void storage_update_abort(void);
+
+/**
+ * @brief Finish a copy cut by a reset, before the storage is mounted
+ *
+ * @return ESP_OK if there was nothing to finish or the copy is done
+ */
+esp_err_t storage_update_resume(void);
+
+/**
+ * @brief Copy the files of the file system mounted at STORAGE_PATH to the scratch area and check them
+ *
+ * @return ESP_ERR_INVALID_SIZE if they do not fit in the scratch area: nothing is staged, the storage is not touched
+ */
+esp_err_t storage_update_stage_files(void);
+
+/**
+ * @brief Format the storage partition as LittleFS and write the staged files to it. Unmount the storage first, it
+ * is unmounted after it.
+ *
+ * @return ESP_ERR_INVALID_STATE if no files are staged
+ */
+esp_err_t storage_update_restore_files(void);
+
+#endif /* STORAGE_UPDATE_H */
@@ -19,6 +19,7 @@
 #include "linky.h"
 #include "tuya_iot.h"
 #include "config.h"
+#include "exporter.h"
 
 /*==============================================================================
  Public Defines
@@ -39,6 +40,7 @@
 ==============================================================================*/
 extern TaskHandle_t tuyaTaskHandle;
 extern bool tuya_state;
+extern const exporter_t tuya_exporter;
 
 /*==============================================================================
  Public Functions Declaration
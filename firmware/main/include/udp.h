@@ -0,0 +1,65 @@
+/**
+ * @file udp.h
+ * @author Dorian Benech
+ * @brief Send the samples to the LAN as UDP multicast / broadcast datagrams
+ * @version 1.0
+ * @date 2024-08-05
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+#ifndef UDP_H
+#define UDP_H
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include <stdint.h>
+#include "esp_err.h"
+#include "linky.h"
+
+/*==============================================================================
+ Public Defines
+==============================================================================*/
+/*
+ * One datagram per sample, version 1, big endian:
+ *   0: magic "TI"
+ *   2: version (1 byte)
+ *   3: flags (1 byte), UDP_FLAG_SIGNED
+ *   4: boot id (4 bytes), random at boot: the sequence restarts from 0 with a new boot id
+ *   8: sequence (4 bytes), +1 per sample, the copies of a sample have the same sequence
+ *  12: the CBOR payload of cbor.h with one sample and without token
+ * If signed, the last UDP_MAC_SIZE bytes are HMAC-SHA256(key, datagram without the MAC), truncated.
+ */
+#define UDP_MAGIC "TI"
+#define UDP_VERSION 1
+#define UDP_FLAG_SIGNED 0x01
+#define UDP_HEADER_SIZE 12
+#define UDP_MAC_SIZE 16
+
+/*==============================================================================
+ Public Macro
+==============================================================================*/
+
+/*==============================================================================
+ Public Type
+==============================================================================*/
+
+/*==============================================================================
+ Public Variables Declaration
+==============================================================================*/
+
+/*==============================================================================
+ Public Functions Declaration
+==============================================================================*/
+
+/**
+ * @brief Send one sample to config_values.udp.host, the wifi must be connected
+ *
+ * @param data the sample to send
+ * @return ESP_OK if the datagram was sent
+ */
+esp_err_t udp_send(linky_data_t *data);
+
+#endif /* UDP_H */
@@ -15,9 +15,9 @@
 /*==============================================================================
  Local Include
 ===============================================================================*/
-#include "cJSON.h"
 #include "linky.h"
 #include "config.h"
+#include "exporter.h"
 
 /*==============================================================================
  Public Defines
@@ -34,19 +34,10 @@
 /*==============================================================================
  Public Variables Declaration
 ==============================================================================*/
+extern const exporter_t web_exporter;
 
 /*==============================================================================
  Public Functions Declaration
 ==============================================================================*/
 
-/**
- * @brief prepare json data to send to server
- *
- * @param data  the Array of data to send
- * @param dataIndex  the index of the data to send
- * @param json  the json destination
- * @param jsonSize the size of the json destination
- */
-extern void web_preapare_json_data(linky_data_t *data, char dataIndex, char **json);
-
 #endif /* WEB_H */
\ No newline at end of file
@@ -86,12 +86,14 @@ extern void wifi_disconnect();
 extern time_t wifi_get_timestamp();
 
 /**
- * @brief Send json data to server
+ * @brief Stream the samples to the server with a chunked POST, json, CBOR or InfluxDB line protocol according to
+ *        config_values.encoding, one object per sample or by columns (json and CBOR) according to config_values.columns
  *
- * @param json the json data to send
- * @return the http code
+ * @param data the Array of samples to send
+ * @param count the number of samples
+ * @return 1 on success, 0 otherwise
  */
-extern uint8_t wifi_send_to_server(const char *json);
+extern uint8_t wifi_send_to_server(linky_data_t *data, char count);
 
 /**
  * @brief Start the captive portal
@@ -106,6 +108,12 @@ extern void wifi_start_captive_portal();
  */
 extern void wifi_http_get_config_from_server();
 
+/**
+ * @brief Close the HTTP connection kept alive between the requests of a wifi connection
+ *
+ */
+extern void wifi_http_close();
+
 extern void wifi_scan(uint16_t *ap_count);
 
 extern esp_err_t wifi_ping(ip_addr_t host, uint32_t *ping_time);
@@ -23,6 +23,7 @@
 #include "ha/zb_ha_device_config.h"
 #include "zcl/esp_zigbee_zcl_power_config.h"
 #include "linky.h"
+#include "exporter.h"
 /*==============================================================================
  Public Defines
 ==============================================================================*/
@@ -42,12 +43,12 @@
 /*==============================================================================
  Public Variables Declaration
 ==============================================================================*/
+extern const exporter_t zigbee_exporter;
 
 /*==============================================================================
  Public Functions Declaration
 ==============================================================================*/
 extern void zigbee_init_stack();
-extern esp_err_t zigbee_send(linky_data_t *data);
 void zigbee_start_pairing();
 uint8_t zigbee_factory_reset();
 #endif // ZIGBEE_H
\ No newline at end of file
@@ -0,0 +1,427 @@
+/**
+ * @file json_reader.c
+ * @author Dorian Benech
+ * @brief JSON lookups without heap on a received buffer, for the config, the OTA manifest and the commands
+ * @version 1.0
+ * @date 2024-09-04
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "json_reader.h"
+#include "core_json.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define JSON_NUMBER_SIZE 32 // longest number read with strtod(), the longer ones are refused
+#define JSON_MAX_DEPTH 32   // of core_json.c, a deeper document fails JSON_Validate()
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static bool json_find(const char *json, size_t len, const char *path, const char **value, size_t *value_len, bool *string);
+static bool json_read_hex(const char *text, size_t len, uint32_t *value);
+static size_t json_put_utf8(uint32_t code, char *out);
+static size_t json_decode(const char *text, size_t len, size_t *i, char *utf8);
+static bool json_unescape(const char *text, size_t len, char *out, size_t size);
+static int32_t json_saturate(double value);
+static bool json_check_brackets(const char *json, size_t len);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+/**
+ * @brief Find the value of a path
+ *
+ * @param value the first character of the value, after the '"' of a string
+ * @param value_len the length of the value, without the '"' of a string
+ * @param string set if the value is a string
+ */
+static bool json_find(const char *json, size_t len, const char *path, const char **value, size_t *value_len, bool *string)
+{
+    if (json == NULL || path == NULL || len == 0)
+    {
+        return false;
+    }
+    char *found = NULL;
+    // JSON_Search() only reads the buffer, its prototype misses the const
+    if (JSON_Search((char *)json, len, path, strlen(path), &found, value_len) != JSONSuccess)
+    {
+        return false;
+    }
+    *value = found;
+    // coreJSON strips the quotes of a string: the other values follow a ':', a ',', a '[' or a space
+    *string = (found > json && found[-1] == '"');
+    return true;
+}
+
+/**
+ * @brief Read the 4 hex digits of a \uXXXX escape
+ */
+static bool json_read_hex(const char *text, size_t len, uint32_t *value)
+{
+    if (len < 4)
+    {
+        return false;
+    }
+    *value = 0;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        char c = text[i];
+        uint8_t digit;
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            digit = c - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        *value = (*value << 4) | digit;
+    }
+    return true;
+}
+
+/**
+ * @brief Encode a code point in UTF-8
+ *
+ * @return the number of bytes written in out, up to 4
+ */
+static size_t json_put_utf8(uint32_t code, char *out)
+{
+    if (code < 0x80)
+    {
+        out[0] = code;
+        return 1;
+    }
+    if (code < 0x800)
+    {
+        out[0] = 0xC0 | (code >> 6);
+        out[1] = 0x80 | (code & 0x3F);
+        return 2;
+    }
+    if (code < 0x10000)
+    {
+        out[0] = 0xE0 | (code >> 12);
+        out[1] = 0x80 | ((code >> 6) & 0x3F);
+        out[2] = 0x80 | (code & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (code >> 18);
+    out[1] = 0x80 | ((code >> 12) & 0x3F);
+    out[2] = 0x80 | ((code >> 6) & 0x3F);
+    out[3] = 0x80 | (code & 0x3F);
+    return 4;
+}
+
+/**
+ * @brief Decode the next character of a string: a byte, an escape or a \uXXXX (a surrogate pair is one character)
+ *
+ * @param i the position in text, moved after the character
+ * @param utf8 the character, up to 4 bytes
+ * @return the length of the character in utf8, 0 for a bad escape or a \u0000
+ */
+static size_t json_decode(const char *text, size_t len, size_t *i, char *utf8)
+{
+    if (text[*i] != '\\')
+    {
+        utf8[0] = text[(*i)++];
+        return 1;
+    }
+    if (*i + 1 >= len)
+    {
+        return 0;
+    }
+    char escape = text[*i + 1];
+    *i += 2;
+    switch (escape)
+    {
+    case '"':
+    case '\\':
+    case '/':
+        utf8[0] = escape;
+        return 1;
+    case 'b':
+        utf8[0] = '\b';
+        return 1;
+    case 'f':
+        utf8[0] = '\f';
+        return 1;
+    case 'n':
+        utf8[0] = '\n';
+        return 1;
+    case 'r':
+        utf8[0] = '\r';
+        return 1;
+    case 't':
+        utf8[0] = '\t';
+        return 1;
+    case 'u':
+        break;
+    default:
+        return 0;
+    }
+    uint32_t code;
+    if (!json_read_hex(&text[*i], len - *i, &code) || code == 0)
+    {
+        return 0;
+    }
+    *i += 4;
+    if (code >= 0xD800 && code <= 0xDBFF)
+    {
+        // high surrogate: the low one follows as an other \uXXXX
+        uint32_t low;
+        if (*i + 2 > len || text[*i] != '\\' || text[*i + 1] != 'u' ||
+            !json_read_hex(&text[*i + 2], len - *i - 2, &low) || low < 0xDC00 || low > 0xDFFF)
+        {
+            return 0;
+        }
+        *i += 6;
+        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    }
+    else if (code >= 0xDC00 && code <= 0xDFFF)
+    {
+        return 0;
+    }
+    return json_put_utf8(code, utf8);
+}
+
+/**
+ * @brief Copy the content of a string and replace its escapes, the result is checked before out is written
+ *
+ * @return false for a bad escape, a \u0000 or a result longer than size - 1
+ */
+static bool json_unescape(const char *text, size_t len, char *out, size_t size)
+{
+    // first pass: the length, so out is left untouched on error
+    for (uint8_t pass = 0; pass < 2; pass++)
+    {
+        size_t o = 0;
+        for (size_t i = 0; i < len;)
+        {
+            char utf8[4];
+            size_t utf8_len = json_decode(text, len, &i, utf8);
+            if (utf8_len == 0 || o + utf8_len >= size)
+            {
+                return false;
+            }
+            if (pass == 1)
+            {
+                memcpy(&out[o], utf8, utf8_len);
+            }
+            o += utf8_len;
+        }
+        if (pass == 1)
+        {
+            out[o] = '\0';
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Convert like cJSON valueint
+ */
+static int32_t json_saturate(double value)
+{
+    if (value >= INT32_MAX)
+    {
+        return INT32_MAX;
+    }
+    if (value <= INT32_MIN)
+    {
+        return INT32_MIN;
+    }
+    return (int32_t)value;
+}
+
+/**
+ * @brief Check what JSON_Validate() of coreJSON v2.0.0 lets through: "{]", a collection without ':' or ',' before it
+ * ("[null [1]]") and a trailing ',' ("[1,]"). The document has passed JSON_Validate(): its strings are well formed.
+ */
+static bool json_check_brackets(const char *json, size_t len)
+{
+    char stack[JSON_MAX_DEPTH];
+    int depth = -1;
+    char previous = '\0'; // last character outside the strings and the blanks
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = json[i];
+        switch (c)
+        {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+            continue;
+
+        case '"':
+            for (i++; i < len && json[i] != '"'; i++)
+            {
+                if (json[i] == '\\')
+                {
+                    i++;
+                }
+            }
+            break;
+
+        case '{':
+        case '[':
+            // a nested collection is a value: after ':' in an object, after '[' or ',' in an array
+            if (depth >= 0 && (stack[depth] == '{' ? previous != ':' : previous != '[' && previous != ','))
+            {
+                return false;
+            }
+            if (++depth == JSON_MAX_DEPTH)
+            {
+                return false;
+            }
+            stack[depth] = c;
+            break;
+
+        case '}':
+        case ']':
+            if (previous == ',' || depth < 0 || stack[depth] != (c == '}' ? '{' : '['))
+            {
+                return false;
+            }
+            depth--;
+            break;
+
+        default:
+            break;
+        }
+        previous = c;
+    }
+    return depth == -1;
+}
+
+bool json_read_object(const char *json, size_t len)
+{
+    if (json == NULL || len == 0 || JSON_Validate(json, len) != JSONSuccess || !json_check_brackets(json, len))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (json[i] != ' ' && json[i] != '\t' && json[i] != '\n' && json[i] != '\r')
+        {
+            return json[i] == '{';
+        }
+    }
+    return false;
+}
+
+bool json_read_exists(const char *json, size_t len, const char *path)
+{
+    const char *value;
+    size_t value_len;
+    bool string;
+    return json_find(json, len, path, &value, &value_len, &string);
+}
+
+bool json_read_span(const char *json, size_t len, const char *path, const char **value, size_t *value_len)
+{
+    bool string;
+    if (value == NULL || value_len == NULL || !json_find(json, len, path, value, value_len, &string))
+    {
+        return false;
+    }
+    return !string && *value_len > 0 && (**value == '{' || **value == '[');
+}
+
+bool json_read_text(const char *json, size_t len, const char *path, char *out, size_t size)
+{
+    const char *value;
+    size_t value_len;
+    bool string;
+    if (out == NULL || size == 0 || !json_find(json, len, path, &value, &value_len, &string) || !string)
+    {
+        return false;
+    }
+    return json_unescape(value, value_len, out, size);
+}
+
+bool json_read_int(const char *json, size_t len, const char *path, int32_t *value)
+{
+    const char *text;
+    size_t text_len;
+    bool string;
+    if (value == NULL || !json_find(json, len, path, &text, &text_len, &string))
+    {
+        return false;
+    }
+    if (string)
+    {
+        // like atoi() on the unescaped string: leading spaces, a sign, then the digits up to the first other character
+        size_t i = 0;
+        char c[4];
+        size_t c_len = (text_len > 0) ? json_decode(text, text_len, &i, c) : 0;
+        while (c_len == 1 && (c[0] == ' ' || (c[0] >= '\t' && c[0] <= '\r')))
+        {
+            c_len = (i < text_len) ? json_decode(text, text_len, &i, c) : 0;
+        }
+        bool negative = false;
+        if (c_len == 1 && (c[0] == '-' || c[0] == '+'))
+        {
+            negative = (c[0] == '-');
+            c_len = (i < text_len) ? json_decode(text, text_len, &i, c) : 0;
+        }
+        int64_t number = 0;
+        while (c_len == 1 && c[0] >= '0' && c[0] <= '9')
+        {
+            if (number <= INT32_MAX)
+            {
+                number = number * 10 + (c[0] - '0');
+            }
+            c_len = (i < text_len) ? json_decode(text, text_len, &i, c) : 0;
+        }
+        *value = json_saturate(negative ? -number : number);
+        return true;
+    }
+    if (text_len == 0 || !(text[0] == '-' || (text[0] >= '0' && text[0] <= '9')))
+    {
+        return false; // true, false, null, an object or an array
+    }
+    char number[JSON_NUMBER_SIZE];
+    if (text_len >= sizeof(number))
+    {
+        return false;
+    }
+    // the value is not terminated in the buffer, strtod() needs a copy
+    memcpy(number, text, text_len);
+    number[text_len] = '\0';
+    *value = json_saturate(strtod(number, NULL));
+    return true;
+}
@@ -0,0 +1,353 @@
+/**
+ * @file json_writer.c
+ * @author Dorian Benech
+ * @brief Streaming JSON writer without heap, for the export payloads
+ * @version 1.0
+ * @date 2024-09-02
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "json_writer.h"
+#include <string.h>
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define JSON_UINT_DIGITS 20 // UINT64_MAX
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static bool json_flush(json_writer_t *writer);
+static void json_write(json_writer_t *writer, const char *data, size_t len);
+static void json_write_char(json_writer_t *writer, char c);
+static void json_write_uint(json_writer_t *writer, uint64_t value);
+static void json_write_string(json_writer_t *writer, const char *text);
+static void json_begin_item(json_writer_t *writer);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+static const char json_hex[] = "0123456789abcdef";
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+/**
+ * @brief Hand the pending part to the sink
+ *
+ * @return false without sink or if the sink failed
+ */
+static bool json_flush(json_writer_t *writer)
+{
+    if (writer->sink == NULL || writer->overflow)
+    {
+        return false;
+    }
+    if (writer->len > 0 && !writer->sink(writer->context, writer->buffer, writer->len))
+    {
+        return false;
+    }
+    writer->len = 0;
+    return true;
+}
+
+static void json_write(json_writer_t *writer, const char *data, size_t len)
+{
+    while (!writer->overflow && len > 0)
+    {
+        size_t room = writer->size - writer->len;
+        if (room == 0)
+        {
+            if (!json_flush(writer))
+            {
+                writer->overflow = true;
+            }
+            continue;
+        }
+        size_t part = len < room ? len : room;
+        memcpy(writer->buffer + writer->len, data, part);
+        writer->len += part;
+        writer->total += part;
+        data += part;
+        len -= part;
+    }
+}
+
+static void json_write_char(json_writer_t *writer, char c)
+{
+    if (!writer->overflow && writer->len < writer->size)
+    {
+        writer->buffer[writer->len++] = c;
+        writer->total++;
+        return;
+    }
+    json_write(writer, &c, 1);
+}
+
+/**
+ * @brief Write the digits from the end of a small buffer, no division by a variable and no printf
+ */
+static void json_write_uint(json_writer_t *writer, uint64_t value)
+{
+    char digits[JSON_UINT_DIGITS];
+    uint8_t i = sizeof(digits);
+    if (value <= UINT32_MAX)
+    {
+        // 32 bits divisions are cheaper on the RISC-V of the C6
+        uint32_t value32 = value;
+        do
+        {
+            digits[--i] = '0' + value32 % 10;
+            value32 /= 10;
+        } while (value32 > 0);
+    }
+    else
+    {
+        do
+        {
+            digits[--i] = '0' + value % 10;
+            value /= 10;
+        } while (value > 0);
+    }
+    json_write(writer, digits + i, sizeof(digits) - i);
+}
+
+/**
+ * @brief Write a quoted string, escaped like cJSON: '"', '\' and the control characters, UTF-8 is kept as is
+ */
+static void json_write_string(json_writer_t *writer, const char *text)
+{
+    json_write_char(writer, '"');
+    const char *run = text; // characters without escape are written by runs
+    for (; *text != '\0'; text++)
+    {
+        unsigned char c = *text;
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+        json_write(writer, run, text - run);
+        run = text + 1;
+        char escape[6] = {'\\', 0};
+        size_t len = 2;
+        switch (c)
+        {
+        case '"':
+        case '\\':
+            escape[1] = c;
+            break;
+        case '\b':
+            escape[1] = 'b';
+            break;
+        case '\f':
+            escape[1] = 'f';
+            break;
+        case '\n':
+            escape[1] = 'n';
+            break;
+        case '\r':
+            escape[1] = 'r';
+            break;
+        case '\t':
+            escape[1] = 't';
+            break;
+        default:
+            escape[1] = 'u';
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = json_hex[c >> 4];
+            escape[5] = json_hex[c & 0x0F];
+            len = 6;
+            break;
+        }
+        json_write(writer, escape, len);
+    }
+    json_write(writer, run, text - run);
+    json_write_char(writer, '"');
+}
+
+/**
+ * @brief Separate the item from the previous one of its container
+ */
+static void json_begin_item(json_writer_t *writer)
+{
+    if (writer->comma)
+    {
+        json_write_char(writer, ',');
+    }
+    writer->comma = true;
+}
+
+void json_init(json_writer_t *writer, char *buffer, size_t size)
+{
+    json_init_sink(writer, buffer, size, NULL, NULL);
+}
+
+void json_init_sink(json_writer_t *writer, char *buffer, size_t size, json_sink_t sink, void *context)
+{
+    writer->buffer = buffer;
+    writer->size = (sink == NULL && size > 0) ? size - 1 : size; // keep the '\0' of a fixed buffer
+    writer->len = 0;
+    writer->total = 0;
+    writer->overflow = (size == 0);
+    writer->comma = false;
+    writer->sink = sink;
+    writer->context = context;
+}
+
+void json_open_object(json_writer_t *writer)
+{
+    json_begin_item(writer);
+    json_write_char(writer, '{');
+    writer->comma = false;
+}
+
+void json_close_object(json_writer_t *writer)
+{
+    json_write_char(writer, '}');
+    writer->comma = true;
+}
+
+void json_open_array(json_writer_t *writer)
+{
+    json_begin_item(writer);
+    json_write_char(writer, '[');
+    writer->comma = false;
+}
+
+void json_close_array(json_writer_t *writer)
+{
+    json_write_char(writer, ']');
+    writer->comma = true;
+}
+
+void json_add_key(json_writer_t *writer, const char *key)
+{
+    json_begin_item(writer);
+    json_write_string(writer, key);
+    json_write_char(writer, ':');
+    writer->comma = false; // the value follows
+}
+
+void json_add_uint(json_writer_t *writer, uint64_t value)
+{
+    json_begin_item(writer);
+    json_write_uint(writer, value);
+}
+
+void json_add_int(json_writer_t *writer, int64_t value)
+{
+    json_begin_item(writer);
+    if (value < 0)
+    {
+        json_write_char(writer, '-');
+        json_write_uint(writer, -(uint64_t)value);
+        return;
+    }
+    json_write_uint(writer, value);
+}
+
+void json_add_decimal(json_writer_t *writer, int64_t value, uint8_t decimals)
+{
+    static const uint32_t powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+    if (decimals >= sizeof(powers) / sizeof(powers[0]))
+    {
+        decimals = sizeof(powers) / sizeof(powers[0]) - 1;
+    }
+    json_begin_item(writer);
+    uint64_t magnitude = value;
+    if (value < 0)
+    {
+        json_write_char(writer, '-');
+        magnitude = -(uint64_t)value;
+    }
+    json_write_uint(writer, magnitude / powers[decimals]);
+    if (decimals == 0)
+    {
+        return;
+    }
+    char fraction[10] = {'.'};
+    uint32_t rest = magnitude % powers[decimals];
+    for (uint8_t i = decimals; i > 0; i--)
+    {
+        fraction[i] = '0' + rest % 10;
+        rest /= 10;
+    }
+    json_write(writer, fraction, decimals + 1);
+}
+
+void json_add_text(json_writer_t *writer, const char *text)
+{
+    json_begin_item(writer);
+    json_write_string(writer, text);
+}
+
+void json_add_bool(json_writer_t *writer, bool value)
+{
+    json_begin_item(writer);
+    json_write(writer, value ? "true" : "false", value ? 4 : 5);
+}
+
+void json_add_null(json_writer_t *writer)
+{
+    json_begin_item(writer);
+    json_write(writer, "null", 4);
+}
+
+void json_add_key_uint(json_writer_t *writer, const char *key, uint64_t value)
+{
+    json_add_key(writer, key);
+    json_add_uint(writer, value);
+}
+
+void json_add_key_int(json_writer_t *writer, const char *key, int64_t value)
+{
+    json_add_key(writer, key);
+    json_add_int(writer, value);
+}
+
+void json_add_key_text(json_writer_t *writer, const char *key, const char *text)
+{
+    json_add_key(writer, key);
+    json_add_text(writer, text);
+}
+
+void json_add_key_bool(json_writer_t *writer, const char *key, bool value)
+{
+    json_add_key(writer, key);
+    json_add_bool(writer, value);
+}
+
+size_t json_end(json_writer_t *writer)
+{
+    if (writer->sink != NULL)
+    {
+        if (!json_flush(writer))
+        {
+            writer->overflow = true;
+        }
+    }
+    else if (writer->buffer != NULL && !writer->overflow)
+    {
+        writer->buffer[writer->len] = '\0';
+    }
+    return writer->overflow ? 0 : writer->total;
+}
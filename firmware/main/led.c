@@ -77,6 +77,9 @@ const uint32_t led_color_mode[] = {
     [MODE_ZIGBEE] = 0xFF0000,
     [MODE_MATTER] = 0xFFFFFF,
     [MODE_TUYA] = 0xB04000,
+    [MODE_UDP] = 0x00FFB0,
+    [MODE_COAP] = 0xFFD000,
+    [MODE_MODBUS] = 0x00FF20,
 };
 /*==============================================================================
  Local Variable
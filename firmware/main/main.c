@@ -43,8 +43,12 @@
 #include "mqtt.h"
 #include "gpio.h"
 #include "web.h"
+#include "udp.h"
+#include "coap.h"
+#include "modbus.h"
 #include "zigbee.h"
 #include "tuya.h"
+#include "exporter.h"
 #include "ota.h"
 #include "power.h"
 #include "led.h"
@@ -211,8 +215,8 @@ void app_main(void)
     err = wifi_connect();
     if (err == ESP_OK)
     {
-      mqtt_init();          // init mqtt
-      wifi_get_timestamp(); // get timestamp from ntp server
+      wifi_get_timestamp();          // get timestamp from ntp server, before the birth message and its next_publish
+      exporter_init(&mqtt_exporter); // init mqtt
       main_ota_check();
       vTaskDelay(1000 / portTICK_PERIOD_MS);
       wifi_disconnect();
@@ -222,10 +226,63 @@ void app_main(void)
       ESP_LOGE(MAIN_TAG, "Wifi connection failed: dont start MQTT");
     }
 
+    break;
+  case MODE_UDP:
+    err = wifi_connect();
+    if (err == ESP_OK)
+    {
+      wifi_get_timestamp(); // get timestamp from ntp server
+      main_ota_check();
+      wifi_disconnect();
+    }
+    else
+    {
+      ESP_LOGE(MAIN_TAG, "Wifi connection failed: dont start UDP");
+    }
+    break;
+  case MODE_COAP:
+    err = wifi_connect();
+    if (err == ESP_OK)
+    {
+      wifi_get_timestamp(); // get timestamp from ntp server
+      main_ota_check();
+      if (gpio_vusb_connected())
+      {
+        coap_server_start(); // the wifi stays on: serve the resources
+      }
+      else
+      {
+        wifi_disconnect();
+      }
+    }
+    else
+    {
+      ESP_LOGE(MAIN_TAG, "Wifi connection failed: dont start COAP");
+    }
+    break;
+  case MODE_MODBUS:
+    err = wifi_connect();
+    if (err == ESP_OK)
+    {
+      wifi_get_timestamp(); // get timestamp from ntp server
+      main_ota_check();
+      if (gpio_vusb_connected())
+      {
+        modbus_server_start(); // the wifi stays on: the masters poll the registers
+      }
+      else
+      {
+        wifi_disconnect();
+      }
+    }
+    else
+    {
+      ESP_LOGE(MAIN_TAG, "Wifi connection failed: dont start MODBUS");
+    }
     break;
   case MODE_ZIGBEE:
     power_set_zigbee();
-    zigbee_init_stack();
+    exporter_init(&zigbee_exporter);
     vTaskDelay(2000 / portTICK_PERIOD_MS);
     break;
   case MODE_TUYA:
@@ -272,6 +329,9 @@ void main_task(void *pvParameters)
       [MODE_MQTT_HA] = 10,
       [MODE_ZIGBEE] = 2,
       [MODE_TUYA] = 10,
+      [MODE_UDP] = 5,
+      [MODE_COAP] = 5,
+      [MODE_MODBUS] = 5,
   };
   linky_clear_data();
 
@@ -342,21 +402,12 @@ esp_err_t main_send_data(linky_data_t *data)
     ESP_LOGI(MAIN_TAG, "Data stored: %d/%d: time: %lld", main_data_index, config_values.web.store_before_send, linky_data.timestamp);
     if (main_data_index >= config_values.web.store_before_send || main_data_index >= MAX_DATA_INDEX)
     {
-      char *json = NULL;
-      web_preapare_json_data(main_data_array, main_data_index, &json);
-      if (json == NULL)
-      {
-        ESP_LOGE(MAIN_TAG, "Cant prepare json data");
-        err = ESP_FAIL;
-        break;
-      }
-
       ESP_LOGI(MAIN_TAG, "Sending data to server");
       err = wifi_connect();
       if (err == ESP_OK)
       {
-        ESP_LOGI(MAIN_TAG, "POST: %s", json);
-        wifi_send_to_server(json);
+        ESP_LOGI(MAIN_TAG, "POST: %d samples as %s", main_data_index, ENCODINGS[config_values.encoding]);
+        exporter_publish(&web_exporter, main_data_array, main_data_index); // the response brings the server config
         main_ota_check();
         err = ESP_OK;
       }
@@ -365,7 +416,6 @@ esp_err_t main_send_data(linky_data_t *data)
         ESP_LOGE(MAIN_TAG, "Wifi connection failed");
         err = ESP_FAIL;
       }
-      free(json);
       wifi_disconnect();
       main_data_index = 0;
     }
@@ -375,20 +425,13 @@ esp_err_t main_send_data(linky_data_t *data)
   case MODE_MQTT_HA: // send data to mqtt server
   {
     linky_free_heap_size = esp_get_free_heap_size();
-    uint8_t ret = mqtt_prepare_publish(data);
-    if (ret == 0)
-    {
-      ESP_LOGE(MAIN_TAG, "Some data will not be sent, but we continue");
-    }
-    ret = wifi_connect();
-    if (ret != ESP_OK)
+    if (wifi_connect() != ESP_OK)
     {
       ESP_LOGE(MAIN_TAG, "Wifi connection failed");
       goto send_error;
     }
     ESP_LOGI(MAIN_TAG, "Sending data to MQTT");
-    ret = mqtt_send();
-    if (ret == 0)
+    if (exporter_publish(&mqtt_exporter, data, 1) != ESP_OK)
     {
       ESP_LOGE(MAIN_TAG, "MQTT send failed");
       goto send_error;
@@ -420,38 +463,23 @@ esp_err_t main_send_data(linky_data_t *data)
     if (err == ESP_OK)
     {
       ESP_LOGI(MAIN_TAG, "Sending data to TUYA");
-      if (tuya_state == false)
+      err = exporter_connect(&tuya_exporter);
+      if (err == ESP_OK)
       {
-        ESP_LOGW(MAIN_TAG, "Tuya not connected, reconnecting...");
-        resume_task(tuyaTaskHandle); // resume tuya task
-        tuya_state = true;
-        if (tuya_wait_event(TUYA_EVENT_MQTT_CONNECTED, 10000))
-        {
-          ESP_LOGE(MAIN_TAG, "Tuya MQTT ERROR");
-          led_start_pattern(LED_SEND_FAILED);
-          err = ESP_FAIL;
-          goto tuya_disconect;
-        }
+        err = exporter_publish(&tuya_exporter, data, 1);
       }
-
-      if (tuya_send_data(data))
+      if (err != ESP_OK)
       {
         ESP_LOGE(MAIN_TAG, "Tuya SEND ERROR");
-        led_start_pattern(LED_SEND_FAILED);
-        err = ESP_FAIL;
-        goto tuya_disconect;
       }
-      err = ESP_OK;
-    tuya_disconect:
       main_ota_check();
       if (!gpio_vusb_connected())
       {
         ESP_LOGI(MAIN_TAG, "VUSB not connected, suspend TUYA");
         wifi_disconnect();
-        suspend_task(tuyaTaskHandle);
-        tuya_state = false;
+        exporter_disconnect(&tuya_exporter);
       }
-      led_start_pattern(LED_SEND_OK);
+      led_start_pattern(err == ESP_OK ? LED_SEND_OK : LED_SEND_FAILED);
     }
     else
     {
@@ -459,9 +487,73 @@ esp_err_t main_send_data(linky_data_t *data)
       err = ESP_FAIL;
     }
     break;
+  case MODE_UDP:
+    // no connection to open: the radio is on for the association and the datagrams only
+    err = wifi_connect();
+    if (err == ESP_OK)
+    {
+      err = udp_send(data);
+      main_ota_check();
+    }
+    else
+    {
+      ESP_LOGE(MAIN_TAG, "Wifi connection failed: dont send UDP");
+    }
+    wifi_disconnect();
+    led_start_pattern(err == ESP_OK ? LED_SEND_OK : LED_SEND_FAILED);
+    break;
+  case MODE_COAP:
+    err = wifi_connect();
+    if (err == ESP_OK)
+    {
+      err = coap_send(data);
+      coap_notify(data);
+      main_ota_check();
+      if (gpio_vusb_connected())
+      {
+        coap_server_start(); // started here too when the USB is plugged after the boot
+      }
+      else
+      {
+        coap_server_stop();
+        wifi_disconnect();
+      }
+    }
+    else
+    {
+      ESP_LOGE(MAIN_TAG, "Wifi connection failed: dont send COAP");
+      coap_server_stop();
+    }
+    led_start_pattern(err == ESP_OK ? LED_SEND_OK : LED_SEND_FAILED);
+    break;
+  case MODE_MODBUS:
+    // nothing is sent: the masters read the last sample
+    modbus_update(data);
+    err = wifi_connect();
+    if (err == ESP_OK)
+    {
+      err = modbus_server_start();
+      main_ota_check();
+      if (!gpio_vusb_connected())
+      {
+        // on battery the registers can only be read while the wifi is on for the OTA check
+        modbus_server_stop();
+        wifi_disconnect();
+      }
+    }
+    else
+    {
+      ESP_LOGE(MAIN_TAG, "Wifi connection failed: dont start MODBUS");
+      modbus_server_stop();
+    }
+    led_start_pattern(err == ESP_OK ? LED_SEND_OK : LED_SEND_FAILED);
+    break;
   case MODE_ZIGBEE:
-
-    err = zigbee_send(data);
+    err = exporter_connect(&zigbee_exporter);
+    if (err == ESP_OK)
+    {
+      err = exporter_publish(&zigbee_exporter, data, 1);
+    }
     if (err != ESP_OK)
     {
       led_start_pattern(LED_SEND_FAILED);
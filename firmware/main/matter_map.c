@@ -0,0 +1,162 @@
+/**
+ * @file matter_map.c
+ * @author Dorian Benech
+ * @brief Mapping of the TIC labels to the Matter electrical measurement attributes
+ * @version 1.0
+ * @date 2024-08-26
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "matter_map.h"
+#include <string.h>
+#include <assert.h>
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define MATTER_MAP_SOURCES 4 // labels that can feed one attribute in a TIC mode, the first one in the sample is used
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+#define MATTER_SOURCE(field, field_type) {&linky_data.field, field_type}
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+typedef struct
+{
+    const void *data; // field of linky_data
+    linky_label_type_t type;
+} matter_source_t;
+
+typedef struct
+{
+    uint16_t endpoint;
+    uint32_t cluster;
+    uint32_t attribute;
+    int32_t scale; // TIC unit to Matter unit: V to mV, A to mA, VA to mVA, Wh to mWh
+    matter_source_t hist[MATTER_MAP_SOURCES];
+    matter_source_t std[MATTER_MAP_SOURCES];
+} matter_map_entry_t;
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static bool matter_map_read(const linky_data_t *sample, const matter_source_t *sources, int64_t *value);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+// clang-format off
+static const matter_map_entry_t matter_map[] = {
+    // Endpoint               Cluster               Attribute                         Scale  Historique                                                                                                              Standard
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_POWER,  MATTER_ATTRIBUTE_APPARENT_POWER,  1000, {MATTER_SOURCE(hist.PAPP, UINT32)},                                                                                      {MATTER_SOURCE(std.SINSTS, UINT32)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_POWER,  MATTER_ATTRIBUTE_RMS_CURRENT,     1000, {MATTER_SOURCE(hist.IINST, UINT16), MATTER_SOURCE(hist.IINST1, UINT16)},                                          {MATTER_SOURCE(std.IRMS1, UINT16)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_POWER,  MATTER_ATTRIBUTE_RMS_VOLTAGE,     1000, {},                                                                                                               {MATTER_SOURCE(std.URMS1, UINT16)}},
+    {MATTER_ENDPOINT_PHASE_2, MATTER_CLUSTER_POWER,  MATTER_ATTRIBUTE_APPARENT_POWER,  1000, {},                                                                                                               {MATTER_SOURCE(std.SINSTS2, UINT32)}},
+    {MATTER_ENDPOINT_PHASE_2, MATTER_CLUSTER_POWER,  MATTER_ATTRIBUTE_RMS_CURRENT,     1000, {MATTER_SOURCE(hist.IINST2, UINT16)},                                                                                    {MATTER_SOURCE(std.IRMS2, UINT16)}},
+    {MATTER_ENDPOINT_PHASE_2, MATTER_CLUSTER_POWER,  MATTER_ATTRIBUTE_RMS_VOLTAGE,     1000, {},                                                                                                               {MATTER_SOURCE(std.URMS2, UINT16)}},
+    {MATTER_ENDPOINT_PHASE_3, MATTER_CLUSTER_POWER,  MATTER_ATTRIBUTE_APPARENT_POWER,  1000, {},                                                                                                               {MATTER_SOURCE(std.SINSTS3, UINT32)}},
+    {MATTER_ENDPOINT_PHASE_3, MATTER_CLUSTER_POWER,  MATTER_ATTRIBUTE_RMS_CURRENT,     1000, {MATTER_SOURCE(hist.IINST3, UINT16)},                                                                                    {MATTER_SOURCE(std.IRMS3, UINT16)}},
+    {MATTER_ENDPOINT_PHASE_3, MATTER_CLUSTER_POWER,  MATTER_ATTRIBUTE_RMS_VOLTAGE,     1000, {},                                                                                                               {MATTER_SOURCE(std.URMS3, UINT16)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_ENERGY, MATTER_ATTRIBUTE_ENERGY_IMPORTED, 1000, {MATTER_SOURCE(hist.TOTAL, UINT64)},                                                                                     {MATTER_SOURCE(std.EAST, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_ENERGY, MATTER_ATTRIBUTE_ENERGY_EXPORTED, 1000, {},                                                                                                               {MATTER_SOURCE(std.EAIT, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_TARIFF,             1, {},                                                                                                               {MATTER_SOURCE(std.NTARF, UINT16)}},
+    // the historique indexes in the order of the standard supplier indexes of the same contract
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(1),        1000, {MATTER_SOURCE(hist.BASE, UINT64), MATTER_SOURCE(hist.HCHC, UINT64), MATTER_SOURCE(hist.EJPHN, UINT64), MATTER_SOURCE(hist.BBRHCJB, UINT64)}, {MATTER_SOURCE(std.EASF01, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(2),        1000, {MATTER_SOURCE(hist.HCHP, UINT64), MATTER_SOURCE(hist.EJPHPM, UINT64), MATTER_SOURCE(hist.BBRHPJB, UINT64)},     {MATTER_SOURCE(std.EASF02, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(3),        1000, {MATTER_SOURCE(hist.BBRHCJW, UINT64)},                                                                                   {MATTER_SOURCE(std.EASF03, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(4),        1000, {MATTER_SOURCE(hist.BBRHPJW, UINT64)},                                                                                   {MATTER_SOURCE(std.EASF04, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(5),        1000, {MATTER_SOURCE(hist.BBRHCJR, UINT64)},                                                                                   {MATTER_SOURCE(std.EASF05, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(6),        1000, {MATTER_SOURCE(hist.BBRHPJR, UINT64)},                                                                                   {MATTER_SOURCE(std.EASF06, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(7),        1000, {},                                                                                                               {MATTER_SOURCE(std.EASF07, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(8),        1000, {},                                                                                                               {MATTER_SOURCE(std.EASF08, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(9),        1000, {},                                                                                                               {MATTER_SOURCE(std.EASF09, UINT64)}},
+    {MATTER_ENDPOINT_METER,   MATTER_CLUSTER_TIC,    MATTER_ATTRIBUTE_INDEX(10),       1000, {},                                                                                                               {MATTER_SOURCE(std.EASF10, UINT64)}},
+};
+// clang-format on
+static_assert(sizeof(matter_map) / sizeof(matter_map[0]) == MATTER_MAP_SIZE, "MATTER_MAP_SIZE does not match matter_map");
+
+static matter_value_t matter_map_last[MATTER_MAP_SIZE];
+static bool matter_map_valid = false; // matter_map_last holds the values of the last update
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+/**
+ * @brief Read the first label of sources that is in the sample, like exporter_value() a cleared value or an index at 0 is missing
+ *
+ * @return false if no label is in the sample
+ */
+static bool matter_map_read(const linky_data_t *sample, const matter_source_t *sources, int64_t *value)
+{
+    for (uint8_t i = 0; i < MATTER_MAP_SOURCES && sources[i].data != NULL; i++)
+    {
+        uint32_t delta_in_data = (const char *)sources[i].data - (const char *)&linky_data;
+        const void *field = (const char *)sample + delta_in_data;
+        switch (sources[i].type)
+        {
+        case UINT16:
+            if (*(const uint16_t *)field == UINT16_MAX)
+                continue;
+            *value = *(const uint16_t *)field;
+            return true;
+        case UINT32:
+            if (*(const uint32_t *)field == UINT32_MAX)
+                continue;
+            *value = *(const uint32_t *)field;
+            return true;
+        case UINT64:
+            if (*(const uint64_t *)field == UINT64_MAX || *(const uint64_t *)field == 0 || *(const uint64_t *)field > INT64_MAX / 1000)
+                continue;
+            *value = *(const uint64_t *)field;
+            return true;
+        default:
+            continue;
+        }
+    }
+    return false;
+}
+
+uint8_t matter_map_update(const linky_data_t *sample, linky_mode_t mode, matter_value_t *changes)
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < MATTER_MAP_SIZE; i++)
+    {
+        const matter_map_entry_t *entry = &matter_map[i];
+        matter_value_t value = {
+            .endpoint = entry->endpoint,
+            .cluster = entry->cluster,
+            .attribute = entry->attribute,
+            .null = true,
+        };
+        const matter_source_t *sources = (mode == MODE_HIST) ? entry->hist : (mode == MODE_STD) ? entry->std : NULL;
+        if (sources != NULL && matter_map_read(sample, sources, &value.value))
+        {
+            value.null = false;
+            value.value *= entry->scale;
+        }
+        if (!matter_map_valid || value.null != matter_map_last[i].null || value.value != matter_map_last[i].value)
+        {
+            matter_map_last[i] = value;
+            changes[count++] = value;
+        }
+    }
+    matter_map_valid = true;
+    return count;
+}
+
+void matter_map_reset()
+{
+    matter_map_valid = false;
+}
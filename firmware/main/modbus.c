@@ -0,0 +1,497 @@
+/**
+ * @file modbus.c
+ * @author Dorian Benech
+ * @brief Modbus TCP server of the TIC registers
+ * @version 1.0
+ * @date 2024-08-19
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "modbus.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "config.h"
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define TAG "MODBUS"
+
+#define MODBUS_MBAP_SIZE 7       // transaction id, protocol id, length, unit id
+#define MODBUS_ADU_SIZE 260      // MBAP + 253 bytes of PDU
+#define MODBUS_MAX_REGISTERS 125 // per request, Modbus application protocol 6.3
+#define MODBUS_MAX_CLIENTS 4
+#define MODBUS_CLIENT_TIMEOUT 60 // s without request before the connection is closed
+#define MODBUS_SERVER_TIMEOUT 1  // s, the server task checks modbus_server_running
+#define MODBUS_UNIT_ANY 0xFF     // Modbus TCP: unit id of a device reached directly
+
+#define MODBUS_READ_HOLDING_REGISTERS 0x03
+#define MODBUS_READ_INPUT_REGISTERS 0x04
+
+#define MODBUS_ILLEGAL_FUNCTION 0x01
+#define MODBUS_ILLEGAL_DATA_ADDRESS 0x02
+#define MODBUS_ILLEGAL_DATA_VALUE 0x03
+#define MODBUS_GATEWAY_TARGET_FAILED 0x0B
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+typedef struct
+{
+    int sock; // -1 when free
+    uint8_t buffer[MODBUS_ADU_SIZE];
+    size_t len;
+    int64_t last_request; // us
+} modbus_client_t;
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static uint16_t modbus_label_registers(const linky_value_t *label);
+static bool modbus_label_in_map(const linky_value_t *label);
+static uint16_t modbus_map_size();
+static void modbus_put_u16(uint8_t *buffer, uint16_t value);
+static void modbus_put_words(uint8_t *registers, uint16_t start, uint16_t count, uint16_t address, const uint8_t *words, uint16_t words_count);
+static void modbus_read_registers(uint8_t *registers, uint16_t start, uint16_t count);
+static size_t modbus_exception(uint8_t *pdu, uint8_t function, uint8_t code);
+static size_t modbus_handle_pdu(const uint8_t *request, size_t len, uint8_t *response);
+static bool modbus_handle_client(modbus_client_t *client);
+static void modbus_close_client(modbus_client_t *client);
+static void modbus_server_task(void *pvParameters);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+static SemaphoreHandle_t modbus_mutex = NULL;
+static linky_data_t modbus_sample; // the last sample, the registers are read from this copy
+static uint16_t modbus_sample_mode = NONE;
+static uint32_t modbus_sequence = 0;
+static int modbus_server_sock = -1;
+static modbus_client_t modbus_clients[MODBUS_MAX_CLIENTS];
+static uint8_t modbus_response[MODBUS_ADU_SIZE];
+static TaskHandle_t modbus_server_task_handle = NULL;
+static volatile bool modbus_server_running = false;
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+/**
+ * @brief Number of registers of a label, see modbus.h
+ */
+static uint16_t modbus_label_registers(const linky_value_t *label)
+{
+    switch (label->type)
+    {
+    case UINT8:
+    case UINT16:
+        return 1;
+    case UINT32:
+        return 2;
+    case UINT64:
+    case UINT32_TIME:
+        return 4;
+    case STRING:
+        return (label->size + 1) / 2;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief The map has the labels stored in linky_data, not the settings of the table (refresh rate, TIC mode...)
+ */
+static bool modbus_label_in_map(const linky_value_t *label)
+{
+    return (char *)label->data >= (char *)&linky_data && (char *)label->data < (char *)&linky_data + sizeof(linky_data) &&
+           modbus_label_registers(label) > 0;
+}
+
+static uint16_t modbus_map_size()
+{
+    uint16_t count = 0;
+    for (uint32_t i = 0; i < linky_label_list_size; i++)
+    {
+        if (modbus_label_in_map(&linky_label_list[i]))
+        {
+            count += modbus_label_registers(&linky_label_list[i]);
+        }
+    }
+    return count;
+}
+
+static void modbus_put_u16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = value >> 8;
+    buffer[1] = value & 0xFF;
+}
+
+/**
+ * @brief Copy the big endian words of a value at address to the part of the request [start, start + count[
+ */
+static void modbus_put_words(uint8_t *registers, uint16_t start, uint16_t count, uint16_t address, const uint8_t *words, uint16_t words_count)
+{
+    for (uint16_t i = 0; i < words_count; i++)
+    {
+        uint32_t reg = (uint32_t)address + i;
+        if (reg >= start && reg < (uint32_t)start + count)
+        {
+            memcpy(registers + (reg - start) * 2, words + i * 2, 2);
+        }
+    }
+}
+
+/**
+ * @brief Read count registers from start in modbus_sample, under modbus_mutex
+ *
+ * @param registers the destination, count * 2 bytes
+ */
+static void modbus_read_registers(uint8_t *registers, uint16_t start, uint16_t count)
+{
+    uint8_t words[MODBUS_MAX_REGISTERS * 2]; // the longest label is shorter than a request
+    memset(registers, 0, count * 2);
+
+    memset(words, 0, 16);
+    modbus_put_u16(words, MODBUS_MAP_VERSION);
+    modbus_put_u16(words + 2, modbus_sample_mode);
+    modbus_put_u16(words + 4, (uint32_t)modbus_sample.timestamp >> 16);
+    modbus_put_u16(words + 6, (uint32_t)modbus_sample.timestamp & 0xFFFF);
+    modbus_put_u16(words + 8, modbus_sequence >> 16);
+    modbus_put_u16(words + 10, modbus_sequence & 0xFFFF);
+    modbus_put_u16(words + 12, MODBUS_LABEL_START);
+    modbus_put_u16(words + 14, modbus_map_size());
+    modbus_put_words(registers, start, count, 0, words, 8);
+
+    uint16_t address = MODBUS_LABEL_START;
+    for (uint32_t i = 0; i < linky_label_list_size && address < (uint32_t)start + count; i++)
+    {
+        const linky_value_t *label = &linky_label_list[i];
+        if (!modbus_label_in_map(label))
+        {
+            continue;
+        }
+        uint16_t size = modbus_label_registers(label);
+        if (address + size <= start)
+        {
+            address += size;
+            continue;
+        }
+        uint32_t delta_in_data = (char *)label->data - (char *)&linky_data;
+        void *value = (char *)&modbus_sample + delta_in_data;
+        uint64_t number = 0;
+        switch (label->type)
+        {
+        case UINT8:
+            number = *(uint8_t *)value;
+            break;
+        case UINT16:
+            number = *(uint16_t *)value;
+            break;
+        case UINT32:
+            number = *(uint32_t *)value;
+            break;
+        case UINT64:
+            number = *(uint64_t *)value;
+            break;
+        case UINT32_TIME:
+            number = ((uint64_t)((time_label_t *)value)->value << 32) | (uint32_t)((time_label_t *)value)->time;
+            break;
+        default:
+            break;
+        }
+        if (label->type == STRING)
+        {
+            memset(words, 0, size * 2);
+            memcpy(words, value, strnlen((char *)value, label->size));
+        }
+        else
+        {
+            for (uint16_t j = 0; j < size; j++)
+            {
+                modbus_put_u16(words + j * 2, number >> (16 * (size - 1 - j)));
+            }
+        }
+        modbus_put_words(registers, start, count, address, words, size);
+        address += size;
+    }
+}
+
+/**
+ * @return the length of the exception PDU
+ */
+static size_t modbus_exception(uint8_t *pdu, uint8_t function, uint8_t code)
+{
+    pdu[0] = function | 0x80;
+    pdu[1] = code;
+    return 2;
+}
+
+/**
+ * @brief Answer a request PDU
+ *
+ * @return the length of the response PDU
+ */
+static size_t modbus_handle_pdu(const uint8_t *request, size_t len, uint8_t *response)
+{
+    uint8_t function = request[0];
+    if (function != MODBUS_READ_HOLDING_REGISTERS && function != MODBUS_READ_INPUT_REGISTERS)
+    {
+        return modbus_exception(response, function, MODBUS_ILLEGAL_FUNCTION);
+    }
+    if (len != 5)
+    {
+        return modbus_exception(response, function, MODBUS_ILLEGAL_DATA_VALUE);
+    }
+    uint16_t start = (request[1] << 8) | request[2];
+    uint16_t count = (request[3] << 8) | request[4];
+    if (count == 0 || count > MODBUS_MAX_REGISTERS)
+    {
+        return modbus_exception(response, function, MODBUS_ILLEGAL_DATA_VALUE);
+    }
+    if ((uint32_t)start + count > MODBUS_LABEL_START + modbus_map_size())
+    {
+        return modbus_exception(response, function, MODBUS_ILLEGAL_DATA_ADDRESS);
+    }
+    response[0] = function;
+    response[1] = count * 2;
+    xSemaphoreTake(modbus_mutex, portMAX_DELAY);
+    modbus_read_registers(response + 2, start, count);
+    xSemaphoreGive(modbus_mutex);
+    return 2 + count * 2;
+}
+
+/**
+ * @brief Read what the client sent and answer the complete requests
+ *
+ * @return false if the connection must be closed
+ */
+static bool modbus_handle_client(modbus_client_t *client)
+{
+    int len = recv(client->sock, client->buffer + client->len, sizeof(client->buffer) - client->len, 0);
+    if (len <= 0)
+    {
+        return false;
+    }
+    client->len += len;
+    client->last_request = esp_timer_get_time();
+    while (client->len >= MODBUS_MBAP_SIZE)
+    {
+        uint16_t protocol = (client->buffer[2] << 8) | client->buffer[3];
+        uint16_t length = (client->buffer[4] << 8) | client->buffer[5]; // unit id + PDU
+        if (protocol != 0 || length < 2 || length > MODBUS_ADU_SIZE - 6)
+        {
+            ESP_LOGW(TAG, "Invalid MBAP header: protocol %d, length %d", protocol, length);
+            return false;
+        }
+        size_t adu_len = 6 + length;
+        if (client->len < adu_len)
+        {
+            break; // wait for the rest of the request
+        }
+        uint8_t unit = client->buffer[6];
+        uint8_t *pdu = modbus_response + MODBUS_MBAP_SIZE;
+        size_t pdu_len;
+        if (unit != config_values.modbus.unit_id && unit != MODBUS_UNIT_ANY)
+        {
+            pdu_len = modbus_exception(pdu, client->buffer[MODBUS_MBAP_SIZE], MODBUS_GATEWAY_TARGET_FAILED);
+        }
+        else
+        {
+            pdu_len = modbus_handle_pdu(client->buffer + MODBUS_MBAP_SIZE, adu_len - MODBUS_MBAP_SIZE, pdu);
+        }
+        memcpy(modbus_response, client->buffer, 4); // transaction id, protocol id
+        modbus_put_u16(modbus_response + 4, pdu_len + 1);
+        modbus_response[6] = unit;
+        if (send(client->sock, modbus_response, MODBUS_MBAP_SIZE + pdu_len, 0) < 0)
+        {
+            return false;
+        }
+        client->len -= adu_len;
+        memmove(client->buffer, client->buffer + adu_len, client->len);
+    }
+    return true;
+}
+
+static void modbus_close_client(modbus_client_t *client)
+{
+    close(client->sock);
+    client->sock = -1;
+    client->len = 0;
+}
+
+static void modbus_server_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "Server started on port %d, %d registers", config_values.modbus.port, MODBUS_LABEL_START + modbus_map_size());
+    while (modbus_server_running)
+    {
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(modbus_server_sock, &read_set);
+        int max_sock = modbus_server_sock;
+        for (uint8_t i = 0; i < MODBUS_MAX_CLIENTS; i++)
+        {
+            if (modbus_clients[i].sock >= 0)
+            {
+                FD_SET(modbus_clients[i].sock, &read_set);
+                max_sock = modbus_clients[i].sock > max_sock ? modbus_clients[i].sock : max_sock;
+            }
+        }
+        struct timeval timeout = {.tv_sec = MODBUS_SERVER_TIMEOUT};
+        int ready = select(max_sock + 1, &read_set, NULL, NULL, &timeout);
+        if (ready < 0)
+        {
+            ESP_LOGW(TAG, "select failed: errno %d", errno);
+            vTaskDelay(MODBUS_SERVER_TIMEOUT * 1000 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        if (FD_ISSET(modbus_server_sock, &read_set))
+        {
+            struct sockaddr_in source;
+            socklen_t source_len = sizeof(source);
+            int sock = accept(modbus_server_sock, (struct sockaddr *)&source, &source_len);
+            modbus_client_t *client = NULL;
+            for (uint8_t i = 0; i < MODBUS_MAX_CLIENTS && client == NULL && sock >= 0; i++)
+            {
+                if (modbus_clients[i].sock < 0)
+                {
+                    client = &modbus_clients[i];
+                }
+            }
+            if (client != NULL)
+            {
+                ESP_LOGI(TAG, "Client %s:%d connected", inet_ntoa(source.sin_addr), ntohs(source.sin_port));
+                int nodelay = 1; // one small response per request
+                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+                client->sock = sock;
+                client->len = 0;
+                client->last_request = esp_timer_get_time();
+            }
+            else if (sock >= 0)
+            {
+                ESP_LOGW(TAG, "Too many clients: %s refused", inet_ntoa(source.sin_addr));
+                close(sock);
+            }
+        }
+
+        for (uint8_t i = 0; i < MODBUS_MAX_CLIENTS; i++)
+        {
+            modbus_client_t *client = &modbus_clients[i];
+            if (client->sock < 0)
+            {
+                continue;
+            }
+            if (FD_ISSET(client->sock, &read_set) && !modbus_handle_client(client))
+            {
+                ESP_LOGI(TAG, "Client disconnected");
+                modbus_close_client(client);
+            }
+            else if (esp_timer_get_time() - client->last_request > MODBUS_CLIENT_TIMEOUT * 1000000LL)
+            {
+                ESP_LOGI(TAG, "Client idle: disconnected");
+                modbus_close_client(client);
+            }
+        }
+    }
+    for (uint8_t i = 0; i < MODBUS_MAX_CLIENTS; i++)
+    {
+        if (modbus_clients[i].sock >= 0)
+        {
+            modbus_close_client(&modbus_clients[i]);
+        }
+    }
+    close(modbus_server_sock);
+    modbus_server_sock = -1;
+    ESP_LOGI(TAG, "Server stopped");
+    modbus_server_task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
+esp_err_t modbus_server_start()
+{
+    if (modbus_server_task_handle != NULL)
+    {
+        return ESP_OK;
+    }
+    if (modbus_mutex == NULL)
+    {
+        modbus_mutex = xSemaphoreCreateMutex();
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config_values.modbus.port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, MODBUS_MAX_CLIENTS) < 0)
+    {
+        ESP_LOGE(TAG, "Socket unable to bind / listen: errno %d", errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+    for (uint8_t i = 0; i < MODBUS_MAX_CLIENTS; i++)
+    {
+        modbus_clients[i].sock = -1;
+        modbus_clients[i].len = 0;
+    }
+    modbus_server_sock = sock;
+    modbus_server_running = true;
+    if (xTaskCreate(modbus_server_task, "modbus_server", 4 * 1024, NULL, PRIORITY_MODBUS, &modbus_server_task_handle) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Unable to create the server task");
+        modbus_server_running = false;
+        close(sock);
+        modbus_server_sock = -1;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void modbus_server_stop()
+{
+    if (modbus_server_task_handle == NULL)
+    {
+        return;
+    }
+    modbus_server_running = false;
+    while (modbus_server_task_handle != NULL)
+    {
+        vTaskDelay(100 / portTICK_PERIOD_MS); // the task exits within MODBUS_SERVER_TIMEOUT
+    }
+}
+
+void modbus_update(linky_data_t *data)
+{
+    if (modbus_mutex == NULL)
+    {
+        modbus_mutex = xSemaphoreCreateMutex();
+    }
+    xSemaphoreTake(modbus_mutex, portMAX_DELAY);
+    modbus_sample = *data;
+    modbus_sample_mode = linky_mode;
+    modbus_sequence++;
+    xSemaphoreGive(modbus_mutex);
+}
@@ -20,9 +20,12 @@
 #include "wifi.h"
 #include "gpio.h"
 #include "led.h"
-#include "cJSON.h"
+#include "json_writer.h"
 #include "esp_ota_ops.h"
 #include "mbedtls/md.h"
+#include "cbor.h"
+#include "exporter.h"
+#include "esp_transport_ssl.h"
 
 /*==============================================================================
  Local Define
@@ -33,8 +36,22 @@
 
 #define MQTT_ID "TICMeter"      // for the home assistant discovery
 #define MQTT_SEND_TIMEOUT 10000 // in ms
+#define MQTT_TLS_PORT 8883
 #define MANUFACTURER "GammaTroniques"
 #define MQTT_QOS 1
+
+#define MQTT_QUEUE_SIZE 100   // scheduled messages: one pending per label (90 in standard) + the in flight ones
+#define MQTT_MAX_IN_FLIGHT 8  // messages handed to the outbox and not yet acknowledged
+#define MQTT_CBOR_TOPIC "cbor"
+
+#define MQTT_AVAILABILITY_TOPIC "availability" // online / offline (LWT) / sleeping
+#define MQTT_STATUS_TOPIC "status"             // json: state and expected next publish
+#define MQTT_AVAILABLE "online"
+#define MQTT_NOT_AVAILABLE "offline"
+#define MQTT_SLEEPING "sleeping"
+#define MQTT_VALID_TIME 1700000000 // before the first NTP sync, dont publish a 1970 date
+#define MQTT_COMMAND_MAX_PAYLOAD 16
+#define MQTT_CBOR_MAX_SIZE 1536
 /*==============================================================================
  Local Macro
 ===============================================================================*/
@@ -56,12 +73,41 @@ typedef struct
     char name[20];
     char unique_id_base[20];
     char ha_identifier_topic[50]; // ADCO or ADSC home assistant topic
+    char availability_topic[120];
+    char status_topic[120];
     char ha_discovery_configured;
     char ha_discovery_configured_temp;
 } mqtt_topic_t;
 
 // #define MQTT_DEBUG
 
+typedef enum
+{
+    MQTT_SLOT_FREE,
+    MQTT_SLOT_PENDING,   // waiting in the scheduler
+    MQTT_SLOT_IN_FLIGHT, // in the esp-mqtt outbox, waiting for PUBACK
+} mqtt_slot_state_t;
+
+typedef struct mqtt_command_t mqtt_command_t;
+struct mqtt_command_t
+{
+    const char *suffix; // <topic>/<suffix>, the label of the HA entity
+    void *data;
+    int32_t min;
+    int32_t max;
+    esp_err_t (*validator)(const mqtt_command_t *command, const char *payload, int len, int32_t *value);
+    void (*handler)(const mqtt_command_t *command, int32_t value);
+};
+
+typedef struct
+{
+    mqtt_slot_state_t state;
+    mqtt_class_t class;
+    uint16_t index; // in linky_label_list, the value is read from mqtt_sample when it is sent
+    int msg_id;
+    uint32_t seq; // keep the insertion order inside a class
+} mqtt_queue_entry_t;
+
 #ifdef MQTT_DEBUG
 typedef struct
 {
@@ -75,16 +121,40 @@ typedef struct
  Local Function Declaration
 ===============================================================================*/
 static void log_error_if_nonzero(const char *message, int error_code);
-static void mqtt_create_sensor(char *json, char *config_topic, linky_value_t sensor);
+static void mqtt_create_sensor(char *json, size_t size, char *config_topic, linky_value_t sensor);
 void mqtt_setup_ha_discovery(bool with_delete);
 void mqtt_topic_comliance(char *topic, int size);
 void mqtt_disconnect_task(void *pvParameters);
+static mqtt_class_t mqtt_label_class(const linky_value_t *label);
+static uint8_t mqtt_queue_push(uint32_t index, mqtt_class_t class);
+static void mqtt_format_value(const exporter_value_t *value, char *str, size_t size);
+static uint8_t mqtt_prepare_cbor(linky_data_t *linkydata);
+static void mqtt_publish_availability(const char *state, bool blocking);
+static esp_err_t mqtt_validate_number(const mqtt_command_t *command, const char *payload, int len, int32_t *value);
+static void mqtt_handle_config_u16(const mqtt_command_t *command, int32_t value);
+static const mqtt_command_t *mqtt_find_command(const char *suffix);
+static const mqtt_command_t *mqtt_match_command(const char *topic, int len);
+static mqtt_queue_entry_t *mqtt_queue_pop();
+static void mqtt_queue_release(int msg_id, bool delivered);
+static void mqtt_queue_clear();
+static void mqtt_queue_print_stats();
+static esp_transport_handle_t mqtt_create_ssl_transport();
+static esp_err_t mqtt_exporter_init(void);
+static esp_err_t mqtt_exporter_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed);
 
 /*==============================================================================
 Public Variable
 ===============================================================================*/
 esp_mqtt_client_handle_t mqtt_client = NULL;
 
+static exporter_stats_t mqtt_exporter_stats = {0};
+const exporter_t mqtt_exporter = {
+    .name = "MQTT",
+    .init = mqtt_exporter_init,
+    .publish = mqtt_exporter_publish,
+    .stats = &mqtt_exporter_stats,
+};
+
 /*==============================================================================
  Local Variable
 ===============================================================================*/
@@ -97,6 +167,32 @@ static EventGroupHandle_t mqtt_event_group = NULL;
 static esp_mqtt_connect_return_code_t last_return_code = 0;
 static esp_mqtt_error_type_t last_error_type;
 
+static char *mqtt_cert = NULL; // pinned CA of mqtts, used by the transport until mqtt_deinit
+
+static mqtt_queue_entry_t mqtt_queue[MQTT_QUEUE_SIZE] = {0};
+static linky_data_t mqtt_sample; // the last prepared sample, the pending messages are formatted from it
+static SemaphoreHandle_t mqtt_queue_mutex = NULL;
+static uint32_t mqtt_queue_seq = 0;
+static uint8_t mqtt_in_flight = 0;
+static uint32_t mqtt_drop_count[MQTT_CLASS_COUNT] = {0};
+static uint32_t mqtt_coalesced_count = 0;
+
+// clang-format off
+static const mqtt_command_t mqtt_commands[] = {
+    // suffix           data                            min     max     validator               handler
+    {"set-refresh",     &config_values.refresh_rate,    30,     3600,   mqtt_validate_number,   mqtt_handle_config_u16},
+};
+// clang-format on
+static const uint8_t mqtt_commands_size = sizeof(mqtt_commands) / sizeof(mqtt_commands[0]);
+static char mqtt_command_topics[sizeof(mqtt_commands) / sizeof(mqtt_commands[0])][120] = {0}; // built once in mqtt_init
+
+static const char *const mqtt_class_str[] = {
+    [MQTT_CLASS_ALERT] = "alert",
+    [MQTT_CLASS_INDEX] = "index",
+    [MQTT_CLASS_REALTIME] = "realtime",
+    [MQTT_CLASS_DIAGNOSTIC] = "diagnostic",
+};
+
 #ifdef MQTT_DEBUG
 static mqtt_debug_t mqtt_messages[100];
 static int mqtt_messages_count = 0;
@@ -123,27 +219,18 @@ static void mqtt_remove_plus(char *topic)
     }
 }
 
-static void mqtt_create_sensor(char *json, char *config_topic, linky_value_t sensor)
+static void mqtt_create_sensor(char *json, size_t size, char *config_topic, linky_value_t sensor)
 {
     const esp_app_desc_t *app_desc = esp_app_get_description();
-    cJSON *jsonDevice = cJSON_CreateObject(); // Create the root object
-    cJSON_AddStringToObject(jsonDevice, "name", mqtt_topics.name);
-    cJSON_AddStringToObject(jsonDevice, "mdl", app_desc->project_name);
-    cJSON_AddStringToObject(jsonDevice, "mf", MANUFACTURER);
-    cJSON_AddStringToObject(jsonDevice, "sw", app_desc->version);
-    cJSON_AddStringToObject(jsonDevice, "sn", efuse_values.serial_number);
-    char hw_version[15];
-    snprintf(hw_version, sizeof(hw_version), "%d.%d.%d", efuse_values.hw_version[0], efuse_values.hw_version[1], efuse_values.hw_version[2]);
-    cJSON_AddStringToObject(jsonDevice, "hw", hw_version);
-    cJSON_AddStringToObject(jsonDevice, "ids", efuse_values.serial_number);
-
-    cJSON *sensorConfig = cJSON_CreateObject(); // Create the root object
-    cJSON_AddStringToObject(sensorConfig, "~", config_values.mqtt.topic);
-    cJSON_AddStringToObject(sensorConfig, "name", sensor.name);
+    json_writer_t writer;
+    json_init(&writer, json, size);
+    json_open_object(&writer);
+    json_add_key_text(&writer, "~", config_values.mqtt.topic);
+    json_add_key_text(&writer, "name", sensor.name);
     char uniq_id[50];
     snprintf(uniq_id, sizeof(uniq_id), "%s_%s", mqtt_topics.unique_id_base, sensor.label);
-    cJSON_AddStringToObject(sensorConfig, "uniq_id", uniq_id);
-    cJSON_AddStringToObject(sensorConfig, "obj_id", uniq_id);
+    json_add_key_text(&writer, "uniq_id", uniq_id);
+    json_add_key_text(&writer, "obj_id", uniq_id);
 
     char state_topic[100];
     snprintf(state_topic, sizeof(state_topic), "~/%s", sensor.label);
@@ -151,8 +238,8 @@ static void mqtt_create_sensor(char *json, char *config_topic, linky_value_t sen
     if (sensor.device_class == CLASS_BOOL)
     {
         type = BOOL;
-        cJSON_AddStringToObject(sensorConfig, "pl_on", "1");
-        cJSON_AddStringToObject(sensorConfig, "pl_off", "0");
+        json_add_key_text(&writer, "pl_on", "1");
+        json_add_key_text(&writer, "pl_off", "0");
     }
     snprintf(config_topic, sizeof(state_topic), "homeassistant/%s/%s/%s/config", ha_sensors_str[type], mqtt_topics.name, sensor.label);
     if (strcmp(sensor.label, "ADCO") == 0 || strcmp(sensor.label, "ADSC") == 0)
@@ -160,49 +247,55 @@ static void mqtt_create_sensor(char *json, char *config_topic, linky_value_t sen
         strncpy(mqtt_topics.ha_identifier_topic, config_topic, sizeof(mqtt_topics.ha_identifier_topic));
     }
 
-    if (sensor.type == HA_NUMBER)
+    const mqtt_command_t *command = mqtt_find_command(sensor.label);
+    if (sensor.type == HA_NUMBER && command != NULL)
     {
-        cJSON_AddStringToObject(sensorConfig, "cmd_t", state_topic);
-        cJSON_AddStringToObject(sensorConfig, "mode", "box");
-        cJSON_AddNumberToObject(sensorConfig, "min", 30);
-        cJSON_AddNumberToObject(sensorConfig, "max", 3600);
-        cJSON_AddStringToObject(sensorConfig, "ret", "true");
-        cJSON_AddNumberToObject(sensorConfig, "qos", 2);
+        snprintf(state_topic, sizeof(state_topic), "~/%s", command->suffix);
+        json_add_key_text(&writer, "cmd_t", state_topic);
+        json_add_key_text(&writer, "mode", "box");
+        json_add_key_int(&writer, "min", command->min);
+        json_add_key_int(&writer, "max", command->max);
+        json_add_key_text(&writer, "ret", "true");
+        json_add_key_int(&writer, "qos", 2);
     }
     else
     {
         mqtt_remove_plus(state_topic);
-        cJSON_AddStringToObject(sensorConfig, "stat_t", state_topic);
+        json_add_key_text(&writer, "stat_t", state_topic);
     }
     if (sensor.device_class == TIMESTAMP)
     {
-        cJSON_AddStringToObject(sensorConfig, "val_tpl", "{{ as_datetime(value) }}");
+        json_add_key_text(&writer, "val_tpl", "{{ as_datetime(value) }}");
     }
 
     if (HADeviceClassStr[sensor.device_class] && strlen(HADeviceClassStr[sensor.device_class]) > 0)
     {
-        cJSON_AddStringToObject(sensorConfig, "dev_cla", HADeviceClassStr[sensor.device_class]);
+        json_add_key_text(&writer, "dev_cla", HADeviceClassStr[sensor.device_class]);
     }
     if (strlen(sensor.icon) > 0)
     {
-        cJSON_AddStringToObject(sensorConfig, "icon", sensor.icon);
+        json_add_key_text(&writer, "icon", sensor.icon);
     }
 
     if (sensor.device_class != NONE_CLASS && sensor.device_class != TIMESTAMP && sensor.device_class != CLASS_BOOL)
     {
-        cJSON_AddStringToObject(sensorConfig, "unit_of_meas", HAUnitsStr[sensor.device_class]);
+        json_add_key_text(&writer, "unit_of_meas", HAUnitsStr[sensor.device_class]);
     }
 
     if (sensor.realTime == REAL_TIME)
     {
-        cJSON_AddNumberToObject(sensorConfig, "exp_aft", config_values.refresh_rate * 4);
+        json_add_key_int(&writer, "exp_aft", config_values.refresh_rate * 4);
     }
 
+    // "sleeping" between two cycles is still available, only the LWT is not
+    json_add_key_text(&writer, "avty_t", "~/" MQTT_AVAILABILITY_TOPIC);
+    json_add_key_text(&writer, "avty_tpl", "{{ '" MQTT_NOT_AVAILABLE "' if value == '" MQTT_NOT_AVAILABLE "' else '" MQTT_AVAILABLE "' }}");
+
     switch (sensor.device_class)
     {
     case ENERGY:
     case ENERGY_Q:
-        cJSON_AddStringToObject(sensorConfig, "stat_cla", "total_increasing");
+        json_add_key_text(&writer, "stat_cla", "total_increasing");
         break;
 
     case POWER_kVA:
@@ -212,17 +305,30 @@ static void mqtt_create_sensor(char *json, char *config_topic, linky_value_t sen
     case POWER_kW:
     case CURRENT:
     case TENSION:
-        cJSON_AddStringToObject(sensorConfig, "stat_cla", "measurement");
+        json_add_key_text(&writer, "stat_cla", "measurement");
         break;
     default:
         break;
     }
 
-    cJSON_AddItemToObject(sensorConfig, "dev", jsonDevice);
-    char *jsonString = cJSON_PrintUnformatted(sensorConfig);
-    strncpy(json, jsonString, 1024);
-    free(jsonString);
-    cJSON_Delete(sensorConfig);
+    json_add_key(&writer, "dev");
+    json_open_object(&writer);
+    json_add_key_text(&writer, "name", mqtt_topics.name);
+    json_add_key_text(&writer, "mdl", app_desc->project_name);
+    json_add_key_text(&writer, "mf", MANUFACTURER);
+    json_add_key_text(&writer, "sw", app_desc->version);
+    json_add_key_text(&writer, "sn", efuse_values.serial_number);
+    char hw_version[15];
+    snprintf(hw_version, sizeof(hw_version), "%d.%d.%d", efuse_values.hw_version[0], efuse_values.hw_version[1], efuse_values.hw_version[2]);
+    json_add_key_text(&writer, "hw", hw_version);
+    json_add_key_text(&writer, "ids", efuse_values.serial_number);
+    json_close_object(&writer);
+    json_close_object(&writer);
+    if (json_end(&writer) == 0)
+    {
+        ESP_LOGE(TAG, "Discovery config of %s too big for %d bytes", sensor.label, size);
+        json[0] = '\0';
+    }
 }
 
 uint8_t mqtt_prepare_publish(linky_data_t *linkydata)
@@ -243,148 +349,372 @@ uint8_t mqtt_prepare_publish(linky_data_t *linkydata)
         mqtt_setup_ha_discovery(true);
     }
 
-    char topic[150];
-    char strValue[100];
+    if (config_values.mode == MODE_MQTT && config_values.encoding == ENCODING_CBOR)
+    {
+        return mqtt_prepare_cbor(linkydata);
+    }
 
     ESP_LOGI(TAG, "Pre-send Outbox size: %d", esp_mqtt_client_get_outbox_size(mqtt_client));
 
-    for (int i = 0; i < linky_label_list_size; i++)
+    if (mqtt_queue_mutex == NULL)
+    {
+        mqtt_queue_mutex = xSemaphoreCreateMutex();
+    }
+    xSemaphoreTake(mqtt_queue_mutex, portMAX_DELAY);
+    mqtt_sample = *linkydata;
+    xSemaphoreGive(mqtt_queue_mutex);
+
+    exporter_iter_t iter;
+    exporter_value_t value;
+    exporter_iter_init(&iter, &mqtt_sample, EXPORTER_DEVICE_VALUES);
+    while (exporter_iter_next(&iter, &value))
     {
-        if (linky_label_list[i].mode != linky_mode && linky_label_list[i].mode != ANY)
+        if (value.label->type == UINT32_TIME && value.number == 0)
         {
             continue;
         }
-
-        if (linky_label_list[i].data == NULL)
+        mqtt_sensors_count++;
+        if (!mqtt_queue_push(value.index, mqtt_label_class(value.label)))
         {
-            continue;
+            has_error = 1;
         }
+    }
 
-        snprintf(topic, sizeof(topic), "%s/%s", config_values.mqtt.topic, (char *)linky_label_list[i].label);
-        switch (linky_label_list[i].type)
-        {
-        case UINT8:
+    if (has_error)
+    {
+        return 0;
+    }
+    ESP_LOGI(TAG, "All data are scheduled");
+    return 1;
+}
+
+/**
+ * @brief Publish the whole frame as a single CBOR payload on <topic>/cbor, see cbor.h for the schema
+ */
+static uint8_t mqtt_prepare_cbor(linky_data_t *linkydata)
+{
+    char topic[150];
+    snprintf(topic, sizeof(topic), "%s/" MQTT_CBOR_TOPIC, config_values.mqtt.topic);
+    mqtt_topic_comliance(topic, sizeof(topic));
+
+    uint8_t *buffer = malloc(MQTT_CBOR_MAX_SIZE);
+    if (buffer == NULL)
+    {
+        ESP_LOGE(TAG, "Cant allocate CBOR buffer");
+        return 0;
+    }
+    size_t len = cbor_encode_linky(linkydata, 1, NULL, buffer, MQTT_CBOR_MAX_SIZE);
+    int ret = -1;
+    if (len > 0)
+    {
+        // not coalesced by the scheduler: a single message per frame
+        ret = esp_mqtt_client_enqueue(mqtt_client, topic, (const char *)buffer, len, MQTT_QOS, 0, true);
+    }
+    free(buffer);
+    if (ret < 0)
+    {
+        ESP_LOGE(TAG, "Error while enqueue CBOR payload: %d", ret);
+        return 0;
+    }
+    mqtt_sensors_count = 1;
+    ESP_LOGI(TAG, "Prepared \"%s\" = %d bytes", topic, len);
+    return 1;
+}
+
+static mqtt_class_t mqtt_label_class(const linky_value_t *label)
+{
+    if (strncmp(label->label, "ADPS", 4) == 0 || strncmp(label->label, "ADIR", 4) == 0 || label->device_class == CLASS_BOOL)
+    {
+        return MQTT_CLASS_ALERT;
+    }
+    if (label->device_class == ENERGY || label->device_class == ENERGY_Q)
+    {
+        return MQTT_CLASS_INDEX;
+    }
+    if (label->realTime == REAL_TIME)
+    {
+        return MQTT_CLASS_REALTIME;
+    }
+    return MQTT_CLASS_DIAGNOSTIC;
+}
+
+/**
+ * @brief The payload of a label: the TIC mode and the grid as text, the TIME_M in seconds
+ */
+static void mqtt_format_value(const exporter_value_t *value, char *str, size_t size)
+{
+    const linky_value_t *label = value->label;
+    if (label->data == &linky_mode)
+    {
+        switch (linky_mode)
         {
-            uint8_t *value = (uint8_t *)linky_label_list[i].data;
-            if (*value == UINT8_MAX)
-                continue;
-            snprintf(strValue, sizeof(strValue), "%d", *value);
+        case MODE_HIST:
+            snprintf(str, size, "Historique");
+            break;
+        case MODE_STD:
+            snprintf(str, size, "Standard");
+            break;
+        default:
+            snprintf(str, size, "Inconnu");
             break;
         }
-        case UINT16:
+    }
+    else if (label->data == &linky_three_phase)
+    {
+        if (linky_three_phase == 1)
         {
-            uint16_t *value = (uint16_t *)linky_label_list[i].data;
-            if (*value == UINT16_MAX)
-                continue;
-            snprintf(strValue, sizeof(strValue), "%d", *value);
-            break;
+            snprintf(str, size, "Triphasé");
         }
-        case UINT32:
+        else
         {
-            uint32_t *value = (uint32_t *)linky_label_list[i].data;
-            if (*value == UINT32_MAX)
-                continue;
-            if (linky_label_list[i].device_class == ENERGY && *(uint32_t *)(linky_label_list[i].data) == 0)
-                continue;
-            snprintf(strValue, sizeof(strValue), "%ld", *value);
-            break;
+            snprintf(str, size, "Monophasé");
         }
-        case UINT64:
+    }
+    else if (label->device_class == TIME_M)
+    {
+        snprintf(str, size, "%llu", value->number / 1000);
+    }
+    else if (value->text != NULL)
+    {
+        snprintf(str, size, "%s", value->text);
+    }
+    else
+    {
+        snprintf(str, size, "%llu", value->number);
+    }
+}
+
+/**
+ * @brief Add a label to the scheduler, its value is read from mqtt_sample when it is sent.
+ * A pending message of the same label is kept: it will send the new value. When the queue is full,
+ * the oldest pending message of the lowest priority class is dropped if it is less important.
+ *
+ * @return 1 if nothing was dropped, 0 otherwise
+ */
+static uint8_t mqtt_queue_push(uint32_t index, mqtt_class_t class)
+{
+    uint8_t ret = 1;
+    if (mqtt_queue_mutex == NULL)
+    {
+        mqtt_queue_mutex = xSemaphoreCreateMutex();
+    }
+    xSemaphoreTake(mqtt_queue_mutex, portMAX_DELAY);
+
+    mqtt_queue_entry_t *slot = NULL;
+    mqtt_queue_entry_t *victim = NULL;
+    for (int i = 0; i < MQTT_QUEUE_SIZE; i++)
+    {
+        mqtt_queue_entry_t *entry = &mqtt_queue[i];
+        if (entry->state == MQTT_SLOT_FREE)
         {
-            uint64_t *value = (uint64_t *)linky_label_list[i].data;
-            if (*value == UINT64_MAX)
-                continue;
-            if (linky_label_list[i].device_class == ENERGY && *(uint64_t *)(linky_label_list[i].data) == 0)
-                continue;
-            snprintf(strValue, sizeof(strValue), "%lld", *value);
-            break;
+            if (slot == NULL)
+            {
+                slot = entry;
+            }
+            continue;
         }
-        case STRING:
+        if (entry->state != MQTT_SLOT_PENDING)
         {
-            char *value = (char *)linky_label_list[i].data;
-            if (strlen(value) == 0)
-                continue;
-            snprintf(strValue, sizeof(strValue), "%s", value);
-            break;
+            continue;
         }
-        case UINT32_TIME:
+        if (entry->index == index)
         {
-            time_label_t *timeLabel = (time_label_t *)linky_label_list[i].data;
-            if (timeLabel->value == UINT32_MAX || timeLabel->value == 0)
-                continue;
-            snprintf(strValue, sizeof(strValue), "%lu", timeLabel->value);
-            break;
+            // superseded value: keep the slot and its place in the queue
+            entry->class = class;
+            mqtt_coalesced_count++;
+            goto exit;
         }
-        case HA_NUMBER:
+        if (victim == NULL || entry->class > victim->class || (entry->class == victim->class && entry->seq < victim->seq))
+        {
+            victim = entry;
+        }
+    }
+
+    if (slot == NULL)
+    {
+        if (victim == NULL || victim->class <= class)
+        {
+            ESP_LOGW(TAG, "Scheduler full, drop %s (%s)", linky_label_list[index].label, mqtt_class_str[class]);
+            mqtt_drop_count[class]++;
+            ret = 0;
+            goto exit;
+        }
+        ESP_LOGW(TAG, "Scheduler full, drop %s (%s)", linky_label_list[victim->index].label, mqtt_class_str[victim->class]);
+        mqtt_drop_count[victim->class]++;
+        ret = 0;
+        slot = victim;
+    }
+
+    slot->state = MQTT_SLOT_PENDING;
+    slot->class = class;
+    slot->msg_id = -1;
+    slot->index = index;
+    slot->seq = mqtt_queue_seq++;
+
+exit:
+    xSemaphoreGive(mqtt_queue_mutex);
+    return ret;
+}
+
+/**
+ * @brief Get the next pending message: highest priority class first, then insertion order
+ * Must be called with the queue mutex taken
+ */
+static mqtt_queue_entry_t *mqtt_queue_pop()
+{
+    mqtt_queue_entry_t *next = NULL;
+    for (int i = 0; i < MQTT_QUEUE_SIZE; i++)
+    {
+        mqtt_queue_entry_t *entry = &mqtt_queue[i];
+        if (entry->state != MQTT_SLOT_PENDING)
+        {
             continue;
+        }
+        if (next == NULL || entry->class < next->class || (entry->class == next->class && entry->seq < next->seq))
+        {
+            next = entry;
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief Free the slot of an acknowledged (or expired) message
+ */
+static void mqtt_queue_release(int msg_id, bool delivered)
+{
+    if (mqtt_queue_mutex == NULL)
+    {
+        return;
+    }
+    xSemaphoreTake(mqtt_queue_mutex, portMAX_DELAY);
+    for (int i = 0; i < MQTT_QUEUE_SIZE; i++)
+    {
+        mqtt_queue_entry_t *entry = &mqtt_queue[i];
+        if (entry->state == MQTT_SLOT_IN_FLIGHT && entry->msg_id == msg_id)
+        {
+            if (!delivered)
+            {
+                ESP_LOGW(TAG, "Expired %s (%s)", linky_label_list[entry->index].label, mqtt_class_str[entry->class]);
+                mqtt_drop_count[entry->class]++;
+            }
+            entry->state = MQTT_SLOT_FREE;
+            mqtt_in_flight--;
             break;
+        }
+    }
+    xSemaphoreGive(mqtt_queue_mutex);
+}
 
-        default:
-            ESP_LOGE(TAG, "Unknown type: %s %d", linky_label_list[i].label, linky_label_list[i].type);
+/**
+ * @brief Drop every scheduled message, used when the client is destroyed with its outbox
+ */
+static void mqtt_queue_clear()
+{
+    if (mqtt_queue_mutex == NULL)
+    {
+        return;
+    }
+    xSemaphoreTake(mqtt_queue_mutex, portMAX_DELAY);
+    for (int i = 0; i < MQTT_QUEUE_SIZE; i++)
+    {
+        if (mqtt_queue[i].state != MQTT_SLOT_FREE)
+        {
+            mqtt_drop_count[mqtt_queue[i].class]++;
+            mqtt_queue[i].state = MQTT_SLOT_FREE;
+        }
+    }
+    mqtt_in_flight = 0;
+    xSemaphoreGive(mqtt_queue_mutex);
+}
+
+static void mqtt_queue_print_stats()
+{
+    ESP_LOGI(TAG, "Scheduler: coalesced %ld, dropped alert %ld, index %ld, realtime %ld, diagnostic %ld",
+             mqtt_coalesced_count,
+             mqtt_drop_count[MQTT_CLASS_ALERT],
+             mqtt_drop_count[MQTT_CLASS_INDEX],
+             mqtt_drop_count[MQTT_CLASS_REALTIME],
+             mqtt_drop_count[MQTT_CLASS_DIAGNOSTIC]);
+}
+
+esp_err_t mqtt_flush(uint32_t timeout)
+{
+    if (mqtt_queue_mutex == NULL)
+    {
+        mqtt_queue_mutex = xSemaphoreCreateMutex();
+    }
+
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    time_t mqtt_send_timeout = MILLIS + timeout;
+    while (mqtt_send_timeout > MILLIS)
+    {
+        if (mqtt_state == MQTT_FAILED || mqtt_state == MQTT_DISCONNETED || mqtt_client == NULL)
+        {
+            ESP_LOGW(TAG, "MQTT Exit: %d", mqtt_state);
+            err = ESP_FAIL;
             break;
         }
 
-        if (linky_label_list[i].data == &linky_mode)
+        if (mqtt_state != MQTT_CONNECTED)
+        {
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        bool done;
+        xSemaphoreTake(mqtt_queue_mutex, portMAX_DELAY);
+        while (mqtt_in_flight < MQTT_MAX_IN_FLIGHT)
         {
-            switch (linky_mode)
+            mqtt_queue_entry_t *entry = mqtt_queue_pop();
+            if (entry == NULL)
             {
-            case MODE_HIST:
-                snprintf(strValue, sizeof(strValue), "Historique");
-                break;
-            case MODE_STD:
-                snprintf(strValue, sizeof(strValue), "Standard");
-                break;
-            default:
-                snprintf(strValue, sizeof(strValue), "Inconnu");
                 break;
             }
-        }
-        else if (linky_label_list[i].data == &linky_three_phase)
-        {
-            if (linky_three_phase == 1)
+            exporter_value_t value;
+            if (!exporter_value(&mqtt_sample, entry->index, EXPORTER_DEVICE_VALUES, &value) || !value.present ||
+                (value.label->type == UINT32_TIME && value.number == 0))
             {
-                snprintf(strValue, sizeof(strValue), "Triphasé");
+                // not in the last sample anymore
+                entry->state = MQTT_SLOT_FREE;
+                continue;
             }
-            else
+            char topic[150];
+            char str_value[100];
+            snprintf(topic, sizeof(topic), "%s/%s", config_values.mqtt.topic, value.label->label);
+            mqtt_topic_comliance(topic, sizeof(topic));
+            mqtt_format_value(&value, str_value, sizeof(str_value));
+            int ret = esp_mqtt_client_enqueue(mqtt_client, topic, str_value, 0, MQTT_QOS, 0, true);
+            if (ret < 0)
             {
-                snprintf(strValue, sizeof(strValue), "Monophasé");
+                // -2: outbox full, retry at the next loop
+                ESP_LOGD(TAG, "Enqueue %s failed: %d", topic, ret);
+                break;
             }
-        }
-        else if (linky_label_list[i].device_class == TIME_M)
-        {
-            snprintf(strValue, sizeof(strValue), "%lu", *((uint32_t *)linky_label_list[i].data) / 1000);
-        }
-
-        mqtt_sensors_count++;
-        // esp_mqtt_client_publish(mqtt_client, topic, strValue, 0, 2, 0);
-        mqtt_topic_comliance(topic, sizeof(topic));
-        int ret = esp_mqtt_client_enqueue(mqtt_client, topic, strValue, 0, MQTT_QOS, 0, true);
-        ESP_LOGI(TAG, "Prepared \"%s\" = \"%s\"", topic, strValue);
-
+            ESP_LOGD(TAG, "Enqueued \"%s\" = \"%s\"", topic, str_value);
 #ifdef MQTT_DEBUG
-        mqtt_messages[mqtt_messages_count++].id = ret;
-        strncpy(mqtt_messages[mqtt_messages_count - 1].name, topic, sizeof(topic));
-        strncpy(mqtt_messages[mqtt_messages_count - 1].value, strValue, sizeof(strValue));
+            mqtt_messages[mqtt_messages_count].id = ret;
+            strncpy(mqtt_messages[mqtt_messages_count].name, topic, sizeof(mqtt_messages[0].name));
+            strncpy(mqtt_messages[mqtt_messages_count].value, str_value, sizeof(mqtt_messages[0].value));
+            mqtt_messages_count = (mqtt_messages_count + 1) % (sizeof(mqtt_messages) / sizeof(mqtt_messages[0]));
 #endif
-        if (ret == -1)
-        {
-            ESP_LOGE(TAG, "Error while enqueue: %d", ret);
-            has_error = 1;
+            entry->msg_id = ret;
+            entry->state = MQTT_SLOT_IN_FLIGHT;
+            mqtt_in_flight++;
         }
-        else if (ret == -2)
+        done = mqtt_in_flight == 0 && mqtt_queue_pop() == NULL;
+        xSemaphoreGive(mqtt_queue_mutex);
+
+        if (done && esp_mqtt_client_get_outbox_size(mqtt_client) == 0)
         {
-            ESP_LOGE(TAG, "Outbox full: %d", ret);
-            has_error = 1;
+            err = ESP_OK;
+            break;
         }
-        ESP_LOGD(TAG, "Outbox size filling: %d %s", esp_mqtt_client_get_outbox_size(mqtt_client), topic);
-    }
-
-    if (has_error)
-    {
-        return 0;
+        vTaskDelay(100 / portTICK_PERIOD_MS);
+        ESP_LOGD(TAG, "In flight: %d, outbox size: %d", mqtt_in_flight, esp_mqtt_client_get_outbox_size(mqtt_client));
     }
-    ESP_LOGI(TAG, "All data are in the outbox");
-    return 1;
+    mqtt_queue_print_stats();
+    return err;
 }
 
 void mqtt_setup_ha_discovery(bool with_delete)
@@ -476,7 +806,7 @@ void mqtt_setup_ha_discovery(bool with_delete)
             ESP_LOGD(TAG, "Dont delete %s: same mode", linky_label_list[i].label);
         }
 
-        mqtt_create_sensor(mqtt_buffer, config_topic, linky_label_list[i]);
+        mqtt_create_sensor(mqtt_buffer, sizeof(mqtt_buffer), config_topic, linky_label_list[i]);
         mqtt_topic_comliance(config_topic, sizeof(config_topic));
 
         if (delete)
@@ -523,16 +853,12 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
         {
             mqtt_state = MQTT_CONNECTED;
         }
+        mqtt_publish_availability(MQTT_AVAILABLE, false); // birth message
         // subscribe to input topic
-        for (int i = 0; i < linky_label_list_size; i++)
+        for (int i = 0; i < mqtt_commands_size; i++)
         {
-            if (linky_label_list[i].type == HA_NUMBER)
-            {
-                char topic[150];
-                snprintf(topic, sizeof(topic), "%s/%s", config_values.mqtt.topic, linky_label_list[i].label);
-                esp_mqtt_client_subscribe(mqtt_client, topic, 1);
-                ESP_LOGI(TAG, "Subscribing to %s", topic);
-            }
+            esp_mqtt_client_subscribe(mqtt_client, mqtt_command_topics[i], 1);
+            ESP_LOGI(TAG, "Subscribing to %s", mqtt_command_topics[i]);
         }
         if (config_values.mode == MODE_MQTT_HA && strlen(mqtt_topics.ha_identifier_topic) > 0)
         {
@@ -568,25 +894,25 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
             }
         }
 #endif
+        mqtt_queue_release(event->msg_id, true);
         mqtt_sent_count++;
         break;
+    case MQTT_EVENT_DELETED:
+        // message expired in the outbox
+        mqtt_queue_release(event->msg_id, false);
+        break;
     case MQTT_EVENT_DATA:
     {
         ESP_LOGI(TAG, "MQTT_EVENT_DATA: %.*s", event->topic_len, event->topic);
-        char fullname[50];
-        char strValue[512]; // prevent buffer overflow with long string (ha discovery)
-        strncpy(fullname, event->topic, event->topic_len);
-        fullname[event->topic_len] = '\0';
-        strncpy(strValue, event->data, event->data_len);
-        strValue[event->data_len] = '\0';
-
-        if (strlen(fullname) == 0)
+        if (event->topic_len == 0 || event->current_data_offset != 0 || event->data_len != event->total_data_len)
         {
+            // commands are small: ignore fragmented messages
             break;
         }
         if (config_values.mode == MODE_MQTT_HA)
         {
-            if (strcmp(fullname, mqtt_topics.ha_identifier_topic) == 0)
+            if (event->topic_len == strlen(mqtt_topics.ha_identifier_topic) &&
+                strncmp(event->topic, mqtt_topics.ha_identifier_topic, event->topic_len) == 0)
             {
                 ESP_LOGI(TAG, "Home Assistant discovery is already configured");
                 mqtt_topics.ha_discovery_configured_temp = 1;
@@ -594,53 +920,20 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
                 break;
             }
         }
-        char *name = fullname + strlen(config_values.mqtt.topic) + 1; // +1 for '/'
-        for (int i = 0; i < linky_label_list_size; i++)
+
+        const mqtt_command_t *command = mqtt_match_command(event->topic, event->topic_len);
+        if (command == NULL)
+        {
+            ESP_LOGW(TAG, "No command for %.*s", event->topic_len, event->topic);
+            break;
+        }
+        int32_t value = 0;
+        if (command->validator(command, event->data, event->data_len, &value) != ESP_OK)
         {
-            if (strcmp(linky_label_list[i].label, name) == 0)
-            {
-                if (linky_label_list[i].data == NULL)
-                {
-                    ESP_LOGE(TAG, "Null pointer for %s", name);
-                    break;
-                }
-
-                switch (linky_label_list[i].type)
-                {
-                case UINT8:
-                    *(uint8_t *)linky_label_list[i].data = atoi(strValue);
-                    break;
-                case UINT16:
-                    *(uint16_t *)linky_label_list[i].data = atoi(strValue);
-                    break;
-                case UINT32:
-                    *(uint32_t *)linky_label_list[i].data = atol(strValue);
-                    break;
-                case UINT64:
-                    *(uint64_t *)linky_label_list[i].data = atoll(strValue);
-                    break;
-                case STRING:
-                    strncpy((char *)linky_label_list[i].data, strValue, linky_label_list[i].size);
-                    break;
-                case UINT32_TIME:
-                    ((time_label_t *)linky_label_list[i].data)->value = atol(strValue);
-                    break;
-                case HA_NUMBER:
-                    uint16_t value = atoi(strValue);
-                    uint16_t *config = (uint16_t *)linky_label_list[i].data;
-                    if (value != *config)
-                    {
-                        *config = value;
-                        ESP_LOGI(TAG, "Set %s = %d", name, *config);
-                        config_write();
-                    }
-                    break;
-                default:
-                    break;
-                }
-                break;
-            }
+            ESP_LOGW(TAG, "Invalid value for %s: %.*s", command->suffix, event->data_len, event->data);
+            break;
         }
+        command->handler(command, value);
     }
     break;
     case MQTT_EVENT_ERROR:
@@ -672,6 +965,35 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
     }
 }
 
+/**
+ * @brief Create the TLS transport of mqtts with the pinned CA
+ *
+ * The client keeps the transport between the wake cycles: with session tickets,
+ * the next connections resume the TLS session instead of a full handshake.
+ *
+ * @return the transport, owned by the client, NULL on error
+ */
+static esp_transport_handle_t mqtt_create_ssl_transport()
+{
+    free(mqtt_cert);
+    mqtt_cert = config_read_cert(config_values.mqtt_ca);
+    if (mqtt_cert == NULL)
+    {
+        return NULL;
+    }
+    esp_transport_handle_t ssl = esp_transport_ssl_init();
+    if (ssl == NULL)
+    {
+        return NULL;
+    }
+    esp_transport_set_default_port(ssl, MQTT_TLS_PORT);
+    esp_transport_ssl_set_cert_data(ssl, mqtt_cert, strlen(mqtt_cert));
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_transport_ssl_session_tickets_enable(ssl);
+#endif
+    return ssl;
+}
+
 int mqtt_init(void)
 {
     esp_log_level_set("mqtt_client", ESP_LOG_WARN);
@@ -688,9 +1010,29 @@ int mqtt_init(void)
 
     snprintf(mqtt_topics.name, sizeof(mqtt_topics.name), MQTT_ID "_%s", efuse_values.mac_address + 6);
     snprintf(mqtt_topics.unique_id_base, sizeof(mqtt_topics.unique_id_base), "TICMeter_%s_", efuse_values.mac_address + 6);
+    snprintf(mqtt_topics.availability_topic, sizeof(mqtt_topics.availability_topic), "%s/" MQTT_AVAILABILITY_TOPIC, config_values.mqtt.topic);
+    mqtt_topic_comliance(mqtt_topics.availability_topic, sizeof(mqtt_topics.availability_topic));
+    snprintf(mqtt_topics.status_topic, sizeof(mqtt_topics.status_topic), "%s/" MQTT_STATUS_TOPIC, config_values.mqtt.topic);
+    mqtt_topic_comliance(mqtt_topics.status_topic, sizeof(mqtt_topics.status_topic));
+    for (int i = 0; i < mqtt_commands_size; i++)
+    {
+        snprintf(mqtt_command_topics[i], sizeof(mqtt_command_topics[i]), "%s/%s", config_values.mqtt.topic, mqtt_commands[i].suffix);
+        mqtt_topic_comliance(mqtt_command_topics[i], sizeof(mqtt_command_topics[i]));
+    }
     mqtt_state = MQTT_CONNECTING;
     char uri[200];
-    snprintf(uri, sizeof(uri), "mqtt://%s:%d", config_values.mqtt.host, config_values.mqtt.port);
+    esp_transport_handle_t transport = NULL;
+    if (strlen(config_values.mqtt_ca) > 0)
+    {
+        transport = mqtt_create_ssl_transport();
+        if (transport == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to load %s: MQTT ERROR", config_values.mqtt_ca);
+            mqtt_state = MQTT_DEINIT;
+            return -1; // never fall back to a clear connection
+        }
+    }
+    snprintf(uri, sizeof(uri), "%s://%s:%d", transport ? "mqtts" : "mqtt", config_values.mqtt.host, config_values.mqtt.port);
     esp_mqtt_client_config_t mqtt_cfg = {
         // .session.message_retransmit_timeout = 500,
         .outbox.limit = 64 * 1024,
@@ -701,7 +1043,14 @@ int mqtt_init(void)
             .priority = 2,
         },
         .broker.address.uri = uri,
+        .network.transport = transport,
         .credentials.client_id = mqtt_topics.name,
+        .session.last_will = {
+            .topic = mqtt_topics.availability_topic,
+            .msg = MQTT_NOT_AVAILABLE,
+            .qos = MQTT_QOS,
+            .retain = 1,
+        },
     };
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
     /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
@@ -716,8 +1065,11 @@ int mqtt_deinit()
     {
         ESP_LOGI(TAG, "Deinit MQTT...");
         esp_mqtt_client_stop(mqtt_client);
-        esp_mqtt_client_destroy(mqtt_client);
+        esp_mqtt_client_destroy(mqtt_client); // destroys the TLS transport too
         mqtt_client = NULL;
+        free(mqtt_cert);
+        mqtt_cert = NULL;
+        mqtt_queue_clear();
     }
     mqtt_state = MQTT_DEINIT;
     return 1;
@@ -755,6 +1107,10 @@ int mqtt_send()
         mqtt_init();
     }
 
+    if (mqtt_state != MQTT_CONNECTED)
+    {
+        mqtt_state = MQTT_CONNECTING;
+    }
     err = esp_mqtt_client_start(mqtt_client);
     if (err != ESP_OK)
     {
@@ -763,25 +1119,7 @@ int mqtt_send()
     }
 
     ESP_LOGI(TAG, "Waiting for MQTT send done, outbox size: %d", esp_mqtt_client_get_outbox_size(mqtt_client));
-    time_t mqtt_send_timeout = MILLIS + MQTT_SEND_TIMEOUT;
-    while ((mqtt_send_timeout > MILLIS) && /*mqtt_sent_count < mqtt_sensors_count*/ esp_mqtt_client_get_outbox_size(mqtt_client) > 0)
-    {
-        if (mqtt_state == MQTT_DISCONNETED)
-        {
-            ESP_LOGE(TAG, "MQTT Exit: %d", mqtt_state);
-            break;
-        }
-        if (mqtt_state == MQTT_FAILED)
-        {
-            ESP_LOGW(TAG, "MQTT faild");
-            break;
-            // esp_mqtt_client_disconnect(mqtt_client);
-            // vTaskDelay(100 / portTICK_PERIOD_MS);
-            // esp_mqtt_client_start(mqtt_client);
-        }
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        ESP_LOGD(TAG, "Outbox size: %d", esp_mqtt_client_get_outbox_size(mqtt_client));
-    }
+    esp_err_t flush_err = mqtt_flush(MQTT_SEND_TIMEOUT);
 
     // ESP_LOGW(TAG, "set ha_discovery_configured to %d", mqtt_topics.ha_discovery_configured_temp);
     mqtt_topics.ha_discovery_configured = mqtt_topics.ha_discovery_configured_temp;
@@ -804,7 +1142,7 @@ int mqtt_send()
         goto error;
     }
 
-    if (/*mqtt_sent_count < mqtt_sensors_count*/ esp_mqtt_client_get_outbox_size(mqtt_client) > 0)
+    if (flush_err != ESP_OK)
     {
         ESP_LOGE(TAG, "Send Timeout: %d/%d", mqtt_sent_count, mqtt_sensors_count);
         goto error;
@@ -822,15 +1160,154 @@ error:
     return 0;
 }
 
+static esp_err_t mqtt_exporter_init(void)
+{
+    return mqtt_init() > 0 ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Schedule the last sample of the batch and send it: the retained topics need every value, the changed set is
+ * not used
+ */
+static esp_err_t mqtt_exporter_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed)
+{
+    if (count == 0)
+    {
+        return ESP_OK;
+    }
+    if (mqtt_prepare_publish(&samples[count - 1]) == 0)
+    {
+        ESP_LOGE(TAG, "Some data will not be sent, but we continue");
+    }
+    return mqtt_send() ? ESP_OK : ESP_FAIL;
+}
+
 void mqtt_disconnect_task(void *pvParameters)
 {
     ESP_LOGI(TAG, "Disconnecting MQTT");
+    if (mqtt_state == MQTT_CONNECTED)
+    {
+        // intentional disconnect: the broker will not send the LWT
+        mqtt_publish_availability(MQTT_SLEEPING, true);
+    }
     mqtt_state = MQTT_DISCONNETED;
     esp_mqtt_client_disconnect(mqtt_client);
     esp_mqtt_client_stop(mqtt_client);
     vTaskDelete(NULL);
 }
 
+/**
+ * @brief Parse a decimal payload and check the range of the command
+ */
+static esp_err_t mqtt_validate_number(const mqtt_command_t *command, const char *payload, int len, int32_t *value)
+{
+    char str_value[MQTT_COMMAND_MAX_PAYLOAD];
+    if (len <= 0 || len >= sizeof(str_value))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(str_value, payload, len);
+    str_value[len] = '\0';
+
+    char *end = NULL;
+    long number = strtol(str_value, &end, 10);
+    if (end == str_value)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (*end == '.') // HA can send "60.0": digits only, they are dropped
+    {
+        size_t decimals = strspn(end + 1, "0123456789");
+        if (decimals == 0)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        end += 1 + decimals;
+    }
+    if (*end != '\0')
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (number < command->min || number > command->max)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *value = number;
+    return ESP_OK;
+}
+
+static void mqtt_handle_config_u16(const mqtt_command_t *command, int32_t value)
+{
+    uint16_t *config = (uint16_t *)command->data;
+    if (value != *config)
+    {
+        *config = value;
+        ESP_LOGI(TAG, "Set %s = %d", command->suffix, *config);
+        config_write_later();
+    }
+}
+
+static const mqtt_command_t *mqtt_find_command(const char *suffix)
+{
+    for (int i = 0; i < mqtt_commands_size; i++)
+    {
+        if (strcmp(mqtt_commands[i].suffix, suffix) == 0)
+        {
+            return &mqtt_commands[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find the command of a received topic (not NUL terminated)
+ */
+static const mqtt_command_t *mqtt_match_command(const char *topic, int len)
+{
+    for (int i = 0; i < mqtt_commands_size; i++)
+    {
+        if (strlen(mqtt_command_topics[i]) == len && strncmp(mqtt_command_topics[i], topic, len) == 0)
+        {
+            return &mqtt_commands[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Publish the availability and the status with the expected next publish
+ *
+ * @param state MQTT_AVAILABLE or MQTT_SLEEPING
+ * @param blocking send it now (before a disconnect) instead of using the outbox
+ */
+static void mqtt_publish_availability(const char *state, bool blocking)
+{
+    char status[150];
+    time_t now = 0;
+    time(&now);
+    if (now > MQTT_VALID_TIME)
+    {
+        snprintf(status, sizeof(status), "{\"state\":\"%s\",\"refresh_rate\":%d,\"next_publish\":%lld}",
+                 state, config_values.refresh_rate, now + config_values.refresh_rate);
+    }
+    else
+    {
+        snprintf(status, sizeof(status), "{\"state\":\"%s\",\"refresh_rate\":%d}", state, config_values.refresh_rate);
+    }
+
+    ESP_LOGI(TAG, "Availability: %s", status);
+    if (blocking)
+    {
+        esp_mqtt_client_publish(mqtt_client, mqtt_topics.status_topic, status, 0, MQTT_QOS, 1);
+        esp_mqtt_client_publish(mqtt_client, mqtt_topics.availability_topic, state, 0, MQTT_QOS, 1);
+    }
+    else
+    {
+        esp_mqtt_client_enqueue(mqtt_client, mqtt_topics.status_topic, status, 0, MQTT_QOS, 1, true);
+        esp_mqtt_client_enqueue(mqtt_client, mqtt_topics.availability_topic, state, 0, MQTT_QOS, 1, true);
+    }
+}
+
 void mqtt_topic_comliance(char *topic, int size)
 {
     for (int j = 0; j < size; j++)
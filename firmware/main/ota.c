@@ -19,6 +19,7 @@
 #include "esp_log.h"
 #include "esp_ota_ops.h"
 #include <esp_tls.h>
+#include <strings.h>
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
@@ -29,11 +30,15 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
-#include "cJSON.h"
+#include "json_reader.h"
 #include "wifi.h"
 #include "gpio.h"
 #include "http.h"
 #include "led.h"
+#include "storage_update.h"
+#include "ota_delta.h"
+#include "ota_zlib.h"
+#include "esp_timer.h"
 /*==============================================================================
  Local Define
 ===============================================================================*/
@@ -41,6 +46,8 @@
 #define TAG "OTA"
 #define OTA_VERSION_URL "https://github.com/GammaTroniques/TICMeter/releases/latest/download/manifest.json"
 #define OTA_TIMEOUT_MS 10000
+#define OTA_MANIFEST_SIZE 4096 // the version JSON of a release, deltas included
+#define OTA_VALIDATOR_SIZE 96  // ETag or Last-Modified of the manifest
 /*==============================================================================
  Local Macro
 ===============================================================================*/
@@ -53,8 +60,15 @@ typedef struct
 {
     char url[256];
     char cert[256];
+    char *cert_pem; // content of cert, read once
 } ota_versions_url_t;
 
+typedef struct
+{
+    const esp_partition_t *running; // the old image of the patch
+    esp_ota_handle_t handle;        // the new one
+} ota_patch_context_t;
+
 /*==============================================================================
  Local Function Declaration
 ===============================================================================*/
@@ -63,6 +77,11 @@ static esp_err_t ota_validate_image_header(esp_app_desc_t *new_app_info);
 static esp_err_t ota_http_client_init_cb(esp_http_client_handle_t http_client);
 static esp_err_t ota_https_event_handler(esp_http_client_event_t *evt);
 static uint8_t ota_version_compare(const char *current_version, const char *to_check_version);
+static bool ota_parse_sha256(const char *hex, uint8_t *sha256);
+static void ota_load_versions(void);
+static int ota_parse_manifest(const char *json, size_t len, ota_version_t *version);
+static esp_err_t ota_patch_read(void *context, uint32_t offset, void *data, size_t len);
+static esp_err_t ota_patch_write(void *context, const void *data, size_t len);
 
 /*==============================================================================
 Public Variable
@@ -75,51 +94,57 @@ bool ota_available = false;
 /*==============================================================================
  Local Variable
 ===============================================================================*/
-char *ota_version_buffer = NULL;
-uint32_t ota_version_buffer_size = 0;
 ota_versions_url_t ota_versions_url[5] = {0};
+bool ota_versions_loaded = false; // ota_versions_url and the certs, read from the storage at the first check
 int8_t ota_to_use_version = -1;
-char *ota_cert;
-
-bool spiffs_update = false;
-const esp_partition_t *storage_partition;
-char *storage_buffer = NULL;
-uint32_t storage_buffer_size = 0;
-uint32_t storage_buffer_index = 0;
+char *ota_cert; // cert_pem of ota_to_use_version
+
+char ota_manifest[OTA_MANIFEST_SIZE]; // the version JSON, received in place
+uint32_t ota_manifest_len = 0;
+bool ota_manifest_overflow = false;
+
+// the last manifest parsed: its validators are sent back, a 304 reuses it
+int8_t ota_manifest_index = -1; // entry of ota_versions_url, -1 if none
+char ota_manifest_etag[OTA_VALIDATOR_SIZE];
+char ota_manifest_last_modified[OTA_VALIDATOR_SIZE];
+ota_version_t ota_manifest_version;
+char ota_received_etag[OTA_VALIDATOR_SIZE]; // headers of the current response
+char ota_received_last_modified[OTA_VALIDATOR_SIZE];
+
+bool storage_download = false;    // the HTTP data goes to storage_update_write()
+ota_delta_t *delta_download = NULL; // the HTTP data goes to ota_delta_feed()
+bool zlib_download = false;         // the HTTP data goes to ota_zlib_write()
 /*==============================================================================
 Function Implementation
 ===============================================================================*/
 
-static int ota_json_parse_string(cJSON *json, const char *key, char *value, size_t value_size)
+static int ota_json_parse_string(const char *json, size_t len, const char *path, char *value, size_t value_size)
 {
     assert(json != NULL);
-    assert(key != NULL);
+    assert(path != NULL);
     assert(value != NULL);
     assert(value_size > 0);
 
-    cJSON *json_value = cJSON_GetObjectItemCaseSensitive(json, key);
-    if (json_value == NULL)
+    if (!json_read_exists(json, len, path))
     {
-        ESP_LOGE(TAG, "Parse Error: %s NULL", key);
+        ESP_LOGE(TAG, "Parse Error: %s NULL", path);
         return -1;
     }
-    if (!cJSON_IsString(json_value))
+    if (!json_read_text(json, len, path, value, value_size))
     {
-        ESP_LOGE(TAG, "Parse Error: %s not a string", key);
+        ESP_LOGE(TAG, "Parse Error: %s not a string or too long", path);
         return -1;
     }
-    if (strlen(json_value->valuestring) >= value_size)
-    {
-        ESP_LOGE(TAG, "Parse Error: %s too long", key);
-        return -1;
-    }
-    int len = strlen(json_value->valuestring);
-    int min = len < value_size ? len : value_size;
-    strncpy(value, json_value->valuestring, min);
     return 0;
 }
 
-int ota_https_request(const char *url, const char *cert)
+/**
+ * @brief GET url, the data goes to the download in progress or to ota_manifest
+ *
+ * @param conditional send the validators of the last manifest, a 304 means it did not change
+ * @return the HTTP status, -1 on error
+ */
+int ota_https_request(const char *url, const char *cert, bool conditional)
 {
     const esp_app_desc_t *app_desc = esp_app_get_description();
     char user_agent[64];
@@ -140,6 +165,14 @@ int ota_https_request(const char *url, const char *cert)
     };
 
     esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (conditional && ota_manifest_etag[0] != '\0')
+    {
+        esp_http_client_set_header(client, "If-None-Match", ota_manifest_etag);
+    }
+    if (conditional && ota_manifest_last_modified[0] != '\0')
+    {
+        esp_http_client_set_header(client, "If-Modified-Since", ota_manifest_last_modified);
+    }
     esp_err_t err = esp_http_client_perform(client);
 
     if (err != ESP_OK)
@@ -157,13 +190,18 @@ int ota_https_request(const char *url, const char *cert)
     return status_code;
 }
 
-int ota_get_latest(ota_version_t *version)
+/**
+ * @brief Read ota_versions.csv and the certs it names, once: they only change with the storage, followed by a restart
+ */
+static void ota_load_versions(void)
 {
-    assert(version != NULL);
-    memset(version, 0, sizeof(ota_version_t));
-    const esp_app_desc_t *app_desc = esp_app_get_description();
+    if (ota_versions_loaded)
+    {
+        return;
+    }
+    ota_versions_loaded = true;
 
-    FILE *file = fopen("/spiffs/ota_versions.csv", "r");
+    FILE *file = fopen(STORAGE_PATH "/ota_versions.csv", "r");
     if (file == NULL)
     {
         // backup
@@ -193,7 +231,7 @@ int ota_get_latest(ota_version_t *version)
                 ESP_LOGE(TAG, "Failed to parse ota_versions.txt");
                 break;
             }
-            snprintf(ota_versions_url[i].cert, sizeof(ota_versions_url[i].cert), "/spiffs/%s", token);
+            snprintf(ota_versions_url[i].cert, sizeof(ota_versions_url[i].cert), STORAGE_PATH "/%s", token);
             // remove \n and \r
             char *pos;
             if ((pos = strchr(ota_versions_url[i].cert, '\n')) != NULL)
@@ -212,7 +250,6 @@ int ota_get_latest(ota_version_t *version)
 
     for (uint8_t i = 0; i < sizeof(ota_versions_url) / sizeof(ota_versions_url[0]); i++)
     {
-        ESP_LOGI(TAG, "Trying to get version from %s", ota_versions_url[i].url);
         if (strlen(ota_versions_url[i].url) == 0)
         {
             break;
@@ -226,72 +263,168 @@ int ota_get_latest(ota_version_t *version)
         fseek(file, 0, SEEK_END);
         long fsize = ftell(file);
         fseek(file, 0, SEEK_SET);
-        if (ota_cert)
+        ota_versions_url[i].cert_pem = malloc(fsize + 1);
+        if (ota_versions_url[i].cert_pem != NULL)
         {
-            free(ota_cert);
-            ota_cert = NULL;
+            fread(ota_versions_url[i].cert_pem, fsize, 1, file);
+            ota_versions_url[i].cert_pem[fsize] = 0;
         }
-        ota_cert = malloc(fsize + 1);
-        fread(ota_cert, fsize, 1, file);
         fclose(file);
-        ota_cert[fsize] = 0;
+    }
+}
 
-        int status_code = ota_https_request(ota_versions_url[i].url, ota_cert);
+int ota_get_latest(ota_version_t *version)
+{
+    assert(version != NULL);
+    memset(version, 0, sizeof(ota_version_t));
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+    int64_t start = esp_timer_get_time();
+    int status_code = -1;
+    bool not_modified = false;
+
+    ota_load_versions();
+    for (uint8_t i = 0; i < sizeof(ota_versions_url) / sizeof(ota_versions_url[0]); i++)
+    {
+        ESP_LOGI(TAG, "Trying to get version from %s", ota_versions_url[i].url);
+        if (strlen(ota_versions_url[i].url) == 0)
+        {
+            break;
+        }
+        if (ota_versions_url[i].cert_pem == NULL)
+        {
+            ESP_LOGE(TAG, "No cert for %s", ota_versions_url[i].url);
+            continue;
+        }
+        ota_cert = ota_versions_url[i].cert_pem;
+        ota_manifest_len = 0;
+        ota_manifest_overflow = false;
+
+        status_code = ota_https_request(ota_versions_url[i].url, ota_cert, i == ota_manifest_index);
+        not_modified = (status_code == 304 && i == ota_manifest_index);
+        if (not_modified)
+        {
+            ota_to_use_version = i;
+            break;
+        }
         if (status_code != 200)
         {
             ESP_LOGE(TAG, "HTTP Get: %s Status code: %d", ota_versions_url[i].url, status_code);
-            free(ota_version_buffer);
-            ota_version_buffer = NULL;
             continue;
         }
-        if (ota_version_buffer == NULL)
+        if (ota_manifest_overflow || ota_manifest_len == 0)
         {
-            ESP_LOGE(TAG, "HTTP Get: %s Buffer is NULL", ota_versions_url[i].url);
+            ESP_LOGE(TAG, "HTTP Get: %s %s", ota_versions_url[i].url, ota_manifest_len ? "manifest too big" : "empty");
+            status_code = -1;
             continue;
         }
 
-        ESP_LOGD(TAG, "Version: %s", ota_version_buffer);
+        ESP_LOGD(TAG, "Version: %s", ota_manifest);
         ota_to_use_version = i;
-        // free(ota_cert); //TODO
-        // ota_cert = NULL;
         break;
     }
+    ESP_LOGI(TAG, "Version check: HTTP %d, %ld bytes in %lld ms", status_code, ota_manifest_len,
+             (esp_timer_get_time() - start) / 1000);
 
-    ESP_LOGD(TAG, "Version: %s", ota_version_buffer);
-    cJSON *json = cJSON_Parse(ota_version_buffer);
-    if (json == NULL)
+    if (not_modified)
     {
-        const char *error_ptr = cJSON_GetErrorPtr();
-        if (error_ptr != NULL)
-        {
-            ESP_LOGE(TAG, "Parse Error: %s", error_ptr);
-        }
-        else
+        ESP_LOGI(TAG, "Manifest not modified");
+        memcpy(version, &ota_manifest_version, sizeof(ota_version_t));
+    }
+    else
+    {
+        ota_manifest_index = -1;
+        if (status_code != 200 || ota_parse_manifest(ota_manifest, ota_manifest_len, version) != 0)
         {
-            ESP_LOGE(TAG, "Parse Error: %s", "Unknown");
+            return -1;
         }
+        // kept for the next checks
+        memcpy(&ota_manifest_version, version, sizeof(ota_version_t));
+        strlcpy(ota_manifest_etag, ota_received_etag, sizeof(ota_manifest_etag));
+        strlcpy(ota_manifest_last_modified, ota_received_last_modified, sizeof(ota_manifest_last_modified));
+        ota_manifest_index = ota_to_use_version;
+    }
+
+    strncpy(version->currentVersion, app_desc->version, sizeof(version->currentVersion));
+
+    ESP_LOGI(TAG, "Current Version: %s", version->currentVersion);
+    ESP_LOGI(TAG, "Latest version: %s", version->version);
+    ESP_LOGI(TAG, "Target: %s", version->target);
+    ESP_LOGI(TAG, "HW Version: %s", version->hwVersion);
+    ESP_LOGI(TAG, "APP URL: %s", version->app_url);
+    ESP_LOGI(TAG, "Storage URL: %s", version->storage_url);
+    ESP_LOGI(TAG, "Delta URL: %s", version->delta_url);
+    ESP_LOGI(TAG, "OTA URL: %s", version->ota_url);
+    ESP_LOGI(TAG, "MD5: %s", version->md5);
+
+    uint8_t result = ota_version_compare(version->currentVersion, version->version);
+    if (result == 0)
+    {
+        ESP_LOGW(TAG, "No update available");
+        ota_available = false;
+        return 0;
+    }
+    else if (result == 1)
+    {
+        ESP_LOGW(TAG, "Current version > latest version");
+        ota_available = false;
+        return 0;
+    }
+    ESP_LOGI(TAG, "Update available");
+    ota_state = OTA_AVAILABLE;
+    ota_available = true;
+    if (!gpip_led_ota_task_handle)
+    {
+        led_start_pattern(LED_OTA_AVAILABLE);
+    }
+
+    return 1;
+}
+/**
+ * @brief Parse the version JSON: the latest version and the parts of the build of this target
+ *
+ * @return 0, -1 if the manifest is not valid
+ */
+static int ota_parse_manifest(const char *json, size_t len, ota_version_t *version)
+{
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+    if (!json_read_object(json, len))
+    {
+        ESP_LOGE(TAG, "Parse Error: %s", "invalid JSON");
         return -1;
     }
-    ota_json_parse_string(json, "version", version->version, sizeof(version->version));
+    ota_json_parse_string(json, len, "version", version->version, sizeof(version->version));
     //------------------------Parse Firmware------------------------
-    cJSON *json_firmware = cJSON_GetObjectItemCaseSensitive(json, "builds");
-    if (json_firmware == NULL)
+    const char *builds;
+    size_t builds_len;
+    if (!json_read_exists(json, len, "builds"))
     {
         ESP_LOGE(TAG, "Parse Error: %s", "firmware not found");
         return -1;
     }
-    if (!cJSON_IsArray(json_firmware))
+    if (!json_read_span(json, len, "builds", &builds, &builds_len) || builds[0] != '[')
     {
         ESP_LOGE(TAG, "Parse Error: %s", "firmware not array");
         return -1;
     }
 
     //------------------------Parse Firmware Item------------------------
-    cJSON *json_firmware_item = NULL;
+    // each lookup walks its span only: the build, then its parts
+    char path[JSON_READ_PATH_SIZE];
+    const char *build;
+    size_t build_len;
     uint8_t found = 0;
-    cJSON_ArrayForEach(json_firmware_item, json_firmware)
+    for (int i = 0;; i++)
     {
-        ota_json_parse_string(json_firmware_item, "target", version->target, sizeof(version->target));
+        snprintf(path, sizeof(path), "[%d]", i);
+        if (!json_read_exists(builds, builds_len, path))
+        {
+            break;
+        }
+        if (!json_read_span(builds, builds_len, path, &build, &build_len))
+        {
+            continue;
+        }
+        ota_json_parse_string(build, build_len, "target", version->target, sizeof(version->target));
         if (strcmp(version->target, CONFIG_IDF_TARGET) == 0)
         {
             found = 1;
@@ -305,68 +438,71 @@ int ota_get_latest(ota_version_t *version)
     }
 
     //------------------------Parse Firmware Parts------------------------
-    cJSON *json_parts = cJSON_GetObjectItemCaseSensitive(json_firmware_item, "parts");
-    if (json_parts == NULL)
+    const char *parts;
+    size_t parts_len;
+    if (!json_read_exists(build, build_len, "parts"))
     {
         ESP_LOGE(TAG, "Parse Error: %s", "parts not found");
         return -1;
     }
-    if (!cJSON_IsArray(json_parts))
+    if (!json_read_span(build, build_len, "parts", &parts, &parts_len) || parts[0] != '[')
     {
         ESP_LOGE(TAG, "Parse Error: %s", "parts not array");
         return -1;
     }
 
     //------------------------Parse Firmware Parts Item------------------------
-    cJSON *json_parts_item = NULL;
-    cJSON_ArrayForEach(json_parts_item, json_parts)
+    const char *part;
+    size_t part_len;
+    for (int i = 0;; i++)
     {
-        cJSON *json_type = cJSON_GetObjectItemCaseSensitive(json_parts_item, "type");
-        if (json_type != NULL && cJSON_IsString(json_type) && (strcmp(json_type->valuestring, "app") == 0))
+        snprintf(path, sizeof(path), "[%d]", i);
+        if (!json_read_exists(parts, parts_len, path))
         {
-            ota_json_parse_string(json_parts_item, "path", version->app_url, sizeof(version->app_url));
+            break;
+        }
+        char type[16];
+        if (!json_read_span(parts, parts_len, path, &part, &part_len) ||
+            !json_read_text(part, part_len, "type", type, sizeof(type)))
+        {
+            continue;
         }
-        else if (json_type != NULL && cJSON_IsString(json_type) && (strcmp(json_type->valuestring, "storage") == 0))
+        if (strcmp(type, "app") == 0)
         {
-            ota_json_parse_string(json_parts_item, "path", version->storage_url, sizeof(version->storage_url));
+            ota_json_parse_string(part, part_len, "path", version->app_url, sizeof(version->app_url));
+            json_read_text(part, part_len, "ota", version->ota_url, sizeof(version->ota_url)); // optional
+        }
+        else if (strcmp(type, "storage") == 0)
+        {
+            ota_json_parse_string(part, part_len, "path", version->storage_url, sizeof(version->storage_url));
+            json_read_text(part, part_len, "sha256", version->storage_sha256, sizeof(version->storage_sha256)); // optional
         }
     }
 
-    strncpy(version->currentVersion, app_desc->version, sizeof(version->currentVersion));
-    free(ota_version_buffer);
-    cJSON_Delete(json);
-    ota_version_buffer = NULL;
-
-    ESP_LOGI(TAG, "Current Version: %s", version->currentVersion);
-    ESP_LOGI(TAG, "Latest version: %s", version->version);
-    ESP_LOGI(TAG, "Target: %s", version->target);
-    ESP_LOGI(TAG, "HW Version: %s", version->hwVersion);
-    ESP_LOGI(TAG, "APP URL: %s", version->app_url);
-    ESP_LOGI(TAG, "Storage URL: %s", version->storage_url);
-    ESP_LOGI(TAG, "MD5: %s", version->md5);
-
-    uint8_t result = ota_version_compare(version->currentVersion, version->version);
-    if (result == 0)
+    //------------------------Parse Deltas------------------------
+    // optional, one patch per old version: only the one from the running version is useful
+    const char *deltas;
+    size_t deltas_len;
+    if (json_read_span(build, build_len, "deltas", &deltas, &deltas_len) && deltas[0] == '[')
     {
-        ESP_LOGW(TAG, "No update available");
-        ota_available = false;
-        return 0;
-    }
-    else if (result == 1)
-    {
-        ESP_LOGW(TAG, "Current version > latest version");
-        ota_available = false;
-        return 0;
-    }
-    ESP_LOGI(TAG, "Update available");
-    ota_state = OTA_AVAILABLE;
-    ota_available = true;
-    if (!gpip_led_ota_task_handle)
-    {
-        led_start_pattern(LED_OTA_AVAILABLE);
+        for (int i = 0;; i++)
+        {
+            snprintf(path, sizeof(path), "[%d]", i);
+            if (!json_read_exists(deltas, deltas_len, path))
+            {
+                break;
+            }
+            char from[sizeof(app_desc->version)];
+            if (json_read_span(deltas, deltas_len, path, &part, &part_len) &&
+                json_read_text(part, part_len, "from", from, sizeof(from)) && strcmp(from, app_desc->version) == 0)
+            {
+                ota_json_parse_string(part, part_len, "path", version->delta_url, sizeof(version->delta_url));
+                break;
+            }
+        }
     }
 
-    return 1;
+    return 0;
 }
 
 static void ota_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
@@ -500,75 +636,170 @@ static uint8_t ota_version_compare(const char *current_version, const char *to_c
     return result;
 }
 
-static void ota_spiffs_update(const char *url)
+/**
+ * @brief Read the hex SHA-256 of the manifest
+ *
+ * @return false if there is none or it is not 64 hex digits
+ */
+static bool ota_parse_sha256(const char *hex, uint8_t *sha256)
+{
+    if (strlen(hex) != 2 * STORAGE_UPDATE_SHA256_SIZE)
+    {
+        return false;
+    }
+    for (uint8_t i = 0; i < STORAGE_UPDATE_SHA256_SIZE; i++)
+    {
+        char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+        char *end;
+        sha256[i] = strtoul(byte, &end, 16);
+        if (*end != '\0')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void ota_storage_update(const char *url, const char *sha256)
 {
     esp_err_t err;
     if (url == NULL)
     {
         return;
     }
-    ESP_LOGI(TAG, "Starting spiffs update");
+    ESP_LOGI(TAG, "Starting storage update");
     ESP_LOGI(TAG, "Free heap: %ld", esp_get_free_heap_size());
-    spiffs_update = true;
+    uint8_t expected[STORAGE_UPDATE_SHA256_SIZE];
+    bool check = ota_parse_sha256(sha256, expected);
+    if (!check)
+    {
+        ESP_LOGW(TAG, "No SHA-256 of the storage image in the manifest");
+    }
     err = wifi_connect();
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Wifi connect failed");
-        spiffs_update = false;
         return;
     }
-    storage_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, "storage");
-    if (storage_partition == NULL)
+
+    // streamed to the scratch area: the partition is erased only once the whole image is received and checked
+    err = storage_update_begin();
+    if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to find storage partition");
-        spiffs_update = false;
+        ESP_LOGE(TAG, "Failed to start the storage update: %s", esp_err_to_name(err));
         return;
     }
-
-    storage_buffer_size = storage_partition->size;
-    storage_buffer = malloc(storage_buffer_size);
-    ESP_LOGI(TAG, "Free heap: %ld", esp_get_free_heap_size());
-
-    storage_buffer_index = 0;
-    if (storage_buffer == NULL)
+    storage_download = true;
+    int status_code = ota_https_request(url, ota_cert, false);
+    storage_download = false;
+    if (status_code != 200)
     {
-        ESP_LOGE(TAG, "Failed to allocate storage buffer");
-        spiffs_update = false;
+        ESP_LOGE(TAG, "HTTP Get: %s Status code: %d", url, status_code);
+        storage_update_abort();
         return;
     }
-    ota_https_request(url, ota_cert);
-    if (storage_buffer == NULL)
+
+    err = storage_update_end(check ? expected : NULL);
+    if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "HTTP Get: %s Buffer is NULL", url);
-        spiffs_update = false;
+        ESP_LOGE(TAG, "Storage update failed: %s", esp_err_to_name(err));
         return;
     }
+    ESP_LOGI(TAG, "Storage partition updated");
+}
+
+static esp_err_t ota_patch_read(void *context, uint32_t offset, void *data, size_t len)
+{
+    ota_patch_context_t *patch = context;
+    return esp_partition_read(patch->running, offset, data, len);
+}
 
-    ESP_LOGD(TAG, "Version: %s", ota_version_buffer);
+static esp_err_t ota_patch_write(void *context, const void *data, size_t len)
+{
+    ota_patch_context_t *patch = context;
+    return esp_ota_write(patch->handle, data, len);
+}
 
-    if (storage_buffer_index != storage_partition->size)
+/**
+ * @brief Rebuild the new firmware in the next OTA partition from the running one and a patch
+ *
+ * @return ESP_OK when the new firmware is the boot partition
+ */
+static esp_err_t ota_patch_update(const char *url)
+{
+    ota_patch_context_t patch = {
+        .running = esp_ota_get_running_partition(),
+    };
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    if (next == NULL)
     {
-        ESP_LOGE(TAG, "Version size is not correct: %ld != %ld", ota_version_buffer_size, storage_partition->size);
-        spiffs_update = false;
-        return;
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "Starting delta update, free heap: %ld", esp_get_free_heap_size());
+    ota_delta_t *delta = malloc(sizeof(ota_delta_t));
+    if (delta == NULL)
+    {
+        return ESP_ERR_NO_MEM;
     }
 
-    err = esp_partition_erase_range(storage_partition, 0, storage_partition->size);
+    esp_err_t err = esp_ota_begin(next, OTA_WITH_SEQUENTIAL_WRITES, &patch.handle);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to erase storage partition");
-        spiffs_update = false;
-        return;
+        free(delta);
+        return err;
+    }
+    err = ota_delta_init(delta, ota_patch_read, ota_patch_write, &patch);
+    if (err == ESP_OK)
+    {
+        delta_download = delta;
+        int status_code = ota_https_request(url, ota_cert, false);
+        delta_download = NULL;
+        err = ota_delta_finish(delta);
+        if (status_code != 200)
+        {
+            ESP_LOGE(TAG, "HTTP Get: %s Status code: %d", url, status_code);
+            err = (err != ESP_OK) ? err : ESP_FAIL;
+        }
+    }
+    ota_delta_free(delta);
+    free(delta);
+    if (err != ESP_OK)
+    {
+        esp_ota_abort(patch.handle);
+        return err;
     }
-    ESP_LOGI(TAG, "Storage partition erased");
-    esp_partition_write(storage_partition, 0, storage_buffer, storage_buffer_size);
 
-    ESP_LOGI(TAG, "Storage partition updated");
-    spiffs_update = false;
-    free(storage_buffer);
-    storage_buffer = NULL;
-    storage_buffer_size = 0;
-    storage_buffer_index = 0;
+    err = esp_ota_end(patch.handle); // checks the image, as esp_https_ota_finish()
+    if (err == ESP_OK)
+    {
+        err = esp_ota_set_boot_partition(next);
+    }
+    return err;
+}
+
+/**
+ * @brief Update the storage and the app from the compressed file, inflated by ota_zlib as a Zigbee or Tuya OTA
+ *
+ * @return ESP_OK when the new firmware is the boot partition
+ */
+static esp_err_t ota_compressed_update(const char *url)
+{
+    ESP_LOGI(TAG, "Starting compressed update, free heap: %ld", esp_get_free_heap_size());
+    esp_err_t err = ota_zlib_init();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    zlib_download = true;
+    int status_code = ota_https_request(url, ota_cert, false);
+    zlib_download = false;
+    if (status_code != 200)
+    {
+        ESP_LOGE(TAG, "HTTP Get: %s Status code: %d", url, status_code);
+        ota_zlib_abort();
+        return ESP_FAIL;
+    }
+    return ota_zlib_end(); // aborts an incomplete file
 }
 
 void ota_perform_task(void *pvParameter)
@@ -621,10 +852,46 @@ void ota_perform_task(void *pvParameter)
         goto ota_end;
     }
 
-    if (strlen(version.storage_url) > 0)
+    // the smallest download first: a patch of the app, the compressed storage and app, then the images
+    bool storage_updated = false;
+    if (strlen(version.delta_url) > 0)
+    {
+        if (strlen(version.storage_url) > 0)
+        {
+            ESP_LOGI(TAG, "Starting download from %s", version.storage_url);
+            ota_storage_update(version.storage_url, version.storage_sha256);
+            storage_updated = true;
+        }
+        ESP_LOGI(TAG, "Starting download from %s", version.delta_url);
+        err = ota_patch_update(version.delta_url);
+        if (err == ESP_OK)
+        {
+            ESP_LOGI(TAG, "Delta upgrade successful. Rebooting ...");
+            ota_state = OTA_OK;
+            vTaskDelay(3000 / portTICK_PERIOD_MS);
+            esp_restart();
+        }
+        ESP_LOGW(TAG, "Delta upgrade failed: %s, downloading the full image", esp_err_to_name(err));
+    }
+
+    if (strlen(version.ota_url) > 0)
+    {
+        ESP_LOGI(TAG, "Starting download from %s", version.ota_url);
+        err = ota_compressed_update(version.ota_url);
+        if (err == ESP_OK)
+        {
+            ESP_LOGI(TAG, "Compressed upgrade successful. Rebooting ...");
+            ota_state = OTA_OK;
+            vTaskDelay(3000 / portTICK_PERIOD_MS);
+            esp_restart();
+        }
+        ESP_LOGW(TAG, "Compressed upgrade failed: %s, downloading the images", esp_err_to_name(err));
+    }
+
+    if (strlen(version.storage_url) > 0 && !storage_updated)
     {
         ESP_LOGI(TAG, "Starting download from %s", version.storage_url);
-        ota_spiffs_update(version.storage_url);
+        ota_storage_update(version.storage_url, version.storage_sha256);
     }
 
     ESP_LOGI(TAG, "Starting download from %s", version.app_url);
@@ -716,7 +983,21 @@ static esp_err_t ota_https_event_handler(esp_http_client_event_t *evt)
     {
     case HTTP_EVENT_ON_CONNECTED:
         // ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
-        ota_version_buffer_size = 0;
+        ota_manifest_len = 0;
+        ota_manifest_overflow = false;
+        ota_received_etag[0] = '\0';
+        ota_received_last_modified[0] = '\0';
+        break;
+    case HTTP_EVENT_ON_HEADER:
+        // validators of the manifest, sent back by the next check
+        if (strcasecmp(evt->header_key, "ETag") == 0)
+        {
+            strlcpy(ota_received_etag, evt->header_value, sizeof(ota_received_etag));
+        }
+        else if (strcasecmp(evt->header_key, "Last-Modified") == 0)
+        {
+            strlcpy(ota_received_last_modified, evt->header_value, sizeof(ota_received_last_modified));
+        }
         break;
     case HTTP_EVENT_ERROR:
         ESP_LOGE(TAG, "HTTP_EVENT_ERROR");
@@ -726,35 +1007,40 @@ static esp_err_t ota_https_event_handler(esp_http_client_event_t *evt)
         // ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
         if (!esp_http_client_is_chunked_response(evt->client))
         {
-            if (spiffs_update)
+            if (storage_download)
             {
-                if (!storage_buffer)
+                if (storage_update_write(evt->data, evt->data_len) != ESP_OK)
                 {
-                    ESP_LOGE(TAG, "Storage buffer is NULL");
-                    return ESP_FAIL;
+                    return ESP_FAIL; // kept by storage_update_end()
                 }
-                if (storage_buffer_index + evt->data_len > storage_buffer_size)
+            }
+            else if (delta_download != NULL)
+            {
+                if (ota_delta_feed(delta_download, evt->data, evt->data_len) != ESP_OK)
                 {
-                    ESP_LOGE(TAG, "Storage buffer too small: %ld + %d > %ld", storage_buffer_index, evt->data_len, storage_buffer_size);
-                    return ESP_FAIL;
+                    return ESP_FAIL; // kept by ota_delta_finish()
+                }
+            }
+            else if (zlib_download)
+            {
+                if (ota_zlib_write((const uint8_t *)evt->data, evt->data_len) != ESP_OK)
+                {
+                    return ESP_FAIL; // the file is incomplete for ota_zlib_end()
                 }
-                memcpy(storage_buffer + storage_buffer_index, evt->data, evt->data_len);
-                storage_buffer_index += evt->data_len;
             }
             else
             {
-                ESP_LOGD(TAG, "Realloc buffer %ld", ota_version_buffer_size + evt->data_len + 1);
-                ota_version_buffer = realloc(ota_version_buffer, ota_version_buffer_size + evt->data_len + 1);
-
-                if (ota_version_buffer)
+                // the manifest, kept NUL-terminated for the logs
+                if (ota_manifest_len + evt->data_len < sizeof(ota_manifest))
                 {
-                    memcpy(ota_version_buffer + ota_version_buffer_size, evt->data, evt->data_len);
-                    ota_version_buffer_size += evt->data_len;
-                    ota_version_buffer[ota_version_buffer_size] = '\0';
+                    memcpy(ota_manifest + ota_manifest_len, evt->data, evt->data_len);
+                    ota_manifest_len += evt->data_len;
+                    ota_manifest[ota_manifest_len] = '\0';
                 }
                 else
                 {
-                    ESP_LOGE(TAG, "get version: realloc failed");
+                    ESP_LOGE(TAG, "get version: manifest bigger than %d bytes", OTA_MANIFEST_SIZE);
+                    ota_manifest_overflow = true;
                 }
             }
         }
@@ -0,0 +1,336 @@
+/**
+ * @file ota_delta.c
+ * @author Dorian Benech
+ * @brief Apply a binary patch to the running firmware: the new image is rebuilt while the patch is downloaded
+ * @version 1.0
+ * @date 2024-09-12
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "ota_delta.h"
+#include "esp_log.h"
+#include <string.h>
+#include <sys/param.h>
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define TAG "OTA_DELTA"
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static uint32_t ota_delta_u32(const uint8_t *data);
+static void ota_delta_output(ota_delta_t *delta, const uint8_t *data, size_t len);
+static void ota_delta_flush(ota_delta_t *delta);
+static void ota_delta_check_old(ota_delta_t *delta);
+static bool ota_delta_varint(ota_delta_t *delta, uint8_t byte);
+static size_t ota_delta_parse(ota_delta_t *delta, const uint8_t *data, size_t len);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+static uint32_t ota_delta_u32(const uint8_t *data)
+{
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+esp_err_t ota_delta_init(ota_delta_t *delta, ota_delta_read_t read, ota_delta_write_t write, void *context)
+{
+    memset(delta, 0, sizeof(*delta));
+    delta->read = read;
+    delta->write = write;
+    delta->context = context;
+    delta->state = OTA_DELTA_HEADER;
+    delta->remaining = OTA_DELTA_HEADER_SIZE;
+    if (inflateInit2(&delta->zlib, OTA_DELTA_WINDOW_BITS) != Z_OK)
+    {
+        ESP_LOGE(TAG, "zlib init failed");
+        delta->err = ESP_ERR_NO_MEM;
+        return delta->err;
+    }
+    mbedtls_sha256_init(&delta->sha);
+    mbedtls_sha256_starts(&delta->sha, 0);
+    return ESP_OK;
+}
+
+/**
+ * @brief Append bytes to the new image
+ */
+static void ota_delta_output(ota_delta_t *delta, const uint8_t *data, size_t len)
+{
+    mbedtls_sha256_update(&delta->sha, data, len);
+    delta->new_pos += len;
+    while (len > 0 && delta->err == ESP_OK)
+    {
+        size_t copy = MIN(len, sizeof(delta->out) - delta->out_len);
+        memcpy(delta->out + delta->out_len, data, copy);
+        delta->out_len += copy;
+        data += copy;
+        len -= copy;
+        if (delta->out_len == sizeof(delta->out))
+        {
+            ota_delta_flush(delta);
+        }
+    }
+}
+
+static void ota_delta_flush(ota_delta_t *delta)
+{
+    if (delta->out_len > 0 && delta->err == ESP_OK)
+    {
+        delta->err = delta->write(delta->context, delta->out, delta->out_len);
+    }
+    delta->out_len = 0;
+}
+
+/**
+ * @brief Check that the patch was made from the running image, before anything is written
+ */
+static void ota_delta_check_old(ota_delta_t *delta)
+{
+    if (memcmp(delta->header, OTA_DELTA_MAGIC, 4) != 0)
+    {
+        ESP_LOGE(TAG, "Not a patch");
+        delta->err = ESP_ERR_INVALID_RESPONSE;
+        return;
+    }
+    delta->old_size = ota_delta_u32(delta->header + 4);
+    delta->new_size = ota_delta_u32(delta->header + 8);
+
+    mbedtls_sha256_context sha;
+    uint8_t sha256[OTA_DELTA_SHA256_SIZE];
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint32_t offset = 0; offset < delta->old_size && delta->err == ESP_OK; offset += sizeof(delta->old))
+    {
+        size_t len = MIN(sizeof(delta->old), delta->old_size - offset);
+        delta->err = delta->read(delta->context, offset, delta->old, len);
+        mbedtls_sha256_update(&sha, delta->old, len);
+    }
+    mbedtls_sha256_finish(&sha, sha256);
+    mbedtls_sha256_free(&sha);
+    if (delta->err == ESP_OK && memcmp(sha256, delta->header + 12, sizeof(sha256)) != 0)
+    {
+        ESP_LOGE(TAG, "Patch not made from the running image");
+        delta->err = ESP_ERR_INVALID_VERSION;
+    }
+    ESP_LOGI(TAG, "Patch %ld -> %ld bytes", delta->old_size, delta->new_size);
+}
+
+/**
+ * @brief Add a byte to the current varint
+ *
+ * @return true when the varint is complete, in delta->varint
+ */
+static bool ota_delta_varint(ota_delta_t *delta, uint8_t byte)
+{
+    if (delta->varint_shift > 56)
+    {
+        delta->err = ESP_ERR_INVALID_RESPONSE;
+        return false;
+    }
+    delta->varint |= (uint64_t)(byte & 0x7F) << delta->varint_shift;
+    delta->varint_shift += 7;
+    if (byte & 0x80)
+    {
+        return false;
+    }
+    delta->varint_shift = 0;
+    return true;
+}
+
+/**
+ * @brief Run the records on inflated bytes
+ *
+ * @return the number of bytes used
+ */
+static size_t ota_delta_parse(ota_delta_t *delta, const uint8_t *data, size_t len)
+{
+    size_t used = 0;
+    while (used < len && delta->err == ESP_OK)
+    {
+        switch (delta->state)
+        {
+        case OTA_DELTA_HEADER:
+        {
+            size_t copy = MIN(len - used, delta->remaining);
+            memcpy(delta->header + OTA_DELTA_HEADER_SIZE - delta->remaining, data + used, copy);
+            delta->remaining -= copy;
+            used += copy;
+            if (delta->remaining == 0)
+            {
+                ota_delta_check_old(delta);
+                delta->varint = 0;
+                delta->state = OTA_DELTA_DIFF_LEN;
+            }
+            break;
+        }
+        case OTA_DELTA_DIFF_LEN:
+        case OTA_DELTA_EXTRA_LEN:
+            if (!ota_delta_varint(delta, data[used++]))
+            {
+                break;
+            }
+            if (delta->varint > delta->new_size - delta->new_pos)
+            {
+                ESP_LOGE(TAG, "Record past the end of the new image");
+                delta->err = ESP_ERR_INVALID_RESPONSE;
+                break;
+            }
+            delta->remaining = delta->varint;
+            delta->varint = 0;
+            delta->state = (delta->state == OTA_DELTA_DIFF_LEN) ? OTA_DELTA_DIFF : OTA_DELTA_EXTRA;
+            if (delta->remaining == 0)
+            {
+                delta->state = (delta->state == OTA_DELTA_DIFF) ? OTA_DELTA_EXTRA_LEN : OTA_DELTA_SEEK;
+            }
+            break;
+        case OTA_DELTA_DIFF:
+        {
+            size_t copy = MIN(MIN(len - used, delta->remaining), sizeof(delta->old));
+            if (delta->old_pos > delta->old_size || copy > delta->old_size - delta->old_pos)
+            {
+                ESP_LOGE(TAG, "Diff past the end of the old image");
+                delta->err = ESP_ERR_INVALID_RESPONSE;
+                break;
+            }
+            delta->err = delta->read(delta->context, delta->old_pos, delta->old, copy);
+            for (size_t i = 0; i < copy; i++)
+            {
+                delta->old[i] += data[used + i];
+            }
+            ota_delta_output(delta, delta->old, copy);
+            delta->old_pos += copy;
+            delta->remaining -= copy;
+            used += copy;
+            if (delta->remaining == 0)
+            {
+                delta->state = OTA_DELTA_EXTRA_LEN;
+            }
+            break;
+        }
+        case OTA_DELTA_EXTRA:
+        {
+            size_t copy = MIN(len - used, delta->remaining);
+            ota_delta_output(delta, data + used, copy);
+            delta->remaining -= copy;
+            used += copy;
+            if (delta->remaining == 0)
+            {
+                delta->state = OTA_DELTA_SEEK;
+            }
+            break;
+        }
+        case OTA_DELTA_SEEK:
+            if (!ota_delta_varint(delta, data[used++]))
+            {
+                break;
+            }
+            // zigzag: 0, -1, 1, -2...
+            delta->old_pos += (int32_t)((delta->varint >> 1) ^ -(int64_t)(delta->varint & 1));
+            delta->varint = 0;
+            delta->state = (delta->new_pos == delta->new_size) ? OTA_DELTA_DONE : OTA_DELTA_DIFF_LEN;
+            break;
+        case OTA_DELTA_DONE:
+            ESP_LOGE(TAG, "Data after the end of the patch");
+            delta->err = ESP_ERR_INVALID_RESPONSE;
+            break;
+        }
+    }
+    return used;
+}
+
+esp_err_t ota_delta_feed(ota_delta_t *delta, const uint8_t *data, size_t len)
+{
+    delta->zlib.next_in = (Bytef *)data;
+    delta->zlib.avail_in = len;
+    while (delta->err == ESP_OK && delta->zlib.avail_in > 0)
+    {
+        if (delta->zlib_end)
+        {
+            ESP_LOGE(TAG, "Data after the end of the deflate stream");
+            delta->err = ESP_ERR_INVALID_RESPONSE;
+            break;
+        }
+        delta->zlib.next_out = delta->inflated;
+        delta->zlib.avail_out = sizeof(delta->inflated);
+        int ret = inflate(&delta->zlib, Z_NO_FLUSH);
+        if (ret == Z_BUF_ERROR)
+        {
+            break; // no progress possible, wait for the next part
+        }
+        if (ret != Z_OK && ret != Z_STREAM_END)
+        {
+            ESP_LOGE(TAG, "zlib inflate failed: %d", ret);
+            delta->err = ESP_ERR_INVALID_RESPONSE;
+            break;
+        }
+        delta->zlib_end = (ret == Z_STREAM_END);
+        ota_delta_parse(delta, delta->inflated, sizeof(delta->inflated) - delta->zlib.avail_out);
+    }
+    return delta->err;
+}
+
+esp_err_t ota_delta_finish(ota_delta_t *delta)
+{
+    // the output kept by zlib for a full buffer
+    while (delta->err == ESP_OK && !delta->zlib_end)
+    {
+        delta->zlib.next_out = delta->inflated;
+        delta->zlib.avail_out = sizeof(delta->inflated);
+        int ret = inflate(&delta->zlib, Z_NO_FLUSH);
+        size_t len = sizeof(delta->inflated) - delta->zlib.avail_out;
+        delta->zlib_end = (ret == Z_STREAM_END);
+        if (ret != Z_OK && ret != Z_STREAM_END)
+        {
+            break; // truncated or corrupted: checked below
+        }
+        ota_delta_parse(delta, delta->inflated, len);
+    }
+    ota_delta_flush(delta);
+    if (delta->err != ESP_OK)
+    {
+        return delta->err;
+    }
+    if (!delta->zlib_end || delta->state != OTA_DELTA_DONE)
+    {
+        ESP_LOGE(TAG, "Patch incomplete: %ld / %ld bytes", delta->new_pos, delta->new_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t sha256[OTA_DELTA_SHA256_SIZE];
+    mbedtls_sha256_finish(&delta->sha, sha256);
+    if (memcmp(sha256, delta->header + 12 + OTA_DELTA_SHA256_SIZE, sizeof(sha256)) != 0)
+    {
+        ESP_LOGE(TAG, "SHA-256 of the new image does not match");
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
+}
+
+void ota_delta_free(ota_delta_t *delta)
+{
+    inflateEnd(&delta->zlib);
+    mbedtls_sha256_free(&delta->sha);
+}
@@ -24,11 +24,19 @@
 #include <stdio.h>
 #include <string.h>
 #include "esp_check.h"
+#include "config.h"
+#include "storage_update.h"
 
 /*==============================================================================
  Local Define
 ===============================================================================*/
 #define TAG "OTA_ZLIB"
+
+#define OTA_ZLIB_FILE_MAGIC 0x0BEEF11E
+#define OTA_ZLIB_FILE_HEADER_SIZE 8 // magic, header version, header length
+#define OTA_ZLIB_ELEMENT_HEADER_SIZE 6
+#define OTA_ZLIB_TAG_APP 0x0000
+#define OTA_ZLIB_TAG_STORAGE 0x0100
 /*==============================================================================
  Local Macro
 ===============================================================================*/
@@ -36,10 +44,29 @@
 /*==============================================================================
  Local Type
 ===============================================================================*/
+/*
+ * The file of create-ota.py: the Zigbee OTA header, then sub-elements of a tag (u16 le), a size (u32 le) and the
+ * zlib-compressed image: the storage (0x100) then the app (0). Tuya sends the file without the Zigbee header.
+ * The storage must come first: it is staged at the end of the partition the app is then written to.
+ * The packets are cut anywhere: headers are collected byte by byte.
+ */
+typedef enum
+{
+    OTA_ZLIB_START,          // the Zigbee magic, or the beginning of the first sub-element
+    OTA_ZLIB_FILE_HEADER,    // up to the header length
+    OTA_ZLIB_SKIP,           // the rest of the file header, or a sub-element not handled
+    OTA_ZLIB_ELEMENT_HEADER, // tag and size
+    OTA_ZLIB_ELEMENT_DATA,   // the compressed image
+} ota_zlib_state_t;
 
 /*==============================================================================
  Local Function Declaration
 ===============================================================================*/
+static esp_err_t ota_zlib_header_done(void);
+static esp_err_t ota_zlib_element_start(void);
+static esp_err_t ota_zlib_element_end(void);
+static esp_err_t ota_zlib_inflate(const uint8_t *data, size_t len);
+static esp_err_t ota_zlib_output(const uint8_t *data, size_t len);
 
 /*==============================================================================
 Public Variable
@@ -48,25 +75,22 @@ Public Variable
 /*==============================================================================
  Local Variable
 ===============================================================================*/
-z_stream zlib_stream = {0};
-uint8_t zlib_init = 0;
-uint8_t zlib_buf[2048];
+static z_stream zlib_stream = {0};
+static bool zlib_init = false;
+static bool zlib_end = false; // the image of the current sub-element is complete
+static uint8_t zlib_buf[2048];
 
 static const esp_partition_t *ota_partition = NULL;
-static const esp_partition_t *storage_partition = NULL;
-static esp_ota_handle_t zigbee_ota_handle = 0;
-
-static size_t ota_data_len_ = 0;
-static size_t ota_header_len_ = 0;
-static bool ota_upgrade_subelement_ = false;
-static uint8_t ota_header_[6] = {0};
-static uint16_t subelement_type = 0;
-static uint32_t subelement_size = 0;
-static uint32_t storage_offset = 0;
-static uint32_t remaining_data = 0;
+static esp_ota_handle_t ota_zlib_handle = 0;
 
-uint8_t zigbee_ota_between_packet[2048];
-uint16_t zigbee_ota_between_packet_size = 0;
+static ota_zlib_state_t ota_zlib_state = OTA_ZLIB_START;
+static uint8_t ota_zlib_header[OTA_ZLIB_FILE_HEADER_SIZE];
+static uint8_t ota_zlib_header_len = 0;
+static uint16_t ota_zlib_tag = 0;
+static uint32_t ota_zlib_remaining = 0; // bytes to skip, or compressed bytes of the current sub-element
+static uint32_t ota_zlib_written = 0;   // inflated bytes of the current sub-element
+static bool ota_zlib_app_done = false;
+static esp_err_t ota_zlib_err = ESP_OK; // first error, the next parts are dropped
 
 /*==============================================================================
 Function Implementation
@@ -74,27 +98,10 @@ Function Implementation
 
 esp_err_t ota_zlib_init()
 {
-    ota_upgrade_subelement_ = false;
-    ota_data_len_ = 0;
-    ota_header_len_ = 0;
-
-    int ret = inflateInit(&zlib_stream);
-
-    if (ret == Z_OK)
-    {
-        zlib_init = 1;
-    }
-    else
-    {
-        ESP_LOGE(TAG, "zlib init failed: %d", ret);
-        return false;
-    }
-
     if (ota_partition != NULL)
     {
         ESP_LOGE(TAG, "OTA already started");
-        ota_partition = NULL;
-        esp_ota_abort(zigbee_ota_handle);
+        ota_zlib_abort();
         return ESP_FAIL;
     }
 
@@ -104,190 +111,266 @@ esp_err_t ota_zlib_init()
         ESP_LOGE(TAG, "OTA partition not found");
         return ESP_FAIL;
     }
-    storage_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, "storage");
-    if (storage_partition == NULL)
+
+    int ret = inflateInit(&zlib_stream);
+    if (ret != Z_OK)
     {
-        ESP_LOGE(TAG, "Storage partition not found");
-        return ESP_FAIL;
+        ESP_LOGE(TAG, "zlib init failed: %d", ret);
+        ota_partition = NULL;
+        return ESP_ERR_NO_MEM;
     }
+    zlib_init = true;
 
-    ret = esp_ota_begin(ota_partition, OTA_WITH_SEQUENTIAL_WRITES, &zigbee_ota_handle);
+    // the storage sub-element uses the end of this partition as scratch area: the app, written after it, starts at 0
+    ret = esp_ota_begin(ota_partition, OTA_WITH_SEQUENTIAL_WRITES, &ota_zlib_handle);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to begin OTA partition, status: %s", esp_err_to_name(ret));
         ota_partition = NULL;
+        ota_zlib_abort();
         return ESP_FAIL;
     }
+    ota_zlib_state = OTA_ZLIB_START;
+    ota_zlib_header_len = 0;
+    ota_zlib_app_done = false;
+    ota_zlib_err = ESP_OK;
     ESP_LOGI(TAG, "Init OK");
     return ESP_OK;
 }
 
 esp_err_t ota_zlib_write(const uint8_t *payload, size_t payload_size)
 {
-    esp_err_t ret = ESP_OK;
-    static uint32_t offset = 0;
-    offset += payload_size;
-
-    if (zigbee_ota_between_packet_size > 0)
+    if (ota_partition == NULL)
     {
-        ESP_LOGI(TAG, "OTA between packet: %d", zigbee_ota_between_packet_size);
-        memcpy(zigbee_ota_between_packet + zigbee_ota_between_packet_size, payload, payload_size);
-        payload = zigbee_ota_between_packet;
-        payload_size += zigbee_ota_between_packet_size;
-        // ESP_LOG_BUFFER_HEXDUMP(TAG, payload, payload_size, ESP_LOG_INFO);
-        zigbee_ota_between_packet_size = 0;
+        return ESP_ERR_INVALID_STATE;
     }
 
-    while (ota_header_len_ < 6 && payload_size > 0)
+    esp_err_t ret = ota_zlib_err;
+    while (payload_size > 0 && ret == ESP_OK)
     {
-        if ((payload[0] | payload[1] << 8 | payload[2] << 16 | payload[3] << 24) == 0x0BEEF11E)
+        size_t used = 0;
+        switch (ota_zlib_state)
         {
-            ESP_LOGI(TAG, "We have OTA Zigbee header, skip it");
-            payload += 56;
-            payload_size -= 56;
-            continue;
-        }
-
-        ota_header_[ota_header_len_] = payload[0];
-        ota_header_len_++;
-        payload++;
-        payload_size--;
-        ESP_LOGI(TAG, "OTA header len %zu:", ota_header_len_);
-        // ESP_LOG_BUFFER_HEXDUMP(TAG, ota_header_, ota_header_len_, ESP_LOG_WARN);
-        // ESP_LOG_BUFFER_HEXDUMP(TAG, payload, payload_size, ESP_LOG_WARN);
-    }
-
-    if (!ota_upgrade_subelement_ && ota_header_len_ == 6)
-    {
-        subelement_type = (ota_header_[1] << 8) | ota_header_[0];
-        subelement_size = (((int)ota_header_[5] & 0xFF) << 24) | (((int)ota_header_[4] & 0xFF) << 16) | (((int)ota_header_[3] & 0xFF) << 8) | ((int)ota_header_[2] & 0xFF);
-        ota_upgrade_subelement_ = true;
-        switch (subelement_type)
+        case OTA_ZLIB_START:
+        case OTA_ZLIB_FILE_HEADER:
+        case OTA_ZLIB_ELEMENT_HEADER:
         {
-        case 0:
-            ota_data_len_ = subelement_size;
-            ESP_LOGW(TAG, "OTA sub-element app [%lu/%lu]", offset, subelement_size);
+            uint8_t size = OTA_ZLIB_ELEMENT_HEADER_SIZE;
+            if (ota_zlib_state == OTA_ZLIB_START)
+            {
+                size = 4;
+            }
+            else if (ota_zlib_state == OTA_ZLIB_FILE_HEADER)
+            {
+                size = OTA_ZLIB_FILE_HEADER_SIZE;
+            }
+            used = MIN(payload_size, size - ota_zlib_header_len);
+            memcpy(ota_zlib_header + ota_zlib_header_len, payload, used);
+            ota_zlib_header_len += used;
+            if (ota_zlib_header_len == size)
+            {
+                ret = ota_zlib_header_done();
+            }
             break;
-
-        case 0x100:
-            ESP_LOGI(TAG, "OTA sub-element storage [%lu/%lu]", offset, subelement_size);
-            ota_data_len_ = subelement_size;
-            storage_offset = 0;
-            ret = esp_partition_erase_range(storage_partition, 0, storage_partition->size);
-            if (ret != ESP_OK)
+        }
+        case OTA_ZLIB_SKIP:
+            used = MIN(payload_size, ota_zlib_remaining);
+            ota_zlib_remaining -= used;
+            if (ota_zlib_remaining == 0)
             {
-                ESP_LOGE(TAG, "Failed to erase storage partition");
-                return ESP_FAIL;
+                ota_zlib_state = OTA_ZLIB_ELEMENT_HEADER;
             }
-            ESP_LOGI(TAG, "Storage partition erased");
             break;
-        default:
-            ESP_LOGE(TAG, "OTA sub-element type %02x%02x not supported", ota_header_[0], ota_header_[1]);
-            return ESP_FAIL;
-
+        case OTA_ZLIB_ELEMENT_DATA:
+            used = MIN(payload_size, ota_zlib_remaining);
+            ret = ota_zlib_inflate(payload, used);
+            ota_zlib_remaining -= used;
+            if (ret == ESP_OK && ota_zlib_remaining == 0)
+            {
+                ret = ota_zlib_element_end();
+            }
             break;
         }
+        payload += used;
+        payload_size -= used;
     }
+    ota_zlib_err = ret;
+    return ret;
+}
 
-    if (ota_data_len_)
+/**
+ * @brief A header is complete in ota_zlib_header
+ */
+static esp_err_t ota_zlib_header_done(void)
+{
+    const uint8_t *header = ota_zlib_header;
+    switch (ota_zlib_state)
     {
-        if (zlib_init == 0)
+    case OTA_ZLIB_START:
+        if ((header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24) == OTA_ZLIB_FILE_MAGIC)
         {
-            int ret = inflateInit(&zlib_stream);
-            if (ret == Z_OK)
-            {
-                zlib_init = 1;
-            }
-            else
-            {
-                ESP_LOGE(TAG, "zlib init failed: %d", ret);
-                return ESP_FAIL;
-            }
+            ESP_LOGI(TAG, "We have OTA Zigbee header, skip it");
+            ota_zlib_state = OTA_ZLIB_FILE_HEADER;
+        }
+        else
+        {
+            ota_zlib_state = OTA_ZLIB_ELEMENT_HEADER; // the 4 bytes are the beginning of the first sub-element
         }
+        return ESP_OK;
 
-        remaining_data = payload_size - ota_data_len_;
-        payload_size = MIN(ota_data_len_, payload_size);
-        ota_data_len_ -= payload_size;
+    case OTA_ZLIB_FILE_HEADER:
+    {
+        uint16_t header_length = header[6] | header[7] << 8;
+        if (header_length < OTA_ZLIB_FILE_HEADER_SIZE)
+        {
+            ESP_LOGE(TAG, "Bad OTA header length: %d", header_length);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        ota_zlib_remaining = header_length - OTA_ZLIB_FILE_HEADER_SIZE;
+        ota_zlib_header_len = 0;
+        ota_zlib_state = (ota_zlib_remaining > 0) ? OTA_ZLIB_SKIP : OTA_ZLIB_ELEMENT_HEADER;
+        return ESP_OK;
+    }
 
-        zlib_stream.avail_in = payload_size;
-        zlib_stream.next_in = (Bytef *)payload;
+    case OTA_ZLIB_ELEMENT_HEADER:
+        ota_zlib_tag = header[0] | header[1] << 8;
+        ota_zlib_remaining = header[2] | header[3] << 8 | header[4] << 16 | (uint32_t)header[5] << 24;
+        ota_zlib_header_len = 0;
+        return ota_zlib_element_start();
+
+    default:
+        return ESP_ERR_INVALID_STATE;
+    }
+}
+
+static esp_err_t ota_zlib_element_start(void)
+{
+    esp_err_t ret = ESP_OK;
+    switch (ota_zlib_tag)
+    {
+    case OTA_ZLIB_TAG_APP:
+        ESP_LOGI(TAG, "OTA sub-element app: %ld bytes", ota_zlib_remaining);
+        break;
 
-        do
+    case OTA_ZLIB_TAG_STORAGE:
+        ESP_LOGI(TAG, "OTA sub-element storage: %ld bytes", ota_zlib_remaining);
+        if (ota_zlib_app_done)
         {
-            zlib_stream.avail_out = sizeof(zlib_buf);
-            zlib_stream.next_out = zlib_buf;
+            // the scratch area would be erased under the app just written
+            ESP_LOGE(TAG, "OTA sub-element storage after the app: not supported");
+            return ESP_ERR_INVALID_STATE;
+        }
+        // staged and checked before the storage partition is replaced, as the HTTP storage update
+        ret = storage_update_begin();
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to start the storage update: %s", esp_err_to_name(ret));
+            return ret;
+        }
+        break;
 
-            ret = inflate(&zlib_stream, Z_NO_FLUSH);
-            if (ret == Z_STREAM_ERROR || ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
-            {
-                ESP_LOGE(TAG, "zlib inflate failed: %d", ret);
-                return ESP_FAIL;
-            }
+    default:
+        ESP_LOGW(TAG, "OTA sub-element type %04x not supported, skipped", ota_zlib_tag);
+        ota_zlib_state = (ota_zlib_remaining > 0) ? OTA_ZLIB_SKIP : OTA_ZLIB_ELEMENT_HEADER;
+        return ESP_OK;
+    }
 
-            size_t have = sizeof(zlib_buf) - zlib_stream.avail_out;
-            if (have)
-            {
-                switch (subelement_type)
-                {
-                case 0:
-                    ESP_LOGI(TAG, "OTA sub-element Firmware [%lu/%lu]", offset, subelement_size);
-                    ret = esp_ota_write(zigbee_ota_handle, zlib_buf, have);
-                    if (ret != ESP_OK)
-                    {
-                        ESP_LOGE(TAG, "Failed to write OTA data to partition, status: %s", esp_err_to_name(ret));
-                        return ESP_FAIL;
-                    }
-                    break;
-                case 0x100:
-                    ESP_LOGI(TAG, "OTA sub-element Storage [%lu/%lu]", subelement_size - ota_data_len_, subelement_size);
-                    ret = esp_partition_write(storage_partition, storage_offset, zlib_buf, have);
-                    ESP_LOGI(TAG, "Write %zu bytes to storage partition at offset %ld", have, storage_offset);
-                    storage_offset += have;
-                    if (ret != ESP_OK)
-                    {
-                        ESP_LOGE(TAG, "Failed to write OTA data to storage partition, status: 0x%x %s", ret, esp_err_to_name(ret));
-                        return ESP_FAIL;
-                    }
-                    break;
-                default:
-                    break;
-                }
-            }
-        } while (zlib_stream.avail_out == 0);
+    if (ota_zlib_remaining == 0)
+    {
+        ESP_LOGE(TAG, "OTA sub-element %04x empty", ota_zlib_tag);
+        return ESP_ERR_INVALID_SIZE;
     }
+    inflateReset(&zlib_stream);
+    zlib_end = false;
+    ota_zlib_written = 0;
+    ota_zlib_state = OTA_ZLIB_ELEMENT_DATA;
+    return ESP_OK;
+}
 
-    if (ota_data_len_ == 0)
+static esp_err_t ota_zlib_element_end(void)
+{
+    ota_zlib_state = OTA_ZLIB_ELEMENT_HEADER;
+    if (!zlib_end)
     {
-        inflateEnd(&zlib_stream);
-        zlib_init = 0;
-        // ESP_LOGI(TAG, "OTA data len 0, remaining data %lu", remaining_data);
-        payload += payload_size;
-        // ESP_LOG_BUFFER_HEXDUMP(TAG, payload, remaining_data, ESP_LOG_WARN);
+        ESP_LOGE(TAG, "OTA sub-element %04x: compressed image incomplete", ota_zlib_tag);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ESP_LOGI(TAG, "OTA sub-element %04x done: %ld bytes", ota_zlib_tag, ota_zlib_written);
+    if (ota_zlib_tag == OTA_ZLIB_TAG_STORAGE)
+    {
+        esp_err_t ret = storage_update_end(NULL);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Storage update failed: %s", esp_err_to_name(ret));
+        }
+        return ret;
+    }
+    ota_zlib_app_done = true;
+    return ESP_OK;
+}
 
-        ota_upgrade_subelement_ = false;
-        ota_header_len_ = 0;
-        while (ota_header_len_ < 6 && payload_size > 0)
+/**
+ * @brief Inflate compressed bytes of the current sub-element to its partition
+ */
+static esp_err_t ota_zlib_inflate(const uint8_t *data, size_t len)
+{
+    zlib_stream.next_in = (Bytef *)data;
+    zlib_stream.avail_in = len;
+    do
+    {
+        zlib_stream.next_out = zlib_buf;
+        zlib_stream.avail_out = sizeof(zlib_buf);
+        int ret = inflate(&zlib_stream, Z_NO_FLUSH);
+        if (ret == Z_BUF_ERROR)
         {
-            ota_header_[ota_header_len_] = payload[0];
-            ota_header_len_++;
-            payload_size--;
-            remaining_data--;
-            payload++;
-            // ESP_LOGI(TAG, "OTA header len END %zu:", ota_header_len_);
-            // ESP_LOG_BUFFER_HEXDUMP(TAG, ota_header_, ota_header_len_, ESP_LOG_WARN);
-            // ESP_LOG_BUFFER_HEXDUMP(TAG, messsage.payload, messsage.payload_size, ESP_LOG_WARN);
+            break; // everything given out, wait for the next packet
         }
-        if (remaining_data)
+        if (ret != Z_OK && ret != Z_STREAM_END)
         {
-            ESP_LOGI(TAG, "Save remaining data %lu", remaining_data);
-            // ESP_LOG_BUFFER_HEXDUMP(TAG, payload, remaining_data, ESP_LOG_WARN);
-            memcpy(zigbee_ota_between_packet, payload, remaining_data);
-            zigbee_ota_between_packet_size = remaining_data;
+            ESP_LOGE(TAG, "zlib inflate failed: %d", ret);
+            return ESP_ERR_INVALID_RESPONSE;
         }
+        zlib_end = (ret == Z_STREAM_END);
+        esp_err_t err = ota_zlib_output(zlib_buf, sizeof(zlib_buf) - zlib_stream.avail_out);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    } while (!zlib_end && (zlib_stream.avail_in > 0 || zlib_stream.avail_out == 0));
+
+    if (zlib_end && zlib_stream.avail_in > 0)
+    {
+        ESP_LOGE(TAG, "OTA sub-element %04x: data after the compressed image", ota_zlib_tag);
+        return ESP_ERR_INVALID_SIZE;
     }
     return ESP_OK;
 }
 
+static esp_err_t ota_zlib_output(const uint8_t *data, size_t len)
+{
+    if (len == 0)
+    {
+        return ESP_OK;
+    }
+    esp_err_t ret = ESP_OK;
+    ESP_LOGD(TAG, "OTA sub-element %04x: %ld bytes", ota_zlib_tag, ota_zlib_written + len);
+    if (ota_zlib_tag == OTA_ZLIB_TAG_STORAGE)
+    {
+        ret = storage_update_write(data, len);
+    }
+    else
+    {
+        ret = esp_ota_write(ota_zlib_handle, data, len);
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write OTA sub-element %04x, status: %s", ota_zlib_tag, esp_err_to_name(ret));
+        return ret;
+    }
+    ota_zlib_written += len;
+    return ESP_OK;
+}
+
 static void reboot_task(void *pvParameter)
 {
     vTaskDelay(10000 / portTICK_PERIOD_MS);
@@ -297,11 +380,44 @@ static void reboot_task(void *pvParameter)
 esp_err_t ota_zlib_end()
 {
     esp_err_t ret = ESP_OK;
-    ret = esp_ota_end(zigbee_ota_handle);
+    if (ota_partition == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (ota_zlib_err != ESP_OK)
+    {
+        ota_zlib_abort();
+        return ota_zlib_err;
+    }
+    if (!ota_zlib_app_done || ota_zlib_state != OTA_ZLIB_ELEMENT_HEADER || ota_zlib_header_len != 0)
+    {
+        ESP_LOGE(TAG, "OTA file incomplete");
+        ota_zlib_abort();
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const esp_partition_t *partition = ota_partition;
+    ota_partition = NULL; // the handle is released by esp_ota_end(), even on error
+    ota_zlib_abort();
+    ret = esp_ota_end(ota_zlib_handle);
     ESP_RETURN_ON_ERROR(ret, TAG, "Failed to end OTA partition, status: %s", esp_err_to_name(ret));
-    ret = esp_ota_set_boot_partition(ota_partition);
+    ret = esp_ota_set_boot_partition(partition);
     ESP_RETURN_ON_ERROR(ret, TAG, "Failed to set OTA boot partition, status: %s", esp_err_to_name(ret));
     ESP_LOGW(TAG, "Prepare to restart system in 10s");
     xTaskCreate(&reboot_task, "reboot_task", 2048, NULL, 20, NULL);
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+void ota_zlib_abort()
+{
+    if (ota_partition != NULL)
+    {
+        esp_ota_abort(ota_zlib_handle);
+        ota_partition = NULL;
+    }
+    if (zlib_init)
+    {
+        inflateEnd(&zlib_stream);
+        zlib_init = false;
+    }
+    storage_update_abort();
+}
@@ -28,6 +28,7 @@
 #include "esp_pm.h"
 #include "led.h"
 #include "tuya.h"
+#include "lwip/inet.h"
 /*==============================================================================
  Local Define
 ===============================================================================*/
@@ -105,6 +106,20 @@ static int ota_start(int argc, char **argv);
 
 static int set_refresh_command(int argc, char **argv);
 static int get_refresh_command(int argc, char **argv);
+static int set_encoding_command(int argc, char **argv);
+static int get_encoding_command(int argc, char **argv);
+static int set_gzip_command(int argc, char **argv);
+static int get_gzip_command(int argc, char **argv);
+static int set_columns_command(int argc, char **argv);
+static int get_columns_command(int argc, char **argv);
+static int set_ca_command(int argc, char **argv);
+static int get_ca_command(int argc, char **argv);
+static int set_udp_command(int argc, char **argv);
+static int get_udp_command(int argc, char **argv);
+static int set_coap_command(int argc, char **argv);
+static int get_coap_command(int argc, char **argv);
+static int set_modbus_command(int argc, char **argv);
+static int get_modbus_command(int argc, char **argv);
 // static esp_err_t esp_console_register_reset_command(void);
 static int led_off(int argc, char **argv);
 static int factory_reset(int argc, char **argv);
@@ -158,10 +173,30 @@ static const shell_cmd_t shell_cmds[] = {
                                     "2 - Wifi - MQTT\n"
                                     "3 - Wifi - MQTT Home Assistant\n"
                                     "4 - Zigbee\n"
-                                    "5 - Tuya\n",                               &set_mode_command,                  1, {"<mode>"}, {"Mode of operation"}},
+                                    "5 - Tuya\n"
+                                    "6 - Wifi - UDP multicast\n"
+                                    "7 - Wifi - CoAP\n"
+                                    "8 - Wifi - Modbus TCP server\n",           &set_mode_command,                  1, {"<mode>"}, {"Mode of operation"}},
 
     {"set-refresh",                 "Set refresh rate",                         &set_refresh_command,               1, {"<refresh>"}, {"Refresh rate in seconds"}},
     {"get-refresh",                 "Get refresh rate",                         &get_refresh_command,               0, {}, {}},
+    {"set-encoding",                "Set payload encoding\n"
+                                    "0 - JSON\n"
+                                    "1 - CBOR\n"
+                                    "2 - InfluxDB line protocol (HTTP)\n",      &set_encoding_command,              1, {"<encoding>"}, {"Encoding of HTTP and MQTT payloads"}},
+    {"get-encoding",                "Get payload encoding",                     &get_encoding_command,              0, {}, {}},
+    {"set-gzip",                    "Set gzip compression of HTTP POST",        &set_gzip_command,                  1, {"<gzip>"}, {"0 - disabled, 1 - enabled"}},
+    {"get-gzip",                    "Get gzip compression of HTTP POST",        &get_gzip_command,                  0, {}, {}},
+    {"set-columns",                 "Set HTTP batches by columns",              &set_columns_command,               1, {"<columns>"}, {"0 - one object per sample, 1 - by columns"}},
+    {"get-columns",                 "Get HTTP batches by columns",              &get_columns_command,               0, {}, {}},
+    {"set-ca",                      "Set the CA pinned for https / mqtts",      &set_ca_command,                    2, {"<web|mqtt>", "<file>"}, {"Exporter", "PEM file in /storage e.g. ISRG_root_x1.pem, - for no TLS"}},
+    {"get-ca",                      "Get the CA pinned for https / mqtts",      &get_ca_command,                    0, {}, {}},
+    {"set-udp",                     "Set udp config",                           &set_udp_command,                   3, {"<host>", "<port>", "<key>"}, {"Multicast group or broadcast address e.g. 239.255.84.73", "Port e.g. 8473", "HMAC key of the datagrams, - for unsigned datagrams"}},
+    {"get-udp",                     "Get udp config",                           &get_udp_command,                   0, {}, {}},
+    {"set-coap",                    "Set coap config",                          &set_coap_command,                  3, {"<host>", "<port>", "<path>"}, {"Host of the CoAP server e.g. 192.168.1.10", "Port e.g. 5683", "Path of the POST e.g. tic"}},
+    {"get-coap",                    "Get coap config",                          &get_coap_command,                  0, {}, {}},
+    {"set-modbus",                  "Set modbus config",                        &set_modbus_command,                2, {"<port>", "<unit>"}, {"TCP port e.g. 502", "Unit id e.g. 1, 255 is answered too"}},
+    {"get-modbus",                  "Get modbus config",                        &get_modbus_command,                0, {}, {}},
     {"get-config",                  "Get config",                               &get_config_command,                0, {}, {}},
     {"set-config",                  "Set config",                               &set_config_command,                0, {}, {}},
     {"get-VCondo",                  "Get VCondo",                               &get_VCondo_command,                0, {}, {}},
@@ -769,6 +804,227 @@ static int get_refresh_command(int argc, char **argv)
   return 0;
 }
 
+static int set_encoding_command(int argc, char **argv)
+{
+  if (argc != 2)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int encoding = atoi(argv[1]);
+  if (encoding < 0 || encoding >= ENCODING_LAST)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  config_values.encoding = encoding;
+  config_write();
+  printf("Encoding saved\n");
+  get_encoding_command(1, NULL);
+  return 0;
+}
+
+static int get_encoding_command(int argc, char **argv)
+{
+  if (argc != 1)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  printf("Encoding: %s\n", ENCODINGS[config_values.encoding]);
+  return 0;
+}
+
+static int set_gzip_command(int argc, char **argv)
+{
+  if (argc != 2)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  config_values.gzip = atoi(argv[1]) ? 1 : 0;
+  config_write();
+  printf("Gzip saved\n");
+  get_gzip_command(1, NULL);
+  return 0;
+}
+
+static int get_gzip_command(int argc, char **argv)
+{
+  if (argc != 1)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  printf("Gzip: %s\n", config_values.gzip ? "enabled" : "disabled");
+  return 0;
+}
+
+static int set_columns_command(int argc, char **argv)
+{
+  if (argc != 2)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  config_values.columns = atoi(argv[1]) ? 1 : 0;
+  config_write();
+  printf("Columns saved\n");
+  get_columns_command(1, NULL);
+  return 0;
+}
+
+static int get_columns_command(int argc, char **argv)
+{
+  if (argc != 1)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  printf("Columns: %s\n", config_values.columns ? "enabled" : "disabled");
+  return 0;
+}
+
+static int set_ca_command(int argc, char **argv)
+{
+  if (argc != 3)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  char *ca = NULL;
+  size_t size = 0;
+  if (strcmp(argv[1], "web") == 0)
+  {
+    ca = config_values.web_ca;
+    size = sizeof(config_values.web_ca);
+  }
+  else if (strcmp(argv[1], "mqtt") == 0)
+  {
+    ca = config_values.mqtt_ca;
+    size = sizeof(config_values.mqtt_ca);
+  }
+  else
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (strcmp(argv[2], "-") == 0)
+  {
+    ca[0] = '\0';
+  }
+  else
+  {
+    char *cert = config_read_cert(argv[2]);
+    if (cert == NULL)
+    {
+      printf("Cant read " STORAGE_PATH "/%s\n", argv[2]);
+      return ESP_ERR_NOT_FOUND;
+    }
+    free(cert);
+    strlcpy(ca, argv[2], size);
+  }
+  config_write();
+  printf("CA saved\n");
+  get_ca_command(1, NULL);
+  return 0;
+}
+
+static int get_ca_command(int argc, char **argv)
+{
+  if (argc != 1)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  printf("Web: %s\n", strlen(config_values.web_ca) > 0 ? config_values.web_ca : "no TLS");
+  printf("MQTT: %s\n", strlen(config_values.mqtt_ca) > 0 ? config_values.mqtt_ca : "no TLS");
+  return 0;
+}
+
+static int set_udp_command(int argc, char **argv)
+{
+  if (argc != 4)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  struct in_addr addr;
+  int port = atoi(argv[2]);
+  if (inet_aton(argv[1], &addr) == 0 || port <= 0 || port > 65535)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  strlcpy(config_values.udp.host, argv[1], sizeof(config_values.udp.host));
+  config_values.udp.port = port;
+  strlcpy(config_values.udp.key, strcmp(argv[3], "-") == 0 ? "" : argv[3], sizeof(config_values.udp.key));
+  config_write();
+  printf("UDP config saved\n");
+  return 0;
+}
+
+static int get_udp_command(int argc, char **argv)
+{
+  if (argc != 1)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  printf("Host: %s\n", config_values.udp.host);
+  printf("Port: %d\n", config_values.udp.port);
+  shell_print_obfuscated("Key", config_values.udp.key);
+  return 0;
+}
+
+static int set_coap_command(int argc, char **argv)
+{
+  if (argc != 4)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int port = atoi(argv[2]);
+  if (port <= 0 || port > 65535)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  strlcpy(config_values.coap.host, argv[1], sizeof(config_values.coap.host));
+  config_values.coap.port = port;
+  strlcpy(config_values.coap.path, argv[3], sizeof(config_values.coap.path));
+  config_write();
+  printf("CoAP config saved\n");
+  return 0;
+}
+
+static int get_coap_command(int argc, char **argv)
+{
+  if (argc != 1)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  printf("Host: %s\n", config_values.coap.host);
+  printf("Port: %d\n", config_values.coap.port);
+  printf("Path: %s\n", config_values.coap.path);
+  return 0;
+}
+
+static int set_modbus_command(int argc, char **argv)
+{
+  if (argc != 3)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int port = atoi(argv[1]);
+  int unit = atoi(argv[2]);
+  if (port <= 0 || port > 65535 || unit <= 0 || unit > 255)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  config_values.modbus.port = port;
+  config_values.modbus.unit_id = unit;
+  config_write();
+  printf("Modbus config saved\n");
+  return 0;
+}
+
+static int get_modbus_command(int argc, char **argv)
+{
+  if (argc != 1)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  printf("Port: %d\n", config_values.modbus.port);
+  printf("Unit id: %d\n", config_values.modbus.unit_id);
+  return 0;
+}
+
 static int led_off(int argc, char **argv)
 {
   gpio_set_level(LED_EN, 0);
@@ -0,0 +1,506 @@
+/**
+ * @file storage_update.c
+ * @author Dorian Benech
+ * @brief Streamed update of the storage partition, staged in a scratch area so a power loss cannot leave it half written
+ * @version 1.0
+ * @date 2024-09-10
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "storage_update.h"
+#include "config.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "esp_littlefs.h"
+#include "mbedtls/sha256.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define TAG "STORAGE_UPDATE"
+
+#define STORAGE_UPDATE_MAGIC 0x50555453       // "STUP"
+#define STORAGE_UPDATE_FILES_MAGIC 0x53465453 // "STFS"
+#define STORAGE_UPDATE_PENDING 0xFFFFFFFF
+#define STORAGE_UPDATE_DONE 0x00000000
+#define STORAGE_UPDATE_CHUNK_SIZE 4096 // buffer of the copy and of the checks
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+// first sector of the scratch area
+typedef struct
+{
+    uint32_t magic;
+    uint32_t size;                               // of the image
+    uint8_t sha256[STORAGE_UPDATE_SHA256_SIZE]; // of the image
+    uint32_t state;                              // PENDING until the copy is checked, then cleared to DONE without erase
+} storage_update_header_t;
+
+// a file staged by storage_update_stage_files(), followed by its data
+typedef struct
+{
+    char name[STORAGE_UPDATE_NAME_SIZE];
+    uint32_t size;
+} storage_update_file_t;
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static esp_err_t storage_update_find(void);
+static esp_err_t storage_update_hash(const esp_partition_t *partition, uint32_t offset, uint32_t size, uint8_t *sha256);
+static esp_err_t storage_update_stage(storage_update_header_t *header);
+static esp_err_t storage_update_copy(const storage_update_header_t *header);
+static esp_err_t storage_update_restore(const storage_update_header_t *header);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+static const esp_partition_t *storage_update_storage = NULL;
+static const esp_partition_t *storage_update_scratch = NULL;
+static uint32_t storage_update_header_offset = 0; // in storage_update_scratch
+static uint32_t storage_update_image_offset = 0;  // in storage_update_scratch
+
+static bool storage_update_started = false;
+static esp_err_t storage_update_err = ESP_OK;
+static uint32_t storage_update_size = 0; // received
+static mbedtls_sha256_context storage_update_sha;
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+
+/**
+ * @brief Find the storage partition and place the scratch area at the end of the next OTA partition
+ */
+static esp_err_t storage_update_find(void)
+{
+    // still the spiffs subtype in the partition table, the image is a LittleFS, or a SPIFFS migrated at boot
+    storage_update_storage = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, STORAGE_PARTITION);
+    storage_update_scratch = esp_ota_get_next_update_partition(NULL);
+    if (storage_update_storage == NULL || storage_update_scratch == NULL)
+    {
+        ESP_LOGE(TAG, "Storage or OTA partition not found");
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint32_t sector = storage_update_scratch->erase_size;
+    uint32_t image_size = (storage_update_storage->size + sector - 1) / sector * sector;
+    if (storage_update_scratch->size < sector + image_size)
+    {
+        ESP_LOGE(TAG, "OTA partition too small for the scratch area: %ld", storage_update_scratch->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    storage_update_header_offset = storage_update_scratch->size - sector - image_size;
+    storage_update_image_offset = storage_update_header_offset + sector;
+    return ESP_OK;
+}
+
+/**
+ * @brief SHA-256 of a range of a partition, read by chunks
+ */
+static esp_err_t storage_update_hash(const esp_partition_t *partition, uint32_t offset, uint32_t size, uint8_t *sha256)
+{
+    uint8_t *buffer = malloc(STORAGE_UPDATE_CHUNK_SIZE);
+    if (buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = ESP_OK;
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint32_t done = 0; done < size && err == ESP_OK; done += STORAGE_UPDATE_CHUNK_SIZE)
+    {
+        uint32_t len = MIN(STORAGE_UPDATE_CHUNK_SIZE, size - done);
+        err = esp_partition_read(partition, offset + done, buffer, len);
+        mbedtls_sha256_update(&sha, buffer, len);
+    }
+    mbedtls_sha256_finish(&sha, sha256);
+    mbedtls_sha256_free(&sha);
+    free(buffer);
+    return err;
+}
+
+esp_err_t storage_update_begin(void)
+{
+    storage_update_abort();
+    esp_err_t err = storage_update_find();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    err = esp_partition_erase_range(storage_update_scratch, storage_update_header_offset,
+                                    storage_update_scratch->size - storage_update_header_offset);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to erase the scratch area: %s", esp_err_to_name(err));
+        return err;
+    }
+    mbedtls_sha256_init(&storage_update_sha);
+    mbedtls_sha256_starts(&storage_update_sha, 0);
+    storage_update_size = 0;
+    storage_update_err = ESP_OK;
+    storage_update_started = true;
+    ESP_LOGI(TAG, "Scratch area: %s at 0x%lx", storage_update_scratch->label, storage_update_image_offset);
+    return ESP_OK;
+}
+
+esp_err_t storage_update_write(const void *data, size_t len)
+{
+    if (!storage_update_started)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (storage_update_err != ESP_OK)
+    {
+        return storage_update_err;
+    }
+    if (storage_update_size + len > storage_update_storage->size)
+    {
+        ESP_LOGE(TAG, "Image bigger than the storage partition: %ld + %d > %ld", storage_update_size, len, storage_update_storage->size);
+        storage_update_err = ESP_ERR_INVALID_SIZE;
+        return storage_update_err;
+    }
+    storage_update_err = esp_partition_write(storage_update_scratch, storage_update_image_offset + storage_update_size, data, len);
+    if (storage_update_err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write the scratch area: %s", esp_err_to_name(storage_update_err));
+        return storage_update_err;
+    }
+    mbedtls_sha256_update(&storage_update_sha, data, len);
+    storage_update_size += len;
+    return ESP_OK;
+}
+
+esp_err_t storage_update_end(const uint8_t *sha256)
+{
+    if (!storage_update_started)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    storage_update_header_t header = {
+        .magic = STORAGE_UPDATE_MAGIC,
+        .size = storage_update_size,
+        .state = STORAGE_UPDATE_PENDING,
+    };
+    mbedtls_sha256_finish(&storage_update_sha, header.sha256);
+    esp_err_t err = storage_update_err;
+    storage_update_abort();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (header.size != storage_update_storage->size)
+    {
+        ESP_LOGE(TAG, "Image size is not correct: %ld != %ld", header.size, storage_update_storage->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (sha256 != NULL && memcmp(sha256, header.sha256, sizeof(header.sha256)) != 0)
+    {
+        ESP_LOGE(TAG, "Image SHA-256 does not match the manifest");
+        return ESP_ERR_INVALID_CRC;
+    }
+    err = storage_update_stage(&header);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    return storage_update_copy(&header);
+}
+
+/**
+ * @brief Check the scratch area against the SHA-256 of the header and write the header: from now on, a reset
+ * finishes the update at boot
+ */
+static esp_err_t storage_update_stage(storage_update_header_t *header)
+{
+    // the data was hashed as received: read it back, a bad write of the scratch area would be copied
+    uint8_t staged[STORAGE_UPDATE_SHA256_SIZE];
+    esp_err_t err = storage_update_hash(storage_update_scratch, storage_update_image_offset, header->size, staged);
+    if (err != ESP_OK || memcmp(staged, header->sha256, sizeof(staged)) != 0)
+    {
+        ESP_LOGE(TAG, "Scratch area does not read back");
+        return err != ESP_OK ? err : ESP_ERR_INVALID_CRC;
+    }
+    err = esp_partition_write(storage_update_scratch, storage_update_header_offset, header, sizeof(*header));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write the header: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+void storage_update_abort(void)
+{
+    if (storage_update_started)
+    {
+        mbedtls_sha256_free(&storage_update_sha);
+    }
+    storage_update_started = false;
+}
+
+/**
+ * @brief Copy the staged image to the storage partition, check it, and mark the header done
+ *
+ * A reset before the header is marked leaves it pending: storage_update_resume() does the copy again.
+ */
+static esp_err_t storage_update_copy(const storage_update_header_t *header)
+{
+    uint8_t *buffer = malloc(STORAGE_UPDATE_CHUNK_SIZE);
+    if (buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_vfs_littlefs_unregister(STORAGE_PARTITION); // the image replaces the mounted file system, the restart mounts it
+    esp_err_t err = esp_partition_erase_range(storage_update_storage, 0, storage_update_storage->size);
+    for (uint32_t done = 0; done < header->size && err == ESP_OK; done += STORAGE_UPDATE_CHUNK_SIZE)
+    {
+        uint32_t len = MIN(STORAGE_UPDATE_CHUNK_SIZE, header->size - done);
+        err = esp_partition_read(storage_update_scratch, storage_update_image_offset + done, buffer, len);
+        if (err == ESP_OK)
+        {
+            err = esp_partition_write(storage_update_storage, done, buffer, len);
+        }
+    }
+    free(buffer);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to copy the image: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    uint8_t sha256[STORAGE_UPDATE_SHA256_SIZE];
+    err = storage_update_hash(storage_update_storage, 0, header->size, sha256);
+    if (err != ESP_OK || memcmp(sha256, header->sha256, sizeof(sha256)) != 0)
+    {
+        ESP_LOGE(TAG, "Storage partition does not read back, the copy is done again at boot");
+        return err != ESP_OK ? err : ESP_ERR_INVALID_CRC;
+    }
+    uint32_t state = STORAGE_UPDATE_DONE;
+    err = esp_partition_write(storage_update_scratch, storage_update_header_offset + offsetof(storage_update_header_t, state),
+                              &state, sizeof(state));
+    ESP_LOGI(TAG, "Storage partition updated: %ld bytes", header->size);
+    return err;
+}
+
+esp_err_t storage_update_stage_files(void)
+{
+    esp_err_t err = storage_update_begin();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    uint8_t *buffer = malloc(STORAGE_UPDATE_CHUNK_SIZE);
+    DIR *dir = opendir(STORAGE_PATH);
+    if (buffer == NULL || dir == NULL)
+    {
+        storage_update_err = (buffer == NULL) ? ESP_ERR_NO_MEM : ESP_FAIL;
+    }
+    uint16_t count = 0;
+    struct dirent *entry;
+    while (storage_update_err == ESP_OK && (entry = readdir(dir)) != NULL)
+    {
+        char path[sizeof(STORAGE_PATH) + STORAGE_UPDATE_NAME_SIZE];
+        snprintf(path, sizeof(path), STORAGE_PATH "/%s", entry->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to read %s", path);
+            storage_update_err = ESP_FAIL;
+            break;
+        }
+        storage_update_file_t staged = {.size = st.st_size};
+        strlcpy(staged.name, entry->d_name, sizeof(staged.name));
+        storage_update_write(&staged, sizeof(staged));
+        for (uint32_t done = 0; done < staged.size && storage_update_err == ESP_OK;)
+        {
+            size_t len = fread(buffer, 1, MIN(STORAGE_UPDATE_CHUNK_SIZE, staged.size - done), file);
+            if (len == 0)
+            {
+                ESP_LOGE(TAG, "Failed to read %s", path);
+                storage_update_err = ESP_FAIL;
+            }
+            storage_update_write(buffer, len);
+            done += len;
+        }
+        fclose(file);
+        count++;
+    }
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+    free(buffer);
+
+    storage_update_header_t header = {
+        .magic = STORAGE_UPDATE_FILES_MAGIC,
+        .size = storage_update_size,
+        .state = STORAGE_UPDATE_PENDING,
+    };
+    mbedtls_sha256_finish(&storage_update_sha, header.sha256);
+    err = storage_update_err;
+    storage_update_abort();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    err = storage_update_stage(&header);
+    if (err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Storage files staged: %d files, %ld bytes", count, header.size);
+    }
+    return err;
+}
+
+/**
+ * @brief Format the storage partition as LittleFS, write the staged files to it, and mark the header done
+ *
+ * A reset before the header is marked leaves it pending: storage_update_resume() formats and writes again.
+ */
+static esp_err_t storage_update_restore(const storage_update_header_t *header)
+{
+    uint8_t *buffer = malloc(STORAGE_UPDATE_CHUNK_SIZE);
+    if (buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_vfs_littlefs_conf_t conf = {
+        .base_path = STORAGE_PATH,
+        .partition_label = STORAGE_PARTITION,
+    };
+    esp_vfs_littlefs_unregister(STORAGE_PARTITION);
+    esp_err_t err = esp_littlefs_format(STORAGE_PARTITION);
+    if (err == ESP_OK)
+    {
+        err = esp_vfs_littlefs_register(&conf);
+    }
+    uint16_t count = 0;
+    uint32_t offset = 0;
+    while (err == ESP_OK && offset < header->size)
+    {
+        storage_update_file_t staged;
+        err = esp_partition_read(storage_update_scratch, storage_update_image_offset + offset, &staged, sizeof(staged));
+        offset += sizeof(staged);
+        staged.name[sizeof(staged.name) - 1] = '\0';
+        char path[sizeof(STORAGE_PATH) + STORAGE_UPDATE_NAME_SIZE];
+        snprintf(path, sizeof(path), STORAGE_PATH "/%s", staged.name);
+        // the directories of the name: SPIFFS has none, the name is the whole path
+        for (char *slash = strchr(path + sizeof(STORAGE_PATH), '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+        {
+            *slash = '\0';
+            mkdir(path, 0755);
+            *slash = '/';
+        }
+        // a file that does not fit is lost, as it would be at each boot: only the flash reads stop the restore
+        FILE *file = (err == ESP_OK) ? fopen(path, "w") : NULL;
+        bool written = (file != NULL);
+        for (uint32_t done = 0; file != NULL && done < staged.size && err == ESP_OK; done += STORAGE_UPDATE_CHUNK_SIZE)
+        {
+            uint32_t len = MIN(STORAGE_UPDATE_CHUNK_SIZE, staged.size - done);
+            err = esp_partition_read(storage_update_scratch, storage_update_image_offset + offset + done, buffer, len);
+            written = written && err == ESP_OK && fwrite(buffer, 1, len, file) == len;
+        }
+        if (file != NULL && fclose(file) != 0)
+        {
+            written = false;
+        }
+        if (!written && err == ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to write %s", path);
+        }
+        offset += staged.size;
+        count++;
+    }
+    esp_vfs_littlefs_unregister(STORAGE_PARTITION); // mounted again by config_init_storage()
+    free(buffer);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to restore the storage files, done again at boot: %s", esp_err_to_name(err));
+        return err;
+    }
+    uint32_t state = STORAGE_UPDATE_DONE;
+    err = esp_partition_write(storage_update_scratch, storage_update_header_offset + offsetof(storage_update_header_t, state),
+                              &state, sizeof(state));
+    ESP_LOGI(TAG, "Storage files restored: %d files", count);
+    return err;
+}
+
+esp_err_t storage_update_restore_files(void)
+{
+    storage_update_header_t header;
+    esp_err_t err = esp_partition_read(storage_update_scratch, storage_update_header_offset, &header, sizeof(header));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (header.magic != STORAGE_UPDATE_FILES_MAGIC || header.state != STORAGE_UPDATE_PENDING)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return storage_update_restore(&header);
+}
+
+esp_err_t storage_update_resume(void)
+{
+    esp_err_t err = storage_update_find();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    storage_update_header_t header;
+    err = esp_partition_read(storage_update_scratch, storage_update_header_offset, &header, sizeof(header));
+    bool files = (header.magic == STORAGE_UPDATE_FILES_MAGIC);
+    if (err != ESP_OK || (header.magic != STORAGE_UPDATE_MAGIC && !files) || header.state != STORAGE_UPDATE_PENDING)
+    {
+        return err;
+    }
+    if (files ? header.size > storage_update_storage->size : header.size != storage_update_storage->size)
+    {
+        return ESP_OK; // not a header: an app image over the scratch area
+    }
+
+    // a reset during the header write leaves a header that does not match the image
+    uint8_t sha256[STORAGE_UPDATE_SHA256_SIZE];
+    err = storage_update_hash(storage_update_scratch, storage_update_image_offset, header.size, sha256);
+    if (err != ESP_OK || memcmp(sha256, header.sha256, sizeof(sha256)) != 0)
+    {
+        ESP_LOGW(TAG, "Staged storage image incomplete, ignored");
+        uint32_t state = STORAGE_UPDATE_DONE;
+        esp_partition_write(storage_update_scratch, storage_update_header_offset + offsetof(storage_update_header_t, state),
+                            &state, sizeof(state));
+        return ESP_OK;
+    }
+    if (files)
+    {
+        ESP_LOGW(TAG, "Storage migration cut by a reset, writing the staged files again");
+        return storage_update_restore(&header);
+    }
+    ESP_LOGW(TAG, "Storage update cut by a reset, copying the staged image again");
+    return storage_update_copy(&header);
+}
@@ -19,6 +19,9 @@
 #include "tuya_iot.h"
 #include "tuya_ota.h"
 #include "cJSON.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include "exporter.h"
 #include "qrcode.h"
 #include "gpio.h"
 #include "wifi.h"
@@ -47,6 +50,7 @@
 ===============================================================================*/
 
 #define TAG "TUYA"
+#define TUYA_JSON_SIZE 1024 // DPs of one report
 #define GATT_SVR_SVC_ALERT_UUID 0x1811
 #define GATT_SVR_CHR_SUP_NEW_ALERT_CAT_UUID 0x2A47
 #define GATT_SVR_CHR_NEW_ALERT 0x2A46
@@ -96,6 +100,9 @@ static void tuya_link_app_task(void *pvParameters);
 static void tuya_send_callback(int result, void *user_data);
 void ble_token_get_cb(wifi_info_t wifi_info);
 static char *tuya_verify_enum(char *input, const char *const *valid_values);
+static esp_err_t tuya_exporter_connect(void);
+static esp_err_t tuya_exporter_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed);
+static void tuya_exporter_disconnect(void);
 
 str_replace_t str_current_tarif_replace[] = {
     {"TH..", "BASE"},
@@ -127,6 +134,15 @@ TaskHandle_t tuyaTaskHandle = NULL;
 TaskHandle_t tuya_ble_pairing_task_handle = NULL;
 bool tuya_state = false;
 
+static exporter_stats_t tuya_exporter_stats = {0};
+const exporter_t tuya_exporter = {
+    .name = "TUYA",
+    .connect = tuya_exporter_connect,
+    .publish = tuya_exporter_publish,
+    .disconnect = tuya_exporter_disconnect,
+    .stats = &tuya_exporter_stats,
+};
+
 /*==============================================================================
  Local Variable
 ===============================================================================*/
@@ -136,6 +152,7 @@ static tuya_ota_handle_t ota_handle = {
 };
 static tuya_event_id_t lastEvent = TUYA_EVENT_RESET;
 static uint8_t newEvent = 0;
+static char tuya_json[TUYA_JSON_SIZE]; // report of tuya_send_data()
 /*==============================================================================
 Function Implementation
 ===============================================================================*/
@@ -155,33 +172,30 @@ static void tuya_iot_dp_download(tuya_iot_client_t *client, const char *json_dps
 {
     ESP_LOGI(TAG, "Data point download value:%s", json_dps);
 
-    /* Parsing json string to cJSON object */
-    cJSON *dps = cJSON_Parse(json_dps);
-    if (dps == NULL)
+    /* Lookup in the received string, no cJSON tree */
+    size_t len = strlen(json_dps);
+    if (!json_read_object(json_dps, len))
     {
         ESP_LOGI(TAG, "JSON parsing error, exit!");
         return;
     }
 
-    cJSON *dp = cJSON_GetObjectItem(dps, "103");
-    if (dp != NULL)
+    int32_t refresh_rate;
+    if (json_read_int(json_dps, len, "103", &refresh_rate))
     {
-        ESP_LOGI(TAG, "Received refresh rate: %d", dp->valueint);
-        config_values.refresh_rate = dp->valueint;
-        if (config_values.refresh_rate < 30)
+        ESP_LOGI(TAG, "Received refresh rate: %ld", refresh_rate);
+        if (refresh_rate < 30)
         {
-            config_values.refresh_rate = 30;
+            refresh_rate = 30;
         }
-        if (config_values.refresh_rate > 300)
+        if (refresh_rate > 300)
         {
-            config_values.refresh_rate = 300;
+            refresh_rate = 300;
         }
-        config_write();
+        config_values.refresh_rate = refresh_rate;
+        config_write_later();
     }
 
-    /* relese cJSON DPS object */
-    cJSON_Delete(dps);
-
     /* Report the received data to synchronize the switch status. */
     tuya_iot_dp_report_json(client, json_dps);
 }
@@ -518,7 +532,9 @@ static char *tuya_verify_enum(char *input, const char *const *valid_values)
 uint8_t tuya_send_data(linky_data_t *linky)
 {
     ESP_LOGI(TAG, "Send data to tuya");
-    cJSON *jsonObject = cJSON_CreateObject(); // Create the root object
+    json_writer_t writer;
+    json_init(&writer, tuya_json, sizeof(tuya_json));
+    json_open_object(&writer);
 
     // add index:
     index_offset_t now = {0};
@@ -532,7 +548,7 @@ uint8_t tuya_send_data(linky_data_t *linky)
     {
     case C_BASE:
     {
-        cJSON_AddNumberToObject(jsonObject, "111", tuya_cap_value(now.index_total));
+        json_add_key_uint(&writer, "111", tuya_cap_value(now.index_total));
     }
 
     break;
@@ -543,9 +559,9 @@ uint8_t tuya_send_data(linky_data_t *linky)
     case C_SEM_WE_MERCREDI:
     case C_SEM_WE_VENDREDI:
     case C_ZEN_FLEX:
-        cJSON_AddNumberToObject(jsonObject, "111", tuya_cap_value(now.index_total));
-        cJSON_AddNumberToObject(jsonObject, "112", tuya_cap_value(now.index_hc));
-        cJSON_AddNumberToObject(jsonObject, "113", tuya_cap_value(now.index_hp));
+        json_add_key_uint(&writer, "111", tuya_cap_value(now.index_total));
+        json_add_key_uint(&writer, "112", tuya_cap_value(now.index_hc));
+        json_add_key_uint(&writer, "113", tuya_cap_value(now.index_hp));
         break;
 
     default:
@@ -559,7 +575,8 @@ uint8_t tuya_send_data(linky_data_t *linky)
         {
             continue; // dont send data for label < 101 : they are not used by tuya
         }
-        if (linky_label_list[i].mode != linky_mode && linky_label_list[i].mode != ANY)
+        exporter_value_t value;
+        if (!exporter_value(linky, i, EXPORTER_DEVICE_VALUES, &value))
         {
             continue; // dont send data for label not used by current mode
         }
@@ -571,18 +588,18 @@ uint8_t tuya_send_data(linky_data_t *linky)
 
         case 102:
             // Max power contract
-            uint32_t max_power = *(uint32_t *)(linky_label_list[i].data);
+            uint32_t max_power = value.number;
             if (linky_mode == MODE_STD && linky_three_phase)
             {
                 max_power *= 3;
             }
 
-            cJSON_AddNumberToObject(jsonObject, "102", max_power);
+            json_add_key_uint(&writer, "102", max_power);
             continue;
             break;
 
         case 103:
-            uint16_t refresh_rate = *(uint16_t *)linky_label_list[i].data;
+            uint16_t refresh_rate = value.number;
             if (refresh_rate > 300)
             {
                 refresh_rate = 300;
@@ -593,25 +610,25 @@ uint8_t tuya_send_data(linky_data_t *linky)
                 refresh_rate = 10;
             }
 
-            cJSON_AddNumberToObject(jsonObject, "103", refresh_rate);
+            json_add_key_uint(&writer, "103", refresh_rate);
             continue;
             break;
 
         case 104:
-            cJSON_AddNumberToObject(jsonObject, "104", tuya_cap_value(linky_data.uptime / 1000));
+            json_add_key_uint(&writer, "104", tuya_cap_value(value.number / 1000));
             continue;
             break;
         case 105:
             switch (linky_mode)
             {
             case MODE_HIST:
-                cJSON_AddStringToObject(jsonObject, "105", "HISTORIQUE");
+                json_add_key_text(&writer, "105", "HISTORIQUE");
                 break;
             case MODE_STD:
-                cJSON_AddStringToObject(jsonObject, "105", "STANDARD");
+                json_add_key_text(&writer, "105", "STANDARD");
                 break;
             default:
-                cJSON_AddStringToObject(jsonObject, "105", "INCONNU");
+                json_add_key_text(&writer, "105", "INCONNU");
                 break;
             }
             continue;
@@ -619,11 +636,11 @@ uint8_t tuya_send_data(linky_data_t *linky)
         case 106:
             if (linky_three_phase)
             {
-                cJSON_AddStringToObject(jsonObject, "106", "TRIPHASE");
+                json_add_key_text(&writer, "106", "TRIPHASE");
             }
             else
             {
-                cJSON_AddStringToObject(jsonObject, "106", "MONOPHASE");
+                json_add_key_text(&writer, "106", "MONOPHASE");
             }
             continue;
             break;
@@ -641,15 +658,14 @@ uint8_t tuya_send_data(linky_data_t *linky)
 
             str = tuya_verify_enum(str, linky_tuya_str_contract);
 
-            cJSON_AddStringToObject(jsonObject, "107", str);
+            json_add_key_text(&writer, "107", str);
             continue;
             break;
         }
         case 108:
         {
-            char *str = (char *)linky_label_list[i].data;
-            str = tuya_replace(str, str_current_tarif_replace);
-            cJSON_AddStringToObject(jsonObject, "108", str);
+            char *str = tuya_replace((char *)value.text, str_current_tarif_replace);
+            json_add_key_text(&writer, "108", str);
             continue;
             break;
         }
@@ -657,17 +673,16 @@ uint8_t tuya_send_data(linky_data_t *linky)
         case 109:
         case 110:
         {
-            char *value = (char *)linky_label_list[i].data;
-            if (value == NULL || strlen(value) == 0)
+            if (!value.present)
                 continue;
 
-            char *str = tuya_verify_enum(value, linky_tuya_valid_color);
+            char *str = tuya_verify_enum((char *)value.text, linky_tuya_valid_color);
             if (str == NULL)
             {
                 str = "INCONNU";
             }
 
-            cJSON_AddStringToObject(jsonObject, str_id, str);
+            json_add_key_text(&writer, str_id, str);
             continue;
             break;
         }
@@ -675,74 +690,31 @@ uint8_t tuya_send_data(linky_data_t *linky)
             break;
         }
 
-        switch (linky_label_list[i].type)
-        {
-        case UINT8:
-        {
-            uint8_t *value = (uint8_t *)linky_label_list[i].data;
-            if (value == NULL || *value == UINT8_MAX)
-                continue;
-            cJSON_AddNumberToObject(jsonObject, str_id, *value);
-            break;
-        }
-        case UINT16:
-        {
-            uint16_t *value = (uint16_t *)linky_label_list[i].data;
-            if (value == NULL || *value == UINT16_MAX)
-                continue;
-            cJSON_AddNumberToObject(jsonObject, str_id, *value);
-            break;
-        }
-        case UINT32:
-        {
-            uint32_t *value = (uint32_t *)linky_label_list[i].data;
-            if (value == NULL || *value == UINT32_MAX)
-                continue;
-            cJSON_AddNumberToObject(jsonObject, str_id, tuya_cap_value(*value));
-            break;
-        }
-        case UINT32_TIME:
+        if (!value.present)
         {
-            uint32_t *value = (uint32_t *)linky_label_list[i].data;
-            if (value == NULL || *value == UINT32_MAX)
-                continue;
-            if (linky_label_list[i].device_class == ENERGY && *value == 0)
-                continue;
-
-            cJSON_AddNumberToObject(jsonObject, str_id, tuya_cap_value(*value));
-            break;
+            continue;
         }
-        case UINT64:
+        if (value.text != NULL)
         {
-            uint64_t *value = (uint64_t *)linky_label_list[i].data;
-            if (value == NULL || *value == UINT64_MAX)
-                continue;
-            if (linky_label_list[i].device_class == ENERGY && *value == 0)
+            if (strlen(value.text) > 255)
                 continue;
-            cJSON_AddNumberToObject(jsonObject, str_id, tuya_cap_value(*value));
-            break;
+            json_add_key_text(&writer, str_id, value.text);
         }
-        case STRING:
+        else
         {
-            char *value = (char *)linky_label_list[i].data;
-            if (value == NULL)
-                continue;
-            uint32_t len = strlen(value);
-            if (len == 0 || len > 255)
-                continue;
-
-            cJSON_AddStringToObject(jsonObject, str_id, value);
-            break;
-        }
-        default:
-            break;
+            json_add_key_uint(&writer, str_id, tuya_cap_value(value.number));
         }
     }
 
-    cJSON_AddStringToObject(jsonObject, "193", efuse_values.serial_number);
+    json_add_key_text(&writer, "193", efuse_values.serial_number);
 
-    char *json = cJSON_PrintUnformatted(jsonObject); // Convert the json object to string
-    cJSON_Delete(jsonObject);                        // Delete the json object
+    json_close_object(&writer);
+    if (json_end(&writer) == 0)
+    {
+        ESP_LOGE(TAG, "DPs too big for %d bytes", sizeof(tuya_json));
+        return 1;
+    }
+    char *json = tuya_json;
 
     printf("JSON: %s\n", json);
     uint8_t sendComplete = 0;
@@ -753,7 +725,6 @@ uint8_t tuya_send_data(linky_data_t *linky)
     {
         vTaskDelay(10 / portTICK_PERIOD_MS);
     }
-    free(json); // Free the memory
 
     if (sendComplete == 0)
     {
@@ -764,6 +735,47 @@ uint8_t tuya_send_data(linky_data_t *linky)
     return 0;
 }
 
+/**
+ * @brief Resume the tuya task if it was suspended, and wait for its MQTT connection
+ */
+static esp_err_t tuya_exporter_connect(void)
+{
+    if (tuya_state)
+    {
+        return ESP_OK;
+    }
+    ESP_LOGW(TAG, "Tuya not connected, reconnecting...");
+    resume_task(tuyaTaskHandle); // resume tuya task
+    tuya_state = true;
+    if (tuya_wait_event(TUYA_EVENT_MQTT_CONNECTED, 10000))
+    {
+        ESP_LOGE(TAG, "Tuya MQTT ERROR");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Report the DPs of the last sample of the batch, the changed set is not used: the app shows the last report
+ */
+static esp_err_t tuya_exporter_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed)
+{
+    if (count == 0)
+    {
+        return ESP_OK;
+    }
+    return tuya_send_data(&samples[count - 1]) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Suspend the tuya task, on battery the wifi is not kept between two samples
+ */
+static void tuya_exporter_disconnect(void)
+{
+    suspend_task(tuyaTaskHandle);
+    tuya_state = false;
+}
+
 void tuya_reset()
 {
     ESP_LOGI(TAG, "Reset Tuya");
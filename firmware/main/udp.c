@@ -0,0 +1,169 @@
+/**
+ * @file udp.c
+ * @author Dorian Benech
+ * @brief Send the samples to the LAN as UDP multicast / broadcast datagrams
+ * @version 1.0
+ * @date 2024-08-05
+ *
+ * @copyright Copyright (c) 2023 GammaTroniques
+ *
+ */
+
+/*==============================================================================
+ Local Include
+===============================================================================*/
+#include "udp.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_random.h"
+#include "lwip/sockets.h"
+#include "mbedtls/md.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "config.h"
+#include "cbor.h"
+
+/*==============================================================================
+ Local Define
+===============================================================================*/
+#define TAG "UDP"
+#define UDP_DATAGRAM_SIZE 1400 // below the MTU, no IP fragmentation
+#define UDP_MULTICAST_TTL 1    // stay on the LAN
+#define UDP_COPIES 2           // multicast frames are not acknowledged by the access point, the listeners drop the duplicates
+#define UDP_COPY_DELAY 20      // ms between the copies
+
+/*==============================================================================
+ Local Macro
+===============================================================================*/
+
+/*==============================================================================
+ Local Type
+===============================================================================*/
+
+/*==============================================================================
+ Local Function Declaration
+===============================================================================*/
+static void udp_put_u32(uint8_t *buffer, uint32_t value);
+static size_t udp_build(linky_data_t *data);
+
+/*==============================================================================
+Public Variable
+===============================================================================*/
+
+/*==============================================================================
+ Local Variable
+===============================================================================*/
+static uint8_t udp_buffer[UDP_DATAGRAM_SIZE];
+static uint32_t udp_boot_id = 0;
+static uint32_t udp_sequence = 0; // kept in RAM through the light sleep
+
+/*==============================================================================
+Function Implementation
+===============================================================================*/
+static void udp_put_u32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = value >> 24;
+    buffer[1] = value >> 16;
+    buffer[2] = value >> 8;
+    buffer[3] = value;
+}
+
+/**
+ * @brief Build the datagram of one sample in udp_buffer, see udp.h
+ *
+ * @return the length of the datagram, 0 on error
+ */
+static size_t udp_build(linky_data_t *data)
+{
+    bool sign = strlen(config_values.udp.key) > 0;
+    memcpy(udp_buffer, UDP_MAGIC, 2);
+    udp_buffer[2] = UDP_VERSION;
+    udp_buffer[3] = sign ? UDP_FLAG_SIGNED : 0;
+    udp_put_u32(udp_buffer + 4, udp_boot_id);
+    udp_put_u32(udp_buffer + 8, udp_sequence);
+
+    cbor_writer_t writer;
+    cbor_init(&writer, udp_buffer + UDP_HEADER_SIZE, sizeof(udp_buffer) - UDP_HEADER_SIZE - UDP_MAC_SIZE);
+    cbor_encode_linky_head(&writer, 1, NULL);
+    cbor_encode_linky_sample(&writer, data);
+    if (writer.overflow)
+    {
+        ESP_LOGE(TAG, "Sample too big for a datagram");
+        return 0;
+    }
+    size_t len = UDP_HEADER_SIZE + writer.len;
+    if (sign)
+    {
+        uint8_t mac[32];
+        int err = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const uint8_t *)config_values.udp.key,
+                                  strlen(config_values.udp.key), udp_buffer, len, mac);
+        if (err != 0)
+        {
+            ESP_LOGE(TAG, "HMAC failed: -0x%x", -err);
+            return 0;
+        }
+        memcpy(udp_buffer + len, mac, UDP_MAC_SIZE);
+        len += UDP_MAC_SIZE;
+    }
+    return len;
+}
+
+esp_err_t udp_send(linky_data_t *data)
+{
+    if (udp_boot_id == 0)
+    {
+        udp_boot_id = esp_random() | 1;
+    }
+    struct sockaddr_in dest_addr = {0};
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port = htons(config_values.udp.port);
+    if (inet_aton(config_values.udp.host, &dest_addr.sin_addr) == 0)
+    {
+        ESP_LOGE(TAG, "Invalid address: %s", config_values.udp.host);
+        return ESP_FAIL;
+    }
+    size_t len = udp_build(data);
+    if (len == 0)
+    {
+        return ESP_FAIL;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+    if (IN_MULTICAST(ntohl(dest_addr.sin_addr.s_addr)))
+    {
+        uint8_t ttl = UDP_MULTICAST_TTL;
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    }
+    else
+    {
+        int broadcast = 1; // the host can be a broadcast address
+        setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+    }
+
+    uint8_t sent = 0;
+    for (uint8_t i = 0; i < UDP_COPIES; i++)
+    {
+        if (i > 0)
+        {
+            vTaskDelay(UDP_COPY_DELAY / portTICK_PERIOD_MS);
+        }
+        if (sendto(sock, udp_buffer, len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) == (int)len)
+        {
+            sent++;
+        }
+        else
+        {
+            ESP_LOGW(TAG, "sendto failed: errno %d", errno);
+        }
+    }
+    close(sock);
+    ESP_LOGI(TAG, "Sample %08lx:%lu: %d bytes to %s:%d%s, %d/%d sent", udp_boot_id, udp_sequence, len,
+             config_values.udp.host, config_values.udp.port, (udp_buffer[3] & UDP_FLAG_SIGNED) ? " (signed)" : "", sent, UDP_COPIES);
+    udp_sequence++;
+    return sent > 0 ? ESP_OK : ESP_FAIL;
+}
@@ -18,11 +18,40 @@
 #include "wifi.h"
 #include "common.h"
 #include "led.h"
+#include "cbor.h"
+#include "json_writer.h"
+#include "json_reader.h"
+#include "exporter.h"
+#include "zlib.h"
+#include "esp_timer.h"
+#include "lwip/netdb.h"
+#include "lwip/inet.h"
+#include <stdarg.h>
+#include <sys/param.h>
 
 /*==============================================================================
  Local Define
 ===============================================================================*/
 #define TAG "WEB"
+#define WEB_BUFFER_SIZE 2048 // bigger than the worst standard mode sample
+#define WEB_URL_SIZE 100
+#define WEB_DNS_TTL (3600 * 1000000LL) // us, the server address is resolved again after 1 hour
+#define WEB_REQUEST_ATTEMPTS 2         // a kept-alive connection may have been closed by the server
+#define WEB_RESPONSE_SIZE 512          // the config sent back by the server
+#define WEB_VARINT_MAX 10 // bytes of a 64 bits varint
+#define WEB_INFLUX_MEASUREMENT "linky"
+#define WEB_INFLUX_CONTENT_TYPE "text/plain; charset=utf-8"
+#define WEB_INFLUX_PRECISION "precision=s" // the timestamps are in seconds
+#define WEB_INFLUX_TEXT_SIZE 130           // the longest text label escaped
+
+// zigzag: small negative and positive deltas both give a small varint
+#define WEB_ZIGZAG(value) (((uint64_t)(value) << 1) ^ (uint64_t)((int64_t)(value) >> 63))
+
+// gzip stream sized for the C6: about 7KB of deflate state instead of 256KB with the zlib defaults
+#define WEB_GZIP_WINDOW_BITS 10 // 1KB window, a sample repeats the labels of the previous one
+#define WEB_GZIP_MEM_LEVEL 3
+#define WEB_GZIP_LEVEL 6
+#define WEB_GZIP_BUFFER_SIZE 1024
 
 /*==============================================================================
  Local Macro
@@ -36,141 +65,631 @@
  Local Function Declaration
 ===============================================================================*/
 static void web_create_http_url(char *url, const char *host, const char *path);
-static esp_err_t web_http_send_data_handler(esp_http_client_event_handle_t evt);
+static const char *web_dns_lookup(const char *name);
+static esp_http_client_handle_t web_get_client(const char *url, esp_http_client_method_t method);
+static int web_request(esp_http_client_handle_t client, linky_data_t *data, char count);
+static esp_err_t web_http_event_handler(esp_http_client_event_handle_t evt);
+static void web_apply_config(int status);
+static void web_json_sample(json_writer_t *writer, linky_data_t *data);
+static void web_json_head(json_writer_t *writer, char count);
+static bool web_json_sink(void *context, const char *data, size_t len);
+static bool web_column_used(uint32_t index, linky_data_t *data, char count);
+static size_t web_put_varint(uint8_t *buffer, uint64_t value);
+static esp_err_t web_print(esp_http_client_handle_t client, const char *format, ...);
+static esp_err_t web_stream_columns_json(esp_http_client_handle_t client, linky_data_t *data, char count);
+static esp_err_t web_stream_columns_cbor(esp_http_client_handle_t client, linky_data_t *data, char count);
+static void web_influx_escape(char *out, const char *text, const char *special);
+static int8_t web_influx_tag(uint32_t index);
+static esp_err_t web_stream_influx(esp_http_client_handle_t client, linky_data_t *data, char count);
+static esp_err_t web_write_chunk(esp_http_client_handle_t client, const char *data, size_t len);
+static esp_err_t web_gzip_deflate(esp_http_client_handle_t client, int flush);
+static esp_err_t web_write(esp_http_client_handle_t client, const char *data, size_t len);
+static esp_err_t web_write_end(esp_http_client_handle_t client);
+static esp_err_t web_stream_body(esp_http_client_handle_t client, linky_data_t *data, char count);
+static esp_err_t web_exporter_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed);
 
 /*==============================================================================
 Public Variable
 ===============================================================================*/
+static exporter_stats_t web_exporter_stats = {0};
+const exporter_t web_exporter = {
+    .name = "HTTP",
+    .publish = web_exporter_publish,
+    .stats = &web_exporter_stats,
+};
 
 /*==============================================================================
  Local Variable
 ===============================================================================*/
+static char web_buffer[WEB_BUFFER_SIZE]; // one part of the streamed body
+static size_t web_buffer_len = 0;        // pending length of web_print()
+
+static z_stream web_gzip_stream;
+static bool web_gzip = false; // the body of the current request is compressed
+static uint8_t web_gzip_buffer[WEB_GZIP_BUFFER_SIZE];
+static size_t web_raw_len = 0;  // body size before compression
+static size_t web_sent_len = 0; // body size on the air, without the chunk headers
+
+// one client for every request of the wifi connection (boot config GET, POSTs), its socket is closed with the wifi
+static esp_http_client_handle_t web_client = NULL;
+static bool web_client_connected = false; // the socket is open and can be reused
+static uint16_t web_request_count = 0;
+static uint16_t web_reused_count = 0;
+
+// response of the current request, parsed once complete
+static char web_response[WEB_RESPONSE_SIZE];
+static size_t web_response_len = 0;
+static bool web_response_overflow = false;
+static char web_response_etag[sizeof(config_values.web_etag)];
+
+// the last resolved server address, kept across the wifi connections
+static struct
+{
+    char name[sizeof(config_values.web.host)];
+    char ip[INET_ADDRSTRLEN];
+    int64_t time;
+} web_dns_cache = {0};
+
+// https: the pinned CA and the name checked in the server certificate, the url may use an ip
+static char *web_cert = NULL;
+static char web_cert_name[sizeof(config_values.web_ca)] = {0};
+static char web_server_name[sizeof(config_values.web.host)] = {0};
+
+// labels sent as tags of the influx points instead of fields, sorted by key like InfluxDB advises
+static const struct
+{
+    const char *key;
+    const void *data[2]; // historic mode, standard mode
+} web_influx_tags[] = {
+    {"contract", {linky_data.hist.OPTARIF, linky_data.std.NGTF}},
+    {"serial", {linky_data.hist.ADCO, linky_data.std.ADSC}},
+    {"tariff", {linky_data.hist.PTEC, linky_data.std.LTARF}},
+};
 
 /*==============================================================================
 Function Implementation
 ===============================================================================*/
 
-void web_preapare_json_data(linky_data_t *data, char count, char **json)
+/**
+ * @brief Serialize one sample as a json object
+ */
+static void web_json_sample(json_writer_t *writer, linky_data_t *data)
+{
+    ESP_LOGI(TAG, "Data timestamp: %lld", data->timestamp);
+    json_open_object(writer);
+    exporter_iter_t iter;
+    exporter_value_t value;
+    exporter_iter_init(&iter, data, 0);
+    while (exporter_iter_next(&iter, &value))
+    {
+        switch (value.label->type)
+        {
+        case STRING:
+            json_add_key_text(writer, value.label->label, value.text);
+            break;
+        case BOOL:
+            json_add_key_bool(writer, value.label->label, value.number);
+            break;
+        default:
+            json_add_key_uint(writer, value.label->label, value.number);
+            break;
+        }
+    }
+    json_close_object(writer);
+}
+
+/**
+ * @brief Open the json root and add its fields before the content: {"TOKEN":"","VCONDO":0.00
+ */
+static void web_json_head(json_writer_t *writer, char count)
+{
+    json_open_object(writer);
+    json_add_key_text(writer, "TOKEN", config_values.web.token);
+    json_add_key(writer, "VCONDO");
+    json_add_decimal(writer, (int64_t)(gpio_get_vcondo() * 100 + 0.5f), 2);
+    if (count == 0)
+    {
+        // Send empty data to server to keep the connection alive
+        json_add_key_text(writer, "ERROR", "Cant read data from linky");
+    }
+}
+
+/**
+ * @brief Send a full web_buffer of the json writer
+ */
+static bool web_json_sink(void *context, const char *data, size_t len)
+{
+    return web_write((esp_http_client_handle_t)context, data, len) == ESP_OK;
+}
+
+/**
+ * @brief Check if a label has a value in at least one sample of the batch
+ */
+static bool web_column_used(uint32_t index, linky_data_t *data, char count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        exporter_value_t value;
+        if (!exporter_value(&data[i], index, 0, &value))
+        {
+            return false;
+        }
+        if (value.present)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Write an unsigned LEB128 varint
+ *
+ * @return the number of bytes written, WEB_VARINT_MAX at most
+ */
+static size_t web_put_varint(uint8_t *buffer, uint64_t value)
+{
+    size_t len = 0;
+    do
+    {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        buffer[len++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return len;
+}
+
+/**
+ * @brief Write one chunk of a chunked transfer encoding body
+ */
+static esp_err_t web_write_chunk(esp_http_client_handle_t client, const char *data, size_t len)
+{
+    char chunk_size[12];
+    int size_len = snprintf(chunk_size, sizeof(chunk_size), "%x\r\n", len);
+    if (esp_http_client_write(client, chunk_size, size_len) < 0)
+    {
+        return ESP_FAIL;
+    }
+    if (len > 0 && esp_http_client_write(client, data, len) < 0)
+    {
+        return ESP_FAIL;
+    }
+    if (esp_http_client_write(client, "\r\n", 2) < 0)
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Run deflate on the pending input and send each full output buffer as a chunk
+ *
+ * @param flush Z_NO_FLUSH while streaming, Z_FINISH to write the gzip trailer
+ */
+static esp_err_t web_gzip_deflate(esp_http_client_handle_t client, int flush)
+{
+    int err;
+    do
+    {
+        web_gzip_stream.next_out = web_gzip_buffer;
+        web_gzip_stream.avail_out = sizeof(web_gzip_buffer);
+        err = deflate(&web_gzip_stream, flush);
+        if (err == Z_STREAM_ERROR)
+        {
+            ESP_LOGE(TAG, "deflate failed: %d", err);
+            return ESP_FAIL;
+        }
+        size_t len = sizeof(web_gzip_buffer) - web_gzip_stream.avail_out;
+        if (len > 0 && web_write_chunk(client, (char *)web_gzip_buffer, len) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        web_sent_len += len;
+    } while (web_gzip_stream.avail_out == 0 || (flush == Z_FINISH && err != Z_STREAM_END));
+    return ESP_OK;
+}
+
+/**
+ * @brief Send a part of the body, through deflate if the request is compressed
+ */
+static esp_err_t web_write(esp_http_client_handle_t client, const char *data, size_t len)
+{
+    web_raw_len += len;
+    if (!web_gzip)
+    {
+        web_sent_len += len;
+        return web_write_chunk(client, data, len);
+    }
+    web_gzip_stream.next_in = (Bytef *)data;
+    web_gzip_stream.avail_in = len;
+    return web_gzip_deflate(client, Z_NO_FLUSH);
+}
+
+/**
+ * @brief Flush the gzip trailer if any and send the last chunk
+ */
+static esp_err_t web_write_end(esp_http_client_handle_t client)
+{
+    if (web_gzip && web_gzip_deflate(client, Z_FINISH) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    return web_write_chunk(client, NULL, 0); // last chunk
+}
+
+/**
+ * @brief Append formatted text to web_buffer, send the buffer when it is full
+ *
+ * @note web_buffer_len must be set before the first call, send the rest with web_write()
+ */
+static esp_err_t web_print(esp_http_client_handle_t client, const char *format, ...)
+{
+    for (uint8_t attempt = 0; attempt < 2; attempt++)
+    {
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(web_buffer + web_buffer_len, sizeof(web_buffer) - web_buffer_len, format, args);
+        va_end(args);
+        if (len >= 0 && web_buffer_len + len < sizeof(web_buffer))
+        {
+            web_buffer_len += len;
+            return ESP_OK;
+        }
+        if (web_buffer_len == 0 || web_write(client, web_buffer, web_buffer_len) != ESP_OK)
+        {
+            break;
+        }
+        web_buffer_len = 0;
+    }
+    return ESP_FAIL;
+}
+
+/**
+ * @brief Stream the batch by columns in json, same layout as the CBOR columns in cbor.h:
+ * {"TOKEN":"","VCONDO":0,"labels":["BASE",...],"time":[t0,dt,...],"columns":[[v0,dv,null,...],["TH..","",...]]}
+ */
+static esp_err_t web_stream_columns_json(esp_http_client_handle_t client, linky_data_t *data, char count)
 {
-    cJSON *jsonObject = cJSON_CreateObject(); // Create the root object
-    cJSON_AddStringToObject(jsonObject, "TOKEN", config_values.web.token);
-    cJSON_AddNumberToObject(jsonObject, "VCONDO", gpio_get_vcondo());
-    cJSON *dataObject = cJSON_CreateArray(); // Create the data array
-    for (int i = 0; i < count; i++)          // Add data to the array
+    json_writer_t writer;
+    json_init_sink(&writer, web_buffer, sizeof(web_buffer), web_json_sink, client);
+    web_json_head(&writer, count);
+    json_add_key(&writer, "labels");
+    json_open_array(&writer);
+    for (uint32_t j = 0; j < linky_label_list_size; j++)
+    {
+        if (web_column_used(j, data, count))
+        {
+            json_add_text(&writer, linky_label_list[j].label);
+        }
+    }
+    json_close_array(&writer);
+    json_add_key(&writer, "time");
+    json_open_array(&writer);
+    for (int i = 0; i < count; i++)
+    {
+        json_add_int(&writer, data[i].timestamp - (i > 0 ? data[i - 1].timestamp : 0));
+    }
+    json_close_array(&writer);
+    json_add_key(&writer, "columns");
+    json_open_array(&writer);
+    for (uint32_t j = 0; j < linky_label_list_size && !writer.overflow; j++)
     {
-        ESP_LOGI(TAG, "Data index: %d: timestamp: %lld", i, data[i].timestamp);
-        cJSON *dataItem = cJSON_CreateObject();
-        for (uint32_t j = 0; j < linky_label_list_size; j++)
+        if (!web_column_used(j, data, count))
+        {
+            continue;
+        }
+        json_open_array(&writer);
+        uint64_t previous = 0;
+        const char *previous_text = NULL;
+        for (int i = 0; i < count; i++)
         {
-            if (linky_label_list[j].data == NULL)
+            exporter_value_t value;
+            exporter_value(&data[i], j, 0, &value);
+            if (!value.present)
             {
-                continue;
+                json_add_null(&writer);
             }
-            if (linky_mode != linky_label_list[j].mode && linky_label_list[j].mode != ANY)
+            else if (value.text != NULL)
             {
-                continue;
+                bool same = previous_text != NULL && strcmp(previous_text, value.text) == 0;
+                json_add_text(&writer, same ? "" : value.text);
+                previous_text = value.text;
+            }
+            else
+            {
+                json_add_int(&writer, (int64_t)(value.number - previous));
+                previous = value.number;
             }
-            uint8_t found = 0;
-            for (uint32_t k = 0; k < linky_protected_data_size; k++)
+        }
+        json_close_array(&writer);
+    }
+    json_close_array(&writer);
+    json_close_object(&writer);
+    return json_end(&writer) > 0 ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Stream the batch by columns in CBOR, see cbor.h
+ */
+static esp_err_t web_stream_columns_cbor(esp_http_client_handle_t client, linky_data_t *data, char count)
+{
+    uint8_t varints[MAX_DATA_INDEX * WEB_VARINT_MAX];
+    if (count > MAX_DATA_INDEX)
+    {
+        return ESP_FAIL;
+    }
+    uint16_t used = 0;
+    for (uint32_t j = 0; j < linky_label_list_size; j++)
+    {
+        used += web_column_used(j, data, count);
+    }
+
+    cbor_writer_t writer;
+    cbor_init(&writer, (uint8_t *)web_buffer, sizeof(web_buffer));
+    cbor_encode_linky_columns_head(&writer, config_values.web.token);
+    cbor_open_array(&writer, used);
+    for (uint32_t j = 0; j < linky_label_list_size; j++)
+    {
+        if (web_column_used(j, data, count))
+        {
+            cbor_add_uint(&writer, linky_label_list[j].id);
+        }
+    }
+    size_t len = 0;
+    for (int i = 0; i < count; i++)
+    {
+        len += web_put_varint(varints + len, WEB_ZIGZAG(data[i].timestamp - (i > 0 ? data[i - 1].timestamp : 0)));
+    }
+    cbor_add_bytes(&writer, varints, len);
+    cbor_open_array(&writer, used);
+    if (writer.overflow || web_write(client, web_buffer, writer.len) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    for (uint32_t j = 0; j < linky_label_list_size; j++)
+    {
+        if (!web_column_used(j, data, count))
+        {
+            continue;
+        }
+        cbor_init(&writer, (uint8_t *)web_buffer, sizeof(web_buffer));
+        uint64_t previous = 0;
+        const char *previous_text = NULL;
+        len = 0;
+        if (linky_label_list[j].type == STRING)
+        {
+            cbor_open_array(&writer, count);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            exporter_value_t value;
+            exporter_value(&data[i], j, 0, &value);
+            if (linky_label_list[j].type == STRING)
             {
-                if (linky_label_list[j].data == linky_protected_data[k])
+                if (!value.present)
                 {
-                    found = 1;
+                    cbor_add_null(&writer);
                     continue;
                 }
+                bool same = previous_text != NULL && strcmp(previous_text, value.text) == 0;
+                cbor_add_text(&writer, same ? "" : value.text);
+                previous_text = value.text;
             }
-            if (found)
+            else if (!value.present)
             {
-                continue;
+                varints[len++] = 0;
             }
-            uint32_t delta_in_data = (char *)linky_label_list[j].data - (char *)&linky_data;
-            ESP_LOGD(TAG, "Adress in data: 0x%lx", delta_in_data);
-            void *value = (char *)&data[i] + delta_in_data;
-            ESP_LOGD(TAG, "Adress in value: 0x%p", value);
-            switch (linky_label_list[j].type)
+            else
             {
-            case UINT8:
-                if (*(uint8_t *)value == UINT8_MAX)
-                {
-                    continue;
-                }
-                ESP_LOGD(TAG, "Name: %s Type: UINT8 Value: %d", linky_label_list[j].label, *(uint8_t *)value);
-                cJSON_AddNumberToObject(dataItem, linky_label_list[j].label, *(uint8_t *)value);
-                break;
-            case UINT16:
-                if (*(uint16_t *)value == UINT16_MAX)
-                {
-                    continue;
-                }
-                ESP_LOGD(TAG, "Name: %s Type: UINT16 Value: %d", linky_label_list[j].label, *(uint16_t *)value);
-                cJSON_AddNumberToObject(dataItem, linky_label_list[j].label, *(uint16_t *)value);
-                break;
-            case UINT32:
-                if (*(uint32_t *)value == UINT32_MAX)
-                {
-                    continue;
-                }
-                if (linky_label_list[j].device_class == ENERGY && *(uint32_t *)value == 0)
-                {
-                    continue;
-                }
-                ESP_LOGD(TAG, "Name: %s Type: UINT32 Value: %ld", linky_label_list[j].label, *(uint32_t *)value);
-                cJSON_AddNumberToObject(dataItem, linky_label_list[j].label, *(uint32_t *)value);
-                break;
-            case UINT64:
-                if (*(uint64_t *)value == UINT64_MAX)
+                len += web_put_varint(varints + len, WEB_ZIGZAG(value.number - previous) + 1);
+                previous = value.number;
+            }
+        }
+        if (linky_label_list[j].type != STRING)
+        {
+            cbor_add_bytes(&writer, varints, len);
+        }
+        if (writer.overflow || web_write(client, web_buffer, writer.len) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Copy text to out with a backslash before each character of special
+ *
+ * @param out WEB_INFLUX_TEXT_SIZE bytes
+ */
+static void web_influx_escape(char *out, const char *text, const char *special)
+{
+    size_t len = 0;
+    for (; *text && len < WEB_INFLUX_TEXT_SIZE - 2; text++)
+    {
+        if (strchr(special, *text))
+        {
+            out[len++] = '\\';
+        }
+        out[len++] = *text;
+    }
+    out[len] = '\0';
+}
+
+/**
+ * @return the index of the label in web_influx_tags, -1 if it is a field
+ */
+static int8_t web_influx_tag(uint32_t index)
+{
+    for (uint8_t t = 0; t < sizeof(web_influx_tags) / sizeof(web_influx_tags[0]); t++)
+    {
+        if (linky_label_list[index].data == web_influx_tags[t].data[0] || linky_label_list[index].data == web_influx_tags[t].data[1])
+        {
+            return t;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Stream the batch in InfluxDB line protocol, one point per sample:
+ * linky,contract=BASE,serial=031976306475,tariff=TH.. BASE=12345i,IINST=2i,PTEC="TH..",VCONDO=4.51 1700000000
+ * Numbers are integer fields, texts are string fields, the tags are in web_influx_tags.
+ */
+static esp_err_t web_stream_influx(esp_http_client_handle_t client, linky_data_t *data, char count)
+{
+    char text[WEB_INFLUX_TEXT_SIZE];
+    float vcondo = gpio_get_vcondo();
+    bool ok = true;
+    web_buffer_len = 0;
+    if (count == 0)
+    {
+        // nothing read from the linky: keep the connection alive with the VCondo at the server time
+        ok = web_print(client, WEB_INFLUX_MEASUREMENT " VCONDO=%.2f\n", vcondo) == ESP_OK;
+    }
+    for (int i = 0; ok && i < count; i++)
+    {
+        ok = web_print(client, WEB_INFLUX_MEASUREMENT) == ESP_OK;
+        for (uint8_t t = 0; ok && t < sizeof(web_influx_tags) / sizeof(web_influx_tags[0]); t++)
+        {
+            for (uint32_t j = 0; ok && j < linky_label_list_size; j++)
+            {
+                if (web_influx_tag(j) != t)
                 {
                     continue;
                 }
-                if (linky_label_list[j].device_class == ENERGY && *(uint64_t *)value == 0)
+                exporter_value_t value;
+                if (!exporter_value(&data[i], j, 0, &value) || !value.present)
                 {
                     continue;
                 }
-                ESP_LOGD(TAG, "Name: %s Type: UINT64 Value: %lld", linky_label_list[j].label, *(uint64_t *)value);
-                cJSON_AddNumberToObject(dataItem, linky_label_list[j].label, *(uint64_t *)value);
-                break;
+                web_influx_escape(text, value.text, ", =");
+                ok = web_print(client, ",%s=%s", web_influx_tags[t].key, text) == ESP_OK;
+            }
+        }
+        char separator = ' ';
+        exporter_iter_t iter;
+        exporter_value_t value;
+        exporter_iter_init(&iter, &data[i], 0);
+        while (ok && exporter_iter_next(&iter, &value))
+        {
+            if (web_influx_tag(value.index) >= 0)
+            {
+                continue;
+            }
+            switch (value.label->type)
+            {
             case STRING:
-                if (strlen((char *)value) == 0)
-                {
-                    continue;
-                }
-                ESP_LOGD(TAG, "Name: %s Type: STRING Value: %s", linky_label_list[j].label, (char *)value);
-                cJSON_AddStringToObject(dataItem, linky_label_list[j].label, (char *)value);
-                break;
-            case UINT32_TIME:
-                if (*(uint32_t *)value == UINT32_MAX)
-                {
-                    continue;
-                }
-                ESP_LOGD(TAG, "Name: %s Type: UINT32_TIME Value: %ld", linky_label_list[j].label, *(uint32_t *)value);
-                cJSON_AddNumberToObject(dataItem, linky_label_list[j].label, *(uint32_t *)value);
+                web_influx_escape(text, value.text, "\"\\");
+                ok = web_print(client, "%c%s=\"%s\"", separator, value.label->label, text) == ESP_OK;
                 break;
             case BOOL:
-                ESP_LOGD(TAG, "Name: %s Type: BOOL Value: %d", linky_label_list[j].label, *(bool *)value);
-                cJSON_AddBoolToObject(dataItem, linky_label_list[j].label, *(bool *)value);
+                ok = web_print(client, "%c%s=%s", separator, value.label->label, value.number ? "true" : "false") == ESP_OK;
                 break;
             default:
+                ok = web_print(client, "%c%s=%llui", separator, value.label->label, value.number) == ESP_OK;
                 break;
             }
+            separator = ',';
         }
-        cJSON_AddItemToArray(dataObject, dataItem);
+        ok = ok && web_print(client, "%cVCONDO=%.2f %lld\n", separator, vcondo, (int64_t)data[i].timestamp) == ESP_OK;
     }
-    if (count == 0)
+    if (!ok || web_write(client, web_buffer, web_buffer_len) != ESP_OK)
     {
-        // Send empty data to server to keep the connection alive
-        cJSON_AddStringToObject(jsonObject, "ERROR", "Cant read data from linky");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Serialize the body part by part in web_buffer and send each part as a chunk
+ */
+static esp_err_t web_stream_body(esp_http_client_handle_t client, linky_data_t *data, char count)
+{
+    web_raw_len = 0;
+    web_sent_len = 0;
+    if (web_gzip)
+    {
+        deflateReset(&web_gzip_stream); // the body may be sent again on a new connection
+    }
+    if (config_values.encoding == ENCODING_INFLUX)
+    {
+        if (web_stream_influx(client, data, count) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+    else if (config_values.columns && count > 0)
+    {
+        esp_err_t err = (config_values.encoding == ENCODING_CBOR) ? web_stream_columns_cbor(client, data, count)
+                                                                 : web_stream_columns_json(client, data, count);
+        if (err != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+    else if (config_values.encoding == ENCODING_CBOR)
+    {
+        cbor_writer_t writer;
+        cbor_init(&writer, (uint8_t *)web_buffer, sizeof(web_buffer));
+        cbor_encode_linky_head(&writer, count, config_values.web.token);
+        if (writer.overflow || web_write(client, web_buffer, writer.len) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            cbor_init(&writer, (uint8_t *)web_buffer, sizeof(web_buffer));
+            cbor_encode_linky_sample(&writer, &data[i]);
+            if (writer.overflow || web_write(client, web_buffer, writer.len) != ESP_OK)
+            {
+                return ESP_FAIL;
+            }
+        }
+    }
+    else
+    {
+        json_writer_t writer;
+        json_init_sink(&writer, web_buffer, sizeof(web_buffer), web_json_sink, client);
+        web_json_head(&writer, count);
+        json_add_key(&writer, "data");
+        json_open_array(&writer);
+        for (int i = 0; i < count && !writer.overflow; i++)
+        {
+            web_json_sample(&writer, &data[i]);
+        }
+        json_close_array(&writer);
+        json_close_object(&writer);
+        if (json_end(&writer) == 0)
+        {
+            return ESP_FAIL;
+        }
     }
-    cJSON_AddItemToObject(jsonObject, "data", dataObject); // Add the data array to the root object
-    *json = cJSON_PrintUnformatted(jsonObject);            // Convert the json object to string
-    cJSON_Delete(jsonObject);                              // Delete the json object
+    return web_write_end(client);
 }
 
-static esp_err_t web_http_send_data_handler(esp_http_client_event_handle_t evt)
+/**
+ * @brief Store the ETag and the body of the response, the body can come in several parts
+ */
+static esp_err_t web_http_event_handler(esp_http_client_event_handle_t evt)
 {
     switch (evt->event_id)
     {
+    case HTTP_EVENT_ON_HEADER:
+        if (strcasecmp(evt->header_key, "ETag") == 0)
+        {
+            strlcpy(web_response_etag, evt->header_value, sizeof(web_response_etag));
+        }
+        break;
     case HTTP_EVENT_ON_DATA:
-        printf("Config: %.*s", evt->data_len, (char *)evt->data);
+        if (web_response_len + evt->data_len >= sizeof(web_response)) // keep one byte for '\0'
+        {
+            web_response_overflow = true;
+            break;
+        }
+        memcpy(web_response + web_response_len, evt->data, evt->data_len);
+        web_response_len += evt->data_len;
         break;
 
     default:
@@ -179,82 +698,290 @@ static esp_err_t web_http_send_data_handler(esp_http_client_event_handle_t evt)
     return ESP_OK;
 }
 
-uint8_t wifi_send_to_server(const char *json)
+/**
+ * @brief Apply and save the config sent in the response of a POST or of the config GET
+ *
+ * The server answers with the ETag of its config: the next requests send it in If-None-Match
+ * and an unchanged config comes back as an empty response (204 or 304).
+ *
+ * @param status the HTTP status of the request
+ */
+static void web_apply_config(int status)
 {
-    if (strlen(config_values.web.host) == 0 || strlen(config_values.web.postUrl) == 0)
+    if (status != 200 || web_response_len == 0)
     {
-        ESP_LOGE(TAG, "host or postUrl not set");
-        return 0;
+        return;
+    }
+    if (web_response_overflow)
+    {
+        ESP_LOGE(TAG, "Response bigger than %d bytes, config ignored", sizeof(web_response));
+        return;
+    }
+    web_response[web_response_len] = '\0';
+    ESP_LOGI(TAG, "Config: %s", web_response);
+    if (!json_read_object(web_response, web_response_len))
+    {
+        return; // "OK" of the servers without config
     }
-    led_start_pattern(LED_SENDING);
 
-    char url[100] = {0};
-    web_create_http_url(url, config_values.web.host, config_values.web.postUrl);
-    // setup post request
-    esp_http_client_config_t config_post;
-    memset(&config_post, 0, sizeof(config_post));
-    config_post.url = url;
-    config_post.cert_pem = NULL;
-    config_post.method = HTTP_METHOD_POST;
-    config_post.event_handler = web_http_send_data_handler;
-
-    // setup client
-    esp_http_client_handle_t client = esp_http_client_init(&config_post);
-    esp_http_client_set_post_field(client, json, strlen(json));
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-
-    // send post request
-    esp_http_client_perform(client);
-    esp_http_client_cleanup(client);
+    int32_t value;
+    if (json_read_int(web_response, web_response_len, "refresh_rate", &value))
+    {
+        config_values.refresh_rate = MIN(MAX(value, 10), 3600);
+        ESP_LOGI(TAG, "Set refresh_rate: %d", config_values.refresh_rate);
+    }
+    if (json_read_int(web_response, web_response_len, "store_before_send", &value))
+    {
+        config_values.web.store_before_send = MIN(MAX(value, 0), MAX_DATA_INDEX);
+        ESP_LOGI(TAG, "Set store_before_send: %d", config_values.web.store_before_send);
+    }
+    if (json_read_int(web_response, web_response_len, "encoding", &value) && value >= 0 && value < ENCODING_LAST)
+    {
+        config_values.encoding = value;
+        ESP_LOGI(TAG, "Set encoding: %s", ENCODINGS[config_values.encoding]);
+    }
+    if (json_read_int(web_response, web_response_len, "gzip", &value))
+    {
+        config_values.gzip = value ? 1 : 0;
+        ESP_LOGI(TAG, "Set gzip: %d", config_values.gzip);
+    }
+    if (json_read_int(web_response, web_response_len, "columns", &value))
+    {
+        config_values.columns = value ? 1 : 0;
+        ESP_LOGI(TAG, "Set columns: %d", config_values.columns);
+    }
 
-    led_stop_pattern(LED_SENDING);
-    led_start_pattern(LED_SEND_OK);
-    return 1;
+    strlcpy(config_values.web_etag, web_response_etag, sizeof(config_values.web_etag));
+    config_write();
 }
 
-esp_err_t wifi_http_get_config_handler(esp_http_client_event_handle_t evt)
+/**
+ * @brief Get the shared client, created on the first request of the wifi connection
+ *
+ * @param url the url of the request
+ * @param method the method of the request
+ * @return the client, NULL on error
+ */
+static esp_http_client_handle_t web_get_client(const char *url, esp_http_client_method_t method)
 {
-    switch (evt->event_id)
+    if (web_client != NULL && strcmp(web_cert_name, config_values.web_ca) != 0)
     {
-    case HTTP_EVENT_ON_DATA:
-        ESP_LOGI(TAG, "Config: %.*s", evt->data_len, (char *)evt->data);
-        cJSON *json = cJSON_Parse(evt->data);
-        cJSON *refresh_rate = cJSON_GetObjectItem(json, "refresh_rate");
-        if (refresh_rate != NULL)
+        ESP_LOGI(TAG, "CA changed: new HTTP client");
+        esp_http_client_cleanup(web_client);
+        web_client = NULL;
+        web_client_connected = false;
+    }
+    if (web_client == NULL)
+    {
+        free(web_cert);
+        web_cert = NULL;
+        strlcpy(web_cert_name, config_values.web_ca, sizeof(web_cert_name));
+        if (strlen(web_cert_name) > 0)
         {
-            uint16_t value = refresh_rate->valueint;
-            if (value < 10)
-            {
-                value = 10;
-            }
-            if (value > 3600)
+            web_cert = config_read_cert(web_cert_name);
+            if (web_cert == NULL)
             {
-                value = 3600;
+                web_cert_name[0] = '\0';
+                return NULL; // never fall back to http
             }
-            config_values.refresh_rate = value;
-            ESP_LOGI(TAG, "Set refresh_rate: %d", value);
         }
-        cJSON *store_before_send = cJSON_GetObjectItem(json, "store_before_send");
-        if (store_before_send != NULL)
+
+        esp_http_client_config_t config;
+        memset(&config, 0, sizeof(config));
+        config.url = url;
+        config.cert_pem = web_cert;
+        config.method = method;
+        config.event_handler = web_http_event_handler;
+        config.keep_alive_enable = true;
+        if (web_cert != NULL)
         {
-            uint8_t value = store_before_send->valueint;
-            if (store_before_send->valueint < 0)
-            {
-                value = 0;
-            }
-            else if (store_before_send->valueint > MAX_DATA_INDEX)
-            {
-                value = MAX_DATA_INDEX;
-            }
-            config_values.web.store_before_send = value;
-            ESP_LOGI(TAG, "Set store_before_send: %d", value);
+            config.common_name = web_server_name; // the url may use the cached ip
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+            config.save_client_session = true; // resume the session on the next connections
+#endif
         }
-        break;
+        web_client = esp_http_client_init(&config);
+        web_client_connected = false;
+        if (web_client == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create the HTTP client");
+            return NULL;
+        }
+    }
+    else
+    {
+        esp_http_client_set_url(web_client, url);
+        esp_http_client_set_method(web_client, method);
+    }
+    // the url may use the cached ip: keep the name for virtual hosts
+    esp_http_client_set_header(web_client, "Host", config_values.web.host);
+    esp_http_client_set_header(web_client, "Connection", "keep-alive");
+    if (strlen(config_values.web_etag) > 0)
+    {
+        esp_http_client_set_header(web_client, "If-None-Match", config_values.web_etag);
+    }
+    else
+    {
+        esp_http_client_delete_header(web_client, "If-None-Match");
+    }
+    return web_client;
+}
 
-    default:
-        break;
+/**
+ * @brief Send a request on the shared client and read the whole response, the socket is kept open
+ *
+ * @param client the shared client
+ * @param data the samples to stream in the body, NULL for a request without body
+ * @param count the number of samples
+ * @return the HTTP status code, -1 on error
+ */
+static int web_request(esp_http_client_handle_t client, linky_data_t *data, char count)
+{
+    for (uint8_t attempt = 0; attempt < WEB_REQUEST_ATTEMPTS; attempt++)
+    {
+        bool reused = web_client_connected;
+        web_response_len = 0;
+        web_response_overflow = false;
+        web_response_etag[0] = '\0';
+        // a negative length sets "Transfer-Encoding: chunked"
+        esp_err_t err = esp_http_client_open(client, data ? -1 : 0);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+        }
+        else if (data && web_stream_body(client, data, count) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to write the body");
+            err = ESP_FAIL;
+        }
+        else if (esp_http_client_fetch_headers(client) < 0)
+        {
+            ESP_LOGE(TAG, "Failed to read the response");
+            err = ESP_FAIL;
+        }
+
+        if (err == ESP_OK)
+        {
+            esp_http_client_flush_response(client, NULL); // the handler stores the response
+            web_client_connected = true;
+            web_request_count++;
+            web_reused_count += reused;
+            return esp_http_client_get_status_code(client);
+        }
+        esp_http_client_close(client);
+        web_client_connected = false;
+        if (!reused)
+        {
+            break;
+        }
+        ESP_LOGW(TAG, "Kept-alive connection lost, retry on a new one");
     }
-    return ESP_OK;
+    return -1;
+}
+
+void wifi_http_close()
+{
+    if (web_client == NULL)
+    {
+        return;
+    }
+    ESP_LOGI(TAG, "HTTP client: %d requests, %d on a kept-alive connection", web_request_count, web_reused_count);
+    // the client is kept for the next wifi connection: it holds the TLS session ticket
+    esp_http_client_close(web_client);
+    web_client_connected = false;
+    web_request_count = 0;
+    web_reused_count = 0;
+}
+
+uint8_t wifi_send_to_server(linky_data_t *data, char count)
+{
+    if (strlen(config_values.web.host) == 0 || strlen(config_values.web.postUrl) == 0)
+    {
+        ESP_LOGE(TAG, "host or postUrl not set");
+        return 0;
+    }
+    led_start_pattern(LED_SENDING);
+
+    char url[WEB_URL_SIZE] = {0};
+    web_create_http_url(url, config_values.web.host, config_values.web.postUrl);
+    if (config_values.encoding == ENCODING_INFLUX && strstr(url, "precision=") == NULL)
+    {
+        // /write and /api/v2/write default to nanoseconds
+        strlcat(url, strchr(url, '?') ? "&" WEB_INFLUX_PRECISION : "?" WEB_INFLUX_PRECISION, sizeof(url));
+    }
+    esp_http_client_handle_t client = web_get_client(url, HTTP_METHOD_POST);
+    if (client == NULL)
+    {
+        led_stop_pattern(LED_SENDING);
+        led_start_pattern(LED_SEND_FAILED);
+        return 0;
+    }
+    esp_http_client_delete_header(client, "Authorization");
+    if (config_values.encoding == ENCODING_CBOR)
+    {
+        esp_http_client_set_header(client, "Content-Type", CBOR_CONTENT_TYPE);
+    }
+    else if (config_values.encoding == ENCODING_INFLUX)
+    {
+        esp_http_client_set_header(client, "Content-Type", WEB_INFLUX_CONTENT_TYPE);
+        if (strlen(config_values.web.token) > 0)
+        {
+            // InfluxDB 1.8+ and 2.x, VictoriaMetrics ignores it
+            char authorization[sizeof(config_values.web.token) + 7];
+            snprintf(authorization, sizeof(authorization), "Token %s", config_values.web.token);
+            esp_http_client_set_header(client, "Authorization", authorization);
+        }
+    }
+    else
+    {
+        esp_http_client_set_header(client, "Content-Type", "application/json");
+    }
+    web_raw_len = 0;
+    web_sent_len = 0;
+    web_gzip = false;
+    esp_http_client_delete_header(client, "Content-Encoding");
+    if (config_values.gzip)
+    {
+        memset(&web_gzip_stream, 0, sizeof(web_gzip_stream));
+        // windowBits + 16: gzip header and trailer instead of the zlib ones
+        int zerr = deflateInit2(&web_gzip_stream, WEB_GZIP_LEVEL, Z_DEFLATED, 16 + WEB_GZIP_WINDOW_BITS, WEB_GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+        if (zerr == Z_OK)
+        {
+            web_gzip = true;
+            esp_http_client_set_header(client, "Content-Encoding", "gzip");
+        }
+        else
+        {
+            ESP_LOGW(TAG, "deflateInit2 failed: %d, sending uncompressed", zerr);
+        }
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    int status = web_request(client, data, count);
+    uint8_t ret = (status >= 0);
+    if (ret)
+    {
+        ESP_LOGI(TAG, "POST %d samples: HTTP %d", count, status);
+        web_apply_config(status); // the server can send its config in the response
+    }
+    if (web_gzip)
+    {
+        deflateEnd(&web_gzip_stream);
+    }
+    ESP_LOGI(TAG, "Body: %d bytes, %d bytes sent%s in %lld ms", web_raw_len, web_sent_len,
+             web_gzip ? " (gzip)" : "", (esp_timer_get_time() - start_time) / 1000);
+
+    led_stop_pattern(LED_SENDING);
+    led_start_pattern(ret ? LED_SEND_OK : LED_SEND_FAILED);
+    return ret;
+}
+
+/**
+ * @brief POST the batch: the server needs every value of every sample, the changed set is not used
+ */
+static esp_err_t web_exporter_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed)
+{
+    return wifi_send_to_server(samples, count) ? ESP_OK : ESP_FAIL;
 }
 
 /**
@@ -264,26 +991,24 @@ esp_err_t wifi_http_get_config_handler(esp_http_client_event_handle_t evt)
 void wifi_http_get_config_from_server()
 {
     ESP_LOGI(TAG, "get config from server");
-    char url[100] = {0};
+    char url[WEB_URL_SIZE] = {0};
     web_create_http_url(url, config_values.web.host, config_values.web.configUrl);
-    strcat(url, "?token=");
-    strcat(url, config_values.web.token);
+    strlcat(url, "?token=", sizeof(url));
+    strlcat(url, config_values.web.token, sizeof(url));
     ESP_LOGI(TAG, "url: %s", url);
 
-    esp_http_client_config_t config_get;
-    memset(&config_get, 0, sizeof(config_get));
-    config_get.url = url;
-    config_get.cert_pem = NULL;
-    config_get.method = HTTP_METHOD_GET;
-    config_get.event_handler = wifi_http_get_config_handler;
-
-    esp_http_client_handle_t client = esp_http_client_init(&config_get);
-    esp_http_client_perform(client);
-    esp_http_client_cleanup(client);
+    esp_http_client_handle_t client = web_get_client(url, HTTP_METHOD_GET);
+    if (client == NULL)
+    {
+        return;
+    }
+    esp_http_client_delete_header(client, "Content-Type");
+    esp_http_client_delete_header(client, "Content-Encoding");
+    web_apply_config(web_request(client, NULL, 0));
 }
 
 /**
- * @brief Create a Http Url (http://host/path)
+ * @brief Create a Http Url (http://host/path), https:// if a CA is set
  *
  * @param url the destination url
  * @param host the host
@@ -291,7 +1016,55 @@ void wifi_http_get_config_from_server()
  */
 static void web_create_http_url(char *url, const char *host, const char *path)
 {
-    url = strcat(url, "http://");
-    url = strcat(url, host);
-    url = strcat(url, path);
+    char name[sizeof(config_values.web.host)];
+    strlcpy(name, host, sizeof(name));
+    char *port = strchr(name, ':');
+    if (port != NULL)
+    {
+        *port = '\0';
+    }
+    strlcpy(web_server_name, name, sizeof(web_server_name));
+    snprintf(url, WEB_URL_SIZE, "%s://%s%s%s%s", strlen(config_values.web_ca) > 0 ? "https" : "http",
+             web_dns_lookup(name), port ? ":" : "", port ? port + 1 : "", path);
+}
+
+/**
+ * @brief Resolve the server name, the result is kept for WEB_DNS_TTL
+ *
+ * @param name the host name without port
+ * @return the ip address as a string, or the name itself if it is an ip or cannot be resolved
+ */
+static const char *web_dns_lookup(const char *name)
+{
+    struct in_addr addr;
+    if (inet_aton(name, &addr))
+    {
+        return name;
+    }
+    int64_t now = esp_timer_get_time();
+    if (strcmp(web_dns_cache.name, name) == 0 && now - web_dns_cache.time < WEB_DNS_TTL)
+    {
+        ESP_LOGD(TAG, "DNS cache: %s -> %s", name, web_dns_cache.ip);
+        return web_dns_cache.ip;
+    }
+
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res = NULL;
+    int err = getaddrinfo(name, NULL, &hints, &res);
+    if (err != 0 || res == NULL)
+    {
+        ESP_LOGW(TAG, "DNS lookup of %s failed: %d", name, err);
+        return name; // let the client try again
+    }
+    addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+
+    strlcpy(web_dns_cache.name, name, sizeof(web_dns_cache.name));
+    inet_ntoa_r(addr, web_dns_cache.ip, sizeof(web_dns_cache.ip));
+    web_dns_cache.time = now;
+    ESP_LOGI(TAG, "DNS: %s -> %s", name, web_dns_cache.ip);
+    return web_dns_cache.ip;
 }
\ No newline at end of file
@@ -330,6 +330,7 @@ void wifi_disconnect()
         return;
     }
     wifi_state = WIFI_DISCONNECTED;
+    wifi_http_close(); // the socket does not survive the disconnection
     // esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
     err = esp_wifi_disconnect();
     if (err != ESP_OK)
@@ -439,7 +440,8 @@ time_t wifi_get_timestamp()
 {
     static time_t now = 0;
     struct tm timeinfo;
-    if (wifi_state == WIFI_CONNECTED && config_values.mode == MODE_HTTP)
+    if (wifi_state == WIFI_CONNECTED && (config_values.mode == MODE_HTTP || config_values.mode == MODE_MQTT || config_values.mode == MODE_MQTT_HA ||
+                                         config_values.mode == MODE_UDP || config_values.mode == MODE_COAP || config_values.mode == MODE_MODBUS))
     {
         ESP_LOGI(TAG, "Getting time over NTP");
         static bool sntp_started = false;
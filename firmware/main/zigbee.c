@@ -30,11 +30,13 @@
 #include "led.h"
 #include "config.h"
 #include "main.h"
+#include "exporter.h"
 /*==============================================================================
  Local Define
 ===============================================================================*/
 
 #define TAG "ZIGBEE"
+#define ZIGBEE_STRING_SIZE 100 // a ZCL string: its length, then the longest text label
 
 /*==============================================================================
  Local Macro
@@ -73,6 +75,10 @@ static esp_err_t zigbee_action_handler(esp_zb_core_action_callback_id_t callback
 static void zigbee_task(void *pvParameters);
 static esp_err_t zigbee_report_attribute(uint8_t endpoint, uint16_t clusterID, uint16_t attributeID, void *value, uint8_t value_length);
 static void zigbee_print_value(char *out_buffer, void *data, linky_label_type_t type);
+static void *zigbee_zcl_value(const exporter_value_t *value, uint8_t *zcl_string);
+static esp_err_t zigbee_exporter_init(void);
+static esp_err_t zigbee_exporter_connect(void);
+static esp_err_t zigbee_exporter_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed);
 static esp_err_t zigbee_ota_upgrade_status_handler(esp_zb_zcl_ota_upgrade_value_message_t messsage);
 static uint32_t zigbee_get_hex_version(const char *version);
 static uint16_t zigbee_get_hex16_version(const char *version);
@@ -80,6 +86,14 @@ static uint16_t zigbee_get_hex16_version(const char *version);
 /*==============================================================================
 Public Variable
 ===============================================================================*/
+static exporter_stats_t zigbee_exporter_stats = {0};
+const exporter_t zigbee_exporter = {
+    .name = "ZIGBEE",
+    .init = zigbee_exporter_init,
+    .connect = zigbee_exporter_connect,
+    .publish = zigbee_exporter_publish,
+    .stats = &zigbee_exporter_stats,
+};
 
 /*==============================================================================
  Local Variable
@@ -293,6 +307,12 @@ static esp_err_t zigbee_action_handler(esp_zb_core_action_callback_id_t callback
     return ret;
 }
 
+static esp_err_t zigbee_exporter_init(void)
+{
+    zigbee_init_stack();
+    return ESP_OK;
+}
+
 void zigbee_init_stack()
 {
     esp_err_t ret = nvs_flash_init();
@@ -452,146 +472,46 @@ static void zigbee_task(void *pvParameters)
     // ------------------ Add attributes ------------------
     uint32_t attributes_count = 0;
 
-    for (int i = 0; i < linky_label_list_size; i++)
+    exporter_iter_t iter;
+    exporter_value_t value;
+    exporter_iter_init(&iter, &linky_data, EXPORTER_DEVICE_VALUES);
+    while (exporter_iter_next(&iter, &value))
     {
-        if (linky_label_list[i].zb_access == 0)
+        const linky_value_t *label = value.label;
+        if (label->zb_access == 0)
         {
             continue;
         }
 
-        if (linky_label_list[i].mode != linky_mode && linky_label_list[i].mode != ANY)
-        {
-            continue;
-        }
-        if (linky_label_list[i].data == NULL)
-        {
-            continue;
-        }
-
-        switch (linky_label_list[i].type)
-        {
-        case UINT8:
-        {
-            if (*(uint8_t *)linky_label_list[i].data == UINT8_MAX)
-            {
-                continue;
-            }
-            break;
-        }
-        case UINT16:
-        {
-            if (*(uint16_t *)linky_label_list[i].data == UINT16_MAX)
-            {
-                continue;
-            }
-            break;
-        }
-        case UINT32:
-        {
-            if (*(uint32_t *)linky_label_list[i].data == UINT32_MAX)
-            {
-                continue;
-            }
-            if (linky_label_list[i].device_class == ENERGY && *(uint32_t *)linky_label_list[i].data == 0)
-            {
-                continue;
-            }
-            break;
-        }
-        case UINT64:
-        {
-            if (*(uint64_t *)linky_label_list[i].data == UINT64_MAX)
-            {
-                continue;
-            }
-            if (linky_label_list[i].device_class == ENERGY && *(uint64_t *)linky_label_list[i].data == 0)
-            {
-                continue;
-            }
-            break;
-        }
-        case STRING:
-        {
-            if (strnlen((char *)linky_label_list[i].data, linky_label_list[i].size) == 0)
-            {
-                continue;
-            }
-            break;
-        }
-        case UINT32_TIME:
-        {
-            if (((time_label_t *)linky_label_list[i].data)->value == UINT32_MAX)
-            {
-                continue;
-            }
-            break;
-        }
-        default:
-            break;
-        };
-
         char str_value[100];
-        void *ptr_value = linky_label_list[i].data;
-
-        if (linky_label_list[i].type == UINT32_TIME)
+        uint8_t zcl_string[ZIGBEE_STRING_SIZE];
+        void *ptr_value = zigbee_zcl_value(&value, zcl_string);
+        if (value.text != NULL)
         {
-            ptr_value = &((time_label_t *)linky_label_list[i].data)->value;
+            snprintf(str_value, sizeof(str_value), "%s", value.text);
         }
-
-        switch (linky_label_list[i].type)
+        else
         {
-        case UINT8:
-            sprintf(str_value, "%u", *(uint8_t *)ptr_value);
-            break;
-        case UINT16:
-            sprintf(str_value, "%u", *(uint16_t *)ptr_value);
-            break;
-        case UINT32:
-            sprintf(str_value, "%lu", *(uint32_t *)ptr_value);
-            break;
-        case UINT64:
-            sprintf(str_value, "%llu", *(uint64_t *)ptr_value);
-            break;
-        case UINT32_TIME:
-            sprintf(str_value, "%lu", *(uint32_t *)ptr_value);
-            break;
-        case STRING:
-            sprintf(str_value, "%s", (char *)ptr_value);
-            char *str = (char *)ptr_value;
-            char temp[100];
-            memcpy(temp + 1, str, linky_label_list[i].size + 1);
-            temp[0] = strlen(temp + 1);
-            if (temp[0] > linky_label_list[i].size)
-            {
-                temp[0] = linky_label_list[i].size;
-            }
-            temp[linky_label_list[i].size + 2] = '\0';
-            memcpy(linky_label_list[i].data, temp, linky_label_list[i].size + 1);
-            // ESP_LOG_BUFFER_HEXDUMP(TAG, linky_label_list[i].data, linky_label_list[i].size + 2, ESP_LOG_INFO);
-            break;
-        default:
-            ESP_LOGE(TAG, "%s : Unknown type", linky_label_list[i].label);
-            continue;
-            break;
+            snprintf(str_value, sizeof(str_value), "%llu", value.number);
         }
 
-        ESP_LOGI(TAG, "Adding %s : Cluster: 0x%04x, attribute: 0x%04x, zbtype: %x, value: %s", linky_label_list[i].label, linky_label_list[i].clusterID, linky_label_list[i].attributeID, linky_label_list[i].zb_type, str_value);
+        ESP_LOGI(TAG, "Adding %s : Cluster: 0x%04x, attribute: 0x%04x, zbtype: %x, value: %s", label->label, label->clusterID, label->attributeID, label->zb_type, str_value);
 
-        switch (linky_label_list[i].clusterID)
+        switch (label->clusterID)
         {
         case ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT:
         {
-            esp_zb_electrical_meas_cluster_add_attr(esp_zb_electrical_meas_cluster, linky_label_list[i].attributeID, ptr_value);
+            esp_zb_electrical_meas_cluster_add_attr(esp_zb_electrical_meas_cluster, label->attributeID, ptr_value);
             break;
         }
         case ESP_ZB_ZCL_CLUSTER_ID_METERING:
         {
-            esp_zb_cluster_add_attr(esp_zb_metering_cluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, linky_label_list[i].attributeID, linky_label_list[i].zb_type, linky_label_list[i].zb_access, ptr_value);
+            esp_zb_cluster_add_attr(esp_zb_metering_cluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, label->attributeID, label->zb_type, label->zb_access, ptr_value);
             break;
         }
         case TICMETER_CLUSTER_ID:
         {
-            esp_zb_custom_cluster_add_custom_attr(esp_zb_ticmeter_cluster, linky_label_list[i].attributeID, linky_label_list[i].zb_type, linky_label_list[i].zb_access, ptr_value);
+            esp_zb_custom_cluster_add_custom_attr(esp_zb_ticmeter_cluster, label->attributeID, label->zb_type, label->zb_access, ptr_value);
             break;
         }
         default:
@@ -675,10 +595,43 @@ static esp_err_t zigbee_report_attribute(uint8_t endpoint, uint16_t clusterID, u
 char string_buffer[100];
 
 uint64_t temp = 150;
-esp_err_t zigbee_send(linky_data_t *data)
+/**
+ * @brief Get the pointer given to the ZCL for a value: the value or the timestamp of a UINT32_TIME (for a U64
+ * attribute), a text is copied in zcl_string after its length
+ *
+ * @param zcl_string ZIGBEE_STRING_SIZE bytes
+ */
+static void *zigbee_zcl_value(const exporter_value_t *value, uint8_t *zcl_string)
 {
-    esp_err_t ret = ESP_OK;
+    const linky_value_t *label = value->label;
+    switch (label->type)
+    {
+    case UINT32_TIME:
+        if (label->zb_type == ESP_ZB_ZCL_ATTR_TYPE_U64)
+        {
+            // pass only timestamp as uint64_t
+            return (void *)&((const time_label_t *)value->data)->time;
+        }
+        return (void *)&((const time_label_t *)value->data)->value;
+    case STRING:
+    {
+        // the whole attribute is sent: the length, then size characters padded with 0
+        size_t size = MIN(label->size, ZIGBEE_STRING_SIZE - 1);
+        memset(zcl_string, 0, size + 1);
+        zcl_string[0] = strnlen(value->text, size);
+        memcpy(zcl_string + 1, value->text, zcl_string[0]);
+        return zcl_string;
+    }
+    default:
+        return (void *)value->data;
+    }
+}
 
+/**
+ * @brief Check that the device can send: paired and commissioned
+ */
+static esp_err_t zigbee_exporter_connect(void)
+{
     if (config_values.zigbee.state != ZIGBEE_PAIRED)
     {
         ESP_LOGE(TAG, "Zigbee not paired");
@@ -691,6 +644,19 @@ esp_err_t zigbee_send(linky_data_t *data)
         esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
         return ESP_ERR_INVALID_STATE;
     }
+    return ESP_OK;
+}
+
+/**
+ * @brief Report the reporting attributes of the last sample of the batch, and set the others if they changed
+ */
+static esp_err_t zigbee_exporter_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed)
+{
+    esp_err_t ret = ESP_OK;
+    if (count == 0)
+    {
+        return ESP_OK;
+    }
 
     if (zigbee_ota_running)
     {
@@ -698,113 +664,35 @@ esp_err_t zigbee_send(linky_data_t *data)
     }
     zigbee_sending = true;
 
-    for (int i = 0; i < linky_label_list_size; i++)
+    exporter_iter_t iter;
+    exporter_value_t value;
+    exporter_iter_init(&iter, &samples[count - 1], EXPORTER_DEVICE_VALUES);
+    while (exporter_iter_next(&iter, &value))
     {
-        char str_value[102];
-        void *ptr_value = linky_label_list[i].data;
-        ESP_LOGD(TAG, "check %s %d", linky_label_list[i].label, i);
-        if (linky_label_list[i].mode != linky_mode && linky_label_list[i].mode != ANY)
-        {
-            continue;
-        }
-        if (linky_label_list[i].data == NULL)
+        const linky_value_t *label = value.label;
+        char str_value[102] = {0};
+        uint8_t zcl_string[ZIGBEE_STRING_SIZE];
+        ESP_LOGD(TAG, "check %s %ld", label->label, value.index);
+        if (label->clusterID == 0 || label->zb_access == 0)
         {
             continue;
         }
-        if (linky_label_list[i].clusterID == 0 || linky_label_list[i].zb_access == 0)
+        if (label->zb_access != ESP_ZB_ZCL_ATTR_ACCESS_REPORTING && !exporter_changed(changed, value.index))
         {
-            continue;
+            continue; // the attribute already holds this value
         }
+        void *ptr_value = zigbee_zcl_value(&value, zcl_string);
 
-        switch (linky_label_list[i].type)
-        {
-        case UINT8:
-        {
-            if (*(uint8_t *)linky_label_list[i].data == UINT8_MAX)
-            {
-                continue;
-            }
-            break;
-        }
-        case UINT16:
-        {
-            if (*(uint16_t *)linky_label_list[i].data == UINT16_MAX)
-            {
-                continue;
-            }
-            break;
-        }
-        case UINT32:
-        {
-            if (*(uint32_t *)linky_label_list[i].data == UINT32_MAX)
-            {
-                continue;
-            }
-            if (linky_label_list[i].device_class == ENERGY && *(uint32_t *)linky_label_list[i].data == 0)
-            {
-                continue;
-            }
-            break;
-        }
-        case UINT64:
-        {
-            if (*(uint64_t *)linky_label_list[i].data == UINT64_MAX)
-            {
-                continue;
-            }
-            if (linky_label_list[i].device_class == ENERGY && *(uint64_t *)linky_label_list[i].data == 0)
-            {
-                continue;
-            }
-            break;
-        }
-        case STRING:
-        {
-            if (strnlen((char *)linky_label_list[i].data, linky_label_list[i].size) == 0)
-            {
-                continue;
-            }
-            char *str = (char *)linky_label_list[i].data;
-            char temp[100];
-            memcpy(temp + 1, str, linky_label_list[i].size + 1);
-            temp[0] = strlen(temp + 1);
-            if (temp[0] > linky_label_list[i].size)
-            {
-                temp[0] = linky_label_list[i].size;
-            }
-            temp[linky_label_list[i].size + 2] = '\0';
-            memcpy(linky_label_list[i].data, temp, linky_label_list[i].size + 1);
-            // ESP_LOG_BUFFER_HEXDUMP(TAG, linky_label_list[i].data, linky_label_list[i].size + 2, ESP_LOG_INFO);
-            break;
-        }
-        case UINT32_TIME:
-        {
-            if (((time_label_t *)linky_label_list[i].data)->value == UINT32_MAX)
-            {
-                continue;
-            }
-            ptr_value = &((time_label_t *)linky_label_list[i].data)->value;
-            if (linky_label_list[i].zb_type == ESP_ZB_ZCL_ATTR_TYPE_U64)
-            {
-                // pass only timestamp as uint64_t
-                ptr_value = &((time_label_t *)linky_label_list[i].data)->time;
-            }
-            break;
-        }
-        default:
-            break;
-        };
-
-        ESP_LOGD(TAG, "Send %s", linky_label_list[i].label);
+        ESP_LOGD(TAG, "Send %s", label->label);
 
         esp_zb_zcl_status_t status = ESP_ZB_ZCL_STATUS_SUCCESS;
 
-        if (linky_label_list[i].zb_access == ESP_ZB_ZCL_ATTR_ACCESS_REPORTING)
+        if (label->zb_access == ESP_ZB_ZCL_ATTR_ACCESS_REPORTING)
         {
-            zigbee_print_value(str_value, linky_label_list[i].data, linky_label_list[i].type);
-            ESP_LOGI(TAG, "Repporting cluster: 0x%x, attribute: 0x%x, name: %s, value: %s", linky_label_list[i].clusterID, linky_label_list[i].attributeID, linky_label_list[i].label, str_value);
+            zigbee_print_value(str_value, (void *)value.data, label->type);
+            ESP_LOGI(TAG, "Repporting cluster: 0x%x, attribute: 0x%x, name: %s, value: %s", label->clusterID, label->attributeID, label->label, str_value);
             uint8_t size;
-            switch (linky_label_list[i].zb_type)
+            switch (label->zb_type)
             {
             case ESP_ZB_ZCL_ATTR_TYPE_U8:
             case ESP_ZB_ZCL_ATTR_TYPE_S8:
@@ -832,17 +720,17 @@ esp_err_t zigbee_send(linky_data_t *data)
                 break;
             case ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING:
             case ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING:
-                size = linky_label_list[i].size + 1;
+                size = label->size + 1;
                 break;
             case ESP_ZB_ZCL_ATTR_TYPE_BOOL:
                 size = sizeof(uint8_t);
                 break;
             default:
-                ESP_LOGE(TAG, "Zigbee send: %s Unknown type. skipping...", linky_label_list[i].label);
+                ESP_LOGE(TAG, "Zigbee send: %s Unknown type. skipping...", label->label);
                 continue;
                 break;
             }
-            ret = zigbee_report_attribute(LINKY_TIC_ENDPOINT, linky_label_list[i].clusterID, linky_label_list[i].attributeID, ptr_value, size);
+            ret = zigbee_report_attribute(LINKY_TIC_ENDPOINT, label->clusterID, label->attributeID, ptr_value, size);
             if (ret != ESP_OK)
             {
                 ESP_LOGE(TAG, "Report attribute failed: 0x%x", ret);
@@ -850,8 +738,8 @@ esp_err_t zigbee_send(linky_data_t *data)
         }
         else
         {
-            ESP_LOGI(TAG, "Set attribute cluster: Status: 0x%X 0x%x, attribute: 0x%x, name: %s, value: %lu", status, linky_label_list[i].clusterID, linky_label_list[i].attributeID, linky_label_list[i].label, *(uint32_t *)ptr_value);
-            status = esp_zb_zcl_set_attribute_val(LINKY_TIC_ENDPOINT, linky_label_list[i].clusterID, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, linky_label_list[i].attributeID, ptr_value, false);
+            ESP_LOGI(TAG, "Set attribute cluster: Status: 0x%X 0x%x, attribute: 0x%x, name: %s, value: %lu", status, label->clusterID, label->attributeID, label->label, *(uint32_t *)ptr_value);
+            status = esp_zb_zcl_set_attribute_val(LINKY_TIC_ENDPOINT, label->clusterID, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, label->attributeID, ptr_value, false);
             if (status != ESP_ZB_ZCL_STATUS_SUCCESS)
             {
                 ESP_LOGE(TAG, "Set attribute failed: 0x%x", status);
@@ -0,0 +1,552 @@
+# Encode, decode and benchmark the TICMeter CBOR payload (schema in main/include/cbor.h)
+# Usage: python cbor_payload.py report [samples]      size of JSON vs CBOR, raw and gzip, for every capture of ../tramesLinky
+#        python cbor_payload.py bench [iterations]    encoder benchmark on the captures
+#        python cbor_payload.py decode <file|->       decode a CBOR payload (raw bytes) to JSON
+#        python cbor_payload.py columns [days]        round trip and size of the batches by columns on synthetic day traces
+#        python cbor_payload.py roundtrip             every label of the standard captures back from both layouts, one key
+#                                                     per label id (exit code 1 on a duplicate)
+# Example: mosquitto_sub -t TICMeter/cbor -C 1 | python cbor_payload.py decode -
+
+import datetime
+import json
+import os
+import random
+import re
+import struct
+import sys
+import time
+import zlib
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+LINKY_C = os.path.join(SCRIPT_DIR, "../main/linky.c")
+CAPTURES_DIR = os.path.join(SCRIPT_DIR, "../tramesLinky")
+
+SCHEMA_VERSION = 1
+KEY_VERSION = 0
+KEY_TOKEN = 1
+KEY_VCONDO = 2
+KEY_DATA = 3
+KEY_COLUMNS = 4
+KEY_TIMESTAMP = 0
+
+# same stream as web.c: WEB_GZIP_LEVEL, WEB_GZIP_WINDOW_BITS, WEB_GZIP_MEM_LEVEL
+GZIP_LEVEL = 6
+GZIP_WINDOW_BITS = 10
+GZIP_MEM_LEVEL = 3
+
+# { id, tuya_id, "name", "label", &data, TYPE, size, MODE, contract, grid, realTime, device_class, ...
+LABEL_REGEX = re.compile(
+    r'^\s*\{\s*(\d+),\s*\d+,\s*"[^"]*",\s*"([^"]+)",\s*&?([\w.\[\]]+)\s*,\s*(\w+),\s*\d+,\s*(\w+),\s*\w+,\s*\w+,\s*\w+,\s*(\w+),'
+)
+
+UINT_TYPES = ("UINT8", "UINT16", "UINT32", "UINT64", "UINT32_TIME")
+
+
+def load_labels():
+    labels = {}
+    with open(LINKY_C, "r", encoding="utf-8") as f:
+        for line in f:
+            match = LABEL_REGEX.match(line)
+            if not match:
+                continue
+            id, label, data, type, mode, device_class = match.groups()
+            labels[label] = {
+                "id": int(id),
+                "type": type,
+                "mode": mode,
+                "device_class": device_class,
+            }
+    return labels
+
+
+# ---------------------------------------------------------------- encoder
+def cbor_head(major, value):
+    if value < 24:
+        return bytes([(major << 5) | value])
+    if value <= 0xFF:
+        return bytes([(major << 5) | 24, value])
+    if value <= 0xFFFF:
+        return bytes([(major << 5) | 25]) + struct.pack(">H", value)
+    if value <= 0xFFFFFFFF:
+        return bytes([(major << 5) | 26]) + struct.pack(">I", value)
+    return bytes([(major << 5) | 27]) + struct.pack(">Q", value)
+
+
+def cbor_item(value):
+    if isinstance(value, bool):
+        return b"\xf5" if value else b"\xf4"
+    if isinstance(value, int):
+        return cbor_head(0, value)
+    data = value.encode("utf-8")
+    return cbor_head(3, len(data)) + data
+
+
+def encode_cbor(samples, token=None, vcondo=4.5):
+    out = bytearray(cbor_head(5, 4 if token is not None else 3))
+    out += cbor_item(KEY_VERSION) + cbor_item(SCHEMA_VERSION)
+    if token is not None:
+        out += cbor_item(KEY_TOKEN) + cbor_item(token)
+    out += cbor_item(KEY_VCONDO) + cbor_item(int(vcondo * 1000))
+    out += cbor_item(KEY_DATA) + cbor_head(4, len(samples))
+    for timestamp, values in samples:
+        out += b"\xbf"  # indefinite map, like the firmware
+        out += cbor_item(KEY_TIMESTAMP) + cbor_item(timestamp)
+        for id, value in values:
+            out += cbor_item(id) + cbor_item(value)
+        out += b"\xff"
+    return bytes(out)
+
+
+def encode_json(samples, labels_by_id, token, vcondo=4.5):
+    # same layout as web_preapare_json_data()
+    data = [{labels_by_id[id]: value for id, value in values} for _, values in samples]
+    body = {"TOKEN": token, "VCONDO": vcondo, "data": data}
+    return json.dumps(body, separators=(",", ":"), ensure_ascii=False).encode("utf-8")
+
+
+def gzip_size(payload):
+    stream = zlib.compressobj(GZIP_LEVEL, zlib.DEFLATED, 16 + GZIP_WINDOW_BITS, GZIP_MEM_LEVEL)
+    return len(stream.compress(payload) + stream.flush())
+
+
+# ---------------------------------------------------------------- columns
+# same layout as web_stream_columns_json() and web_stream_columns_cbor(), see cbor.h
+UINT64_MASK = (1 << 64) - 1
+
+
+def zigzag(value):
+    value = ((value + (1 << 63)) & UINT64_MASK) - (1 << 63)  # to int64, like the firmware
+    return ((value << 1) ^ (value >> 63)) & UINT64_MASK
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def put_varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        out.append(byte | (0x80 if value else 0))
+        if not value:
+            return bytes(out)
+
+
+def get_varints(data):
+    values, value, shift = [], 0, 0
+    for byte in data:
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            values.append(value)
+            value, shift = 0, 0
+    return values
+
+
+def to_columns(samples, labels_by_id):
+    """list of (id, [value or None per sample]) in the order of linky_label_list"""
+    ids = sorted({id for _, values in samples for id, _ in values})
+    rows = [dict(values) for _, values in samples]
+    return [(id, [row.get(id) for row in rows]) for id in ids]
+
+
+def time_deltas(samples):
+    return [timestamp - (samples[i - 1][0] if i else 0) for i, (timestamp, _) in enumerate(samples)]
+
+
+def text_column(column):
+    out, previous = [], None
+    for value in column:
+        if value is None:
+            out.append(None)
+        else:
+            out.append("" if value == previous else value)
+            previous = value
+    return out
+
+
+def number_deltas(column):
+    out, previous = [], 0
+    for value in column:
+        if value is None:
+            out.append(None)
+        else:
+            out.append(((int(value) - previous + (1 << 63)) & UINT64_MASK) - (1 << 63))
+            previous = int(value)
+    return out
+
+
+def encode_json_columns(samples, labels_by_id, token, vcondo=4.5):
+    columns = to_columns(samples, labels_by_id)
+    body = {
+        "TOKEN": token,
+        "VCONDO": vcondo,
+        "labels": [labels_by_id[id] for id, _ in columns],
+        "time": time_deltas(samples),
+        "columns": [text_column(c) if isinstance(next(v for v in c if v is not None), str) else number_deltas(c) for _, c in columns],
+    }
+    return json.dumps(body, separators=(",", ":"), ensure_ascii=False).encode("utf-8")
+
+
+def encode_cbor_columns(samples, labels_by_id, token=None, vcondo=4.5):
+    columns = to_columns(samples, labels_by_id)
+    out = bytearray(cbor_head(5, 4 if token is not None else 3))
+    out += cbor_item(KEY_VERSION) + cbor_item(SCHEMA_VERSION)
+    if token is not None:
+        out += cbor_item(KEY_TOKEN) + cbor_item(token)
+    out += cbor_item(KEY_VCONDO) + cbor_item(int(vcondo * 1000))
+    out += cbor_item(KEY_COLUMNS) + cbor_head(4, 3)
+    out += cbor_head(4, len(columns)) + b"".join(cbor_item(id) for id, _ in columns)
+    times = b"".join(put_varint(zigzag(delta)) for delta in time_deltas(samples))
+    out += cbor_head(2, len(times)) + times
+    out += cbor_head(4, len(columns))
+    for _, column in columns:
+        if isinstance(next(v for v in column if v is not None), str):
+            out += cbor_head(4, len(column))
+            out += b"".join(b"\xf6" if v is None else cbor_item(v) for v in text_column(column))
+        else:
+            data = b"".join(b"\x00" if d is None else put_varint(zigzag(d) + 1) for d in number_deltas(column))
+            out += cbor_head(2, len(data)) + data
+    return bytes(out)
+
+
+def from_columns(labels, times, columns):
+    """rebuild the samples: list of {"timestamp": t, label: value}"""
+    timestamp, samples = 0, []
+    for delta in times:
+        timestamp += delta
+        samples.append({"timestamp": timestamp})
+    for label, column in zip(labels, columns):
+        previous = None if isinstance(column, list) and any(isinstance(v, str) for v in column) else 0
+        for sample, value in zip(samples, column):
+            if value is None:
+                continue
+            if isinstance(value, str):
+                previous = previous if value == "" else value
+            else:
+                previous = (previous + value) & UINT64_MASK
+            sample[label] = previous
+    return samples
+
+
+def decode_json_columns(body):
+    return from_columns(body["labels"], body["time"], body["columns"])
+
+
+# ---------------------------------------------------------------- decoder
+class Decoder:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def byte(self):
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def argument(self, info):
+        if info < 24:
+            return info
+        size = {24: 1, 25: 2, 26: 4, 27: 8}.get(info)
+        if size is None:
+            raise ValueError(f"Unsupported additional info {info} at {self.pos}")
+        value = int.from_bytes(self.data[self.pos : self.pos + size], "big")
+        self.pos += size
+        return value
+
+    def item(self):
+        initial = self.byte()
+        major, info = initial >> 5, initial & 0x1F
+        if major == 7:
+            return {20: False, 21: True, 22: None}[info]
+        if info == 31:
+            if major == 4:
+                items = []
+                while self.data[self.pos] != 0xFF:
+                    items.append(self.item())
+                self.pos += 1
+                return items
+            if major == 5:
+                items = {}
+                while self.data[self.pos] != 0xFF:
+                    self.entry(items)
+                self.pos += 1
+                return items
+            raise ValueError(f"Unsupported indefinite major type {major}")
+        value = self.argument(info)
+        if major == 0:
+            return value
+        if major == 1:
+            return -1 - value
+        if major in (2, 3):
+            raw = self.data[self.pos : self.pos + value]
+            self.pos += value
+            return raw.decode("utf-8") if major == 3 else bytes(raw)
+        if major == 4:
+            return [self.item() for _ in range(value)]
+        if major == 5:
+            items = {}
+            for _ in range(value):
+                self.entry(items)
+            return items
+        raise ValueError(f"Unsupported major type {major}")
+
+    def entry(self, items):
+        """a key and its value in a map: a decoder keeps one of duplicate keys, the encoder must not write them"""
+        at = self.pos
+        key = self.item()
+        if key in items:
+            raise ValueError(f"Duplicate map key {key} at {at}")
+        items[key] = self.item()
+
+
+def decode_cbor(data, labels_by_id):
+    root = Decoder(data).item()
+    if root.get(KEY_VERSION) != SCHEMA_VERSION:
+        raise ValueError(f"Unsupported schema version {root.get(KEY_VERSION)}")
+    result = {"version": root[KEY_VERSION]}
+    if KEY_TOKEN in root:
+        result["TOKEN"] = root[KEY_TOKEN]
+    result["VCONDO"] = root[KEY_VCONDO] / 1000
+    result["data"] = []
+    if KEY_COLUMNS in root:
+        ids, times, columns = root[KEY_COLUMNS]
+        columns = [
+            [None if v == 0 else unzigzag(v - 1) for v in get_varints(c)] if isinstance(c, bytes) else c for c in columns
+        ]
+        labels = [labels_by_id.get(id, str(id)) for id in ids]
+        result["data"] = from_columns(labels, [unzigzag(v) for v in get_varints(times)], columns)
+        return result
+    for sample in root[KEY_DATA]:
+        item = {}
+        for key, value in sample.items():
+            if key == KEY_TIMESTAMP:
+                item["timestamp"] = value
+            else:
+                item[labels_by_id.get(key, str(key))] = value
+        result["data"].append(item)
+    return result
+
+
+# ---------------------------------------------------------------- captures
+def parse_date(date):
+    # H210310115551 -> season + YYMMDDhhmmss
+    try:
+        return int(datetime.datetime.strptime(date[1:13], "%y%m%d%H%M%S").timestamp())
+    except ValueError:
+        return None
+
+
+def parse_capture(path, labels):
+    return [(labels[label]["id"], value) for label, value in capture_values(path, labels).items()]
+
+
+def capture_values(path, labels):
+    """the values of the first frame of a capture: {label: value}"""
+    standard = "STANDARD" in os.path.basename(path).upper()
+    mode = "MODE_STD" if standard else "MODE_HIST"
+    with open(path, "r", encoding="utf-8", errors="replace") as f:
+        text = f.read()
+    # some captures are escaped like trames.py: [9] for TAB, [13] for CR...
+    text = re.sub(r"\[(\d+)\]", lambda m: chr(int(m.group(1))), text)
+
+    values = {}
+    for line in re.split(r"[\r\n]+", text):
+        line = line.strip("\x02\x03")
+        # standard mode is tab separated, but some captures were saved with spaces
+        parts = re.split(r"\t|\s{2,}", line) if standard else line.split(" ")
+        if len(parts) < 2:
+            if values:
+                break  # one frame is enough
+            continue
+        label = parts[0]
+        if label not in labels or labels[label]["mode"] not in (mode, "ANY"):
+            continue
+        if label in values:
+            break
+        info = labels[label]
+        value = parts[1].strip()
+        if info["type"] == "UINT32_TIME":
+            # LABEL DATE VALUE CHECKSUM, or LABEL DATE CHECKSUM
+            if len(parts) >= 4 and parts[2].strip():
+                value = parts[2].strip()
+            else:
+                value = str(parse_date(value))
+        if info["type"] in UINT_TYPES:
+            if not value.isdigit():
+                continue
+            value = int(value)
+            if info["device_class"] == "ENERGY" and value == 0:
+                continue
+        elif not value:
+            continue
+        values[label] = value
+    return values
+
+
+def load_captures(labels):
+    captures = {}
+    for file in sorted(os.listdir(CAPTURES_DIR)):
+        if not file.endswith(".txt"):
+            continue
+        values = parse_capture(os.path.join(CAPTURES_DIR, file), labels)
+        if len(values) > 3:
+            captures[file] = values
+    return captures
+
+
+def report(count):
+    labels = load_labels()
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    token = "0" * 32
+    print(f"{count} sample(s) per payload, token of {len(token)} chars")
+    print(f"{'capture':30} {'labels':>6} {'json':>7} {'cbor':>7} {'gain':>6} {'json.gz':>7} {'cbor.gz':>7}")
+    for file, values in load_captures(labels).items():
+        samples = [(1700000000 + i * 60, values) for i in range(count)]
+        json_payload = encode_json(samples, labels_by_id, token)
+        json_size = len(json_payload)
+        cbor_payload = encode_cbor(samples, token)
+        decoded = decode_cbor(cbor_payload, labels_by_id)
+        assert decoded["data"][0] == dict({"timestamp": samples[0][0]}, **{labels_by_id[id]: v for id, v in values})
+        gain = (json_size - len(cbor_payload)) / json_size * 100
+        print(
+            f"{file:30} {len(values):6} {json_size:7} {len(cbor_payload):7} {gain:5.1f}%"
+            f" {gzip_size(json_payload):7} {gzip_size(cbor_payload):7}"
+        )
+
+
+def bench(iterations):
+    labels = load_labels()
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    for file, values in load_captures(labels).items():
+        samples = [(1700000000, values)]
+        for name, encoder in (
+            ("json", lambda: encode_json(samples, labels_by_id, "token")),
+            ("cbor", lambda: encode_cbor(samples, "token")),
+        ):
+            start = time.perf_counter()
+            for _ in range(iterations):
+                encoder()
+            elapsed = (time.perf_counter() - start) / iterations * 1e6
+            print(f"{file:30} {name}: {elapsed:8.1f} us/frame")
+
+
+def day_trace(values, labels, labels_by_id, refresh=60, seed=0):
+    """one sample every refresh seconds for 24h, built on the values of a capture"""
+    rng = random.Random(seed)
+    state = dict(values)
+    classes = {id: labels[labels_by_id[id]]["device_class"] for id in state}
+    energy = [id for id in state if classes[id] == "ENERGY"][:1]  # one index runs at a time
+    power = 800.0
+    samples = []
+    for i in range(24 * 3600 // refresh):
+        power = min(max(power + rng.gauss(0, 150), 150), 6000)
+        for id, value in state.items():
+            device_class = classes[id]
+            if not isinstance(value, int):
+                continue
+            if id in energy:
+                state[id] = value + round(power * refresh / 3600)
+            elif device_class in ("POWER_VA", "POWER_W", "POWER_"):
+                state[id] = int(power)
+            elif device_class == "CURRENT":
+                state[id] = int(power / 230)
+            elif device_class == "TENSION":
+                state[id] = 230 + rng.randint(-3, 3)
+            elif device_class == "TIMESTAMP":
+                state[id] = value + refresh
+        samples.append((1700000000 + i * refresh, list(state.items())))
+    return samples
+
+
+def columns(days):
+    labels = load_labels()
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    token = "0" * 32
+    print(f"{days} day(s), one sample per minute, sizes per day in bytes (gzip as web.c)")
+    for batch in (1, 3, 10):
+        print(f"\nbatches of {batch} sample(s)")
+        print(f"{'capture':30} {'json':>8} {'json col':>8} {'cbor':>8} {'cbor col':>8} {'json.gz':>8} {'col.gz':>8}")
+        for file, values in load_captures(labels).items():
+            sizes = [0] * 6
+            for day in range(days):
+                trace = day_trace(values, labels, labels_by_id, seed=day)
+                for start in range(0, len(trace), batch):
+                    samples = trace[start : start + batch]
+                    expected = [dict({"timestamp": t}, **{labels_by_id[id]: v for id, v in s}) for t, s in samples]
+                    json_rows = encode_json(samples, labels_by_id, token)
+                    json_columns = encode_json_columns(samples, labels_by_id, token)
+                    cbor_rows = encode_cbor(samples, token)
+                    cbor_columns = encode_cbor_columns(samples, labels_by_id, token)
+                    # round trip of both forms
+                    assert decode_json_columns(json.loads(json_columns)) == expected, file
+                    assert decode_cbor(cbor_columns, labels_by_id)["data"] == expected, file
+                    for i, size in enumerate(
+                        (
+                            len(json_rows),
+                            len(json_columns),
+                            len(cbor_rows),
+                            len(cbor_columns),
+                            gzip_size(json_rows),
+                            gzip_size(json_columns),
+                        )
+                    ):
+                        sizes[i] += size
+            print(f"{file:30} " + " ".join(f"{size // days:8}" for size in sizes))
+
+
+def roundtrip():
+    labels = load_labels()
+    failed = 0
+    # every row of the table, load_labels() keeps one row per label
+    ids = {}
+    with open(LINKY_C, "r", encoding="utf-8") as f:
+        for match in filter(None, map(LABEL_REGEX.match, f)):
+            ids.setdefault(int(match.group(1)), []).append(match.group(2))
+    duplicates = {id: names for id, names in ids.items() if len(names) > 1}
+    print(f"label ids      {sum(map(len, ids.values()))} rows, {len(duplicates)} duplicate id(s)"
+          f"{''.join(f', {id}: ' + ' '.join(names) for id, names in duplicates.items())}")
+    failed += len(duplicates) > 0
+
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    for file in ("STANDARD Mono.txt", "STANDARD PRODUCTION.txt"):
+        expected = capture_values(os.path.join(CAPTURES_DIR, file), labels)
+        samples = [(1700000000 + i * 60, [(labels[label]["id"], value) for label, value in expected.items()])
+                   for i in range(3)]
+        for name, encoder in (("rows", encode_cbor), ("columns", lambda s, t: encode_cbor_columns(s, labels_by_id, t))):
+            try:
+                decoded = decode_cbor(encoder(samples, "token"), labels_by_id)["data"]
+                lost = [label for label in expected if any(sample.get(label) != expected[label] for sample in decoded)]
+                error = f"{len(lost)} label(s) lost{': ' + ' '.join(lost) if lost else ''}"
+            except ValueError as e:
+                lost, error = True, str(e)
+            print(f"{file:25} {name:8} {len(expected):3} labels: {error}{'  FAILED' if lost else ''}")
+            failed += bool(lost)
+    return failed
+
+
+def decode(path):
+    labels_by_id = {info["id"]: label for label, info in load_labels().items()}
+    data = sys.stdin.buffer.read() if path == "-" else open(path, "rb").read()
+    print(json.dumps(decode_cbor(data, labels_by_id), indent=2, ensure_ascii=False))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2 or sys.argv[1] not in ("report", "bench", "decode", "columns", "roundtrip"):
+        print("Usage: python cbor_payload.py report [samples] | bench [iterations] | decode <file|-> | columns [days]"
+              " | roundtrip")
+        sys.exit(1)
+    if sys.argv[1] == "report":
+        report(int(sys.argv[2]) if len(sys.argv) > 2 else 3)
+    elif sys.argv[1] == "columns":
+        columns(int(sys.argv[2]) if len(sys.argv) > 2 else 1)
+    elif sys.argv[1] == "roundtrip":
+        sys.exit(1 if roundtrip() else 0)
+    elif sys.argv[1] == "bench":
+        bench(int(sys.argv[2]) if len(sys.argv) > 2 else 1000)
+    else:
+        if len(sys.argv) != 3:
+            print("Usage: python cbor_payload.py decode <file|->")
+            sys.exit(1)
+        decode(sys.argv[2])
@@ -0,0 +1,565 @@
+# Minimal CoAP (RFC 7252) peer for the TICMeter CoAP mode (main/coap.c)
+# Usage: python coap_server.py serve [port] [--separate]       receive the uploads, answer 2.04 (piggybacked or separate) and print the samples as json
+#        python coap_server.py get <device> <path> [observe]   GET a resource of the device, observe: print the notifications
+#        python coap_server.py test                            coap.c on loopback: options, upload with losses, separate response, observe
+# Example: python coap_server.py get 192.168.1.42 tic/index observe
+# The test needs gcc: coap.c, cbor.c, json_writer.c, exporter.c and the label table of linky.c are built on the host with
+# build_host() of mqtt_commands.py, on the sockets and the threads of the host, and run on a clock SCALE times faster.
+# The device serves on COAP_PORT of the host.
+
+import json
+import os
+import random
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from cbor_payload import KEY_TIMESTAMP, Decoder, decode_cbor, load_captures, load_labels
+from exporter_bench import SAMPLE, write_fields
+from mqtt_commands import build_host
+from udp_listen import DEVICE, SOCKET_MODULES, TIMESTAMP, expected, text_sizes
+
+CON, NON, ACK, RST = range(4)
+EMPTY, GET, POST = 0x00, 0x01, 0x02
+CREATED, CHANGED, CONTENT = 0x41, 0x44, 0x45
+BAD_OPTION, NOT_FOUND, METHOD_NOT_ALLOWED = 0x82, 0x84, 0x85
+OBSERVE, URI_PATH, CONTENT_FORMAT, MAX_AGE = 6, 11, 12, 14
+FORMAT_LINK, FORMAT_JSON, FORMAT_CBOR = 40, 50, 60
+PORT = 5683
+# same values as coap.c: COAP_MAX_RETRANSMIT, COAP_CON_EVERY, COAP_MAX_OBSERVERS
+MAX_RETRANSMIT = 4
+CON_EVERY = 10
+MAX_OBSERVERS = 4
+SCALE = 40  # the clock of the device runs SCALE times faster: the retransmissions of a minute take 1.5 s
+
+# the receive timeouts follow the clock of the device, the semaphores and the tasks are the ones of the host (shared
+# with modbus_map.py)
+TASK_MODULES = SOCKET_MODULES | {
+    "lwip/sockets.h": SOCKET_MODULES["lwip/sockets.h"]
+                      + "int host_setsockopt(int sock, int level, int name, const void *value, socklen_t len);\n"
+                      "#define setsockopt host_setsockopt\n",
+    "freertos/task.h": '#pragma once\n#include "host.h"\n#define pdPASS 1\n',
+    "freertos/semphr.h": '#pragma once\n#include "host.h"\n'
+                         "#undef xSemaphoreCreateMutex\n#undef xSemaphoreTake\n#undef xSemaphoreGive\n"
+                         "SemaphoreHandle_t xSemaphoreCreateMutex(void);\n"
+                         "int xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks);\n"
+                         "int xSemaphoreGive(SemaphoreHandle_t mutex);\n",
+}
+
+# FreeRTOS on pthread and the clock of the device
+RTOS = r"""
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000) * SCALE;
+}
+TickType_t xTaskGetTickCount(void) { return esp_timer_get_time() / 1000; }
+void vTaskDelay(TickType_t ticks) { usleep((int64_t)ticks * portTICK_PERIOD_MS * 1000 / SCALE); }
+int host_setsockopt(int sock, int level, int name, const void *value, socklen_t len)
+{
+    if (level == SOL_SOCKET && name == SO_RCVTIMEO)
+    {
+        const struct timeval *tv = value;
+        int64_t us = ((int64_t)tv->tv_sec * 1000000 + tv->tv_usec) / SCALE + 1; // 0 would wait forever
+        struct timeval scaled = {.tv_sec = us / 1000000, .tv_usec = us % 1000000};
+        return setsockopt(sock, level, name, &scaled, sizeof(scaled));
+    }
+    return setsockopt(sock, level, name, value, len);
+}
+
+typedef struct
+{
+    void (*task)(void *);
+    void *arg;
+} task_t;
+static void *task_run(void *arg)
+{
+    task_t task = *(task_t *)arg;
+    free(arg);
+    task.task(task.arg);
+    return NULL;
+}
+int xTaskCreate(void (*function)(void *), const char *name, uint32_t stack, void *arg, int priority, TaskHandle_t *handle)
+{
+    task_t *task = malloc(sizeof(task_t));
+    task->task = function;
+    task->arg = arg;
+    pthread_t thread;
+    *handle = (TaskHandle_t)task;
+    if (pthread_create(&thread, NULL, task_run, task) != 0)
+    {
+        free(task);
+        *handle = NULL;
+        return pdFALSE;
+    }
+    pthread_detach(thread);
+    return pdPASS;
+}
+void vTaskDelete(TaskHandle_t task) { pthread_exit(NULL); }
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    pthread_mutex_t *mutex = malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(mutex, NULL);
+    return mutex;
+}
+int xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks) { return pthread_mutex_lock(mutex) == 0; }
+int xSemaphoreGive(SemaphoreHandle_t mutex) { return pthread_mutex_unlock(mutex) == 0; }
+"""
+
+# commands on stdin, one answer line each: upload <capture> <port> <path>, start, notify <capture>, stop; the size of
+# each text label is printed first, fill() cuts the longer texts
+HARNESS = r"""
+#include "coap.h"
+#include "exporter.h"
+
+float gpio_get_vcondo(void) { return 4.5f; }
+const char *config_get_str_mode() { return "COAP"; }
+""" + SAMPLE + r"""
+static linky_data_t sample;
+
+static void load(int c)
+{
+    linky_mode = captures[c].mode;
+    fill(&sample, captures[c].fields, captures[c].count);
+    sample.timestamp = TIMESTAMP;
+}
+
+int main(void)
+{
+    static char line[128];
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    strcpy(config_values.coap.host, "127.0.0.1");
+    strcpy(config_values.version, "test");
+    config_values.refresh_rate = 60;
+    for (int32_t i = 0; i < linky_label_list_size; i++)
+        if (linky_label_list[i].type == STRING)
+            printf("size %s %d\n", linky_label_list[i].label, linky_label_list[i].size);
+    while (fgets(line, sizeof(line), stdin))
+    {
+        char command[16] = "", path[50] = "";
+        int capture = 0, port = 0;
+        sscanf(line, "%15s %d %d %49s", command, &capture, &port, path);
+        if (strcmp(command, "upload") == 0)
+        {
+            config_values.coap.port = port;
+            strcpy(config_values.coap.path, path);
+            load(capture);
+            printf("upload %d\n", coap_send(&sample));
+        }
+        else if (strcmp(command, "notify") == 0)
+        {
+            load(capture);
+            coap_notify(&sample);
+            printf("notify\n");
+        }
+        else if (strcmp(command, "start") == 0)
+            printf("start %d\n", coap_server_start());
+        else if (strcmp(command, "stop") == 0)
+        {
+            coap_server_stop();
+            printf("stop\n");
+        }
+    }
+    return 0;
+}
+"""
+
+
+def code_str(code):
+    return f"{code >> 5}.{code & 0x1F:02d}"
+
+
+def encode_uint(value):
+    return value.to_bytes((value.bit_length() + 7) // 8, "big")
+
+
+def encode(type, code, message_id, token=b"", options=(), payload=b""):
+    """options: (number, bytes) in any order, written sorted as deltas like coap_write_option()"""
+    out = bytearray([0x40 | (type << 4) | len(token), code]) + struct.pack(">H", message_id) + token
+    last = 0
+    for number, value in sorted(options, key=lambda o: o[0]):
+        head, ext = 0, b""
+        for shift, field in ((4, number - last), (0, len(value))):
+            if field >= 269:
+                head |= 14 << shift
+                ext += struct.pack(">H", field - 269)
+            elif field >= 13:
+                head |= 13 << shift
+                ext += bytes([field - 13])
+            else:
+                head |= field << shift
+        out += bytes([head]) + ext + value
+        last = number
+    if payload:
+        out += b"\xff" + payload
+    return bytes(out)
+
+
+def decode(data):
+    """return a dict: type, code, id, token, options [(number, bytes)], payload; ValueError if malformed"""
+    if len(data) < 4 or data[0] >> 6 != 1:
+        raise ValueError("not a CoAP message")
+    token_len = data[0] & 0x0F
+    if token_len > 8 or 4 + token_len > len(data):
+        raise ValueError("bad token")
+    message = {
+        "type": (data[0] >> 4) & 3,
+        "code": data[1],
+        "id": struct.unpack_from(">H", data, 2)[0],
+        "token": bytes(data[4 : 4 + token_len]),
+        "options": [],
+        "payload": b"",
+    }
+    pos, number = 4 + token_len, 0
+    while pos < len(data) and data[pos] != 0xFF:
+        fields = [data[pos] >> 4, data[pos] & 0x0F]
+        pos += 1
+        for i in range(2):
+            if fields[i] == 13:
+                fields[i] = data[pos] + 13
+                pos += 1
+            elif fields[i] == 14:
+                fields[i] = struct.unpack_from(">H", data, pos)[0] + 269
+                pos += 2
+            elif fields[i] == 15:
+                raise ValueError("reserved option nibble")
+        number += fields[0]
+        if pos + fields[1] > len(data):
+            raise ValueError("truncated option")
+        message["options"].append((number, bytes(data[pos : pos + fields[1]])))
+        pos += fields[1]
+    if pos < len(data):
+        if pos + 1 == len(data):
+            raise ValueError("payload marker without payload")
+        message["payload"] = bytes(data[pos + 1 :])
+    return message
+
+
+def option(message, number, default=None):
+    values = [v for n, v in message["options"] if n == number]
+    return values[0] if values else default
+
+
+def path_of(message):
+    return "/".join(v.decode("utf-8") for n, v in message["options"] if n == URI_PATH)
+
+
+def path_options(path):
+    return [(URI_PATH, segment.encode("utf-8")) for segment in path.split("/") if segment]
+
+
+# ---------------------------------------------------------------- server of the uploads
+class UploadServer:
+    """receive the confirmable POSTs of coap_send(), drop the duplicates by message id"""
+
+    def __init__(self, sock, labels_by_id, separate=False, drop=0):
+        self.sock = sock
+        self.labels_by_id = labels_by_id
+        self.separate = separate  # empty ACK first, then the response in a CON message
+        self.drop = drop  # number of datagrams to ignore, to force retransmissions
+        self.seen = {}  # (source, message id) -> response, replayed for the retransmissions
+        self.samples = []
+        self.received = 0
+
+    def handle(self, data, source):
+        self.received += 1
+        if self.drop > 0:
+            self.drop -= 1
+            return
+        message = decode(data)
+        if message["type"] != CON or message["code"] != POST:
+            return
+        key = (source, message["id"])
+        if key in self.seen:
+            self.sock.sendto(self.seen[key], source)
+            return
+        if option(message, CONTENT_FORMAT) != encode_uint(FORMAT_CBOR):
+            code = 0x8F  # 4.15 Unsupported Content-Format
+        else:
+            sample = decode_cbor(message["payload"], self.labels_by_id)
+            sample["path"] = path_of(message)
+            self.samples.append(sample)
+            code = CHANGED
+        if self.separate:
+            ack = encode(ACK, EMPTY, message["id"])
+            self.seen[key] = ack
+            self.sock.sendto(ack, source)
+            self.sock.sendto(encode(CON, code, random.getrandbits(16), message["token"]), source)
+        else:
+            response = encode(ACK, code, message["id"], message["token"])
+            self.seen[key] = response
+            self.sock.sendto(response, source)
+
+
+def serve(port, separate):
+    labels_by_id = {info["id"]: label for label, info in load_labels().items()}
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", port))
+    server = UploadServer(sock, labels_by_id, separate)
+    print(f"Listening on coap://0.0.0.0:{port}{' (separate responses)' if separate else ''}", file=sys.stderr)
+    while True:
+        data, source = sock.recvfrom(2048)
+        try:
+            server.handle(data, source)
+        except (ValueError, IndexError, KeyError) as e:
+            print(f"{source[0]}: dropped, {e}", file=sys.stderr)
+            continue
+        while server.samples:
+            print(json.dumps(server.samples.pop(0), ensure_ascii=False), flush=True)
+
+
+# ---------------------------------------------------------------- client
+def show(message):
+    content_format = int.from_bytes(option(message, CONTENT_FORMAT, b""), "big")
+    if content_format == FORMAT_CBOR:
+        return json.dumps(Decoder(message["payload"]).item(), ensure_ascii=False, default=str)
+    return message["payload"].decode("utf-8", errors="replace")
+
+
+def get(device, path, observe):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(None if observe else 5)
+    token = os.urandom(4)
+    options = path_options(path) + ([(OBSERVE, b"")] if observe else [])
+    sock.sendto(encode(CON, GET, random.getrandbits(16), token, options), (device, PORT))
+    while True:
+        message = decode(sock.recvfrom(2048)[0])
+        if message["token"] != token:
+            continue
+        if message["type"] == CON:
+            sock.sendto(encode(ACK, EMPTY, message["id"]), (device, PORT))
+        seq = option(message, OBSERVE)
+        print(f"{code_str(message['code'])}{'' if seq is None else ' observe ' + str(int.from_bytes(seq, 'big'))} {show(message)}", flush=True)
+        if not observe or seq is None:
+            return
+
+
+# ---------------------------------------------------------------- test
+def decode_sample(payload, labels_by_id):
+    """the sample map of cbor.h of a resource, without head"""
+    return {"timestamp" if key == KEY_TIMESTAMP else labels_by_id.get(key, str(key)): value
+            for key, value in Decoder(payload).item().items()}
+
+
+def build(work, captures, labels):
+    write_fields(os.path.join(work, "fields.h"), captures, labels)
+    code = DEVICE + f"#define TIMESTAMP {TIMESTAMP}\n#define SCALE {SCALE}\n" + RTOS + HARNESS
+    sources = ["coap.c", "cbor.c", "json_writer.c", "exporter.c"]
+    return build_host(work, "device", code, sources, TASK_MODULES, libs=["-lcrypto", "-lpthread"])
+
+
+class Device:
+    """the harness of coap.c, driven by its commands"""
+
+    def __init__(self, program):
+        self.process = subprocess.Popen([program], stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+        self.sizes = {}
+
+    def command(self, line):
+        """the answer to the command, after its logs"""
+        self.process.stdin.write(line + "\n")
+        self.process.stdin.flush()
+        while True:
+            out = self.process.stdout.readline()
+            if not out:
+                raise RuntimeError(f"the device exited on {line!r}")
+            self.sizes.update(text_sizes(out))
+            if out.split()[0] == line.split()[0]:
+                return out.split()[1:]
+
+    def close(self):
+        self.process.stdin.close()
+        self.process.wait(timeout=5)
+
+
+def test():
+    labels = load_labels()
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    failures = 0
+
+    def check(name, ok):
+        nonlocal failures
+        failures += not ok
+        print(f"{name:50} {'OK' if ok else 'FAILED'}")
+
+    # options: deltas and lengths with the 13 and 14 extensions
+    options = [(URI_PATH, b"tic"), (URI_PATH, b"x" * 20), (CONTENT_FORMAT, encode_uint(60)), (300, b"y" * 300), (2000, b"")]
+    message = decode(encode(CON, POST, 0x1234, b"\x01\x02", options, b"payload"))
+    check("options with extended deltas and lengths", message["options"] == sorted(options, key=lambda o: o[0]))
+    check("header, token and payload", (message["type"], message["code"], message["id"], message["token"], message["payload"])
+          == (CON, POST, 0x1234, b"\x01\x02", b"payload"))
+    check("uint options on the shortest length", [encode_uint(v) for v in (0, 60, 255, 256, 0xFFFFFF)]
+          == [b"", b"\x3c", b"\xff", b"\x01\x00", b"\xff\xff\xff"])
+    for name, data in (("payload marker without payload", encode(CON, GET, 1) + b"\xff"),
+                       ("reserved option nibble", encode(CON, GET, 1) + b"\xf0"),
+                       ("truncated option", encode(CON, GET, 1) + b"\xb5ab")):
+        try:
+            decode(data)
+            check(f"rejects {name}", False)
+        except ValueError:
+            check(f"rejects {name}", True)
+
+    captures = load_captures(labels)
+    values = list(captures.values())
+    work = tempfile.TemporaryDirectory()
+    device = Device(build(work.name, captures, labels))
+
+    # uploads of coap_send() to the server, with losses and separate responses
+    server_sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server_sock.bind(("127.0.0.1", 0))
+    server_sock.settimeout(0.1)
+    server = UploadServer(server_sock, labels_by_id)
+    running = True
+
+    def loop():
+        while running:
+            try:
+                data, source = server_sock.recvfrom(2048)
+            except socket.timeout:
+                continue
+            server.handle(data, source)
+
+    thread = threading.Thread(target=loop, daemon=True)
+    thread.start()
+
+    def upload(capture, path="tic"):
+        """the error of coap_send() and the sample received, server.received counts the datagrams of the device"""
+        server.received = 0
+        err = int(device.command(f"upload {capture} {server_sock.getsockname()[1]} {path}")[0])
+        time.sleep(0.05)  # the ACK of a separate response
+        return err, server.samples.pop() if server.samples else {}
+
+    for n, (file, capture) in enumerate(captures.items()):
+        err, sample = upload(n)
+        data = sample.get("data", [{}])
+        ok = err == 0 and server.received == 1 and sample.get("path") == "tic"
+        check(f"upload {file}", ok and data == [expected(capture, data[0], labels_by_id, device.sizes)])
+    server.drop = 2
+    err, sample = upload(0, "/a/b//tic")
+    check("upload after 2 lost datagrams", err == 0 and server.received == 3 and sample.get("path") == "a/b/tic")
+    server.drop = MAX_RETRANSMIT + 1
+    err, sample = upload(0)
+    check("upload fails after the retransmissions", err != 0 and server.received == MAX_RETRANSMIT + 1 and not sample)
+    server.drop, server.separate = 0, True
+    err, sample = upload(0)
+    check("upload with a separate response, acknowledged", err == 0 and server.received == 2 and sample)
+    running = False
+    thread.join()
+    server_sock.close()
+
+    # resources and observe
+    device.command("notify 0")  # kept for the resources, the server is not running yet
+    check("server started", device.command("start") == ["0"])
+    address = ("127.0.0.1", PORT)
+    client = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+    def receive(sock=client, timeout=1.0):
+        """the next message, None after timeout"""
+        sock.settimeout(timeout)
+        try:
+            return decode(sock.recvfrom(2048)[0])
+        except socket.timeout:
+            return None
+
+    def request(type, code, token, path, observe=None, extra=(), sock=client):
+        options = path_options(path) + ([(OBSERVE, encode_uint(observe))] if observe is not None else []) + list(extra)
+        message_id = random.getrandbits(16)
+        sock.sendto(encode(type, code, message_id, token, options), address)
+        return message_id, receive(sock) or {"type": None, "code": None, "id": None, "options": [], "payload": b""}
+
+    def notify(capture=0):
+        device.command(f"notify {capture}")
+        return receive(timeout=0.3)
+
+    message_id, response = request(CON, GET, b"t1", ".well-known/core")
+    check("GET /.well-known/core piggybacked", response["type"] == ACK and response["id"] == message_id
+          and b"</tic/live>;ct=60;obs" in response["payload"])
+    _, response = request(NON, GET, b"t2", "nothing")
+    check("NON GET of an unknown path: NON 4.04", response["type"] == NON and response["code"] == NOT_FOUND)
+    _, response = request(CON, GET, b"t3", "tic/live", extra=[(9, b"")])
+    check("unknown critical option: 4.02", response["code"] == BAD_OPTION)
+    _, response = request(CON, POST, b"t4", "tic/live")
+    check("POST on a resource: 4.05", response["code"] == METHOD_NOT_ALLOWED)
+    _, response = request(CON, GET, b"t5", "config")
+    check("GET /config: json", response["code"] == CONTENT and option(response, CONTENT_FORMAT) == encode_uint(FORMAT_JSON)
+          and json.loads(response["payload"]) == {"mode": "COAP", "refresh_rate": 60, "version": "test"})
+    _, response = request(CON, GET, b"t6", "tic/index")
+    index = decode_sample(response["payload"], labels_by_id) if response["code"] == CONTENT else {}
+    check("GET /tic/index: the energy indexes", index.pop("timestamp", None) == TIMESTAMP and index
+          and all(labels[label]["device_class"] == "ENERGY" for label in index))
+
+    _, response = request(CON, GET, b"ob", "tic/live", observe=0)
+    observe = option(response, OBSERVE)
+    check("register: 2.05 with Observe", response["code"] == CONTENT and observe is not None)
+    seqs, samples_ok = [], True
+    for i in range(1, CON_EVERY + 1):
+        notification = notify(i % len(values))
+        if notification is None:
+            break
+        seqs.append(int.from_bytes(option(notification, OBSERVE), "big"))
+        sample = decode_sample(notification["payload"], labels_by_id)
+        samples_ok &= sample == expected(values[i % len(values)], sample, labels_by_id, device.sizes)
+        if notification["type"] == CON:
+            client.sendto(encode(ACK, EMPTY, notification["id"]), address)
+            time.sleep(0.1)  # handled by the server task before the next sample
+    start = int.from_bytes(observe or b"", "big")
+    check("notifications: increasing Observe, last one CON", seqs == list(range(start + 1, start + CON_EVERY + 1))
+          and notification["type"] == CON and samples_ok)
+    notification = notify()
+    check("ACK of the CON notification keeps the observer", notification is not None)
+    client.sendto(encode(RST, EMPTY, notification["id"] if notification else 0), address)
+    time.sleep(0.1)
+    check("RST of a notification removes the observer", notify() is None)
+    request(CON, GET, b"ob", "tic/live", observe=0)
+    _, response = request(CON, GET, b"ob", "tic/live", observe=1)
+    check("deregister with Observe: 1", response["code"] == CONTENT and option(response, OBSERVE) is None and notify() is None)
+    request(CON, GET, b"ob", "tic/live", observe=0)
+    for _ in range(CON_EVERY):
+        notification = notify()  # the CON notification is left unacknowledged
+        if notification is None or notification["type"] == CON:
+            break
+    check("observer without ACK of the CON notification removed", notification is not None and notify() is None)
+    others = [socket.socket(socket.AF_INET, socket.SOCK_DGRAM) for _ in range(MAX_OBSERVERS + 1)]
+    responses = [request(CON, GET, b"o", "tic/live", observe=0, sock=other)[1] for other in others]
+    registered = [option(response, OBSERVE) is not None for response in responses]
+    device.command("notify 0")
+    notified = [receive(other, 0.3) is not None for other in others]
+    expected_table = [True] * MAX_OBSERVERS + [False]
+    check("table full: response without Observe", registered == expected_table and notified == expected_table)
+    client.sendto(encode(CON, EMPTY, 0x4242), address)
+    response = receive()
+    check("CoAP ping: RST", response is not None and response["type"] == RST and response["id"] == 0x4242)
+    device.command("stop")
+    client.sendto(encode(CON, EMPTY, 0x4243), address)
+    check("server stopped", receive(timeout=0.3) is None)
+    device.close()
+    for s in others + [client]:
+        s.close()
+    work.cleanup()
+
+    print("FAILED" if failures else "All OK")
+    return failures
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2 or sys.argv[1] not in ("serve", "get", "test") or (sys.argv[1] == "get" and len(sys.argv) < 4):
+        print("Usage: python coap_server.py serve [port] [--separate] | get <device> <path> [observe] | test")
+        sys.exit(1)
+    if sys.argv[1] == "serve":
+        args = [a for a in sys.argv[2:] if a != "--separate"]
+        serve(int(args[0]) if args else PORT, "--separate" in sys.argv)
+    elif sys.argv[1] == "get":
+        get(sys.argv[2], sys.argv[3], len(sys.argv) > 4 and sys.argv[4] == "observe")
+    else:
+        sys.exit(1 if test() else 0)
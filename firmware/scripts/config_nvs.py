@@ -0,0 +1,457 @@
+# Host check of the NVS accesses of main/config.c: only the changed items are written, with one commit per partition, the
+# boot reads the config blob in one get, and an old, missing or corrupted blob falls back to the per-key items
+# Usage: python config_nvs.py
+# Needs gcc. config.c is built on the host with stubs of the IDF headers and an NVS mock that keeps the values in memory
+# and counts the get, set and commit calls; each scenario prints its counts and is compared with the expected ones.
+
+import os
+import subprocess
+import sys
+import tempfile
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+MAIN_DIR = os.path.join(SCRIPT_DIR, "../main")
+
+# the IDF as seen by config.c and the headers it includes
+HOST_H = r"""
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_INVALID_VERSION 0x10A
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_NVS_INVALID_LENGTH 0x110c
+#define ESP_ERR_NVS_READ_ONLY 0x1104
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE 0x1105
+#define ESP_ERR_NVS_NO_FREE_PAGES 0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND 0x1110
+#define ESP_ERR_NVS_SEC_HMAC_KEY_NOT_FOUND 0x1121
+#define ESP_ERROR_CHECK(x) (void)(x)
+const char *esp_err_to_name(esp_err_t err);
+size_t strlcpy(char *dst, const char *src, size_t size); // newlib
+
+#define ESP_LOGI(tag, ...)
+#define ESP_LOGW(tag, ...)
+#define ESP_LOGE(tag, ...)
+#define ESP_LOGD(tag, ...)
+#define ESP_LOG_INFO 3
+#define ESP_LOG_BUFFER_HEXDUMP(...)
+
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define vTaskDelay(ticks)
+#define xTaskGetTickCount() 0
+#define xSemaphoreCreateMutex() ((SemaphoreHandle_t)1)
+#define xSemaphoreTake(mutex, ticks) 1
+#define xSemaphoreGive(mutex) 1
+
+typedef int esp_zb_zcl_attr_access_t;
+typedef int esp_zb_zcl_attr_type_t;
+uint8_t zigbee_factory_reset();
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+typedef struct { uint8_t key[64]; } nvs_sec_cfg_t;
+typedef struct { int type; } nvs_sec_scheme_t;
+typedef struct { int hmac_key_id; } nvs_sec_config_hmac_t;
+#define HMAC_KEY5 5
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+esp_err_t nvs_flash_erase_partition(const char *label);
+esp_err_t nvs_flash_deinit_partition(const char *label);
+esp_err_t nvs_flash_secure_init_partition(const char *label, nvs_sec_cfg_t *cfg);
+esp_err_t nvs_flash_read_security_cfg_v2(nvs_sec_scheme_t *scheme, nvs_sec_cfg_t *cfg);
+esp_err_t nvs_flash_generate_keys_v2(nvs_sec_scheme_t *scheme, nvs_sec_cfg_t *cfg);
+esp_err_t nvs_sec_provider_register_hmac(nvs_sec_config_hmac_t *config, nvs_sec_scheme_t **scheme);
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle);
+esp_err_t nvs_open_from_partition(const char *partition, const char *name, nvs_open_mode_t mode, nvs_handle_t *handle);
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *value);
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *value);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value);
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char *key, uint64_t *value);
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *length);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length);
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value);
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value);
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char *key, uint64_t value);
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_commit(nvs_handle_t handle);
+
+typedef int esp_efuse_coding_scheme_t;
+typedef int esp_efuse_block_t;
+#define EFUSE_CODING_SCHEME_NONE 0
+#define EFUSE_CODING_SCHEME_3_4 1
+#define EFUSE_CODING_SCHEME_RS 3
+#define EFUSE_BLK1 1
+#define EFUSE_BLK2 2
+#define EFUSE_BLK3 3
+typedef struct { int bit_start; } esp_efuse_desc_t;
+extern const esp_efuse_desc_t *ESP_EFUSE_MAC_FACTORY[];
+esp_efuse_coding_scheme_t esp_efuse_get_coding_scheme(esp_efuse_block_t block);
+esp_err_t esp_efuse_read_field_blob(const void *field, void *dst, size_t bits);
+esp_err_t esp_efuse_write_field_blob(const void *field, const void *src, size_t bits);
+esp_err_t esp_efuse_batch_write_begin(void);
+esp_err_t esp_efuse_batch_write_commit(void);
+
+typedef struct { const char *base_path; const char *partition_label; size_t max_files; bool format_if_mount_failed; } esp_vfs_spiffs_conf_t;
+esp_err_t esp_vfs_spiffs_register(const esp_vfs_spiffs_conf_t *conf);
+esp_err_t esp_vfs_spiffs_unregister(const char *partition_label);
+typedef struct { const char *base_path; const char *partition_label; bool format_if_mount_failed; } esp_vfs_littlefs_conf_t;
+esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t *conf);
+esp_err_t esp_littlefs_format(const char *partition_label);
+bool esp_littlefs_mounted(const char *partition_label);
+esp_err_t esp_littlefs_info(const char *partition_label, size_t *total_bytes, size_t *used_bytes);
+
+typedef struct esp_timer *esp_timer_handle_t;
+typedef struct { void (*callback)(void *arg); void *arg; const char *name; } esp_timer_create_args_t;
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+bool esp_timer_is_active(esp_timer_handle_t timer);
+
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+typedef void (*shutdown_handler_t)(void);
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
+void esp_restart(void);
+"""
+
+STUBS = [
+    "freertos/FreeRTOS.h", "freertos/task.h", "freertos/semphr.h", "driver/gpio.h", "driver/uart.h", "esp_zigbee_core.h",
+    "esp_system.h", "esp_err.h", "esp_log.h", "nvs_flash.h", "nvs.h", "version.h", "zigbee.h",
+    "esp_efuse.h", "esp_efuse_table.h", "esp_vfs.h", "esp_spiffs.h", "esp_littlefs.h", "esp_hmac.h", "nvs_sec_provider.h", "esp_timer.h", "esp_crc.h",
+]
+
+HARNESS = r"""
+#include "config.h"
+
+// ---- NVS mock: the committed values, the values set since the last commit of each handle
+typedef struct { nvs_handle_t handle; char key[16]; uint8_t data[2048]; size_t length; bool committed; } entry_t;
+static entry_t entries[128];
+static int entry_count;
+static int get_count, set_count, commit_count, fail_next_commit;
+
+const char *esp_err_to_name(esp_err_t err) { return "ERR"; }
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+esp_err_t nvs_flash_erase(void) { entry_count = 0; return ESP_OK; }
+esp_err_t nvs_flash_erase_partition(const char *label) { entry_count = 0; return ESP_OK; }
+esp_err_t nvs_flash_deinit_partition(const char *label) { return ESP_OK; }
+esp_err_t nvs_flash_secure_init_partition(const char *label, nvs_sec_cfg_t *cfg) { return ESP_OK; }
+esp_err_t nvs_flash_read_security_cfg_v2(nvs_sec_scheme_t *scheme, nvs_sec_cfg_t *cfg) { return ESP_OK; }
+esp_err_t nvs_flash_generate_keys_v2(nvs_sec_scheme_t *scheme, nvs_sec_cfg_t *cfg) { return ESP_OK; }
+esp_err_t nvs_sec_provider_register_hmac(nvs_sec_config_hmac_t *config, nvs_sec_scheme_t **scheme) { return ESP_OK; }
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle) { *handle = 1; return ESP_OK; }
+esp_err_t nvs_open_from_partition(const char *partition, const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    *handle = 100; // the read-only partition keeps its handle, its content tells if it exists
+    for (int i = 0; i < entry_count; i++)
+        if (entries[i].handle == 100 && entries[i].committed)
+            return ESP_OK;
+    return mode == NVS_READONLY ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+}
+
+static entry_t *find(nvs_handle_t handle, const char *key)
+{
+    for (int i = 0; i < entry_count; i++)
+        if (entries[i].handle == handle && strcmp(entries[i].key, key) == 0)
+            return &entries[i];
+    return NULL;
+}
+static esp_err_t get(nvs_handle_t handle, const char *key, void *value, size_t *length)
+{
+    get_count++;
+    entry_t *entry = find(handle, key);
+    if (entry == NULL || !entry->committed)
+        return ESP_ERR_NVS_NOT_FOUND;
+    if (entry->length > *length)
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(value, entry->data, entry->length);
+    *length = entry->length;
+    return ESP_OK;
+}
+static esp_err_t set(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    entry_t *entry = find(handle, key);
+    if (entry == NULL)
+    {
+        entry = &entries[entry_count++];
+        entry->handle = handle;
+        strcpy(entry->key, key);
+    }
+    memcpy(entry->data, value, length);
+    entry->length = length;
+    entry->committed = false;
+    set_count++;
+    return ESP_OK;
+}
+esp_err_t nvs_get_u8(nvs_handle_t h, const char *k, uint8_t *v) { size_t l = sizeof(*v); return get(h, k, v, &l); }
+esp_err_t nvs_get_u16(nvs_handle_t h, const char *k, uint16_t *v) { size_t l = sizeof(*v); return get(h, k, v, &l); }
+esp_err_t nvs_get_u32(nvs_handle_t h, const char *k, uint32_t *v) { size_t l = sizeof(*v); return get(h, k, v, &l); }
+esp_err_t nvs_get_u64(nvs_handle_t h, const char *k, uint64_t *v) { size_t l = sizeof(*v); return get(h, k, v, &l); }
+esp_err_t nvs_get_str(nvs_handle_t h, const char *k, char *v, size_t *l) { return get(h, k, v, l); }
+esp_err_t nvs_get_blob(nvs_handle_t h, const char *k, void *v, size_t *l) { return get(h, k, v, l); }
+esp_err_t nvs_set_u8(nvs_handle_t h, const char *k, uint8_t v) { return set(h, k, &v, sizeof(v)); }
+esp_err_t nvs_set_u16(nvs_handle_t h, const char *k, uint16_t v) { return set(h, k, &v, sizeof(v)); }
+esp_err_t nvs_set_u32(nvs_handle_t h, const char *k, uint32_t v) { return set(h, k, &v, sizeof(v)); }
+esp_err_t nvs_set_u64(nvs_handle_t h, const char *k, uint64_t v) { return set(h, k, &v, sizeof(v)); }
+esp_err_t nvs_set_str(nvs_handle_t h, const char *k, const char *v) { return set(h, k, v, strlen(v) + 1); }
+esp_err_t nvs_set_blob(nvs_handle_t h, const char *k, const void *v, size_t l) { return set(h, k, v, l); }
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    commit_count++;
+    if (fail_next_commit)
+    {
+        fail_next_commit = 0;
+        for (int i = 0; i < entry_count; i++)
+            if (entries[i].handle == handle && !entries[i].committed)
+                entries[i] = entries[--entry_count], i--; // lost
+        return ESP_FAIL;
+    }
+    for (int i = 0; i < entry_count; i++)
+        if (entries[i].handle == handle)
+            entries[i].committed = true;
+    return ESP_OK;
+}
+
+// ---- the rest of the IDF
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (int b = 0; b < 8; b++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+esp_efuse_coding_scheme_t esp_efuse_get_coding_scheme(esp_efuse_block_t block) { return EFUSE_CODING_SCHEME_NONE; }
+esp_err_t esp_efuse_read_field_blob(const void *field, void *dst, size_t bits) { memset(dst, 0x12, bits / 8); return ESP_OK; }
+esp_err_t esp_efuse_write_field_blob(const void *field, const void *src, size_t bits) { return ESP_OK; }
+esp_err_t esp_efuse_batch_write_begin(void) { return ESP_OK; }
+esp_err_t esp_efuse_batch_write_commit(void) { return ESP_OK; }
+esp_err_t esp_vfs_spiffs_register(const esp_vfs_spiffs_conf_t *conf) { return ESP_OK; }
+esp_err_t esp_vfs_spiffs_unregister(const char *partition_label) { return ESP_OK; }
+size_t strlcpy(char *dst, const char *src, size_t size) { snprintf(dst, size, "%s", src); return strlen(src); }
+esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t *conf) { return ESP_OK; }
+esp_err_t esp_littlefs_format(const char *partition_label) { return ESP_OK; }
+esp_err_t storage_update_resume(void) { return ESP_OK; }
+esp_err_t storage_update_stage_files(void) { return ESP_OK; }
+esp_err_t storage_update_restore_files(void) { return ESP_OK; }
+bool esp_littlefs_mounted(const char *partition_label) { return false; }
+esp_err_t esp_littlefs_info(const char *partition_label, size_t *total_bytes, size_t *used_bytes) { return ESP_OK; }
+const esp_efuse_desc_t *ESP_EFUSE_MAC_FACTORY[] = {NULL};
+const esp_efuse_desc_t *ESP_EFUSE_USER_DATA_SERIALNUMBER[] = {NULL};
+const esp_efuse_desc_t *ESP_EFUSE_USER_DATA_HWVERSION[] = {NULL};
+uint8_t zigbee_factory_reset() { return 0; }
+void hard_restart() {}
+
+// one timer, fired by the scenarios
+static void (*timer_callback)(void *arg);
+static bool timer_active;
+static int timer_starts;
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    timer_callback = args->callback;
+    *handle = (esp_timer_handle_t)1;
+    return ESP_OK;
+}
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) { timer_active = true; timer_starts++; return ESP_OK; }
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    bool was = timer_active;
+    timer_active = false;
+    return was ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+bool esp_timer_is_active(esp_timer_handle_t timer) { return timer_active; }
+static void timer_fire(void)
+{
+    if (timer_active)
+    {
+        timer_active = false;
+        timer_callback(NULL);
+    }
+}
+static shutdown_handler_t shutdown_handler;
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler) { shutdown_handler = handler; return ESP_OK; }
+
+static void report(const char *scenario)
+{
+    printf("%s %d %d %d\n", scenario, get_count, set_count, commit_count);
+    get_count = set_count = commit_count = 0;
+}
+
+// a restart: config_values is lost, config_begin() reads it back
+static config_t saved;
+static void boot(const char *scenario)
+{
+    saved = config_values;
+    memset(&config_values, 0, sizeof(config_values));
+    config_begin();
+    report(scenario);
+    printf("values %s %d\n", scenario, memcmp(&saved, &config_values, sizeof(config_values)) == 0);
+}
+
+int main(void)
+{
+    config_begin();
+    report("first-boot");
+    boot("boot");
+
+    config_write();
+    report("unchanged");
+
+    config_values.refresh_rate = 120;
+    config_write();
+    report("one-item");
+
+    // a string is compared up to its '\0'
+    char ssid[sizeof(config_values.ssid)];
+    memcpy(ssid, config_values.ssid, sizeof(ssid));
+    memset(config_values.ssid, 'x', sizeof(config_values.ssid));
+    strcpy(config_values.ssid, ssid);
+    config_write();
+    report("string-tail");
+    memcpy(config_values.ssid, ssid, sizeof(ssid));
+
+    config_values.mqtt.port = 1884;
+    config_values.web.store_before_send = 5;
+    config_values.sleep = 0;
+    config_write();
+    report("three-items");
+
+    // the auto TIC mode and the Home Assistant numbers, in a burst
+    for (int i = 0; i < 10; i++)
+    {
+        config_values.last_linky_mode = (i % 2) ? MODE_STD : MODE_HIST;
+        config_values.refresh_rate = 30 + i;
+        config_write_later();
+    }
+    report("later-pending");
+    timer_fire();
+    report("later-fired");
+
+    config_values.refresh_rate = 300;
+    config_write_later();
+    config_write(); // the pending write is done now
+    timer_fire();
+    report("later-then-write");
+
+    config_values.refresh_rate = 200;
+    config_write_later();
+    shutdown_handler(); // esp_restart() before the delay
+    report("later-restart");
+    shutdown_handler();
+    report("restart-idle");
+
+    fail_next_commit = 1;
+    config_values.refresh_rate = 90;
+    config_write();
+    report("commit-failed");
+    config_write();
+    report("commit-retry");
+    boot("boot-after-retry");
+
+    // a config saved by a firmware without the blob: the keys are read and the blob is written
+    entry_t *blob = find(1, "config");
+    *blob = entries[--entry_count];
+    boot("migration");
+    boot("boot-migrated");
+
+    // a damaged blob: the keys are read and the blob is written again
+    find(1, "config")->data[100] ^= 0x40;
+    boot("corrupted");
+    find(1, "config")->data[0] = 0; // version
+    boot("other-version");
+    find(1, "config")->length -= 8;
+    boot("other-size");
+    boot("boot-repaired");
+    return 0;
+}
+"""
+
+# scenario: (get calls, set calls, commit calls), config_begin() reads the config twice: the blob and the tuya keys of
+# the read-only partition each time
+KEYS = None  # one get per item, the count of config_items[] is not repeated here
+EXPECTED = {
+    "first-boot": (KEYS, KEYS, 2),
+    "boot": (4, 0, 0),
+    "unchanged": (0, 0, 0),
+    "one-item": (0, 2, 1),
+    "string-tail": (0, 0, 0),
+    "three-items": (0, 4, 1),
+    "later-pending": (0, 0, 0),
+    "later-fired": (0, 3, 1),
+    "later-then-write": (0, 2, 1),
+    "later-restart": (0, 2, 1),
+    "restart-idle": (0, 0, 0),
+    "commit-failed": (0, 2, 1),
+    "commit-retry": (0, 2, 1),
+    "boot-after-retry": (4, 0, 0),
+    "migration": (KEYS, 1, 1),
+    "boot-migrated": (4, 0, 0),
+    "corrupted": (KEYS, 1, 1),
+    "other-version": (KEYS, 1, 1),
+    "other-size": (KEYS, 1, 1),
+    "boot-repaired": (4, 0, 0),
+}
+
+
+def build(work):
+    with open(os.path.join(work, "host.h"), "w", encoding="utf-8") as f:
+        f.write(HOST_H)
+    for name in STUBS:
+        os.makedirs(os.path.dirname(os.path.join(work, name)), exist_ok=True)
+        with open(os.path.join(work, name), "w", encoding="utf-8") as f:
+            f.write('#pragma once\n#include "host.h"\n')
+    with open(os.path.join(work, "harness.c"), "w", encoding="utf-8") as f:
+        f.write(HARNESS)
+    program = os.path.join(work, "harness")
+    subprocess.run(
+        [
+            "gcc", "-O1", "-std=gnu17", "-w", "-I", work, "-I", os.path.join(MAIN_DIR, "include"), "-o", program,
+            os.path.join(work, "harness.c"), os.path.join(MAIN_DIR, "config.c"),
+        ],
+        check=True,
+    )
+    return program
+
+
+def check():
+    with tempfile.TemporaryDirectory() as work:
+        program = build(work)
+        lines = subprocess.run([program], check=True, capture_output=True, text=True).stdout.splitlines()
+    failed = 0
+    print(f"{'scenario':18} {'gets':>5} {'sets':>5} {'commits':>7}")
+    for line in lines:
+        parts = line.split()
+        if parts[0] == "values":
+            if parts[2] != "1":
+                print(f"{parts[1]:18} the config read back differs  FAILED")
+                failed += 1
+            continue
+        counts = tuple(int(part) for part in parts[1:])
+        ok = all(expected is None or count == expected for count, expected in zip(counts, EXPECTED[parts[0]]))
+        print(f"{parts[0]:18} {counts[0]:5} {counts[1]:5} {counts[2]:7}  {'' if ok else 'FAILED'}")
+        failed += not ok
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(1 if check() else 0)
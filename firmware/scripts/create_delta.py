@@ -0,0 +1,189 @@
+# Make the patch of a delta OTA: from the firmware of a release to the one of build/, applied by main/ota_delta.c
+# Usage: python create_delta.py <old TICMeter.bin> <old version> [new TICMeter.bin]
+# Example: python create_delta.py ~/Downloads/TICMeter.bin v2.1.0    writes ../build/TICMeter-from-v2.1.0.delta
+# create_manifest.py lists the patches of ../build in the manifest. The format is described in main/include/ota_delta.h:
+# bsdiff records (diff against the old image, extra bytes, seek) in one deflate stream, so the device applies the
+# patch while it downloads it.
+
+import hashlib
+import os
+import struct
+import sys
+import time
+import zlib
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+BUILD_DIR = os.path.join(SCRIPT_DIR, "../build")
+
+MAGIC = b"TDLT"
+WINDOW_BITS = 12  # OTA_DELTA_WINDOW_BITS: the inflate window of the device
+KEY_SIZE = 12  # bytes of the index keys
+INDEX_STEP = 2  # the old image is indexed every 2 bytes: the RISC-V instructions are 16 bits aligned
+MIN_MATCH = 24  # shorter matches are left in the diff or the extra bytes
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return (value << 1) if value >= 0 else ((-value << 1) - 1)
+
+
+def match_len(old, old_pos, new, new_pos):
+    limit = min(len(old) - old_pos, len(new) - new_pos)
+    n = 0
+    while n + 64 <= limit and old[old_pos + n : old_pos + n + 64] == new[new_pos + n : new_pos + n + 64]:
+        n += 64
+    while n < limit and old[old_pos + n] == new[new_pos + n]:
+        n += 1
+    return n
+
+
+def build_index(old):
+    index = {}
+    for i in range(0, len(old) - KEY_SIZE, INDEX_STEP):
+        index.setdefault(old[i : i + KEY_SIZE], i)
+    return index
+
+
+def records(old, new):
+    """bsdiff: exact matches found in an index of the old image, extended forward and backward with mismatches"""
+    index = build_index(old)
+    scan = last_scan = last_pos = last_offset = 0
+    while scan < len(new):
+        pos = index.get(new[scan : scan + KEY_SIZE])
+        length = 0
+        if pos is not None:
+            if pos == scan + last_offset:
+                # the current alignment goes on: it is part of the diff of the next record
+                scan += max(match_len(old, pos, new, scan), 1)
+                continue
+            length = match_len(old, pos, new, scan)
+        if length < MIN_MATCH:
+            scan += 1
+            continue
+        # bytes the current alignment already gives over the match
+        aligned = sum(
+            1 for i in range(length) if scan + last_offset + i < len(old) and old[scan + last_offset + i] == new[scan + i]
+        )
+        if length <= aligned + 8:
+            scan += 1
+            continue
+        diff, extra, seek, lenb = record(old, new, last_scan, last_pos, scan, pos)
+        yield diff, extra, seek
+        last_scan, last_pos, last_offset = scan - lenb, pos - lenb, pos - scan
+        scan += length
+    yield record(old, new, last_scan, last_pos, len(new), None)[:3]
+
+
+def record(old, new, last_scan, last_pos, scan, pos):
+    """the record of new[last_scan:scan], pos is the match at scan, None at the end of the new image"""
+    # forward: from the previous match, while at least half of the bytes match
+    limit = min(scan - last_scan, len(old) - last_pos)
+    exact = match_len(old, last_pos, new, last_scan) if limit > 0 else 0
+    exact = min(exact, limit)
+    count = score = lenf = exact
+    for i in range(exact, limit):
+        count += old[last_pos + i] == new[last_scan + i]
+        if count * 2 - (i + 1) > score * 2 - lenf:
+            score, lenf = count, i + 1
+    # backward: from the next match
+    lenb = 0
+    if pos is not None:
+        count = score = 0
+        for i in range(1, min(scan - last_scan, pos) + 1):
+            count += old[pos - i] == new[scan - i]
+            if count * 2 - i > score * 2 - lenb:
+                score, lenb = count, i
+    if last_scan + lenf > scan - lenb:
+        overlap = (last_scan + lenf) - (scan - lenb)
+        count = score = lens = 0
+        for i in range(overlap):
+            count += new[last_scan + lenf - overlap + i] == old[last_pos + lenf - overlap + i]
+            count -= new[scan - lenb + i] == old[pos - lenb + i]
+            if count > score:
+                score, lens = count, i + 1
+        lenf += lens - overlap
+        lenb -= lens
+    diff = bytes((a - b) & 0xFF for a, b in zip(new[last_scan : last_scan + lenf], old[last_pos : last_pos + lenf]))
+    extra = new[last_scan + lenf : scan - lenb]
+    seek = (pos - lenb) - (last_pos + lenf) if pos is not None else 0
+    return diff, extra, seek, lenb
+
+
+def make_patch(old, new):
+    header = MAGIC + struct.pack("<II", len(old), len(new)) + hashlib.sha256(old).digest() + hashlib.sha256(new).digest()
+    raw = bytearray(header)
+    for diff, extra, seek in records(old, new):
+        raw += varint(len(diff)) + diff + varint(len(extra)) + extra + varint(zigzag(seek))
+    compressor = zlib.compressobj(9, zlib.DEFLATED, WINDOW_BITS, 9)
+    return compressor.compress(bytes(raw)) + compressor.flush()
+
+
+def apply_patch(old, patch):
+    """the reference of ota_delta.c, to check a patch before it is published"""
+    raw = zlib.decompress(patch, WINDOW_BITS)
+    assert raw[:4] == MAGIC
+    old_size, new_size = struct.unpack("<II", raw[4:12])
+    assert old_size == len(old) and raw[12:44] == hashlib.sha256(old).digest()
+    pos, old_pos, new = 76, 0, bytearray()
+
+    def read_varint():
+        nonlocal pos
+        value = shift = 0
+        while True:
+            byte = raw[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value
+
+    while len(new) < new_size:
+        length = read_varint()
+        new += bytes((a + b) & 0xFF for a, b in zip(raw[pos : pos + length], old[old_pos : old_pos + length]))
+        pos += length
+        old_pos += length
+        length = read_varint()
+        new += raw[pos : pos + length]
+        pos += length
+        seek = read_varint()
+        old_pos += (seek >> 1) ^ -(seek & 1)
+    assert pos == len(raw) and hashlib.sha256(new).digest() == raw[44:76]
+    return bytes(new)
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("Usage: python create_delta.py <old TICMeter.bin> <old version> [new TICMeter.bin]")
+        return 1
+    with open(sys.argv[1], "rb") as f:
+        old = f.read()
+    new_path = sys.argv[3] if len(sys.argv) > 3 else os.path.join(BUILD_DIR, "TICMeter.bin")
+    with open(new_path, "rb") as f:
+        new = f.read()
+    start = time.time()
+    patch = make_patch(old, new)
+    if apply_patch(old, patch) != new:
+        print("The patch does not give the new image")
+        return 1
+    out = os.path.join(BUILD_DIR, f"TICMeter-from-{sys.argv[2]}.delta")
+    with open(out, "wb") as f:
+        f.write(patch)
+    full = len(zlib.compress(new, 9))
+    print(f"{out}: {len(patch)} bytes, {100 * len(patch) / full:.1f}% of the compressed image ({full} bytes),"
+          f" made in {time.time() - start:.1f} s")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
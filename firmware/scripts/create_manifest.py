@@ -1,10 +1,16 @@
 import csv
+import glob
+import hashlib
 import json
+import os
 import re
 import subprocess
 
 csv_file = "../partitions.csv"
 json_file = "../build/manifest.json"
+storage_bin = "../build/storage.bin"
+ota_c = "../main/ota.c"
+max_deltas = 8  # the releases a device can patch from, the older ones download the full image
 
 # git describe --tags
 version = subprocess.check_output(["git", "describe", "--tags"]).decode("utf-8").strip()
@@ -17,6 +23,27 @@ toFill = {
 }
 
 
+# checked by the firmware before the storage partition is replaced
+# The firmwares before LittleFS read this storage part too: they write it before the app, and format a storage they
+# cannot mount as an empty SPIFFS. Until every device runs a LittleFS firmware, storage.bin is a SPIFFS image
+# (STORAGE_IMAGE_SPIFFS of main/CMakeLists.txt) that they still mount if the app update fails after it, and that the
+# new firmware copies to LittleFS at boot. The same image goes in TICMeter.ota for the Zigbee devices.
+with open(storage_bin, mode="rb") as file:
+    storage = file.read()
+storage_sha256 = hashlib.sha256(storage).hexdigest()
+# the LittleFS superblock is at the beginning of block 0 or 1
+storage_littlefs = b"littlefs" in storage[:64] or b"littlefs" in storage[4096 : 4096 + 64]
+print(f"storage: {'LittleFS' if storage_littlefs else 'SPIFFS'} image")
+
+# patches of create_delta.py, applied by the firmware of the "from" version instead of the full image
+deltas = []
+for path in glob.glob("../build/TICMeter-from-*.delta"):
+    name = os.path.basename(path)
+    deltas.append({"from": name[len("TICMeter-from-") : -len(".delta")], "path": fileURL + name})
+# the newest versions first, v2.10.0 after v2.9.0
+deltas.sort(key=lambda delta: [int(n) for n in re.findall(r"\d+", delta["from"])], reverse=True)
+deltas = deltas[:max_deltas]
+
 offset = []
 # Lire le fichier CSV
 with open(csv_file, mode="r") as file:
@@ -53,6 +80,7 @@ output_data = {
                     "path": fileURL + "storage.bin",
                     "offset": offset[1],
                     "type": "storage",
+                    "sha256": storage_sha256,
                 },
                 {
                     "path": fileURL + "TICMeter.bin",
@@ -61,12 +89,19 @@ output_data = {
                     "ota": fileURL + "TICMeter.ota",
                 },
             ],
+            "deltas": deltas,
         }
     ],
 }
 
+# the firmware receives the manifest in a buffer of OTA_MANIFEST_SIZE bytes, NUL included, and refuses a bigger one
+with open(ota_c, mode="r") as file:
+    manifest_size = int(re.search(r"#define OTA_MANIFEST_SIZE (\d+)", file.read()).group(1))
+manifest = json.dumps(output_data, indent=2)
+assert len(manifest.encode()) < manifest_size, f"manifest of {len(manifest)} bytes, the firmware reads {manifest_size - 1}"
+
 # Écrire le fichier JSON résultant
 with open(json_file, "w") as json_output:
-    json.dump(output_data, json_output, indent=2)
+    json_output.write(manifest)
 
 print(f"Le fichier JSON a été généré avec succès : {json_file}")
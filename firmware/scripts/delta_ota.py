@@ -0,0 +1,256 @@
+# Host check and benchmark of the delta OTA: patches made by create_delta.py, applied by main/ota_delta.c
+# Usage: python delta_ota.py [old.bin new.bin]    two TICMeter.bin of releases, e.g. from the GitHub releases
+# Needs gcc, the zlib and OpenSSL headers. Without images, the pair is made from the Python library: the new image has
+# code inserted, removed and a word changed here and there, like a relinked firmware.
+# The running partition is the old image file, read through the callback of ota_delta.c; the patch is fed in the parts
+# of an HTTP download. Reported: patch size, time to make it, apply throughput and peak heap of the device side.
+
+import os
+import random
+import subprocess
+import sys
+import sysconfig
+import tempfile
+import time
+import zlib
+
+from create_delta import make_patch
+from storage_update import SHA256_H
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+MAIN_DIR = os.path.join(SCRIPT_DIR, "../main")
+APP_SIZE = 1900 * 1024  # ota_0 of ../partitions.csv
+
+HOST_H = r"""
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_INVALID_RESPONSE 0x108
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_INVALID_VERSION 0x10A
+
+#define ESP_LOGI(tag, ...)
+#define ESP_LOGW(tag, ...)
+#define ESP_LOGE(tag, ...)
+"""
+
+HARNESS = r"""
+#include <malloc.h>
+#include <time.h>
+#include "ota_delta.h"
+
+#define HTTP_PART 1436 // what an HTTP_EVENT_ON_DATA brings
+
+static uint8_t *old_image, *new_image, *patch, *written;
+static size_t old_size, new_size, patch_size, written_size;
+static size_t heap_base, heap_peak;
+static uint32_t reads, writes;
+
+static void heap_sample(void)
+{
+    size_t used = mallinfo2().uordblks - heap_base;
+    heap_peak = used > heap_peak ? used : heap_peak;
+}
+
+static esp_err_t read_old(void *context, uint32_t offset, void *data, size_t len)
+{
+    if (offset + len > old_size)
+        return ESP_FAIL;
+    memcpy(data, old_image + offset, len);
+    reads++;
+    return ESP_OK;
+}
+
+static esp_err_t write_new(void *context, const void *data, size_t len)
+{
+    if (written_size + len > new_size + 1024)
+        return ESP_FAIL;
+    memcpy(written + written_size, data, len);
+    written_size += len;
+    writes++;
+    heap_sample();
+    return ESP_OK;
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size + 1);
+    fread(data, 1, *size, f);
+    fclose(f);
+    return data;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// what ota_patch_update() does, on a patch of len bytes
+static esp_err_t apply(const uint8_t *data, size_t len)
+{
+    written_size = reads = writes = 0;
+    heap_base = mallinfo2().uordblks;
+    heap_peak = 0;
+    ota_delta_t *delta = malloc(sizeof(ota_delta_t));
+    esp_err_t err = ota_delta_init(delta, read_old, write_new, NULL);
+    heap_sample();
+    for (size_t done = 0; done < len && err == ESP_OK; done += HTTP_PART)
+        err = ota_delta_feed(delta, data + done, len - done < HTTP_PART ? len - done : HTTP_PART);
+    if (err == ESP_OK)
+        err = ota_delta_finish(delta);
+    ota_delta_free(delta);
+    free(delta);
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    // harness <old image> <new image> <patch> <iterations>
+    old_image = read_file(argv[1], &old_size);
+    new_image = read_file(argv[2], &new_size);
+    patch = read_file(argv[3], &patch_size);
+    written = malloc(new_size + 1024);
+    int iterations = atoi(argv[4]);
+
+    double start = now_us();
+    esp_err_t err = ESP_OK;
+    for (int i = 0; i < iterations && err == ESP_OK; i++)
+        err = apply(patch, patch_size);
+    double time = (now_us() - start) / iterations;
+    bool same = written_size == new_size && memcmp(written, new_image, new_size) == 0;
+    printf("apply %d %d %.0f %zu %u %u\n", err, same, time, heap_peak, reads, writes);
+
+    // the running image is not the one of the patch: nothing is written
+    old_image[old_size / 2] ^= 1;
+    err = apply(patch, patch_size);
+    printf("other-old %d %u\n", err, writes);
+    old_image[old_size / 2] ^= 1;
+
+    err = apply(patch, patch_size - 100);
+    printf("truncated %d %u\n", err, writes);
+
+    patch[patch_size / 2] ^= 0x10;
+    err = apply(patch, patch_size);
+    printf("corrupted %d %u\n", err, writes);
+    return 0;
+}
+"""
+
+# error codes of HOST_H
+OK, INVALID_SIZE, INVALID_RESPONSE, INVALID_CRC, INVALID_VERSION = 0, 0x104, 0x108, 0x109, 0x10A
+
+
+def host_binary():
+    """machine code of the host, as large as a firmware: libpython when Python is built shared"""
+    library = os.path.join(sysconfig.get_config_var("LIBDIR") or "", sysconfig.get_config_var("LDLIBRARY") or "")
+    return library if os.path.isfile(library) else os.path.realpath(sys.executable)
+
+
+def relinked_pair(rng):
+    """an old image and a new one as a release changes it: functions added and removed, calls and addresses moved"""
+    with open(host_binary(), "rb") as f:
+        old = f.read()[:APP_SIZE - 64 * 1024]
+    new = bytearray(old)
+    for _ in range(4):
+        at = rng.randrange(len(new))
+        source = rng.randrange(len(old) - 8192)
+        new[at:at] = old[source : source + rng.randrange(512, 8192)]  # a new function, code like the rest
+    for _ in range(3):
+        at = rng.randrange(len(new) - 8192)
+        del new[at : at + rng.randrange(256, 4096)]
+    for _ in range(len(new) // 400):
+        at = rng.randrange(len(new) - 4) & ~3
+        new[at : at + 4] = rng.randbytes(4)  # an offset or an address changed by the link
+    return bytes(old), bytes(new)
+
+
+def build(work):
+    with open(os.path.join(work, "host.h"), "w", encoding="utf-8") as f:
+        f.write(HOST_H)
+    for name in ("esp_err.h", "esp_log.h"):
+        with open(os.path.join(work, name), "w", encoding="utf-8") as f:
+            f.write('#pragma once\n#include "host.h"\n')
+    os.makedirs(os.path.join(work, "mbedtls"), exist_ok=True)
+    with open(os.path.join(work, "mbedtls/sha256.h"), "w", encoding="utf-8") as f:
+        f.write(SHA256_H)
+    with open(os.path.join(work, "harness.c"), "w", encoding="utf-8") as f:
+        f.write(HARNESS)
+    program = os.path.join(work, "harness")
+    subprocess.run(
+        [
+            "gcc", "-O2", "-std=gnu17", "-w", "-I", work, "-I", os.path.join(MAIN_DIR, "include"), "-o", program,
+            os.path.join(work, "harness.c"), os.path.join(MAIN_DIR, "ota_delta.c"), "-lz", "-lcrypto",
+        ],
+        check=True,
+    )
+    return program
+
+
+def check():
+    if len(sys.argv) > 2:
+        with open(sys.argv[1], "rb") as f:
+            old = f.read()
+        with open(sys.argv[2], "rb") as f:
+            new = f.read()
+        source = f"{os.path.basename(sys.argv[1])} -> {os.path.basename(sys.argv[2])}"
+    else:
+        old, new = relinked_pair(random.Random(73))
+        source = "relinked copy of " + os.path.basename(host_binary())
+
+    start = time.time()
+    patch = make_patch(old, new)
+    make_time = time.time() - start
+    full = len(zlib.compress(new, 9))
+
+    with tempfile.TemporaryDirectory() as work:
+        program = build(work)
+        paths = []
+        for name, data in (("old.bin", old), ("new.bin", new), ("patch.delta", patch)):
+            paths.append(os.path.join(work, name))
+            with open(paths[-1], "wb") as f:
+                f.write(data)
+        lines = subprocess.run([program] + paths + ["5"], check=True, capture_output=True, text=True).stdout.splitlines()
+
+    print(f"{source}: {len(old)} -> {len(new)} bytes")
+    print(f"patch          {len(patch)} bytes, {100 * len(patch) / full:.1f}% of the compressed image ({full} bytes),"
+          f" made in {make_time:.1f} s")
+    failed = 0
+    for line in lines:
+        name, err, *values = line.split()
+        err = int(err)
+        if name == "apply":
+            same, time_us, heap, reads, writes = (int(float(value)) for value in values)
+            ok = err == OK and same
+            print(f"apply          {time_us / 1000:.1f} ms, {len(new) / time_us:.1f} MB/s, peak heap {heap} bytes,"
+                  f" {reads} reads, {writes} writes{'' if ok else '  FAILED'}")
+        else:
+            writes = int(values[0])
+            expected = {
+                "other-old": err == INVALID_VERSION and writes == 0,
+                "truncated": err == INVALID_SIZE,
+                "corrupted": err in (INVALID_RESPONSE, INVALID_CRC, INVALID_SIZE),
+            }
+            ok = expected[name]
+            print(f"{name:14} {err:#x}, {writes} writes{'' if ok else '  FAILED'}")
+        failed += not ok
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(1 if check() else 0)
@@ -0,0 +1,300 @@
+# Host benchmark of the exporter interface of main/exporter.c: cost of the shared walk of a sample and of the changed set
+# Usage: python exporter_bench.py [iterations]    time per publish on the captures of ../tramesLinky
+# Needs gcc. exporter.c and the label table of linky.c are built on the host with stubs of the IDF headers, each capture
+# is published alternately with a copy where the measures moved, so the changed set is not empty.
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+from cbor_payload import SCRIPT_DIR, load_captures, load_labels
+from json_bench import c_string
+
+MAIN_DIR = os.path.join(SCRIPT_DIR, "../main")
+LINKY_C = os.path.join(MAIN_DIR, "linky.c")
+
+# just enough of the IDF for linky.h and exporter.c
+STUBS = {
+    "freertos/FreeRTOS.h": "#pragma once\n#include <stdint.h>\n#include <stdbool.h>\n",
+    "freertos/task.h": "#pragma once\n",
+    "freertos/semphr.h": "#pragma once\n",
+    "driver/gpio.h": "#pragma once\n",
+    "driver/uart.h": "#pragma once\n",
+    "esp_zigbee_core.h": "#pragma once\ntypedef int esp_zb_zcl_attr_access_t;\ntypedef int esp_zb_zcl_attr_type_t;\n",
+    "esp_err.h": "#pragma once\ntypedef int esp_err_t;\n#define ESP_OK 0\n#define ESP_FAIL -1\n#define ESP_ERR_INVALID_ARG 0x102\n",
+    "esp_log.h": "#pragma once\n#define ESP_LOGI(tag, ...)\n#define ESP_LOGW(tag, ...)\n#define ESP_LOGE(tag, ...)\n",
+    "esp_timer.h": "#pragma once\n#include <stdint.h>\n#include <time.h>\n"
+                   "static inline int64_t esp_timer_get_time(void)\n"
+                   "{\n    struct timespec t;\n    clock_gettime(CLOCK_MONOTONIC, &t);\n"
+                   "    return t.tv_sec * 1000000LL + t.tv_nsec / 1000;\n}\n",
+}
+
+# the device values of the table, defined in config.c, ota.c and linky.c on the target
+GLOBALS = r"""
+#include "esp_err.h"
+#include "linky.h"
+struct { uint16_t refresh_rate; } config_values = {60};
+uint8_t ota_available = 0;
+uint32_t linky_free_heap_size = 100000;
+linky_data_t linky_data;
+linky_mode_t linky_mode = MODE_HIST;
+uint8_t linky_three_phase = 0;
+"""
+
+# a sample filled from the fields of a capture (fields.h, see write_fields), and the next one where the measures moved
+SAMPLE = r"""
+typedef struct { const char *label; const char *text; unsigned long long value; } field_t;
+#include "fields.h"
+
+static void clear(linky_data_t *sample)
+{
+    for (int32_t i = 0; i < linky_label_list_size; i++)
+    {
+        const linky_value_t *label = &linky_label_list[i];
+        uintptr_t offset = (uintptr_t)label->data - (uintptr_t)&linky_data;
+        if (label->data == NULL || offset >= sizeof(linky_data_t))
+            continue;
+        void *data = (uint8_t *)sample + offset;
+        switch (label->type)
+        {
+        case UINT8: *(uint8_t *)data = UINT8_MAX; break;
+        case UINT16: *(uint16_t *)data = UINT16_MAX; break;
+        case UINT32: *(uint32_t *)data = UINT32_MAX; break;
+        case UINT64: *(uint64_t *)data = UINT64_MAX; break;
+        case UINT32_TIME: ((time_label_t *)data)->value = UINT32_MAX; ((time_label_t *)data)->time = 0; break;
+        case STRING: *(char *)data = '\0'; break;
+        default: break;
+        }
+    }
+}
+
+static void fill(linky_data_t *sample, const field_t *fields, int count)
+{
+    clear(sample);
+    for (int f = 0; f < count; f++)
+        for (int32_t i = 0; i < linky_label_list_size; i++)
+        {
+            const linky_value_t *label = &linky_label_list[i];
+            uintptr_t offset = (uintptr_t)label->data - (uintptr_t)&linky_data;
+            if (label->data == NULL || offset >= sizeof(linky_data_t) || strcmp(label->label, fields[f].label) != 0)
+                continue;
+            if (label->mode != linky_mode && label->mode != ANY)
+                continue;
+            void *data = (uint8_t *)sample + offset;
+            switch (label->type)
+            {
+            case UINT8: *(uint8_t *)data = fields[f].value; break;
+            case UINT16: *(uint16_t *)data = fields[f].value; break;
+            case UINT32: *(uint32_t *)data = fields[f].value; break;
+            case UINT64: *(uint64_t *)data = fields[f].value; break;
+            case UINT32_TIME: ((time_label_t *)data)->value = fields[f].value; ((time_label_t *)data)->time = 1700000000; break;
+            case STRING:
+            {
+                size_t len = strlen(fields[f].text);
+                len = len < label->size ? len : label->size;
+                memcpy(data, fields[f].text, len);
+                ((char *)data)[len] = '\0';
+                break;
+            }
+            default: break;
+            }
+        }
+}
+
+// the next sample: the measures and the indexes moved, the rest is the same
+static void step(linky_data_t *sample)
+{
+    exporter_iter_t iter;
+    exporter_value_t value;
+    exporter_iter_init(&iter, sample, 0);
+    while (exporter_iter_next(&iter, &value))
+    {
+        if (value.label->device_class == NONE_CLASS)
+            continue;
+        void *data = (uint8_t *)sample + ((const uint8_t *)value.data - (const uint8_t *)sample);
+        switch (value.label->type)
+        {
+        case UINT16: (*(uint16_t *)data)++; break;
+        case UINT32: (*(uint32_t *)data)++; break;
+        case UINT64: (*(uint64_t *)data)++; break;
+        default: break;
+        }
+    }
+}
+
+"""
+
+HARNESS = r"""
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "exporter.h"
+
+""" + SAMPLE + r"""
+// the work of a text exporter (MQTT, Tuya): one topic and one formatted value per label
+static char topic[64], payload[64];
+static size_t text_bytes;
+static void format(const exporter_value_t *value)
+{
+    text_bytes += snprintf(topic, sizeof(topic), "TICMeter/%s/state", value->label->label);
+    if (value->text != NULL)
+        text_bytes += snprintf(payload, sizeof(payload), "%s", value->text);
+    else
+        text_bytes += snprintf(payload, sizeof(payload), "%llu", (unsigned long long)value->number);
+}
+static esp_err_t text_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed)
+{
+    exporter_iter_t iter;
+    exporter_value_t value;
+    exporter_iter_init(&iter, &samples[count - 1], EXPORTER_DEVICE_VALUES);
+    while (exporter_iter_next(&iter, &value))
+        format(&value);
+    return ESP_OK;
+}
+// a reporting exporter (Zigbee): only the changed labels are sent
+static esp_err_t report_publish(linky_data_t *samples, uint8_t count, const exporter_changed_t *changed)
+{
+    exporter_iter_t iter;
+    exporter_value_t value;
+    exporter_iter_init(&iter, &samples[count - 1], EXPORTER_DEVICE_VALUES);
+    while (exporter_iter_next(&iter, &value))
+        if (exporter_changed(changed, value.index))
+            format(&value);
+    return ESP_OK;
+}
+static exporter_stats_t text_stats, report_stats;
+static const exporter_t text_exporter = {.name = "text", .publish = text_publish, .stats = &text_stats};
+static const exporter_t report_exporter = {.name = "report", .publish = report_publish, .stats = &report_stats};
+
+static double run(const exporter_t *exporter, linky_data_t *samples, int iterations)
+{
+    memset(exporter->stats, 0, sizeof(*exporter->stats));
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < iterations; i++)
+        exporter_publish(exporter, &samples[i % 2], 1);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double us = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e3;
+    return us / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = atoi(argv[1]);
+    static linky_data_t samples[2];
+    for (int c = 0; c < CAPTURE_COUNT; c++)
+    {
+        linky_mode = captures[c].mode;
+        fill(&samples[0], captures[c].fields, captures[c].count);
+        samples[1] = samples[0];
+        step(&samples[1]);
+
+        // the walk without the device values gives back the labels of the capture, in the order of the table
+        printf("capture %s %d", captures[c].name, captures[c].count);
+        exporter_iter_t iter;
+        exporter_value_t value;
+        exporter_iter_init(&iter, &samples[0], 0);
+        while (exporter_iter_next(&iter, &value))
+            printf(" %s", value.label->label);
+        printf("\n");
+
+        const exporter_t *exporters[] = {&exporter_null, &text_exporter, &report_exporter};
+        for (int e = 0; e < 3; e++)
+        {
+            double us = run(exporters[e], samples, iterations);
+            const exporter_stats_t *stats = exporters[e]->stats;
+            printf("%s %.3f %u\n", exporters[e]->name, us, (unsigned)(stats->changed_count / stats->publish_count));
+        }
+    }
+    fprintf(stderr, "%zu\n", text_bytes);
+    return 0;
+}
+"""
+
+
+def write_table(path, globals=GLOBALS):
+    """the label table of linky.c, the Zigbee access and type columns are not used on the host"""
+    with open(LINKY_C, "r", encoding="utf-8") as f:
+        source = f.read()
+    table = source[source.index("const linky_value_t linky_label_list[] ="):]
+    table = table[:table.index("\n", table.index("linky_label_list_size ="))]
+    with open(path, "w", encoding="utf-8") as f:
+        f.write(globals)
+        for name in sorted(set(re.findall(r"^#define (ZB_\w+)", source, re.MULTILINE))):
+            f.write(f"#define {name} 0\n")
+        f.write(table + "\n")
+
+
+def write_fields(path, captures, labels):
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    with open(path, "w", encoding="utf-8") as f:
+        names = []
+        for n, (file, values) in enumerate(captures.items()):
+            f.write(f"static const field_t fields_{n}[] = {{\n")
+            for id, value in values:
+                if isinstance(value, int):
+                    f.write(f"    {{{c_string(labels_by_id[id])}, NULL, {value}ULL}},\n")
+                else:
+                    f.write(f"    {{{c_string(labels_by_id[id])}, {c_string(value)}, 0}},\n")
+            f.write("};\n")
+            standard = any(labels[labels_by_id[id]]["mode"] == "MODE_STD" for id, _ in values)
+            names.append((file, n, len(values), "MODE_STD" if standard else "MODE_HIST"))
+        f.write(f"#define CAPTURE_COUNT {len(names)}\n")
+        f.write("static const struct { const char *name; const field_t *fields; int count; linky_mode_t mode; } captures[] = {\n")
+        for file, n, count, mode in names:
+            f.write(f"    {{{c_string(file.replace(' ', '_'))}, fields_{n}, {count}, {mode}}},\n")
+        f.write("};\n")
+
+
+def build(work):
+    for name, content in STUBS.items():
+        os.makedirs(os.path.dirname(os.path.join(work, name)), exist_ok=True)
+        with open(os.path.join(work, name), "w", encoding="utf-8") as f:
+            f.write(content)
+    write_table(os.path.join(work, "table.c"))
+    with open(os.path.join(work, "bench.c"), "w", encoding="utf-8") as f:
+        f.write(HARNESS)
+    program = os.path.join(work, "bench")
+    subprocess.run(
+        [
+            "gcc", "-O2", "-std=gnu17", "-I", work, "-I", os.path.join(MAIN_DIR, "include"), "-o", program,
+            os.path.join(work, "bench.c"), os.path.join(work, "table.c"), os.path.join(MAIN_DIR, "exporter.c"),
+        ],
+        check=True,
+    )
+    return program
+
+
+def bench(iterations):
+    labels = load_labels()
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    captures = load_captures(labels)
+    with tempfile.TemporaryDirectory() as work:
+        write_fields(os.path.join(work, "fields.h"), captures, labels)
+        program = build(work)
+        lines = subprocess.run([program, str(iterations)], check=True, capture_output=True, text=True).stdout.splitlines()
+
+    print(f"{iterations} publish per capture, alternating two samples")
+    print(f"{'capture':28} {'labels':>6} {'changed':>7} {'null us':>8} {'text us':>8} {'report us':>9}")
+    capture = None
+    results = {}
+    for line in lines:
+        parts = line.split(" ")
+        if parts[0] == "capture":
+            capture = (parts[1], int(parts[2]))
+            # the "_time" labels read the date of a UINT32_TIME label, the captures do not list them
+            walked = [label for label in parts[3:] if not label.endswith("_time")]
+            expected = [labels_by_id[id] for id, _ in captures[next(f for f in captures if f.replace(" ", "_") == parts[1])]]
+            assert set(walked) == set(expected), f"{parts[1]}: the walk differs from the capture"
+            continue
+        results[parts[0]] = (float(parts[1]), int(parts[2]))
+        if parts[0] != "report":
+            continue
+        print(f"{capture[0]:28} {capture[1]:6} {results['report'][1]:7} {results['NULL'][0]:8.2f}"
+              f" {results['text'][0]:8.2f} {results['report'][0]:9.2f}")
+
+
+if __name__ == "__main__":
+    bench(int(sys.argv[1]) if len(sys.argv) > 1 else 20000)
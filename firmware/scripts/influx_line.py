@@ -0,0 +1,258 @@
+# Encode, receive and benchmark the TICMeter InfluxDB line protocol payload (web_stream_influx() in main/web.c)
+# Usage: python influx_line.py bench [iterations]    serializer benchmark and size vs json on the captures of ../tramesLinky
+#        python influx_line.py receive [port]        tiny line protocol receiver, prints the points POSTed by a TICMeter
+#        python influx_line.py test [samples]        end to end: POST the captures like the firmware to a local receiver and compare
+# Example: python influx_line.py receive 8086, then on the TICMeter: set-web 192.168.1.10:8086 /api/v2/write?bucket=linky <token>
+
+import gzip
+import http.client
+import http.server
+import json
+import re
+import sys
+import threading
+import time
+import urllib.parse
+
+from cbor_payload import encode_json, gzip_size, load_captures, load_labels
+
+MEASUREMENT = "linky"
+# same tags as web_influx_tags in web.c, sorted by key
+TAGS = (
+    ("contract", ("OPTARIF", "NGTF")),
+    ("serial", ("ADCO", "ADSC")),
+    ("tariff", ("PTEC", "LTARF")),
+)
+TAG_LABELS = {label: key for key, labels in TAGS for label in labels}
+
+
+# ---------------------------------------------------------------- encoder
+def escape(text, special):
+    return "".join("\\" + c if c in special else c for c in text)
+
+
+def load_named_captures(labels):
+    # the samples are keyed by label: the ids of linky_label_list are not unique (EAST and LTARF)
+    return load_captures({label: dict(info, id=label) for label, info in labels.items()})
+
+
+def encode_lines(samples, labels, vcondo=4.5):
+    if not samples:
+        return f"{MEASUREMENT} VCONDO={vcondo:.2f}\n".encode("utf-8")
+    order = {label: i for i, label in enumerate(labels)}  # web.c follows linky_label_list
+    lines = []
+    for timestamp, values in samples:
+        tags = {}
+        fields = []
+        for label, value in sorted(values, key=lambda v: order[v[0]]):
+            if label in TAG_LABELS:
+                tags[TAG_LABELS[label]] = escape(value, ", =")
+            elif labels[label]["type"] == "STRING":
+                fields.append(f'{label}="{escape(value, chr(34) + chr(92))}"')
+            elif labels[label]["type"] == "BOOL":
+                fields.append(f"{label}={'true' if value else 'false'}")
+            else:
+                fields.append(f"{label}={value}i")
+        fields.append(f"VCONDO={vcondo:.2f}")
+        line = MEASUREMENT + "".join(f",{key}={tags[key]}" for key, _ in TAGS if key in tags)
+        lines.append(f"{line} {','.join(fields)} {timestamp}\n")
+    return "".join(lines).encode("utf-8")
+
+
+# ---------------------------------------------------------------- receiver
+def split_unescaped(text, separator):
+    parts = []
+    current = ""
+    quoted = False
+    i = 0
+    while i < len(text):
+        c = text[i]
+        if c == "\\" and i + 1 < len(text):
+            current += text[i : i + 2]
+            i += 2
+            continue
+        if c == '"':
+            quoted = not quoted
+        if c == separator and not quoted:
+            parts.append(current)
+            current = ""
+        else:
+            current += c
+        i += 1
+    if quoted:
+        raise ValueError(f"unterminated string in {text!r}")
+    parts.append(current)
+    return parts
+
+
+def unescape(text):
+    return re.sub(r"\\(.)", r"\1", text)
+
+
+def parse_field(value):
+    if value.startswith('"'):
+        if not value.endswith('"') or len(value) < 2:
+            raise ValueError(f"bad string field {value!r}")
+        return unescape(value[1:-1])
+    if value in ("true", "false"):
+        return value == "true"
+    if value.endswith("i"):
+        return int(value[:-1])
+    return float(value)
+
+
+def parse_lines(body):
+    """strict enough line protocol parser: return [(measurement, tags, fields, timestamp or None)]"""
+    points = []
+    for line in body.decode("utf-8").split("\n"):
+        if not line or line.startswith("#"):
+            continue
+        parts = split_unescaped(line, " ")
+        if len(parts) not in (2, 3):
+            raise ValueError(f"bad line {line!r}")
+        series = split_unescaped(parts[0], ",")
+        tags = {}
+        for tag in series[1:]:
+            key, value = split_unescaped(tag, "=")
+            tags[unescape(key)] = unescape(value)
+        if list(tags) != sorted(tags):
+            raise ValueError(f"tags not sorted in {line!r}")
+        fields = {}
+        for field in split_unescaped(parts[1], ","):
+            key, value = split_unescaped(field, "=")
+            fields[unescape(key)] = parse_field(value)
+        if not fields:
+            raise ValueError(f"no field in {line!r}")
+        timestamp = int(parts[2]) if len(parts) == 3 else None
+        points.append((unescape(series[0]), tags, fields, timestamp))
+    return points
+
+
+class Receiver(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"  # keep-alive like InfluxDB
+    points = []
+    verbose = True
+
+    def read_body(self):
+        if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+            body = b""
+            while True:
+                size = int(self.rfile.readline().split(b";")[0], 16)
+                chunk = self.rfile.read(size)
+                self.rfile.readline()
+                if size == 0:
+                    return body
+                body += chunk
+        return self.rfile.read(int(self.headers.get("Content-Length", 0)))
+
+    def do_POST(self):
+        body = self.read_body()
+        if self.headers.get("Content-Encoding") == "gzip":
+            body = gzip.decompress(body)
+        query = urllib.parse.parse_qs(urllib.parse.urlparse(self.path).query)
+        try:
+            if query.get("precision") != ["s"]:
+                raise ValueError(f"precision must be s: {self.path}")
+            points = parse_lines(body)
+        except ValueError as e:
+            self.reply(400, json.dumps({"code": "invalid", "message": str(e)}).encode("utf-8"))
+            return
+        Receiver.points += points
+        if self.verbose:
+            auth = self.headers.get("Authorization", "no token")
+            print(f"{self.path} ({auth}): {len(points)} point(s), {len(body)} bytes")
+            for point in points:
+                print("  ", point)
+        self.reply(204, b"")
+
+    def reply(self, status, body):
+        self.send_response(status)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def receive(port):
+    server = http.server.ThreadingHTTPServer(("", port), Receiver)
+    print(f"Listening on port {port}")
+    server.serve_forever()
+
+
+# ---------------------------------------------------------------- bench and test
+def bench(iterations):
+    labels = load_labels()
+    print(f"{'capture':30} {'json':>7} {'influx':>7} {'json.gz':>7} {'inf.gz':>7} {'us/frame':>9}  (10 samples per payload)")
+    for file, values in load_named_captures(labels).items():
+        samples = [(1700000000 + i * 60, values) for i in range(10)]
+        json_payload = encode_json(samples, {label: label for label in labels}, "0" * 32)
+        lines = encode_lines(samples, labels)
+        start = time.perf_counter()
+        for _ in range(iterations):
+            encode_lines(samples[:1], labels)
+        elapsed = (time.perf_counter() - start) / iterations * 1e6
+        print(
+            f"{file:30} {len(json_payload):7} {len(lines):7} {gzip_size(json_payload):7} {gzip_size(lines):7} {elapsed:9.1f}"
+        )
+
+
+def post(port, body, gzipped, chunk=256):
+    # like wifi_send_to_server(): chunked, optionally gzip, precision added to the url
+    connection = http.client.HTTPConnection("127.0.0.1", port)
+    headers = {"Content-Type": "text/plain; charset=utf-8", "Authorization": "Token test"}
+    if gzipped:
+        body = gzip.compress(body)
+        headers["Content-Encoding"] = "gzip"
+    parts = (body[i : i + chunk] for i in range(0, len(body), chunk))
+    connection.request("POST", "/api/v2/write?bucket=linky&precision=s", parts, headers, encode_chunked=True)
+    response = connection.getresponse()
+    response.read()
+    connection.close()
+    return response.status
+
+
+def test(count):
+    labels = load_labels()
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Receiver)
+    Receiver.verbose = False
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    port = server.server_address[1]
+
+    failures = 0
+    captures = load_named_captures(labels)
+    # an escaped tag and string field, and the empty batch sent when the linky can't be read
+    captures["escape (synthetic)"] = [("ADSC", "0219 75,=1"), ("LTARF", " HC  BLEU"), ("MSG1", 'PAS "DE" \\ MSG')]
+    captures["empty batch"] = None
+    for file, values in captures.items():
+        samples = [(1700000000 + i * 60, values) for i in range(count)] if values else []
+        for gzipped in (False, True):
+            Receiver.points = []
+            status = post(port, encode_lines(samples, labels), gzipped)
+            expected = []
+            for timestamp, sample in samples:
+                tags = {TAG_LABELS[label]: v for label, v in sample if label in TAG_LABELS}
+                fields = {label: v for label, v in sample if label not in TAG_LABELS}
+                fields["VCONDO"] = 4.5
+                expected.append((MEASUREMENT, tags, fields, timestamp))
+            if not samples:
+                expected = [(MEASUREMENT, {}, {"VCONDO": 4.5}, None)]
+            ok = status == 204 and Receiver.points == expected
+            failures += not ok
+            print(f"{file:30} {'gzip' if gzipped else 'raw ':4} HTTP {status} {len(Receiver.points):3} point(s) {'OK' if ok else 'FAILED'}")
+    server.shutdown()
+    print("FAILED" if failures else "All OK")
+    return failures
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2 or sys.argv[1] not in ("bench", "receive", "test"):
+        print("Usage: python influx_line.py bench [iterations] | receive [port] | test [samples]")
+        sys.exit(1)
+    if sys.argv[1] == "bench":
+        bench(int(sys.argv[2]) if len(sys.argv) > 2 else 1000)
+    elif sys.argv[1] == "receive":
+        receive(int(sys.argv[2]) if len(sys.argv) > 2 else 8086)
+    else:
+        sys.exit(1 if test(int(sys.argv[2]) if len(sys.argv) > 2 else 10) else 0)
@@ -0,0 +1,224 @@
+# Host benchmark of the JSON export: cJSON tree + print vs the streaming writer of main/json_writer.c
+# Usage: python json_bench.py [iterations]    time, peak heap and allocation count per sample, on the captures of ../tramesLinky
+# Needs gcc. Both encoders are built from the sources of the firmware (cJSON from the Tuya SDK component, the same library
+# as the IDF json component) into one host program, malloc/realloc/free are wrapped to count the heap of each encoder.
+
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+from cbor_payload import SCRIPT_DIR, load_captures, load_labels
+
+MAIN_DIR = os.path.join(SCRIPT_DIR, "../main")
+CJSON_DIR = os.path.join(SCRIPT_DIR, "../components/tuya-iot-link-sdk/tuya-connect-kit-for-mqtt-embedded-c/utils")
+TOKEN = "0" * 32
+
+# heap accounting, linked with -Wl,--wrap=malloc,--wrap=free,--wrap=realloc (shared with json_read.py)
+HEAP_WRAP = r"""
+// heap accounting of the wrapped allocator, a header keeps the size of each block
+static size_t heap_now, heap_peak, heap_count;
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+void *__wrap_malloc(size_t size)
+{
+    size_t *block = __real_malloc(size + sizeof(size_t) * 2);
+    block[0] = size;
+    heap_now += size;
+    heap_count++;
+    if (heap_now > heap_peak)
+        heap_peak = heap_now;
+    return block + 2;
+}
+void __wrap_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    size_t *block = (size_t *)ptr - 2;
+    heap_now -= block[0];
+    __real_free(block);
+}
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    void *out = __wrap_malloc(size);
+    if (ptr != NULL)
+    {
+        size_t old = ((size_t *)ptr - 2)[0];
+        memcpy(out, ptr, old < size ? old : size);
+        __wrap_free(ptr);
+    }
+    return out;
+}
+"""
+
+HARNESS = r"""
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cJSON.h"
+#include "json_writer.h"
+
+typedef struct { const char *label; const char *text; unsigned long long value; } field_t;
+#include "fields.h"
+
+HEAP_WRAP
+
+static char output[4096];
+
+// like web_json_sample() before the writer: a tree, then cJSON_PrintUnformatted()
+static size_t encode_cjson(const field_t *fields, int count)
+{
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "TOKEN", TOKEN);
+    cJSON_AddNumberToObject(root, "VCONDO", 4.5);
+    cJSON *data = cJSON_CreateArray();
+    cJSON *sample = cJSON_CreateObject();
+    for (int i = 0; i < count; i++)
+    {
+        if (fields[i].text != NULL)
+            cJSON_AddStringToObject(sample, fields[i].label, fields[i].text);
+        else
+            cJSON_AddNumberToObject(sample, fields[i].label, fields[i].value);
+    }
+    cJSON_AddItemToArray(data, sample);
+    cJSON_AddItemToObject(root, "data", data);
+    char *text = cJSON_PrintUnformatted(root);
+    size_t len = strlen(text);
+    memcpy(output, text, len + 1);
+    free(text);
+    cJSON_Delete(root);
+    return len;
+}
+
+static size_t encode_writer(const field_t *fields, int count)
+{
+    json_writer_t writer;
+    json_init(&writer, output, sizeof(output));
+    json_open_object(&writer);
+    json_add_key_text(&writer, "TOKEN", TOKEN);
+    json_add_key(&writer, "VCONDO");
+    json_add_decimal(&writer, 450, 2);
+    json_add_key(&writer, "data");
+    json_open_array(&writer);
+    json_open_object(&writer);
+    for (int i = 0; i < count; i++)
+    {
+        if (fields[i].text != NULL)
+            json_add_key_text(&writer, fields[i].label, fields[i].text);
+        else
+            json_add_key_uint(&writer, fields[i].label, fields[i].value);
+    }
+    json_close_object(&writer);
+    json_close_array(&writer);
+    json_close_object(&writer);
+    return json_end(&writer);
+}
+
+static void run(const char *name, size_t (*encode)(const field_t *, int), const field_t *fields, int count, long iterations)
+{
+    heap_now = heap_peak = heap_count = 0;
+    size_t len = encode(fields, count);
+    size_t peak = heap_peak, allocations = heap_count;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; i++)
+        encode(fields, count);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double us = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e3 / iterations;
+    encode(fields, count);
+    printf("%s %zu %.3f %zu %zu %s\n", name, len, us, peak, allocations, output);
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = atol(argv[1]);
+    for (int c = 0; c < CAPTURE_COUNT; c++)
+    {
+        printf("capture %s %d\n", captures[c].name, captures[c].count);
+        run("cjson", encode_cjson, captures[c].fields, captures[c].count, iterations);
+        run("writer", encode_writer, captures[c].fields, captures[c].count, iterations);
+    }
+    return 0;
+}
+"""
+
+
+def c_string(text):
+    # octal escapes: some captures are corrupted (NUL, control characters), the C string stops at the first NUL
+    out = ""
+    for byte in text.encode("utf-8"):
+        out += chr(byte) if 0x20 <= byte < 0x7F and chr(byte) not in '"\\?' else f"\\{byte:03o}"
+    return f'"{out}"'
+
+
+def write_fields(path, captures, labels_by_id):
+    with open(path, "w", encoding="utf-8") as f:
+        f.write(f'#define TOKEN "{TOKEN}"\n')
+        names = []
+        for n, (file, values) in enumerate(captures.items()):
+            f.write(f"static const field_t fields_{n}[] = {{\n")
+            for id, value in values:
+                if isinstance(value, int):
+                    f.write(f"    {{{c_string(labels_by_id[id])}, NULL, {value}ULL}},\n")
+                else:
+                    f.write(f"    {{{c_string(labels_by_id[id])}, {c_string(value)}, 0}},\n")
+            f.write("};\n")
+            names.append((file, n, len(values)))
+        f.write(f"#define CAPTURE_COUNT {len(names)}\n")
+        f.write("static const struct { const char *name; const field_t *fields; int count; } captures[] = {\n")
+        for file, n, count in names:
+            f.write(f"    {{{c_string(file.replace(' ', '_'))}, fields_{n}, {count}}},\n")
+        f.write("};\n")
+
+
+def build(work):
+    with open(os.path.join(work, "bench.c"), "w", encoding="utf-8") as f:
+        f.write(HARNESS.replace("HEAP_WRAP", HEAP_WRAP))
+    program = os.path.join(work, "bench")
+    subprocess.run(
+        [
+            "gcc", "-O2", "-std=gnu17", "-I", work, "-I", os.path.join(MAIN_DIR, "include"), "-I", CJSON_DIR,
+            "-Wl,--wrap=malloc,--wrap=free,--wrap=realloc", "-o", program,
+            os.path.join(work, "bench.c"), os.path.join(MAIN_DIR, "json_writer.c"), os.path.join(CJSON_DIR, "cJSON.c"),
+        ],
+        check=True,
+    )
+    return program
+
+
+def bench(iterations):
+    labels = load_labels()
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    captures = load_captures(labels)
+    with tempfile.TemporaryDirectory() as work:
+        write_fields(os.path.join(work, "fields.h"), captures, labels_by_id)
+        program = build(work)
+        lines = subprocess.run([program, str(iterations)], check=True, capture_output=True, text=True).stdout.splitlines()
+
+    print(f"{iterations} iterations per capture, one sample per payload")
+    print(f"{'capture':28} {'labels':>6} {'bytes':>6} {'cJSON us':>9} {'writer us':>9} {'speedup':>7}"
+          f" {'cJSON heap':>10} {'allocs':>6} {'writer heap':>11} {'allocs':>6}")
+    results = {}
+    capture = None
+    for line in lines:
+        parts = line.split(" ", 5)
+        if parts[0] == "capture":
+            capture = (parts[1], int(parts[2]))
+            continue
+        name, length, us, peak, allocations, output = parts[0], int(parts[1]), float(parts[2]), int(parts[3]), int(parts[4]), parts[5]
+        results[name] = (length, us, peak, allocations, json.loads(output))
+        if name != "writer":
+            continue
+        cjson, writer = results["cjson"], results["writer"]
+        # same document, except VCONDO: a double for cJSON, 2 decimals for the writer
+        assert cjson[4] == writer[4], f"{capture[0]}: the payloads differ"
+        assert writer[2] == 0 and writer[3] == 0, f"{capture[0]}: the writer used the heap"
+        print(f"{capture[0]:28} {capture[1]:6} {writer[0]:6} {cjson[1]:9.2f} {writer[1]:9.2f} {cjson[1] / writer[1]:6.1f}x"
+              f" {cjson[2]:10} {cjson[3]:6} {writer[2]:11} {writer[3]:6}")
+
+
+if __name__ == "__main__":
+    bench(int(sys.argv[1]) if len(sys.argv) > 1 else 20000)
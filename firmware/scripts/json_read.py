@@ -0,0 +1,504 @@
+# Host fuzz test and benchmark of the JSON lookups of main/json_reader.c (coreJSON of the Tuya SDK component)
+# Usage: python json_read.py fuzz [documents] [seed]    random and mutated documents, lookups compared with the json module
+#        python json_read.py bench [iterations]         cJSON tree + lookups vs json_reader, time, peak heap and allocations
+# Needs gcc. The fuzz build runs under AddressSanitizer and UBSan, each document is in a buffer of its exact size
+# without '\0', so a read past the end stops the test.
+
+import json
+import math
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+
+from json_bench import CJSON_DIR, HEAP_WRAP, MAIN_DIR, SCRIPT_DIR
+
+CORE_JSON_DIR = os.path.join(
+    SCRIPT_DIR, "../components/tuya-iot-link-sdk/tuya-connect-kit-for-mqtt-embedded-c/libraries/coreJSON/source"
+)
+INT32_MIN, INT32_MAX = -(2**31), 2**31 - 1
+TEXT_SIZES = (1, 4, 16, 64, 256)
+
+FUZZ_HARNESS = r"""
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json_reader.h"
+
+// records on stdin: u32 length, document, u32 path count, then per path: u16 length, path, u16 size of the text buffer
+static int read_all(void *out, size_t len)
+{
+    return fread(out, 1, len, stdin) == len;
+}
+
+int main(void)
+{
+    unsigned int len;
+    while (read_all(&len, 4))
+    {
+        char *json = malloc(len ? len : 1); // exact size: ASan catches any read past the document
+        unsigned int paths;
+        if (!read_all(json, len) || !read_all(&paths, 4))
+            return 2;
+        printf("O %d\n", json_read_object(json, len));
+        for (unsigned int p = 0; p < paths; p++)
+        {
+            unsigned short path_len, size;
+            char path[256];
+            if (!read_all(&path_len, 2) || path_len >= sizeof(path) || !read_all(path, path_len) || !read_all(&size, 2))
+                return 2;
+            path[path_len] = '\0';
+            char *text = malloc(size);
+            memset(text, 0x55, size);
+            int found = json_read_text(json, len, path, text, size);
+            printf("T %d ", found);
+            for (size_t i = 0; found && text[i] != '\0'; i++)
+                printf("%02x", (unsigned char)text[i]);
+            int32_t value = 0;
+            found = json_read_int(json, len, path, &value);
+            printf("\nI %d %d\nE %d\n", found, (int)value, json_read_exists(json, len, path));
+            free(text);
+        }
+        free(json);
+    }
+    return 0;
+}
+"""
+
+BENCH_HARNESS = r"""
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cJSON.h"
+#include "json_reader.h"
+
+typedef struct { const char *path; int text; } lookup_t;
+typedef struct { const char *name; const char *json; const lookup_t *lookups; int count; } document_t;
+#include "documents.h"
+
+HEAP_WRAP
+
+static char text[256];
+static int32_t number;
+
+// the path of json_reader on a cJSON tree: keys joined by '.', array indexes in []
+static cJSON *cjson_find(cJSON *item, const char *path)
+{
+    char key[64];
+    while (item != NULL && *path != '\0')
+    {
+        if (*path == '[')
+        {
+            item = cJSON_GetArrayItem(item, atoi(path + 1));
+            path = strchr(path, ']') + 1;
+        }
+        else
+        {
+            size_t len = strcspn(path, ".[");
+            memcpy(key, path, len);
+            key[len] = '\0';
+            item = cJSON_GetObjectItemCaseSensitive(item, key);
+            path += len;
+        }
+        if (*path == '.')
+            path++;
+    }
+    return item;
+}
+
+// like the firmware before json_reader: cJSON_Parse(), lookups and copies, cJSON_Delete()
+static int lookup_cjson(const document_t *document)
+{
+    int found = 0;
+    cJSON *json = cJSON_Parse(document->json);
+    if (!cJSON_IsObject(json))
+        return -1;
+    for (int i = 0; i < document->count; i++)
+    {
+        cJSON *item = cjson_find(json, document->lookups[i].path);
+        if (document->lookups[i].text && cJSON_IsString(item) && strlen(item->valuestring) < sizeof(text))
+        {
+            strcpy(text, item->valuestring);
+            found++;
+        }
+        else if (!document->lookups[i].text && cJSON_IsNumber(item))
+        {
+            number = item->valueint;
+            found++;
+        }
+        else if (!document->lookups[i].text && cJSON_IsString(item))
+        {
+            number = atoi(item->valuestring);
+            found++;
+        }
+    }
+    cJSON_Delete(json);
+    return found;
+}
+
+static int lookup_reader(const document_t *document)
+{
+    int found = 0;
+    size_t len = strlen(document->json);
+    if (!json_read_object(document->json, len))
+        return -1;
+    for (int i = 0; i < document->count; i++)
+    {
+        if (document->lookups[i].text)
+            found += json_read_text(document->json, len, document->lookups[i].path, text, sizeof(text));
+        else
+            found += json_read_int(document->json, len, document->lookups[i].path, &number);
+    }
+    return found;
+}
+
+static void run(const char *name, int (*lookup)(const document_t *), const document_t *document, long iterations)
+{
+    heap_now = heap_peak = heap_count = 0;
+    int found = lookup(document);
+    size_t peak = heap_peak, allocations = heap_count;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; i++)
+        lookup(document);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double us = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e3 / iterations;
+    printf("%s %d %.3f %zu %zu\n", name, found, us, peak, allocations);
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = atol(argv[1]);
+    for (int d = 0; d < DOCUMENT_COUNT; d++)
+    {
+        printf("document %s %zu %d\n", documents[d].name, strlen(documents[d].json), documents[d].count);
+        run("cjson", lookup_cjson, &documents[d], iterations);
+        run("reader", lookup_reader, &documents[d], iterations);
+    }
+    return 0;
+}
+"""
+
+
+def c_string(text):
+    out = ""
+    for byte in text.encode("utf-8"):
+        out += chr(byte) if 0x20 <= byte < 0x7F and chr(byte) not in '"\\?' else f"\\{byte:03o}"
+    return f'"{out}"'
+
+
+# ------------------------------------------------------------------ fuzz
+
+
+def random_key(rng):
+    # no '.' nor '[': they are separators of the paths
+    return "".join(rng.choice("abcdefghijklmnopqrstuvwxyz0123456789-_") for _ in range(rng.randint(1, 12)))
+
+
+def random_text(rng):
+    pool = ['"', "\\", "/", "\b", "\f", "\n", "\r", "\t", "\x01", "\x1f", " ", "é", "€", "😀", " ", "0", "-", "+", "7"]
+    chars = []
+    for _ in range(rng.choice((0, 1, 3, 8, 20, 80, 300))):
+        chars.append(rng.choice(pool) if rng.random() < 0.4 else chr(rng.randint(0x20, 0x7E)))
+    if rng.random() < 0.2:
+        chars.insert(0, " " * rng.randint(0, 3) + str(rng.randint(-(2**40), 2**40)))
+    return "".join(chars)
+
+
+def random_number(rng):
+    kind = rng.random()
+    if kind < 0.5:
+        return rng.randint(-1000, 100000)
+    if kind < 0.7:
+        return rng.randint(-(2**40), 2**40)
+    if kind < 0.9:
+        return round(rng.uniform(-1e6, 1e6), rng.randint(0, 6))
+    return rng.choice((0.5, -0.5, 1e10, -1e10, 2147483647, -2147483648, 2147483648, 1e300))
+
+
+def random_value(rng, depth):
+    kind = rng.random()
+    if depth < 6 and kind < 0.2:
+        return {random_key(rng): random_value(rng, depth + 1) for _ in range(rng.randint(0, 6))}
+    if depth < 6 and kind < 0.3:
+        return [random_value(rng, depth + 1) for _ in range(rng.randint(0, 5))]
+    if kind < 0.65:
+        return random_text(rng)
+    if kind < 0.9:
+        return random_number(rng)
+    return rng.choice((True, False, None))
+
+
+def dump(rng, document):
+    # random layout: the firmware gets compact documents, the OTA manifest is indented
+    text = json.dumps(document, ensure_ascii=rng.random() < 0.5, indent=rng.choice((None, None, 2)),
+                      separators=rng.choice(((",", ":"), (", ", ": "), (" , ", " : "))) if rng.random() < 0.8 else None)
+    return text.encode("utf-8")
+
+
+def paths_of(value, prefix=""):
+    # every path of the document, plus missing ones
+    out = []
+    if isinstance(value, dict):
+        for key, item in value.items():
+            path = f"{prefix}.{key}" if prefix else key
+            out.append(path)
+            out += paths_of(item, path)
+    elif isinstance(value, list):
+        for i, item in enumerate(value):
+            path = f"{prefix}[{i}]"
+            out.append(path)
+            out += paths_of(item, path)
+        if prefix:
+            out.append(f"{prefix}[{len(value)}]")
+    return out
+
+
+def lookup(document, path):
+    # the json module version of a path, KeyError if it does not exist
+    value = document
+    for part in path.replace("[", ".[").split("."):
+        if part.startswith("["):
+            if not isinstance(value, list) or int(part[1:-1]) >= len(value):
+                raise KeyError(path)
+            value = value[int(part[1:-1])]
+        elif part:
+            if not isinstance(value, dict) or part not in value:
+                raise KeyError(path)
+            value = value[part]
+    return value
+
+
+def saturate(value):
+    if isinstance(value, float) and math.isinf(value):
+        return INT32_MAX if value > 0 else INT32_MIN
+    return max(INT32_MIN, min(INT32_MAX, int(value)))
+
+
+def atoi(text):
+    i = 0
+    while i < len(text) and text[i] in " \t\n\v\f\r":
+        i += 1
+    sign = 1
+    if i < len(text) and text[i] in "+-":
+        sign = -1 if text[i] == "-" else 1
+        i += 1
+    digits = ""
+    while i < len(text) and text[i] in "0123456789":
+        digits += text[i]
+        i += 1
+    return saturate(sign * int(digits)) if digits else 0
+
+
+def expected(document, path, size):
+    # (text, int, exists) as json_reader should return them
+    try:
+        value = lookup(document, path)
+    except KeyError:
+        return None, None, False
+    text = None
+    if isinstance(value, str) and "\0" not in value and len(value.encode("utf-8")) < size:
+        text = value.encode("utf-8").hex()
+    number = None
+    if isinstance(value, str):
+        number = atoi(value)
+    elif isinstance(value, (int, float)) and not isinstance(value, bool):
+        number = saturate(value)
+    return text, number, True
+
+
+def mutate(rng, raw):
+    raw = bytearray(raw)
+    for _ in range(rng.randint(1, 4)):
+        kind = rng.random()
+        if kind < 0.3 and raw:
+            raw[rng.randrange(len(raw))] = rng.choice(b'{}[]",:\\ 0123456789eE.-+tfnu\x00\xff\xc3')
+        elif kind < 0.5 and raw:
+            del raw[rng.randrange(len(raw)):]
+        elif kind < 0.7:
+            raw.insert(rng.randint(0, len(raw)), rng.choice(b'{}[]",:\\'))
+        elif kind < 0.85 and raw:
+            del raw[rng.randrange(len(raw))]
+        else:
+            raw[:0] = b"[" * rng.randint(1, 40) if rng.random() < 0.5 else b'{"a":' * rng.randint(1, 40)
+    return bytes(raw)
+
+
+def strict_object(raw):
+    # the documents coreJSON accepts: strict JSON, UTF-8, depth up to 32, no \u0000 nor lone surrogate
+    def constant(name):
+        raise ValueError(name)
+
+    try:
+        document = json.loads(raw.decode("utf-8"), parse_constant=constant)
+    except ValueError:
+        return None
+    return document if isinstance(document, dict) else None
+
+
+def build_fuzz(work):
+    source = os.path.join(work, "fuzz.c")
+    with open(source, "w", encoding="utf-8") as f:
+        f.write(FUZZ_HARNESS)
+    program = os.path.join(work, "fuzz")
+    subprocess.run(
+        [
+            "gcc", "-O1", "-g", "-std=gnu17", "-fsanitize=address,undefined", "-fno-sanitize-recover=all",
+            "-I", os.path.join(MAIN_DIR, "include"), "-I", os.path.join(CORE_JSON_DIR, "include"), "-o", program,
+            source, os.path.join(MAIN_DIR, "json_reader.c"), os.path.join(CORE_JSON_DIR, "core_json.c"),
+        ],
+        check=True,
+    )
+    return program
+
+
+def fuzz(count, seed):
+    rng = random.Random(seed)
+    cases = []
+    for n in range(count):
+        document = {random_key(rng): random_value(rng, 1) for _ in range(rng.randint(0, 10))}
+        raw = dump(rng, document)
+        paths = paths_of(document) + [random_key(rng) for _ in range(2)]
+        if n % 2:
+            raw = mutate(rng, raw)
+        cases.append((raw, [(path, rng.choice(TEXT_SIZES)) for path in paths if len(path) < 256]))
+
+    stream = bytearray()
+    for raw, paths in cases:
+        stream += struct.pack("<I", len(raw)) + raw + struct.pack("<I", len(paths))
+        for path, size in paths:
+            stream += struct.pack("<H", len(path)) + path.encode() + struct.pack("<H", size)
+
+    with tempfile.TemporaryDirectory() as work:
+        program = build_fuzz(work)
+        result = subprocess.run([program], input=bytes(stream), capture_output=True)
+    if result.returncode != 0:
+        sys.exit(f"harness failed ({result.returncode}):\n{result.stderr.decode(errors='replace')}")
+    lines = iter(result.stdout.decode().splitlines())
+
+    accepted = mutated_accepted = compared = 0
+    for n, (raw, paths) in enumerate(cases):
+        is_object = next(lines) == "O 1"
+        reference = strict_object(raw)
+        if n % 2 == 0:
+            assert is_object, f"document {n} refused: {raw[:200]!r}"
+        elif is_object:
+            # a mutated document can only be accepted if it is still a valid object
+            assert reference is not None, f"document {n} accepted but invalid: {raw[:200]!r}"
+            mutated_accepted += 1
+        accepted += is_object
+        for path, size in paths:
+            text_line, int_line, exists_line = next(lines), next(lines), next(lines)
+            if not is_object or raw.count(b'"' + path.split(".")[-1].split("[")[0].encode() + b'"') > 1:
+                continue  # only the lookups of a valid document are defined, without duplicate keys
+            text, number, exists = expected(reference, path, size)
+            got_text = text_line[4:] if text_line.startswith("T 1") else None
+            got_number = int(int_line.split()[2]) if int_line.startswith("I 1") else None
+            assert (got_text, got_number, exists_line == "E 1") == (text, number, exists), \
+                f"document {n} path {path} size {size}: {(got_text, got_number, exists_line)} != {(text, number, exists)}"
+            compared += 1
+    print(f"{count} documents (seed {seed}), {accepted} accepted ({mutated_accepted} mutated), {compared} lookups compared, "
+          "no ASan/UBSan error")
+
+
+# ------------------------------------------------------------------ bench
+
+CONFIG_POST = {
+    "wifi-ssid": "Livebox-A1B2", "wifi-password": "correct horse battery", "linky-mode": "2", "server-mode": "2",
+    "web-url": "http://192.168.1.10:8080", "web-token": "0" * 32, "web-post": "/api/linky", "web-config": "/api/config",
+    "mqtt-host": "192.168.1.10", "mqtt-port": "1883", "mqtt-user": "ticmeter", "mqtt-password": "secret",
+    "mqtt-topic": "ticmeter/linky", "refresh-rate": "60", "encoding": "0", "web-gzip": "1", "web-ca": "",
+    "mqtt-ca": "", "udp-host": "239.255.0.1", "udp-port": "5683", "udp-key": "", "coap-host": "", "coap-port": "5683",
+    "coap-path": "tic", "modbus-port": "502", "modbus-unit": "1", "web-columns": "0",
+}
+WEB_CONFIG = {"refresh_rate": 60, "store_before_send": 5, "encoding": 1, "gzip": 1, "columns": 0}
+OTA_URL = "https://github.com/GammaTroniques/TICMeter/releases/v2.1.0/download/"
+OTA_MANIFEST = {
+    "name": "TICMeter", "version": "v2.1.0", "home_assistant_domain": "esphome",
+    "funding_url": "https://esphome.io/guides/supporters.html", "new_install_prompt_erase": True,
+    "builds": [{
+        "chipFamily": "ESP32-C6", "target": "esp32c6",
+        "parts": [
+            {"path": OTA_URL + "bootloader.bin", "offset": 0},
+            {"path": OTA_URL + "partition-table.bin", "offset": 32768},
+            {"path": OTA_URL + "ota_data_initial.bin", "offset": 61440},
+            {"path": OTA_URL + "storage.bin", "offset": 2686976, "type": "storage"},
+            {"path": OTA_URL + "TICMeter.bin", "offset": 131072, "type": "app", "ota": OTA_URL + "TICMeter.ota"},
+        ],
+    }],
+}
+TUYA_DP = {"103": 120}
+
+BENCH_DOCUMENTS = [
+    # name, document, indent, lookups (path, text): the lookups of the firmware
+    ("http_config_post", CONFIG_POST, None, [(key, not value.isdigit()) for key, value in CONFIG_POST.items()]),
+    ("web_config", WEB_CONFIG, None, [(key, False) for key in WEB_CONFIG]),
+    ("ota_manifest", OTA_MANIFEST, 2, [("version", True), ("builds[0].target", True)]
+     + [(f"builds[0].parts[{i}].{key}", True) for i in range(5) for key in ("type", "path")]),
+    ("tuya_dp", TUYA_DP, None, [("103", False)]),
+]
+
+
+def build_bench(work):
+    with open(os.path.join(work, "documents.h"), "w", encoding="utf-8") as f:
+        for n, (name, document, indent, lookups) in enumerate(BENCH_DOCUMENTS):
+            f.write(f"static const lookup_t lookups_{n}[] = {{\n")
+            for path, text in lookups:
+                f.write(f"    {{{c_string(path)}, {int(text)}}},\n")
+            f.write("};\n")
+        f.write(f"#define DOCUMENT_COUNT {len(BENCH_DOCUMENTS)}\n")
+        f.write("static const document_t documents[] = {\n")
+        for n, (name, document, indent, lookups) in enumerate(BENCH_DOCUMENTS):
+            f.write(f"    {{{c_string(name)}, {c_string(json.dumps(document, indent=indent))}, lookups_{n}, {len(lookups)}}},\n")
+        f.write("};\n")
+    source = os.path.join(work, "bench.c")
+    with open(source, "w", encoding="utf-8") as f:
+        f.write(BENCH_HARNESS.replace("HEAP_WRAP", HEAP_WRAP))
+    program = os.path.join(work, "bench")
+    subprocess.run(
+        [
+            "gcc", "-O2", "-std=gnu17", "-I", work, "-I", os.path.join(MAIN_DIR, "include"), "-I", CJSON_DIR,
+            "-I", os.path.join(CORE_JSON_DIR, "include"), "-Wl,--wrap=malloc,--wrap=free,--wrap=realloc", "-o", program,
+            source, os.path.join(MAIN_DIR, "json_reader.c"), os.path.join(CORE_JSON_DIR, "core_json.c"),
+            os.path.join(CJSON_DIR, "cJSON.c"), "-lm",
+        ],
+        check=True,
+    )
+    return program
+
+
+def bench(iterations):
+    with tempfile.TemporaryDirectory() as work:
+        program = build_bench(work)
+        lines = subprocess.run([program, str(iterations)], check=True, capture_output=True, text=True).stdout.splitlines()
+
+    print(f"{iterations} iterations per document, validation + every lookup of the firmware")
+    print(f"{'document':18} {'bytes':>6} {'lookups':>7} {'cJSON us':>9} {'reader us':>9}"
+          f" {'cJSON heap':>10} {'allocs':>6} {'reader heap':>11} {'allocs':>6}")
+    results = {}
+    for line in lines:
+        parts = line.split()
+        if parts[0] == "document":
+            document = (parts[1], int(parts[2]), int(parts[3]))
+            continue
+        results[parts[0]] = (int(parts[1]), float(parts[2]), int(parts[3]), int(parts[4]))
+        if parts[0] != "reader":
+            continue
+        cjson, reader = results["cjson"], results["reader"]
+        assert cjson[0] == reader[0], f"{document[0]}: {cjson[0]} values found by cJSON, {reader[0]} by the reader"
+        assert reader[2] == 0 and reader[3] == 0, f"{document[0]}: the reader used the heap"
+        print(f"{document[0]:18} {document[1]:6} {document[2]:7} {cjson[1]:9.2f} {reader[1]:9.2f}"
+              f" {cjson[2]:10} {cjson[3]:6} {reader[2]:11} {reader[3]:6}")
+
+
+if __name__ == "__main__":
+    command = sys.argv[1] if len(sys.argv) > 1 else "fuzz"
+    if command == "fuzz":
+        fuzz(int(sys.argv[2]) if len(sys.argv) > 2 else 2000, int(sys.argv[3]) if len(sys.argv) > 3 else 1)
+    elif command == "bench":
+        bench(int(sys.argv[2]) if len(sys.argv) > 2 else 20000)
+    else:
+        sys.exit(__doc__ or "usage: python json_read.py fuzz [documents] [seed] | bench [iterations]")
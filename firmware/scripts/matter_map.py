@@ -0,0 +1,172 @@
+# Host check of main/matter_map.c on the captures of ../tramesLinky: every attribute of the Matter endpoints gets the
+# label of its TIC mode in the Matter unit, a missing label is null, the same sample gives no change and a sample where
+# the measures moved gives only the moved attributes.
+# Usage: python matter_map.py
+# Needs gcc. matter_map.c, exporter.c and the label table of linky.c are built on the host like in exporter_bench.py;
+# the expected attributes are computed here from the labels of each capture.
+
+import os
+import subprocess
+import sys
+import tempfile
+
+from cbor_payload import capture_values, load_labels, CAPTURES_DIR
+from exporter_bench import MAIN_DIR, SAMPLE, STUBS, write_fields, write_table
+
+POWER, ENERGY, TIC = 0x0090, 0x0091, 0xFFF1FC42
+APPARENT_POWER, RMS_VOLTAGE, RMS_CURRENT = 0x000A, 0x000B, 0x000C
+ENERGY_IMPORTED, ENERGY_EXPORTED, TARIFF = 0x0001, 0x0002, 0x0000
+
+# (endpoint, cluster, attribute): (scale, historique labels, standard labels), the first label of the sample is used
+ATTRIBUTES = {
+    (1, POWER, APPARENT_POWER): (1000, ["PAPP"], ["SINSTS"]),
+    (1, POWER, RMS_CURRENT): (1000, ["IINST", "IINST1"], ["IRMS1"]),
+    (1, POWER, RMS_VOLTAGE): (1000, [], ["URMS1"]),
+    (2, POWER, APPARENT_POWER): (1000, [], ["SINSTS2"]),
+    (2, POWER, RMS_CURRENT): (1000, ["IINST2"], ["IRMS2"]),
+    (2, POWER, RMS_VOLTAGE): (1000, [], ["URMS2"]),
+    (3, POWER, APPARENT_POWER): (1000, [], ["SINSTS3"]),
+    (3, POWER, RMS_CURRENT): (1000, ["IINST3"], ["IRMS3"]),
+    (3, POWER, RMS_VOLTAGE): (1000, [], ["URMS3"]),
+    (1, ENERGY, ENERGY_IMPORTED): (1000, ["total"], ["EAST"]),
+    (1, ENERGY, ENERGY_EXPORTED): (1000, [], ["EAIT"]),
+    (1, TIC, TARIFF): (1, [], ["NTARF"]),
+    (1, TIC, 1): (1000, ["BASE", "HCHC", "EJPHN", "BBRHCJB"], ["EASF01"]),
+    (1, TIC, 2): (1000, ["HCHP", "EJPHPM", "BBRHPJB"], ["EASF02"]),
+    (1, TIC, 3): (1000, ["BBRHCJW"], ["EASF03"]),
+    (1, TIC, 4): (1000, ["BBRHPJW"], ["EASF04"]),
+    (1, TIC, 5): (1000, ["BBRHCJR"], ["EASF05"]),
+    (1, TIC, 6): (1000, ["BBRHPJR"], ["EASF06"]),
+    **{(1, TIC, n): (1000, [], [f"EASF{n:02}"]) for n in range(7, 11)},
+}
+
+# the indexes summed by the decoder of linky.c in the historique total
+TOTAL = [["BASE"], ["HCHC", "HCHP"], ["EJPHN", "EJPHPM"], ["BBRHCJB", "BBRHPJB", "BBRHCJW", "BBRHPJW", "BBRHCJR", "BBRHPJR"]]
+
+HARNESS = r"""
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "exporter.h"
+#include "matter_map.h"
+
+""" + SAMPLE + r"""
+static void print(const char *step, const matter_value_t *changes, uint8_t count)
+{
+    printf("%s %d\n", step, count);
+    for (uint8_t i = 0; i < count; i++)
+        printf("value %u %lx %lx %d %lld\n", changes[i].endpoint, (unsigned long)changes[i].cluster,
+               (unsigned long)changes[i].attribute, changes[i].null, (long long)changes[i].value);
+}
+
+int main(void)
+{
+    static linky_data_t samples[2];
+    matter_value_t changes[MATTER_MAP_SIZE];
+    for (int c = 0; c < CAPTURE_COUNT; c++)
+    {
+        linky_mode = captures[c].mode;
+        fill(&samples[0], captures[c].fields, captures[c].count);
+        samples[1] = samples[0];
+        step(&samples[1]);
+
+        printf("capture %s\n", captures[c].name);
+        matter_map_reset();
+        print("first", changes, matter_map_update(&samples[0], linky_mode, changes));
+        print("same", changes, matter_map_update(&samples[0], linky_mode, changes));
+        print("moved", changes, matter_map_update(&samples[1], linky_mode, changes));
+    }
+    return 0;
+}
+"""
+
+
+def numbers(values):
+    """the numeric labels of the capture, the historique total as computed by the decoder"""
+    result = {label: value for label, value in values.items() if isinstance(value, int)}
+    for indexes in TOTAL:
+        if all(result.get(index) for index in indexes):
+            result["total"] = sum(result[index] for index in indexes)
+            break
+    return result
+
+
+def expected(labels, values, standard):
+    """{(endpoint, cluster, attribute): value or None}, an index at 0 is missing like in exporter_value()"""
+    attributes = {}
+    for key, (scale, hist, std) in ATTRIBUTES.items():
+        present = [label for label in (std if standard else hist) if label in values]
+        present = [label for label in present if values[label] != 0 or labels[label]["type"] != "UINT64"]
+        attributes[key] = values[present[0]] * scale if present else None
+    return attributes
+
+
+def run(captures, labels):
+    with tempfile.TemporaryDirectory() as work:
+        # matter_map.c includes linky.h first, esp_err.h comes with FreeRTOS.h on the target
+        stubs = STUBS | {"freertos/FreeRTOS.h": STUBS["freertos/FreeRTOS.h"] + '#include "esp_err.h"\n'}
+        for name, content in stubs.items():
+            os.makedirs(os.path.dirname(os.path.join(work, name)), exist_ok=True)
+            with open(os.path.join(work, name), "w", encoding="utf-8") as f:
+                f.write(content)
+        write_table(os.path.join(work, "table.c"))
+        write_fields(os.path.join(work, "fields.h"), captures, labels)
+        with open(os.path.join(work, "harness.c"), "w", encoding="utf-8") as f:
+            f.write(HARNESS)
+        program = os.path.join(work, "harness")
+        subprocess.run(
+            [
+                "gcc", "-O1", "-std=gnu17", "-w", "-I", work, "-I", os.path.join(MAIN_DIR, "include"), "-o", program,
+                os.path.join(work, "harness.c"), os.path.join(work, "table.c"), os.path.join(MAIN_DIR, "exporter.c"),
+                os.path.join(MAIN_DIR, "matter_map.c"),
+            ],
+            check=True,
+        )
+        return subprocess.run([program], check=True, capture_output=True, text=True).stdout.splitlines()
+
+
+def check():
+    labels = load_labels()
+    captures, values = {}, {}
+    for file in sorted(os.listdir(CAPTURES_DIR)):
+        if not file.endswith(".txt"):
+            continue
+        capture = capture_values(os.path.join(CAPTURES_DIR, file), labels)
+        if len(capture) <= 3:
+            continue
+        standard = "STANDARD" in file.upper()
+        capture = numbers(capture) | {k: v for k, v in capture.items() if not isinstance(v, int)}
+        captures[file] = [(labels[label]["id"], value) for label, value in capture.items()]
+        values[file.replace(" ", "_")] = expected(labels, capture, standard)
+
+    failed = 0
+    results = {}
+    for line in run(captures, labels):
+        parts = line.split()
+        if parts[0] == "capture":
+            name = parts[1]
+        elif parts[0] == "value":
+            key = (int(parts[1]), int(parts[2], 16), int(parts[3], 16))
+            results[name][step][key] = None if parts[4] == "1" else int(parts[5])
+        else:
+            step = parts[0]
+            results.setdefault(name, {})[step] = {}
+
+    print(f"{'capture':26} {'attributes':>10} {'null':>5} {'same':>5} {'moved':>5}")
+    for name, attributes in values.items():
+        got = results[name]
+        # the measures and the indexes moved by one TIC unit, not the tariff
+        moved = {key: value + ATTRIBUTES[key][0] for key, value in attributes.items() if value is not None and key != (1, TIC, TARIFF)}
+        ok = got["first"] == attributes and got["same"] == {} and got["moved"] == moved
+        nulls = sum(value is None for value in attributes.values())
+        print(f"{name:26} {len(got['first']):10} {nulls:5} {len(got['same']):5} {len(got['moved']):5}  {'' if ok else 'FAILED'}")
+        if not ok:
+            for key, value in attributes.items():
+                if got["first"].get(key, "missing") != value:
+                    print(f"    {key}: {got['first'].get(key, 'missing')} expected {value}")
+        failed += not ok
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(1 if check() else 0)
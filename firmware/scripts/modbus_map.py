@@ -0,0 +1,343 @@
+# Register map of the TICMeter Modbus TCP server (layout in main/include/modbus.h), generated from the label table
+# Usage: python modbus_map.py map [--markdown]             print the register map of the labels of ../main/linky.c
+#        python modbus_map.py poll <host> [port] [unit]    read every register with function 0x04 and print the labels as json
+#        python modbus_map.py test                         poll modbus.c on loopback: labels, functions, exceptions, framing
+# Example: python modbus_map.py poll 192.168.1.42 502 1
+# The test needs gcc: modbus.c, exporter.c and the label table of linky.c are built on the host with build_host() of
+# mqtt_commands.py, on the sockets and the threads of the host like in coap_server.py, and serve the samples of
+# ../tramesLinky.
+
+import json
+import os
+import re
+import socket
+import struct
+import sys
+import tempfile
+import time
+
+from cbor_payload import load_captures, load_labels
+from coap_server import RTOS, TASK_MODULES, Device
+from exporter_bench import SAMPLE, write_fields
+from mqtt_commands import build_host
+from udp_listen import TIMESTAMP
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+LINKY_C = os.path.join(SCRIPT_DIR, "../main/linky.c")
+
+# same as modbus.h
+MAP_VERSION = 1
+LABEL_START = 100
+HEADER = [(0, 1, "map version"), (1, 1, "TIC mode"), (2, 2, "timestamp"), (4, 2, "sequence"), (6, 1, "label start"), (7, 1, "label registers")]
+MAX_REGISTERS = 125
+MAX_CLIENTS = 4  # MODBUS_MAX_CLIENTS of modbus.c
+UNIT = 1
+
+# { id, tuya_id, "name", "label", &data, TYPE, size, MODE, ...
+LABEL_REGEX = re.compile(r'^\s*\{\s*(\d+),\s*\d+,\s*"([^"]*)",\s*"([^"]+)",\s*&?([\w.\[\]]+)\s*,\s*(\w+),\s*(\d+),\s*(\w+),')
+
+REGISTERS = {"UINT8": 1, "UINT16": 1, "UINT32": 2, "UINT64": 4, "UINT32_TIME": 4}
+CLEARED = {"UINT8": 0xFF, "UINT16": 0xFFFF, "UINT32": 0xFFFFFFFF, "UINT64": 0xFFFFFFFFFFFFFFFF}  # linky_clear_data()
+
+
+def load_map():
+    """labels of linky_data in the order of the table: [(address, registers, label, type, size, mode, name)]"""
+    entries = []
+    address = LABEL_START
+    with open(LINKY_C, "r", encoding="utf-8") as f:
+        for line in f:
+            match = LABEL_REGEX.match(line)
+            if not match:
+                continue
+            id, name, label, data, type, size, mode = match.groups()
+            if not data.startswith("linky_data."):
+                continue  # settings of the table (refresh rate, TIC mode...)
+            registers = (int(size) + 1) // 2 if type == "STRING" else REGISTERS.get(type, 0)
+            if registers == 0:
+                continue
+            entries.append((address, registers, label, type, int(size), mode, name))
+            address += registers
+    return entries
+
+
+def print_map(markdown):
+    entries = load_map()
+    if markdown:
+        print("| Register | Count | Label | Type | Mode | Description |")
+        print("|---:|---:|---|---|---|---|")
+        for address, registers, name in HEADER:
+            print(f"| {address} | {registers} | | {'UINT32' if registers == 2 else 'UINT16'} | | {name} |")
+        for address, registers, label, type, size, mode, name in entries:
+            print(f"| {address} | {registers} | {label} | {type}{f' ({size})' if type == 'STRING' else ''} | {mode} | {name} |")
+    else:
+        for address, registers, label, type, size, mode, name in entries:
+            print(f"{address:5} {registers:3}  {label:12} {type:12} {mode:9} {name}")
+    last = entries[-1]
+    print(f"{len(entries)} labels, registers {LABEL_START} to {last[0] + last[1] - 1}", file=sys.stderr)
+
+
+def decode_label(words, type):
+    if type == "STRING":
+        return b"".join(struct.pack(">H", w) for w in words).split(b"\0")[0].decode("utf-8", errors="replace")
+    value = 0
+    for word in words:
+        value = (value << 16) | word
+    if type == "UINT32_TIME":
+        number, date = value >> 32, value & 0xFFFFFFFF
+        return None if number == 0xFFFFFFFF else {"value": number, "date": date}
+    return None if value == CLEARED[type] else value
+
+
+class Client:
+    def __init__(self, host, port, unit):
+        self.sock = socket.create_connection((host, port), timeout=5)
+        self.unit = unit
+        self.transaction = 0
+
+    def request(self, pdu):
+        self.transaction = (self.transaction + 1) & 0xFFFF
+        self.sock.sendall(struct.pack(">HHHB", self.transaction, 0, len(pdu) + 1, self.unit) + pdu)
+        head = self.recv(7)
+        transaction, protocol, length, unit = struct.unpack(">HHHB", head)
+        if transaction != self.transaction or protocol != 0:
+            raise ValueError("unexpected response")
+        return self.recv(length - 1)
+
+    def recv(self, size):
+        data = b""
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise ConnectionError("connection closed")
+            data += chunk
+        return data
+
+    def read(self, start, count, function=0x04):
+        """return the registers, or raise ValueError with the exception code"""
+        pdu = self.request(struct.pack(">BHH", function, start, count))
+        if pdu[0] & 0x80:
+            raise ValueError(f"exception {pdu[1]}")
+        return list(struct.unpack(f">{pdu[1] // 2}H", pdu[2:]))
+
+
+    def close(self):
+        self.sock.close()
+
+
+def poll(host, port, unit):
+    client = Client(host, port, unit)
+    try:
+        return poll_client(client)
+    finally:
+        client.close()
+
+
+def poll_client(client):
+    header = client.read(0, 8)
+    if header[0] != MAP_VERSION:
+        raise ValueError(f"unsupported map version {header[0]}")
+    end = header[6] + header[7]
+    registers = header
+    registers += [0] * (header[6] - len(registers))
+    for start in range(header[6], end, MAX_REGISTERS):
+        registers += client.read(start, min(MAX_REGISTERS, end - start))
+    result = {
+        "mode": {0: "historique", 1: "standard"}.get(header[1], "unknown"),
+        "timestamp": (header[2] << 16) | header[3],
+        "sequence": (header[4] << 16) | header[5],
+    }
+    for address, count, label, type, size, mode, name in load_map():
+        value = decode_label(registers[address : address + count], type)
+        if value not in (None, ""):
+            result[label] = value
+    return result
+
+
+# ---------------------------------------------------------------- test
+# commands on stdin, one answer line each: start <port>, update <capture>, stop; the size of each text label is printed
+# first, fill() cuts the longer texts
+HARNESS = r"""
+#include "modbus.h"
+#include "exporter.h"
+""" + SAMPLE + r"""
+int main(void)
+{
+    static linky_data_t sample;
+    static char line[64];
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    config_values.modbus.unit_id = UNIT;
+    for (int32_t i = 0; i < linky_label_list_size; i++)
+        if (linky_label_list[i].type == STRING)
+            printf("size %s %d\n", linky_label_list[i].label, linky_label_list[i].size);
+    while (fgets(line, sizeof(line), stdin))
+    {
+        char command[16] = "";
+        int arg = 0;
+        sscanf(line, "%15s %d", command, &arg);
+        if (strcmp(command, "start") == 0)
+        {
+            config_values.modbus.port = arg;
+            printf("start %d\n", modbus_server_start());
+        }
+        else if (strcmp(command, "update") == 0)
+        {
+            linky_mode = captures[arg].mode;
+            fill(&sample, captures[arg].fields, captures[arg].count);
+            sample.timestamp = TIMESTAMP;
+            modbus_update(&sample);
+            printf("update\n");
+        }
+        else if (strcmp(command, "stop") == 0)
+        {
+            modbus_server_stop();
+            printf("stop\n");
+        }
+    }
+    return 0;
+}
+"""
+
+
+def frame(transaction, pdu, unit=UNIT, protocol=0):
+    return struct.pack(">HHHB", transaction, protocol, len(pdu) + 1, unit) + pdu
+
+
+def test():
+    labels = load_labels()
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    entries = {entry[2]: entry for entry in load_map()}
+    captures = load_captures(labels)
+    failures = 0
+
+    def check(name, ok):
+        nonlocal failures
+        failures += not ok
+        print(f"{name:50} {'OK' if ok else 'FAILED'}")
+
+    def attempt(function, *args):
+        """the result of a request, None if the server answered an exception or closed the connection"""
+        try:
+            return function(*args)
+        except (OSError, ValueError):
+            return None
+
+    work = tempfile.TemporaryDirectory()
+    write_fields(os.path.join(work.name, "fields.h"), captures, labels)
+    # the clock of the device is not scaled: no client stays idle for MODBUS_CLIENT_TIMEOUT
+    code = f'#include "config.h"\n#define TIMESTAMP {TIMESTAMP}\n#define SCALE 1\n#define UNIT {UNIT}\n' + RTOS + HARNESS
+    device = Device(build_host(work.name, "device", code, ["modbus.c", "exporter.c"], TASK_MODULES, libs=["-lpthread"]))
+    with socket.socket() as free:
+        free.bind(("127.0.0.1", 0))
+        port = free.getsockname()[1]
+    check("server started", device.command(f"start {port}") == ["0"])
+
+    client = Client("127.0.0.1", port, UNIT)
+    header = client.read(0, 8)
+    end = max(address + count for address, count, *_ in entries.values())
+    check("header before the first sample", header[0] == MAP_VERSION and header[4:6] == [0, 0])
+    check("label registers of modbus.c match load_map()", header[6:8] == [LABEL_START, end - LABEL_START])
+
+    for n, (file, values) in enumerate(captures.items()):
+        device.command(f"update {n}")
+        standard = any(labels[labels_by_id[id]]["mode"] == "MODE_STD" for id, _ in values)
+        expected = {"mode": "standard" if standard else "historique", "timestamp": TIMESTAMP, "sequence": n + 1}
+        for id, value in values:
+            label = labels_by_id[id]
+            type = entries[label][3]
+            if type == "UINT32_TIME":
+                value = {"value": value, "date": TIMESTAMP}
+            elif type == "STRING":
+                value = value.split("\0")[0][: device.sizes[label]]
+            if value != "":
+                expected[label] = value
+        result = attempt(poll_client, client) or {}
+        # the "_time" labels read the date of a UINT32_TIME label, the captures do not list them
+        expected.update({label: TIMESTAMP for label in result if label.endswith("_time") and label not in expected})
+        check(f"poll {file} ({len(expected) - 3} labels)", result == expected)
+
+    check("0x03 reads the same registers as 0x04", all(attempt(client.read, start, count, 0x03) == client.read(start, count, 0x04)
+          for start, count in ((0, MAX_REGISTERS), (end - 10, 10))))
+    check("last register readable", attempt(client.read, end - 1, 1) is not None)
+    for name, pdu, unit, code in (
+        ("function 0x06: illegal function", struct.pack(">BHH", 0x06, 0, 1), UNIT, (0x86, 0x01)),
+        ("count 0: illegal data value", struct.pack(">BHH", 0x04, 0, 0), UNIT, (0x84, 0x03)),
+        (f"count {MAX_REGISTERS + 1}: illegal data value", struct.pack(">BHH", 0x04, 0, MAX_REGISTERS + 1), UNIT, (0x84, 0x03)),
+        ("request of 6 bytes: illegal data value", struct.pack(">BHHB", 0x03, 0, 1, 0), UNIT, (0x83, 0x03)),
+        ("past the last register: illegal data address", struct.pack(">BHH", 0x04, end - 1, 2), UNIT, (0x84, 0x02)),
+        ("other unit: gateway target failed", struct.pack(">BHH", 0x04, 0, 1), UNIT + 1, (0x84, 0x0B)),
+        ("unit 0xFF answered", struct.pack(">BHH", 0x04, 0, 1), 0xFF, (0x04, 0x02)),
+    ):
+        client.unit = unit
+        response = client.request(pdu)
+        check(name, tuple(response[:2]) == code)
+    client.unit = UNIT
+
+    def responses(parts, count):
+        """send the parts of the requests on a new connection, the (transaction, registers) of the count responses"""
+        other = Client("127.0.0.1", port, UNIT)
+        try:
+            for part in parts:
+                other.sock.sendall(part)
+                time.sleep(0.05)
+            out = []
+            for _ in range(count):
+                transaction, _, length, _ = struct.unpack(">HHHB", other.recv(7))
+                out.append((transaction, other.recv(length - 1)[2:]))
+            return out
+        finally:
+            other.close()
+
+    request = frame(0x1234, struct.pack(">BHH", 0x04, 0, 8))
+    expected = [(0x1234, struct.pack(">8H", *client.read(0, 8)))]
+    check("request split in 3 segments", attempt(responses, [request[:4], request[4:9], request[9:]], 1) == expected)
+    starts = (0, LABEL_START, end - 3)
+    expected = [(0x100 + i, struct.pack(">3H", *client.read(start, 3))) for i, start in enumerate(starts)]
+    requests = b"".join(frame(0x100 + i, struct.pack(">BHH", 0x04, start, 3)) for i, start in enumerate(starts))
+    check("3 pipelined requests answered in order", attempt(responses, [requests], len(starts)) == expected)
+    client.sock.sendall(frame(1, struct.pack(">BHH", 0x04, 0, 1), protocol=1))
+    try:
+        closed = client.sock.recv(16) == b""
+    except ConnectionError:
+        closed = True
+    check("invalid MBAP header closes the connection", closed)
+    client.close()
+    time.sleep(0.1)
+
+    def reads(client):
+        return attempt(client.read, 0, 1) is not None
+
+    clients = [Client("127.0.0.1", port, UNIT) for _ in range(MAX_CLIENTS + 1)]
+    time.sleep(0.1)
+    check(f"client {MAX_CLIENTS + 1} refused", [reads(c) for c in clients] == [True] * MAX_CLIENTS + [False])
+    clients[0].close()
+    time.sleep(0.1)
+    clients.append(Client("127.0.0.1", port, UNIT))
+    check("the slot of a closed client is given again", reads(clients[-1]))
+    for c in clients:
+        c.close()
+
+    device.command("stop")
+    try:
+        Client("127.0.0.1", port, UNIT).close()
+        stopped = False
+    except ConnectionRefusedError:
+        stopped = True
+    check("server stopped", stopped)
+    device.close()
+    work.cleanup()
+    print("FAILED" if failures else "All OK")
+    return failures
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2 or sys.argv[1] not in ("map", "poll", "test") or (sys.argv[1] == "poll" and len(sys.argv) < 3):
+        print("Usage: python modbus_map.py map [--markdown] | poll <host> [port] [unit] | test")
+        sys.exit(1)
+    if sys.argv[1] == "map":
+        print_map("--markdown" in sys.argv)
+    elif sys.argv[1] == "test":
+        sys.exit(1 if test() else 0)
+    else:
+        port = int(sys.argv[3]) if len(sys.argv) > 3 else 502
+        unit = int(sys.argv[4]) if len(sys.argv) > 4 else 1
+        print(json.dumps(poll(sys.argv[2], port, unit), ensure_ascii=False, indent=2))
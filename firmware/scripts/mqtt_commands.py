@@ -0,0 +1,381 @@
+# Host check of the commands received by main/mqtt.c: a payload on <topic>/set-refresh is validated and applied, the
+# decimals of Home Assistant ("60.0") are accepted, any other character, an empty or too long payload, a value out of
+# the range of the command, a fragmented message or an other topic changes nothing.
+# Usage: python mqtt_commands.py
+# Needs gcc. mqtt.c, json_writer.c, exporter.c and the label table of linky.c are built on the host with stubs of the
+# IDF headers and of esp-mqtt; each payload is given to mqtt_event_handler() as an MQTT_EVENT_DATA and the refresh
+# rate and the config writes are compared with the expected ones.
+
+import os
+import subprocess
+import sys
+import tempfile
+
+from exporter_bench import write_table
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+MAIN_DIR = os.path.join(SCRIPT_DIR, "../main")
+
+# the IDF and esp-mqtt as seen by mqtt.c, the logs go to stdout prefixed by "log"
+HOST_H = r"""
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERROR_CHECK(x) (void)(x)
+
+#define ESP_LOG_VERBOSE 5
+#define ESP_LOG_WARN 2
+#define ESP_LOGI(tag, format, ...) printf("log I " format "\n", ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) printf("log W " format "\n", ##__VA_ARGS__)
+#define ESP_LOGE(tag, format, ...) printf("log E " format "\n", ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)
+#define esp_log_level_set(tag, level)
+
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+typedef uint32_t TickType_t;
+#define pdFALSE 0
+#define pdTRUE 1
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define BIT0 0x01
+#define BIT1 0x02
+#define BIT2 0x04
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+int xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *arg, int priority, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+#define xSemaphoreCreateMutex() ((SemaphoreHandle_t)1)
+#define xSemaphoreTake(mutex, ticks) 1
+#define xSemaphoreGive(mutex) 1
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, int clear, int all, TickType_t ticks);
+
+typedef int esp_zb_zcl_attr_access_t;
+typedef int esp_zb_zcl_attr_type_t;
+typedef struct { int bit_start; } esp_efuse_desc_t;
+
+typedef const char *esp_event_base_t;
+#define ESP_EVENT_ANY_ID -1
+typedef struct { char project_name[32]; char version[32]; } esp_app_desc_t;
+const esp_app_desc_t *esp_app_get_description(void);
+int64_t esp_timer_get_time(void);
+
+typedef struct esp_transport *esp_transport_handle_t;
+esp_transport_handle_t esp_transport_ssl_init(void);
+void esp_transport_set_default_port(esp_transport_handle_t t, int port);
+void esp_transport_ssl_set_cert_data(esp_transport_handle_t t, const char *data, int len);
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+typedef enum
+{
+    MQTT_EVENT_ERROR, MQTT_EVENT_CONNECTED, MQTT_EVENT_DISCONNECTED, MQTT_EVENT_SUBSCRIBED, MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED, MQTT_EVENT_DATA, MQTT_EVENT_BEFORE_CONNECT, MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+typedef enum { MQTT_ERROR_TYPE_NONE, MQTT_ERROR_TYPE_TCP_TRANSPORT, MQTT_ERROR_TYPE_CONNECTION_REFUSED } esp_mqtt_error_type_t;
+typedef int esp_mqtt_connect_return_code_t;
+typedef struct
+{
+    esp_mqtt_error_type_t error_type;
+    esp_mqtt_connect_return_code_t connect_return_code;
+    esp_err_t esp_tls_last_esp_err;
+    int esp_tls_stack_err;
+    int esp_transport_sock_errno;
+} esp_mqtt_error_codes_t;
+typedef struct
+{
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    char *data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+    char *topic;
+    int topic_len;
+    int msg_id;
+    esp_mqtt_error_codes_t *error_handle;
+} esp_mqtt_event_t;
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+typedef struct
+{
+    struct { struct { const char *uri; } address; } broker;
+    struct { const char *username; const char *client_id; struct { const char *password; } authentication; } credentials;
+    struct { struct { const char *topic; const char *msg; int qos; int retain; } last_will; } session;
+    struct { esp_transport_handle_t transport; } network;
+    struct { int priority; int stack_size; } task;
+    struct { int64_t limit; } outbox;
+} esp_mqtt_client_config_t;
+typedef void (*esp_event_handler_t)(void *args, esp_event_base_t base, int32_t id, void *data);
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t handler, void *arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain);
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain, bool store);
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client);
+"""
+
+STUBS = [
+    "freertos/FreeRTOS.h", "freertos/task.h", "freertos/semphr.h", "freertos/queue.h", "freertos/event_groups.h",
+    "driver/gpio.h", "driver/uart.h", "esp_zigbee_core.h", "esp_system.h", "esp_err.h", "esp_log.h", "nvs_flash.h",
+    "nvs.h", "version.h", "esp_efuse.h", "esp_event.h", "esp_ota_ops.h", "esp_transport_ssl.h", "mqtt_client.h",
+    "mbedtls/md.h", "esp_timer.h",
+]
+
+# the modules of mqtt.c that need the network or the hardware
+MODULES = {
+    "wifi.h": '#pragma once\n#include "config.h"\n'
+              "typedef enum { WIFI_CONNECTED, WIFI_DISCONNECTED } wifi_state_t;\nextern wifi_state_t wifi_state;\n",
+    "gpio.h": "#pragma once\n",
+    "led.h": "#pragma once\ntypedef int led_pattern_t;\n#define LED_SENDING 0\n#define LED_SEND_OK 1\n#define LED_SEND_FAILED 2\n"
+             "void led_start_pattern(led_pattern_t pattern);\nvoid led_stop_pattern(led_pattern_t pattern);\n",
+}
+
+# the device values of the table and the rest of the firmware seen by mqtt.c
+GLOBALS = r"""
+#include "config.h"
+config_t config_values;
+efuse_t efuse_values = {.serial_number = "012345678901", .mac_address = "A0B1C2D3E4F5", .hw_version = {3, 2, 1}};
+bool ota_available = 0;
+uint32_t linky_free_heap_size = 100000;
+linky_data_t linky_data;
+linky_mode_t linky_mode = MODE_HIST;
+uint8_t linky_three_phase = 0;
+const char *const HADeviceClassStr[64] = {0};
+const char *const HAUnitsStr[64] = {0};
+const char *const ha_sensors_str[16] = {0};
+static linky_value_rw_t rw_values[256];
+linky_value_rw_t *linky_get_value_rw(uint32_t index) { return &rw_values[index]; }
+"""
+
+# esp-mqtt: a connected client, its outbox and the events of the broker
+CLIENT = r"""
+#include "mqtt.h"
+#include "wifi.h"
+#include "led.h"
+#include "cbor.h"
+
+wifi_state_t wifi_state = WIFI_CONNECTED;
+int config_writes;
+void config_write_later() { config_writes++; }
+char *config_read_cert(const char *name) { return NULL; }
+size_t cbor_encode_linky(linky_data_t *data, uint8_t count, const char *token, uint8_t *buffer, size_t size) { return 0; }
+void led_start_pattern(led_pattern_t pattern) {}
+void led_stop_pattern(led_pattern_t pattern) {}
+
+static const esp_app_desc_t app_desc = {"TICMeter", "host"};
+const esp_app_desc_t *esp_app_get_description(void) { return &app_desc; }
+esp_transport_handle_t esp_transport_ssl_init(void) { return NULL; }
+void esp_transport_set_default_port(esp_transport_handle_t t, int port) {}
+void esp_transport_ssl_set_cert_data(esp_transport_handle_t t, const char *data, int len) {}
+EventGroupHandle_t xEventGroupCreate(void) { return (EventGroupHandle_t)1; }
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) { return bits; }
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) { return 0; }
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, int clear, int all, TickType_t ticks) { return BIT0; }
+int xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *arg, int priority, TaskHandle_t *handle) { return 1; }
+void vTaskDelete(TaskHandle_t task) {}
+int64_t esp_timer_get_time(void) { return 0; }
+
+// the messages in the outbox, acknowledged by broker_tick()
+#define OUTBOX_SIZE 256
+typedef struct { int msg_id; char topic[160]; char data[160]; } message_t;
+static message_t outbox[OUTBOX_SIZE];
+static int outbox_count, next_msg_id = 1, max_outbox;
+static int acks_per_tick = 1000;
+static uint32_t ticks;
+
+static void event(esp_mqtt_event_id_t id, int msg_id)
+{
+    esp_mqtt_event_t event = {.event_id = id, .msg_id = msg_id};
+    mqtt_event_handler(NULL, "MQTT", id, &event);
+}
+
+static void broker_tick(void)
+{
+    for (int i = 0; i < acks_per_tick && outbox_count > 0; i++)
+    {
+        int msg_id = outbox[0].msg_id;
+        memmove(&outbox[0], &outbox[1], --outbox_count * sizeof(outbox[0]));
+        event(MQTT_EVENT_PUBLISHED, msg_id);
+    }
+}
+
+TickType_t xTaskGetTickCount(void) { return ticks; }
+void vTaskDelay(TickType_t delay)
+{
+    ticks += delay;
+    broker_tick();
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) { return (esp_mqtt_client_handle_t)1; }
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, esp_event_handler_t handler, void *arg) { return ESP_OK; }
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    event(MQTT_EVENT_CONNECTED, 0);
+    return ESP_OK;
+}
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client) { return ESP_OK; }
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client) { return ESP_OK; }
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) { return ESP_OK; }
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) { outbox_count = 0; return ESP_OK; }
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos) { return next_msg_id++; }
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain) { return next_msg_id++; }
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain, bool store)
+{
+    if (outbox_count == OUTBOX_SIZE)
+    {
+        return -2;
+    }
+    message_t *message = &outbox[outbox_count++];
+    message->msg_id = next_msg_id++;
+    snprintf(message->topic, sizeof(message->topic), "%s", topic);
+    snprintf(message->data, sizeof(message->data), "%.*s", len > 0 ? len : (int)strlen(data), data);
+    printf("enqueue %s %s\n", message->topic, message->data);
+    max_outbox = outbox_count > max_outbox ? outbox_count : max_outbox;
+    return message->msg_id;
+}
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client) { return outbox_count * 64; }
+
+static void client_connect(void)
+{
+    config_values.mode = MODE_MQTT;
+    config_values.refresh_rate = 60;
+    strcpy(config_values.mqtt.topic, "ticmeter/linky");
+    mqtt_init();
+    esp_mqtt_client_start(mqtt_client);
+    outbox_count = 0; // the availability
+}
+"""
+
+HARNESS = r"""
+// each argument pair is a topic suffix and a payload, given as one MQTT_EVENT_DATA, a suffix starting with '~' is a
+// message in two fragments
+int main(int argc, char **argv)
+{
+    client_connect();
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        char topic[160];
+        bool fragmented = argv[i][0] == '~';
+        snprintf(topic, sizeof(topic), "%s/%s", config_values.mqtt.topic, argv[i] + fragmented);
+        esp_mqtt_event_t event = {
+            .event_id = MQTT_EVENT_DATA,
+            .topic = topic,
+            .topic_len = strlen(topic),
+            .data = argv[i + 1],
+            .data_len = strlen(argv[i + 1]),
+            .total_data_len = strlen(argv[i + 1]) * (fragmented ? 2 : 1),
+        };
+        config_writes = 0;
+        mqtt_event_handler(NULL, "MQTT", MQTT_EVENT_DATA, &event);
+        printf("result %d %d\n", config_values.refresh_rate, config_writes);
+    }
+    return 0;
+}
+"""
+
+# (topic suffix, payload, refresh rate after it, or None if the payload must not change it)
+CASES = [
+    ("set-refresh", "120", 120),
+    ("set-refresh", "90.0", 90),
+    ("set-refresh", "45.50", 45),
+    ("set-refresh", "3600", 3600),
+    ("set-refresh", "3600", None),  # the same value: no write
+    ("set-refresh", "30", 30),
+    ("set-refresh", "60.", None),
+    ("set-refresh", "60.xyz", None),
+    ("set-refresh", "60.0x", None),
+    ("set-refresh", "60.0.0", None),
+    ("set-refresh", "60x", None),
+    ("set-refresh", ".5", None),
+    ("set-refresh", "abc", None),
+    ("set-refresh", "", None),
+    ("set-refresh", "-60", None),
+    ("set-refresh", "29", None),
+    ("set-refresh", "3601", None),
+    ("set-refresh", "99999999999999999999", None),
+    ("set-refresh", "0000000000000060", None),  # longer than MQTT_COMMAND_MAX_PAYLOAD
+    ("~set-refresh", "120", None),
+    ("set-other", "120", None),
+    ("set-refresh", "0120", 120),
+]
+
+
+def build_host(work, name, code, sources, modules=MODULES, includes=(), libs=()):
+    """write the stubs and modules in work and build code with the sources of main/ (or absolute paths) into a host program"""
+    with open(os.path.join(work, "host.h"), "w", encoding="utf-8") as f:
+        f.write(HOST_H)
+    for stub in STUBS:
+        os.makedirs(os.path.dirname(os.path.join(work, stub)), exist_ok=True)
+        with open(os.path.join(work, stub), "w", encoding="utf-8") as f:
+            f.write('#pragma once\n#include "host.h"\n')
+    for module, content in modules.items():
+        os.makedirs(os.path.dirname(os.path.join(work, module)), exist_ok=True)
+        with open(os.path.join(work, module), "w", encoding="utf-8") as f:
+            f.write(content)
+    write_table(os.path.join(work, "table.c"), GLOBALS)
+    with open(os.path.join(work, f"{name}.c"), "w", encoding="utf-8") as f:
+        f.write(code)
+    program = os.path.join(work, name)
+    subprocess.run(
+        ["gcc", "-O1", "-std=gnu17", "-w", "-I", work, "-I", os.path.join(MAIN_DIR, "include")]
+        + [flag for include in includes for flag in ("-I", include)]
+        + ["-o", program, os.path.join(work, f"{name}.c"), os.path.join(work, "table.c")]
+        + [os.path.join(MAIN_DIR, source) for source in sources]
+        + list(libs),
+        check=True,
+    )
+    return program
+
+
+def build(work, harness, name="harness"):
+    return build_host(work, name, CLIENT + harness, ["mqtt.c", "json_writer.c", "exporter.c"])
+
+
+def check():
+    with tempfile.TemporaryDirectory() as work:
+        program = build(work, HARNESS)
+        args = [arg for suffix, payload, _ in CASES for arg in (suffix, payload)]
+        lines = subprocess.run([program] + args, check=True, capture_output=True, text=True).stdout.splitlines()
+    results = [line.split()[1:] for line in lines if line.startswith("result ")]
+    failed = 0
+    refresh = 60
+    print(f"{'topic':14} {'payload':22} {'refresh':>7} {'writes':>6}")
+    for (suffix, payload, expected), (got, writes) in zip(CASES, results):
+        if expected is not None:
+            refresh = expected
+        ok = int(got) == refresh and int(writes) == (expected is not None)
+        print(f"{suffix:14} {payload!r:22} {got:>7} {writes:>6}  {'' if ok else 'FAILED'}")
+        failed += not ok
+    if len(results) != len(CASES):
+        print(f"{len(results)} results for {len(CASES)} cases  FAILED")
+        failed += 1
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(1 if check() else 0)
@@ -0,0 +1,146 @@
+# Host check of the publish scheduler of main/mqtt.c: at most MQTT_MAX_IN_FLIGHT messages wait for their PUBACK, every
+# label of a capture is sent once, a new sample before the flush replaces the pending values, and the expired or
+# cleared messages are counted in the drop counters of their class.
+# Usage: python mqtt_queue.py
+# Needs gcc. mqtt.c is built on the host like in mqtt_commands.py, the broker acknowledges a given number of messages
+# every 100 ms tick. The counters are read from the "Scheduler:" line that mqtt_flush() logs.
+
+import os
+import re
+import sys
+import tempfile
+import subprocess
+
+from cbor_payload import load_captures, load_labels
+from exporter_bench import SAMPLE, write_fields
+from mqtt_commands import MAIN_DIR, build
+
+CAPTURES = ["STANDARD Mono.txt", "HISTORIQUE Triphasé.txt"]
+
+HARNESS = r"""
+""" + SAMPLE + r"""
+static linky_data_t samples[2];
+
+static int prepared(const linky_data_t *sample)
+{
+    int count = 0;
+    exporter_iter_t iter;
+    exporter_value_t value;
+    exporter_iter_init(&iter, sample, EXPORTER_DEVICE_VALUES);
+    while (exporter_iter_next(&iter, &value))
+        count += !(value.label->type == UINT32_TIME && value.number == 0);
+    return count;
+}
+
+static void flush(const char *scenario, uint32_t timeout)
+{
+    max_outbox = 0;
+    esp_err_t err = mqtt_flush(timeout);
+    printf("flush %s 0x%x %d %d\n", scenario, err, max_outbox, outbox_count);
+}
+
+int main(void)
+{
+    client_connect();
+    for (int c = 0; c < CAPTURE_COUNT; c++)
+    {
+        linky_mode = captures[c].mode;
+        fill(&samples[0], captures[c].fields, captures[c].count);
+        samples[1] = samples[0];
+        step(&samples[1]);
+        printf("capture %s %d\n", captures[c].name, prepared(&samples[0]));
+
+        // a slow broker: one PUBACK per tick
+        acks_per_tick = 1;
+        mqtt_prepare_publish(&samples[0]);
+        flush("slow", 60000);
+
+        // two samples before the flush: the second values are sent once
+        acks_per_tick = 1000;
+        mqtt_prepare_publish(&samples[0]);
+        mqtt_prepare_publish(&samples[1]);
+        flush("coalesced", 60000);
+
+        // no PUBACK: the first messages expire in the outbox, the next ones are sent
+        acks_per_tick = 0;
+        mqtt_prepare_publish(&samples[0]);
+        flush("stalled", 1000);
+        while (outbox_count > 0)
+        {
+            int msg_id = outbox[0].msg_id;
+            memmove(&outbox[0], &outbox[1], --outbox_count * sizeof(outbox[0]));
+            event(MQTT_EVENT_DELETED, msg_id);
+        }
+        acks_per_tick = 1000;
+        flush("expired", 60000);
+    }
+
+    // the client is destroyed with its outbox: the in flight and pending messages are dropped
+    acks_per_tick = 0;
+    mqtt_prepare_publish(&samples[0]);
+    flush("stalled", 1000);
+    mqtt_deinit();
+    flush("deinit", 1000);
+    return 0;
+}
+"""
+
+STATS_REGEX = re.compile(r"Scheduler: coalesced (\d+), dropped alert (\d+), index (\d+), realtime (\d+), diagnostic (\d+)")
+
+
+def max_in_flight():
+    with open(os.path.join(MAIN_DIR, "mqtt.c"), encoding="utf-8") as f:
+        return int(re.search(r"#define MQTT_MAX_IN_FLIGHT (\d+)", f.read()).group(1))
+
+
+def run():
+    labels = load_labels()
+    captures = {file: values for file, values in load_captures(labels).items() if file in CAPTURES}
+    with tempfile.TemporaryDirectory() as work:
+        write_fields(os.path.join(work, "fields.h"), captures, labels)
+        program = build(work, HARNESS, "queue")
+        return subprocess.run([program], check=True, capture_output=True, text=True).stdout.splitlines()
+
+
+def check():
+    in_flight = max_in_flight()
+    failed = 0
+    count = 0
+    topics = []
+    stats = [0] * 5
+    print(f"{'capture':24} {'scenario':10} {'result':>6} {'in flight':>9} {'sent':>5} {'coalesced':>9} {'dropped':>7}")
+    for line in run():
+        parts = line.split()
+        if parts[0] == "capture":
+            capture, count = parts[1], int(parts[2])
+            topics = []  # the availability of the connection
+        elif parts[0] == "enqueue":
+            topics.append(parts[1])
+        elif parts[0] == "log" and STATS_REGEX.search(line):
+            new_stats = [int(n) for n in STATS_REGEX.search(line).groups()]
+            coalesced, dropped = new_stats[0] - stats[0], sum(new_stats[1:]) - sum(stats[1:])
+            stats = new_stats
+        elif parts[0] == "flush":
+            scenario, err, outbox, left = parts[1], int(parts[2], 16), int(parts[3]), int(parts[4])
+            sent = len(topics)
+            duplicates = sent - len(set(topics))
+            # result, max in flight, sent, coalesced and dropped expected for each scenario
+            expected = {
+                "slow": (0, in_flight, count, 0, 0),
+                "coalesced": (0, in_flight, count, count, 0),
+                "stalled": (0x107, in_flight, in_flight, 0, 0),
+                "expired": (0, in_flight, count - in_flight, 0, in_flight),
+                "deinit": (0xFFFFFFFF, 0, 0, 0, count),
+            }[scenario]
+            got = (err, outbox, sent, coalesced, dropped)
+            ok = got == expected and duplicates == 0
+            if scenario == "deinit":
+                ok = ok and left == 0
+            print(f"{capture:24} {scenario:10} {err:>6x} {outbox:>9} {sent:>5} {coalesced:>9} {dropped:>7}  {'' if ok else 'FAILED'}")
+            failed += not ok
+            topics = []
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(1 if check() else 0)
@@ -0,0 +1,164 @@
+# Local OTA server: serves the manifest and the images of ../build like the GitHub releases, with ETag and
+# Last-Modified so the version checks of the device get a 304 while the manifest does not change
+# Usage: python ota_server.py [directory] [port]    serve, default ../build and 8070
+#        python ota_server.py --check [checks]       version checks as the device does them, bytes and time of each
+# To point a device at it, put "http://<host>:8070/manifest.json,<a cert of the storage>" first in
+# src_data/ota_versions.csv. Responses have a Content-Length: the device does not read chunked responses.
+
+import email.utils
+import hashlib
+import http.server
+import json
+import os
+import socket
+import sys
+import tempfile
+import threading
+import time
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+BUILD_DIR = os.path.join(SCRIPT_DIR, "../build")
+PORT = 8070
+
+
+class OtaHandler(http.server.BaseHTTPRequestHandler):
+    directory = BUILD_DIR
+    protocol_version = "HTTP/1.1"
+
+    def do_GET(self):
+        start = time.time()
+        path = os.path.join(self.directory, os.path.basename(self.path.split("?")[0]))
+        if not os.path.isfile(path):
+            self.reply(404, b"", {}, start)
+            return
+        with open(path, "rb") as f:
+            body = f.read()
+        etag = '"' + hashlib.sha256(body).hexdigest()[:16] + '"'
+        mtime = int(os.path.getmtime(path))
+        validators = {"ETag": etag, "Last-Modified": email.utils.formatdate(mtime, usegmt=True)}
+
+        # If-None-Match wins over If-Modified-Since (RFC 9110)
+        if_none_match = self.headers.get("If-None-Match")
+        if_modified_since = self.headers.get("If-Modified-Since")
+        not_modified = False
+        if if_none_match is not None:
+            not_modified = etag in [tag.strip() for tag in if_none_match.split(",")] or if_none_match.strip() == "*"
+        elif if_modified_since is not None:
+            since = email.utils.parsedate_to_datetime(if_modified_since)
+            not_modified = since is not None and mtime <= since.timestamp()
+        if not_modified:
+            self.reply(304, b"", validators, start)
+        else:
+            self.reply(200, body, {"Content-Type": "application/octet-stream", **validators}, start)
+
+    def reply(self, status, body, headers, start):
+        self.send_response(status)
+        for key, value in headers.items():
+            self.send_header(key, value)
+        if status != 304:
+            self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+        self.log_message("%s %d, %d bytes in %.1f ms", self.path, status, len(body), (time.time() - start) * 1000)
+
+
+def serve(directory, port, quiet=False):
+    handler = type("Handler", (OtaHandler,), {"directory": directory})
+    if quiet:
+        handler.log_message = lambda *args: None
+    server = http.server.ThreadingHTTPServer(("", port), handler)
+    return server
+
+
+def get(port, path, headers):
+    """one check as the device does it: a new connection, the raw bytes received counted"""
+    request = f"GET {path} HTTP/1.1\r\nHost: localhost\r\nUser-Agent: TICMeter/check\r\nConnection: close\r\n"
+    request += "".join(f"{key}: {value}\r\n" for key, value in headers.items()) + "\r\n"
+    start = time.time()
+    with socket.create_connection(("127.0.0.1", port)) as sock:
+        sock.sendall(request.encode())
+        received = b""
+        while chunk := sock.recv(4096):
+            received += chunk
+    elapsed = (time.time() - start) * 1000
+    head, _, body = received.partition(b"\r\n\r\n")
+    lines = head.decode().split("\r\n")
+    status = int(lines[0].split()[1])
+    response = {key.strip().lower(): value.strip() for key, _, value in (line.partition(":") for line in lines[1:])}
+    return status, response, len(request), len(received), len(body), elapsed
+
+
+def sample_manifest(directory):
+    """a manifest the size of the one of create_manifest.py, with two deltas"""
+    url = "https://github.com/GammaTroniques/TICMeter/releases/v2.2.0/download/"
+    manifest = {
+        "name": "TICMeter",
+        "version": "v2.2.0",
+        "home_assistant_domain": "esphome",
+        "funding_url": "https://esphome.io/guides/supporters.html",
+        "new_install_prompt_erase": True,
+        "builds": [
+            {
+                "chipFamily": "ESP32-C6",
+                "target": "esp32c6",
+                "parts": [
+                    {"path": url + "bootloader.bin", "offset": 0},
+                    {"path": url + "partition-table.bin", "offset": 32768},
+                    {"path": url + "ota_data_initial.bin", "offset": 61440},
+                    {"path": url + "storage.bin", "offset": 94208, "type": "storage", "sha256": "0" * 64},
+                    {"path": url + "TICMeter.bin", "offset": 196608, "type": "app", "ota": url + "TICMeter.ota"},
+                ],
+                "deltas": [{"from": v, "path": url + f"TICMeter-from-{v}.delta"} for v in ("v2.1.0", "v2.1.1")],
+            }
+        ],
+    }
+    with open(os.path.join(directory, "manifest.json"), "w") as f:
+        json.dump(manifest, f, indent=2)
+
+
+def check(checks):
+    """the checks of the device before (unconditional) and now (validators sent back), the manifest changed midway"""
+    with tempfile.TemporaryDirectory() as work:
+        manifest = os.path.join(BUILD_DIR, "manifest.json")
+        if os.path.isfile(manifest):
+            with open(manifest, "rb") as f, open(os.path.join(work, "manifest.json"), "wb") as out:
+                out.write(f.read())
+        else:
+            sample_manifest(work)
+        server = serve(work, 0, quiet=True)
+        port = server.server_address[1]
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+
+        print(f"{'check':>5} {'mode':12} {'status':>6} {'sent':>6} {'received':>9} {'body':>6} {'ms':>6}")
+        totals = {}
+        for mode in ("unconditional", "conditional"):
+            validators = {}
+            total = [0, 0]
+            for n in range(checks):
+                if n == checks // 2:
+                    # a new release: the manifest changes
+                    with open(os.path.join(work, "manifest.json"), "a") as f:
+                        f.write(" ")
+                    os.utime(os.path.join(work, "manifest.json"), (time.time() + 1 + n, time.time() + 1 + n))
+                status, response, sent, received, body, elapsed = get(port, "/manifest.json", validators)
+                if mode == "conditional" and status == 200:
+                    validators = {"If-None-Match": response["etag"], "If-Modified-Since": response["last-modified"]}
+                total[0] += sent + received
+                total[1] += elapsed
+                print(f"{n:>5} {mode:12} {status:>6} {sent:>6} {received:>9} {body:>6} {elapsed:>6.2f}")
+            totals[mode] = total
+        server.shutdown()
+
+    before, after = totals["unconditional"], totals["conditional"]
+    print(f"per check: {before[0] / checks:.0f} -> {after[0] / checks:.0f} bytes"
+          f" ({100 * after[0] / before[0]:.0f}%), {before[1] / checks:.2f} -> {after[1] / checks:.2f} ms on loopback")
+    return 0
+
+
+if __name__ == "__main__":
+    if len(sys.argv) > 1 and sys.argv[1] == "--check":
+        sys.exit(check(int(sys.argv[2]) if len(sys.argv) > 2 else 6))
+    directory = sys.argv[1] if len(sys.argv) > 1 else BUILD_DIR
+    port = int(sys.argv[2]) if len(sys.argv) > 2 else PORT
+    print(f"Serving {os.path.abspath(directory)} on port {port}")
+    serve(directory, port).serve_forever()
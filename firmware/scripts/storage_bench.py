@@ -0,0 +1,431 @@
+# Host benchmark of the storage partition: open and read latency of the web files on LittleFS and on the SPIFFS it
+# replaces, each built in a file-backed image of the partition size
+# Usage: python storage_bench.py [iterations]    files of ../data, or ../src_data before compress.py
+# Needs gcc and the sources of both file systems:
+#   LittleFS: LITTLEFS_SRC, default ../managed_components/joltwallet__littlefs/src/littlefs (after an idf.py reconfigure)
+#   SPIFFS:   SPIFFS_SRC, default $IDF_PATH/components/spiffs/spiffs/src
+# The geometry is the one of the firmware: 4 KB blocks, LittleFS read/prog size 128 and cache 512 (esp_littlefs
+# defaults), SPIFFS page 256 with 32 bytes names (esp_spiffs defaults). Each file is read like http.c does: stat, open,
+# one read of the whole file, close, on a freshly mounted file system. The flash reads are counted: on the chip they
+# cost much more than the host time.
+
+import os
+import subprocess
+import sys
+import tempfile
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+FIRMWARE_DIR = os.path.join(SCRIPT_DIR, "..")
+PARTITIONS_CSV = os.path.join(FIRMWARE_DIR, "partitions.csv")
+LITTLEFS_SRC = os.environ.get(
+    "LITTLEFS_SRC", os.path.join(FIRMWARE_DIR, "managed_components/joltwallet__littlefs/src/littlefs")
+)
+SPIFFS_SRC = os.environ.get("SPIFFS_SRC", os.path.join(os.environ.get("IDF_PATH", ""), "components/spiffs/spiffs/src"))
+
+# the SPIFFS of components/spiffs/include/spiffs_config.h with the defaults of the sdkconfig, without the locks
+SPIFFS_CONFIG_H = r"""
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef int32_t s32_t;
+typedef uint32_t u32_t;
+typedef int16_t s16_t;
+typedef uint16_t u16_t;
+typedef int8_t s8_t;
+typedef uint8_t u8_t;
+
+#define SPIFFS_DBG(...)
+#define SPIFFS_GC_DBG(...)
+#define SPIFFS_CACHE_DBG(...)
+#define SPIFFS_CHECK_DBG(...)
+#define SPIFFS_API_DBG(...)
+#define SPIFFS_BUFFER_HELP 0
+#define SPIFFS_CACHE 1
+#define SPIFFS_CACHE_WR 1
+#define SPIFFS_CACHE_STATS 0
+#define SPIFFS_PAGE_CHECK 1
+#define SPIFFS_GC_MAX_RUNS 10
+#define SPIFFS_GC_STATS 0
+#define SPIFFS_GC_HEUR_W_DELET (5)
+#define SPIFFS_GC_HEUR_W_USED (-1)
+#define SPIFFS_GC_HEUR_W_ERASE_AGE (50)
+#define SPIFFS_OBJ_NAME_LEN 32
+#define SPIFFS_OBJ_META_LEN 4
+#define SPIFFS_COPY_BUFFER_STACK 256
+#define SPIFFS_USE_MAGIC 1
+#define SPIFFS_USE_MAGIC_LENGTH 1
+#define SPIFFS_LOCK(fs)
+#define SPIFFS_UNLOCK(fs)
+#define SPIFFS_SINGLETON 0
+#define SPIFFS_ALIGNED_OBJECT_INDEX_TABLES 0
+#define SPIFFS_HAL_CALLBACK_EXTRA 0
+#define SPIFFS_FILEHDL_OFFSET 0
+#define SPIFFS_READ_ONLY 0
+#define SPIFFS_TEMPORAL_FD_CACHE 1
+#define SPIFFS_TEMPORAL_CACHE_HIT_SCORE 4
+#define SPIFFS_IX_MAP 1
+#define SPIFFS_NO_BLIND_WRITES 0
+#define SPIFFS_TEST_VISUALISATION 0
+
+typedef u16_t spiffs_block_ix;
+typedef u16_t spiffs_page_ix;
+typedef u16_t spiffs_obj_id;
+typedef u16_t spiffs_span_ix;
+"""
+
+HARNESS = r"""
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lfs.h"
+#include "spiffs.h"
+
+#define BLOCK_SIZE 4096
+#define SPIFFS_PAGE_SIZE 256
+#define SPIFFS_MAX_FILES 5 // config.c
+#define NAME_SIZE 64
+
+// ---- the flash: the image in RAM, the reads counted
+static uint8_t *flash;
+static uint32_t flash_size;
+static uint32_t read_calls;
+static uint32_t read_bytes;
+
+static void flash_read(uint32_t addr, void *dst, uint32_t size)
+{
+    memcpy(dst, flash + addr, size);
+    read_calls++;
+    read_bytes += size;
+}
+static void flash_write(uint32_t addr, const void *src, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+        flash[addr + i] &= ((const uint8_t *)src)[i]; // NOR: a write only clears bits
+}
+static void flash_erase(uint32_t addr, uint32_t size) { memset(flash + addr, 0xFF, size); }
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// ---- LittleFS
+static int lfs_read_cb(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+{
+    flash_read(block * c->block_size + off, buffer, size);
+    return 0;
+}
+static int lfs_prog_cb(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
+{
+    flash_write(block * c->block_size + off, buffer, size);
+    return 0;
+}
+static int lfs_erase_cb(const struct lfs_config *c, lfs_block_t block)
+{
+    flash_erase(block * c->block_size, c->block_size);
+    return 0;
+}
+static int lfs_sync_cb(const struct lfs_config *c) { return 0; }
+
+static struct lfs_config lfs_cfg = {
+    .read = lfs_read_cb,
+    .prog = lfs_prog_cb,
+    .erase = lfs_erase_cb,
+    .sync = lfs_sync_cb,
+    .read_size = 128,
+    .prog_size = 128,
+    .block_size = BLOCK_SIZE,
+    .cache_size = 512,
+    .lookahead_size = 128,
+    .block_cycles = 512,
+};
+static lfs_t lfs;
+
+// ---- SPIFFS
+static s32_t spiffs_read_cb(u32_t addr, u32_t size, u8_t *dst) { flash_read(addr, dst, size); return SPIFFS_OK; }
+static s32_t spiffs_write_cb(u32_t addr, u32_t size, u8_t *src) { flash_write(addr, src, size); return SPIFFS_OK; }
+static s32_t spiffs_erase_cb(u32_t addr, u32_t size) { flash_erase(addr, size); return SPIFFS_OK; }
+
+static spiffs fs;
+static spiffs_config spiffs_cfg = {
+    .hal_read_f = spiffs_read_cb,
+    .hal_write_f = spiffs_write_cb,
+    .hal_erase_f = spiffs_erase_cb,
+    .phys_addr = 0,
+    .phys_erase_block = BLOCK_SIZE,
+    .log_block_size = BLOCK_SIZE,
+    .log_page_size = SPIFFS_PAGE_SIZE,
+};
+static u8_t spiffs_work[2 * SPIFFS_PAGE_SIZE];
+static u8_t spiffs_fds[SPIFFS_MAX_FILES * 64];
+static u8_t spiffs_cache[SPIFFS_MAX_FILES * (SPIFFS_PAGE_SIZE + 64) + 64];
+
+static int spiffs_mount(void)
+{
+    return SPIFFS_mount(&fs, &spiffs_cfg, spiffs_work, spiffs_fds, sizeof(spiffs_fds), spiffs_cache,
+                        sizeof(spiffs_cache), NULL);
+}
+
+// ---- the files
+typedef struct { char name[NAME_SIZE]; uint8_t *data; uint32_t size; } file_t;
+static file_t files[64];
+static int file_count;
+static uint8_t *buffer;
+
+static void load(const char *list)
+{
+    FILE *f = fopen(list, "r");
+    char name[NAME_SIZE], path[1024];
+    while (fscanf(f, "%63s %1023s", name, path) == 2)
+    {
+        FILE *in = fopen(path, "rb");
+        fseek(in, 0, SEEK_END);
+        file_t *file = &files[file_count++];
+        strcpy(file->name, name);
+        file->size = ftell(in);
+        file->data = malloc(file->size + 1);
+        fseek(in, 0, SEEK_SET);
+        fread(file->data, 1, file->size, in);
+        fclose(in);
+    }
+    fclose(f);
+}
+
+static void save(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    fwrite(flash, 1, flash_size, f);
+    fclose(f);
+}
+
+static int build_lfs(const char *image)
+{
+    flash_erase(0, flash_size);
+    if (lfs_format(&lfs, &lfs_cfg) || lfs_mount(&lfs, &lfs_cfg))
+        return 1;
+    for (int i = 0; i < file_count; i++)
+    {
+        char path[NAME_SIZE];
+        strcpy(path, files[i].name);
+        for (char *slash = strchr(path, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+        {
+            *slash = '\0';
+            lfs_mkdir(&lfs, path);
+            *slash = '/';
+        }
+        lfs_file_t file;
+        if (lfs_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) ||
+            lfs_file_write(&lfs, &file, files[i].data, files[i].size) != (lfs_ssize_t)files[i].size ||
+            lfs_file_close(&lfs, &file))
+            return 1;
+    }
+    lfs_unmount(&lfs);
+    save(image);
+    return 0;
+}
+
+static int build_spiffs(const char *image)
+{
+    flash_erase(0, flash_size);
+    spiffs_mount();
+    SPIFFS_unmount(&fs);
+    if (SPIFFS_format(&fs) || spiffs_mount())
+        return 1;
+    for (int i = 0; i < file_count; i++)
+    {
+        char path[NAME_SIZE];
+        snprintf(path, sizeof(path), "/%s", files[i].name);
+        spiffs_file file = SPIFFS_open(&fs, path, SPIFFS_O_CREAT | SPIFFS_O_TRUNC | SPIFFS_O_WRONLY, 0);
+        if (file < 0 || SPIFFS_write(&fs, file, files[i].data, files[i].size) != (s32_t)files[i].size ||
+            SPIFFS_close(&fs, file))
+            return 1;
+    }
+    SPIFFS_unmount(&fs);
+    save(image);
+    return 0;
+}
+
+typedef struct { double mount_us, open_us, read_us; uint32_t mount_calls, mount_bytes, calls, bytes; int ok; } result_t;
+
+// one file: mount, stat + open, read, close, unmount
+static result_t bench_lfs(const file_t *f)
+{
+    result_t r = {0};
+    lfs_file_t file;
+    struct lfs_info info;
+    read_calls = read_bytes = 0;
+    double t0 = now_us();
+    lfs_mount(&lfs, &lfs_cfg);
+    double t1 = now_us();
+    r.mount_calls = read_calls, r.mount_bytes = read_bytes;
+    read_calls = read_bytes = 0;
+    int err = lfs_stat(&lfs, f->name, &info) || lfs_file_open(&lfs, &file, f->name, LFS_O_RDONLY);
+    double t2 = now_us();
+    r.ok = !err && lfs_file_read(&lfs, &file, buffer, info.size) == (lfs_ssize_t)f->size;
+    lfs_file_close(&lfs, &file);
+    double t3 = now_us();
+    r.ok = r.ok && memcmp(buffer, f->data, f->size) == 0;
+    r.calls = read_calls, r.bytes = read_bytes;
+    lfs_unmount(&lfs);
+    r.mount_us = t1 - t0, r.open_us = t2 - t1, r.read_us = t3 - t2;
+    return r;
+}
+
+static result_t bench_spiffs(const file_t *f)
+{
+    result_t r = {0};
+    char path[NAME_SIZE];
+    spiffs_stat st;
+    snprintf(path, sizeof(path), "/%s", f->name);
+    read_calls = read_bytes = 0;
+    double t0 = now_us();
+    spiffs_mount();
+    double t1 = now_us();
+    r.mount_calls = read_calls, r.mount_bytes = read_bytes;
+    read_calls = read_bytes = 0;
+    spiffs_file file = -1;
+    if (SPIFFS_stat(&fs, path, &st) == SPIFFS_OK)
+        file = SPIFFS_open(&fs, path, SPIFFS_O_RDONLY, 0);
+    double t2 = now_us();
+    r.ok = file >= 0 && SPIFFS_read(&fs, file, buffer, st.size) == (s32_t)f->size;
+    SPIFFS_close(&fs, file);
+    double t3 = now_us();
+    r.ok = r.ok && memcmp(buffer, f->data, f->size) == 0;
+    r.calls = read_calls, r.bytes = read_bytes;
+    SPIFFS_unmount(&fs);
+    r.mount_us = t1 - t0, r.open_us = t2 - t1, r.read_us = t3 - t2;
+    return r;
+}
+
+static void run(const char *fs_name, result_t (*bench)(const file_t *), int iterations)
+{
+    result_t total = {0};
+    for (int i = 0; i < file_count; i++)
+    {
+        result_t r = {0}, sum = {0};
+        for (int n = 0; n < iterations; n++)
+        {
+            r = bench(&files[i]);
+            sum.mount_us += r.mount_us, sum.open_us += r.open_us, sum.read_us += r.read_us;
+        }
+        printf("%s %s %u %.2f %.2f %.2f %u %u %u %u %d\n", fs_name, files[i].name, files[i].size,
+               sum.mount_us / iterations, sum.open_us / iterations, sum.read_us / iterations, r.mount_calls,
+               r.mount_bytes, r.calls, r.bytes, r.ok);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // harness <partition size> <files list> <lfs image> <spiffs image> <iterations>
+    flash_size = strtoul(argv[1], NULL, 0);
+    flash = malloc(flash_size);
+    buffer = malloc(flash_size);
+    lfs_cfg.block_count = flash_size / BLOCK_SIZE;
+    spiffs_cfg.phys_size = flash_size;
+    load(argv[2]);
+    int iterations = atoi(argv[5]);
+
+    if (build_lfs(argv[3]))
+    {
+        printf("error LittleFS image\n");
+        return 1;
+    }
+    run("littlefs", bench_lfs, iterations);
+    if (build_spiffs(argv[4]))
+    {
+        printf("error SPIFFS image\n");
+        return 1;
+    }
+    run("spiffs", bench_spiffs, iterations);
+    return 0;
+}
+"""
+
+
+def partition_size():
+    with open(PARTITIONS_CSV, encoding="utf-8") as f:
+        for line in f:
+            fields = [field.strip() for field in line.split(",")]
+            if fields[0] == "storage":
+                size = fields[4].upper()
+                return int(size[:-1]) * 1024 if size.endswith("K") else int(size, 0)
+    raise SystemExit("no storage partition in " + PARTITIONS_CSV)
+
+
+def data_files():
+    for directory in ("data", "src_data"):
+        root = os.path.join(FIRMWARE_DIR, directory)
+        if os.path.isdir(root):
+            break
+    else:
+        raise SystemExit("no ../data nor ../src_data")
+    found = []
+    for path, _, names in os.walk(root):
+        for name in sorted(names):
+            full = os.path.join(path, name)
+            found.append((os.path.relpath(full, root).replace(os.sep, "/"), full))
+    return directory, found
+
+
+def build(work):
+    for src in (LITTLEFS_SRC, SPIFFS_SRC):
+        if not os.path.isdir(src):
+            raise SystemExit("sources not found: " + src + " (see the header of this script)")
+    with open(os.path.join(work, "spiffs_config.h"), "w", encoding="utf-8") as f:
+        f.write(SPIFFS_CONFIG_H)
+    with open(os.path.join(work, "harness.c"), "w", encoding="utf-8") as f:
+        f.write(HARNESS)
+    program = os.path.join(work, "harness")
+    spiffs_sources = [os.path.join(SPIFFS_SRC, name) for name in sorted(os.listdir(SPIFFS_SRC)) if name.endswith(".c")]
+    subprocess.run(
+        ["gcc", "-O2", "-std=gnu11", "-w", "-DLFS_NO_DEBUG", "-DLFS_NO_WARN", "-DLFS_NO_ERROR", "-DLFS_NO_ASSERT",
+         "-I", work, "-I", LITTLEFS_SRC, "-I", SPIFFS_SRC, "-o", program, os.path.join(work, "harness.c"),
+         os.path.join(LITTLEFS_SRC, "lfs.c"), os.path.join(LITTLEFS_SRC, "lfs_util.c")] + spiffs_sources,
+        check=True,
+    )
+    return program
+
+
+def main():
+    iterations = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+    size = partition_size()
+    directory, files = data_files()
+    with tempfile.TemporaryDirectory() as work:
+        program = build(work)
+        with open(os.path.join(work, "files.txt"), "w", encoding="utf-8") as f:
+            for name, path in files:
+                f.write(f"{name} {path}\n")
+        lfs_image = os.path.join(work, "littlefs.bin")
+        spiffs_image = os.path.join(work, "spiffs.bin")
+        out = subprocess.run(
+            [program, str(size), os.path.join(work, "files.txt"), lfs_image, spiffs_image, str(iterations)],
+            check=True, capture_output=True, text=True,
+        ).stdout
+
+    print(f"{len(files)} files of ../{directory}, {size // 1024} KB partition, {iterations} iterations, host us")
+    print(f"{'fs':<9} {'file':<20} {'bytes':>7} {'mount':>8} {'open':>7} {'read':>7} {'mnt rd':>7} {'mnt B':>7}"
+          f" {'rd':>4} {'rd B':>7}")
+    totals = {}
+    failed = False
+    for line in out.splitlines():
+        fs, name, size_b, mount, open_, read, mount_calls, mount_bytes, calls, read_b, ok = line.split()
+        failed |= ok != "1"
+        print(f"{fs:<9} {name:<20} {size_b:>7} {float(mount):>8.1f} {float(open_):>7.1f} {float(read):>7.1f}"
+              f" {mount_calls:>7} {mount_bytes:>7} {calls:>4} {read_b:>7}{'' if ok == '1' else '  READ BACK FAILED'}")
+        total = totals.setdefault(fs, [0.0, 0, 0])
+        total[0] += float(open_) + float(read)
+        total[1] += int(calls)
+        total[2] += int(read_b)
+    for fs, (time_us, calls, read_b) in totals.items():
+        print(f"{fs}: open + read of all the files {time_us:.1f} us, {calls} flash reads, {read_b} bytes read")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,471 @@
+# Host check of main/storage_update.c: the storage image is streamed to the scratch area, checked, and copied, and a
+# power cut at any flash operation leaves the old or the new image once the next boot has run storage_update_resume().
+# The SPIFFS to LittleFS migration of config.c is checked the same way: a power cut at any flash operation, format
+# or file creation leaves every file of the storage once the next boot is done.
+# Usage: python storage_update.py
+# Needs gcc and the OpenSSL headers (libssl-dev). storage_update.c is built on the host with stubs of the IDF headers
+# and mbedtls/sha256.h on OpenSSL; the flash is a file-backed image holding the storage and ota_1 partitions of
+# ../partitions.csv, a write only clears bits like on the NOR flash. The mounted file system is a directory: a format
+# removes its files.
+
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+MAIN_DIR = os.path.join(SCRIPT_DIR, "../main")
+PARTITIONS_CSV = os.path.join(SCRIPT_DIR, "../partitions.csv")
+CONFIG_H = os.path.join(MAIN_DIR, "include/config.h")
+SRC_DATA = os.path.join(SCRIPT_DIR, "../src_data")
+
+HOST_H = r"""
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_INVALID_CRC 0x109
+const char *esp_err_to_name(esp_err_t err);
+
+#define ESP_LOGI(tag, ...)
+#define ESP_LOGW(tag, ...)
+#define ESP_LOGE(tag, ...)
+#define ESP_LOGD(tag, ...)
+
+typedef enum { ESP_PARTITION_TYPE_APP, ESP_PARTITION_TYPE_DATA } esp_partition_type_t;
+typedef enum { ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82 } esp_partition_subtype_t;
+typedef struct { uint32_t address; uint32_t size; uint32_t erase_size; char label[17]; } esp_partition_t;
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start);
+
+typedef struct { const char *base_path; const char *partition_label; bool format_if_mount_failed; } esp_vfs_littlefs_conf_t;
+esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t *conf);
+esp_err_t esp_vfs_littlefs_unregister(const char *partition_label);
+esp_err_t esp_littlefs_format(const char *partition_label);
+
+// the file creations can be cut by the power too
+FILE *host_fopen(const char *path, const char *mode);
+#define fopen host_fopen
+
+static inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0)
+    {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+"""
+
+SHA256_H = r"""
+#pragma once
+#include <string.h>
+#include <openssl/sha.h>
+typedef SHA256_CTX mbedtls_sha256_context;
+static inline void mbedtls_sha256_init(mbedtls_sha256_context *ctx) { memset(ctx, 0, sizeof(*ctx)); }
+static inline void mbedtls_sha256_free(mbedtls_sha256_context *ctx) {}
+static inline int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224) { return !SHA256_Init(ctx); }
+static inline int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t len)
+{
+    return !SHA256_Update(ctx, input, len);
+}
+static inline int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char *output)
+{
+    return !SHA256_Final(output, ctx);
+}
+"""
+
+STUBS = ["esp_err.h", "esp_log.h", "esp_partition.h", "esp_ota_ops.h", "esp_littlefs.h"]
+
+HARNESS = r"""
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <openssl/sha.h>
+#include "config.h"
+#include "storage_update.h"
+
+#define CHUNK 1460 // an HTTP read, not aligned on the flash pages
+
+// ---- the flash: a file, the storage partition then ota_1, a power cut at the operation cut_at
+static int flash;
+static esp_partition_t storage = {.erase_size = 4096, .label = STORAGE_PARTITION};
+static esp_partition_t scratch = {.erase_size = 4096, .label = "ota_1"};
+static long ops, cut_at = -1;
+static bool powered = true;
+
+const char *esp_err_to_name(esp_err_t err) { return "ERR"; }
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    return strcmp(label, storage.label) == 0 ? &storage : NULL;
+}
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start) { return &scratch; }
+esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t *conf) { return ESP_OK; }
+esp_err_t esp_vfs_littlefs_unregister(const char *partition_label) { return ESP_OK; }
+
+// an operation cut by the power applies its first half
+static size_t power(size_t size)
+{
+    if (!powered)
+        return 0;
+    if (ops++ == cut_at)
+    {
+        powered = false;
+        return size / 2;
+    }
+    return size;
+}
+
+// ---- the file system: the directory STORAGE_PATH
+static long formats;
+esp_err_t esp_littlefs_format(const char *partition_label)
+{
+    size_t files = 0, removed;
+    DIR *dir = opendir(STORAGE_PATH);
+    while (readdir(dir) != NULL)
+        files++;
+    removed = power(files); // a cut format removes half of the files
+    rewinddir(dir);
+    struct dirent *entry;
+    char path[512];
+    while (removed > 0 && (entry = readdir(dir)) != NULL)
+    {
+        snprintf(path, sizeof(path), STORAGE_PATH "/%s", entry->d_name);
+        removed -= unlink(path) == 0;
+    }
+    closedir(dir);
+    formats++;
+    return powered ? ESP_OK : ESP_FAIL;
+}
+#undef fopen
+FILE *host_fopen(const char *path, const char *mode)
+{
+    if (mode[0] == 'w' && power(1) == 0)
+        return NULL;
+    return fopen(path, mode);
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t size)
+{
+    if (!powered)
+        return ESP_FAIL;
+    pread(flash, dst, size, p->address + offset);
+    return ESP_OK;
+}
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t size)
+{
+    size_t done = power(size);
+    uint8_t *data = malloc(size + 1);
+    pread(flash, data, done, p->address + offset);
+    for (size_t i = 0; i < done; i++)
+        data[i] &= ((const uint8_t *)src)[i];
+    pwrite(flash, data, done, p->address + offset);
+    free(data);
+    return done == size ? ESP_OK : ESP_FAIL;
+}
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size)
+{
+    if (offset % p->erase_size || size % p->erase_size)
+        return ESP_ERR_INVALID_ARG;
+    size_t done = power(size / p->erase_size) * p->erase_size;
+    uint8_t *data = malloc(size + 1);
+    memset(data, 0xFF, size);
+    pwrite(flash, data, done, p->address + offset);
+    free(data);
+    return done == size ? ESP_OK : ESP_FAIL;
+}
+
+// ---- the images
+static uint8_t *old_image, *new_image, *app_image;
+static uint8_t *read_file(const char *path, size_t size)
+{
+    uint8_t *data = malloc(size);
+    FILE *f = fopen(path, "rb");
+    fread(data, 1, size, f);
+    fclose(f);
+    return data;
+}
+
+// the device before the update: the old storage, the previous app in ota_1
+static void flash_reset(void)
+{
+    pwrite(flash, old_image, storage.size, storage.address);
+    pwrite(flash, app_image, scratch.size, scratch.address);
+    ops = 0, cut_at = -1, powered = true;
+}
+
+static const char *storage_state(void)
+{
+    uint8_t *data = malloc(storage.size);
+    pread(flash, data, storage.size, storage.address);
+    const char *state = memcmp(data, new_image, storage.size) == 0 ? "new"
+                        : memcmp(data, old_image, storage.size) == 0 ? "old" : "broken";
+    free(data);
+    return state;
+}
+
+// what ota_storage_update() does: begin, the HTTP data, end
+static esp_err_t update(const uint8_t *image, size_t size, const uint8_t *sha256)
+{
+    esp_err_t err = storage_update_begin();
+    for (size_t done = 0; done < size && err == ESP_OK; done += CHUNK)
+        err = storage_update_write(image + done, size - done < CHUNK ? size - done : CHUNK);
+    if (err != ESP_OK)
+    {
+        storage_update_abort();
+        return err;
+    }
+    return storage_update_end(sha256);
+}
+
+int main(int argc, char **argv)
+{
+    // harness <flash image> <storage size> <ota_1 size> <old image> <new image> <app image>
+    flash = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    storage.size = strtoul(argv[2], NULL, 0);
+    scratch.address = storage.size;
+    scratch.size = strtoul(argv[3], NULL, 0);
+    old_image = read_file(argv[4], storage.size);
+    new_image = read_file(argv[5], storage.size + CHUNK);
+    app_image = read_file(argv[6], scratch.size);
+    uint8_t sha256[32], wrong[32];
+    char same[1024];
+    SHA256(new_image, storage.size, sha256);
+    memcpy(wrong, sha256, sizeof(wrong));
+    wrong[31] ^= 1;
+
+    flash_reset();
+    esp_err_t err = update(new_image, storage.size, sha256);
+    long total = ops;
+    printf("update %d %s\n", err, storage_state());
+    ops = 0;
+    err = storage_update_resume();
+    printf("resume-idle %d %ld\n", err, ops);
+
+    // the arguments of printf() are evaluated in any order
+    flash_reset();
+    err = update(new_image, storage.size, NULL);
+    printf("no-sha256 %d %s\n", err, storage_state());
+    flash_reset();
+    err = update(new_image, storage.size, wrong);
+    printf("wrong-sha256 %d %s\n", err, storage_state());
+    flash_reset();
+    err = update(new_image, storage.size - 100, NULL);
+    printf("short %d %s\n", err, storage_state());
+    flash_reset();
+    err = update(new_image, storage.size + 100, NULL);
+    printf("long %d %s\n", err, storage_state());
+
+    // a power cut at each flash operation of the update, then a boot
+    for (long cut = 0; cut < total; cut++)
+    {
+        flash_reset();
+        cut_at = cut;
+        update(new_image, storage.size, sha256);
+        powered = true, cut_at = -1;
+        storage_update_resume();
+        const char *state = storage_state();
+        ops = 0;
+        storage_update_resume(); // the next boot has nothing to do
+        printf("cut %ld %s %ld\n", cut, state, ops);
+    }
+
+    // the SPIFFS files of an older firmware to LittleFS, as config_migrate_spiffs() does
+    char command[1024];
+    snprintf(command, sizeof(command), "rm -rf " STORAGE_PATH " && cp -r %s " STORAGE_PATH, argv[7]);
+    snprintf(same, sizeof(same), "diff -r %s " STORAGE_PATH " >/dev/null 2>&1", argv[7]);
+    flash_reset();
+    system(command);
+    err = storage_update_stage_files();
+    if (err == ESP_OK)
+        err = storage_update_restore_files();
+    total = ops;
+    printf("migrate %d %s\n", err, system(same) == 0 ? "same" : "lost");
+    ops = 0;
+    err = storage_update_resume();
+    printf("migrate-idle %d %ld\n", err, ops);
+    flash_reset();
+    err = storage_update_restore_files();
+    printf("migrate-none %d %s\n", err, system(same) == 0 ? "same" : "lost");
+
+    // files bigger than the scratch area: nothing is staged, the SPIFFS is kept
+    flash_reset();
+    snprintf(command + strlen(command), sizeof(command) - strlen(command), " && head -c %lu /dev/zero > " STORAGE_PATH "/big",
+             (unsigned long)storage.size);
+    system(command);
+    formats = 0;
+    err = storage_update_stage_files();
+    long staged_formats = formats;
+    storage_update_resume();
+    printf("migrate-big %d %ld\n", err, staged_formats + formats);
+
+    // a power cut at each operation of the migration, then the boots of config_init_storage(): resume, and the
+    // migration again when the SPIFFS is still there
+    snprintf(command, sizeof(command), "rm -rf " STORAGE_PATH " && cp -r %s " STORAGE_PATH, argv[7]);
+    for (long cut = 0; cut < total; cut++)
+    {
+        flash_reset();
+        system(command);
+        cut_at = cut;
+        formats = 0;
+        err = storage_update_stage_files();
+        if (err == ESP_OK)
+            err = storage_update_restore_files();
+        powered = true, cut_at = -1;
+        storage_update_resume();
+        if (formats == 0) // the format is the first write to the storage partition: the SPIFFS is still there
+        {
+            err = storage_update_stage_files();
+            if (err == ESP_OK)
+                err = storage_update_restore_files();
+        }
+        const char *state = system(same) == 0 ? "same" : "lost";
+        ops = 0;
+        storage_update_resume();
+        printf("migrate-cut %ld %s %ld\n", cut, state, ops);
+    }
+    close(flash);
+    return 0;
+}
+"""
+
+# error codes of HOST_H
+OK, INVALID_STATE, INVALID_SIZE, INVALID_CRC = 0, 0x103, 0x104, 0x109
+EXPECTED = {
+    "migrate": (OK, "same"),
+    "migrate-idle": (OK, 0),
+    "migrate-none": (INVALID_STATE, "same"),
+    "migrate-big": (INVALID_SIZE, 0),
+    "update": (OK, "new"),
+    "resume-idle": (OK, 0),
+    "no-sha256": (OK, "new"),
+    "wrong-sha256": (INVALID_CRC, "old"),
+    "short": (INVALID_SIZE, "old"),
+    "long": (INVALID_SIZE, "old"),
+}
+
+
+def partition_sizes():
+    sizes = {}
+    with open(PARTITIONS_CSV, encoding="utf-8") as f:
+        for line in f:
+            fields = [field.strip() for field in line.split(",")]
+            if len(fields) >= 5 and not fields[0].startswith("#"):
+                size = fields[4].upper()
+                sizes[fields[0]] = int(size[:-1]) * 1024 if size.endswith("K") else int(size, 0)
+    return sizes["storage"], sizes["ota_1"]
+
+
+def storage_partition_label():
+    with open(CONFIG_H, encoding="utf-8") as f:
+        return re.search(r'#define STORAGE_PARTITION (".*")', f.read()).group(1)
+
+
+def spiffs_files(path, storage_size):
+    """the files of an older firmware: the smallest of src_data, half of the partition"""
+    os.makedirs(path)
+    total = 0
+    for name in sorted(os.listdir(SRC_DATA), key=lambda name: os.path.getsize(os.path.join(SRC_DATA, name))):
+        total += os.path.getsize(os.path.join(SRC_DATA, name))
+        if total > storage_size // 2:
+            break
+        with open(os.path.join(SRC_DATA, name), "rb") as f, open(os.path.join(path, name), "wb") as out:
+            out.write(f.read())
+    return path
+
+
+def build(work):
+    with open(os.path.join(work, "host.h"), "w", encoding="utf-8") as f:
+        f.write(HOST_H)
+    for name in STUBS:
+        with open(os.path.join(work, name), "w", encoding="utf-8") as f:
+            f.write('#pragma once\n#include "host.h"\n')
+    # config.h only for the partition label and the mount point, without the headers it pulls
+    with open(os.path.join(work, "config.h"), "w", encoding="utf-8") as f:
+        f.write(f"#pragma once\n#define STORAGE_PARTITION {storage_partition_label()}\n")
+        f.write(f'#define STORAGE_PATH "{os.path.join(work, "storage")}"\n')
+    os.makedirs(os.path.join(work, "mbedtls"), exist_ok=True)
+    with open(os.path.join(work, "mbedtls/sha256.h"), "w", encoding="utf-8") as f:
+        f.write(SHA256_H)
+    with open(os.path.join(work, "harness.c"), "w", encoding="utf-8") as f:
+        f.write(HARNESS)
+    program = os.path.join(work, "harness")
+    subprocess.run(
+        [
+            "gcc", "-O1", "-std=gnu17", "-w", "-I", work, "-I", os.path.join(MAIN_DIR, "include"), "-o", program,
+            os.path.join(work, "harness.c"), os.path.join(MAIN_DIR, "storage_update.c"), "-lcrypto",
+        ],
+        check=True,
+    )
+    return program
+
+
+def check():
+    storage_size, ota_size = partition_sizes()
+    rng = random.Random(72)
+    with tempfile.TemporaryDirectory() as work:
+        program = build(work)
+        images = {}
+        for name, size in (("old", storage_size), ("new", storage_size + 1460), ("app", ota_size)):
+            images[name] = os.path.join(work, name + ".bin")
+            with open(images[name], "wb") as f:
+                f.write(rng.randbytes(size))
+        spiffs = spiffs_files(os.path.join(work, "spiffs"), storage_size)
+        lines = subprocess.run(
+            [program, os.path.join(work, "flash.bin"), str(storage_size), str(ota_size), images["old"],
+             images["new"], images["app"], spiffs],
+            check=True, capture_output=True, text=True,
+        ).stdout.splitlines()
+
+    failed = 0
+    cuts = []
+    migrate_cuts = []
+    for line in lines:
+        parts = line.split()
+        if parts[0] in ("cut", "migrate-cut"):
+            (cuts if parts[0] == "cut" else migrate_cuts).append((int(parts[1]), parts[2], int(parts[3])))
+            continue
+        result = (int(parts[1]), parts[2] if not parts[2].isdigit() else int(parts[2]))
+        ok = result == EXPECTED[parts[0]]
+        print(f"{parts[0]:14} {result[0]:#6x} {result[1]!s:6}  {'' if ok else 'FAILED'}")
+        failed += not ok
+
+    # the old image until the header is written, the new one after: never a mix, never a second copy
+    states = [state for _, state, _ in cuts]
+    first_new = states.index("new") if "new" in states else len(states)
+    bad = [cut for cut, state, ops in cuts if state == "broken" or ops != 0]
+    bad += [cut for cut, state, _ in cuts[first_new:] if state != "new"]
+    print(f"power cuts     {len(cuts)} flash operations: old image up to the cut {first_new - 1}, new image after,"
+          f" {len(bad)} failed{'' if not bad else ': ' + ' '.join(str(cut) for cut in bad[:10])}")
+    failed += len(bad) > 0
+
+    # every file of the SPIFFS, from the SPIFFS or from the LittleFS written at the next boot, never a second restore
+    bad = [cut for cut, state, ops in migrate_cuts if state != "same" or ops != 0]
+    print(f"migration cuts {len(migrate_cuts)} operations: {len(bad)} failed"
+          f"{'' if not bad else ': ' + ' '.join(str(cut) for cut in bad[:10])}")
+    failed += len(bad) > 0 or not migrate_cuts
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(1 if check() else 0)
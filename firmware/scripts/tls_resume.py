@@ -0,0 +1,72 @@
+# Measure a full TLS 1.2 handshake against a resumed one, like the TICMeter does on each wake cycle
+# Usage: python tls_resume.py <host> <port> <ca.pem> [connections]
+# Example: python tls_resume.py 192.168.1.10 8883 ../src_data/ISRG_root_x1.pem
+#          python tls_resume.py 192.168.1.10 443 ../src_data/ISRG_root_x1.pem 20
+
+import socket
+import ssl
+import sys
+import time
+
+
+def handshake(host, port, context, session=None):
+    """return (session, reused, bytes sent, bytes received, handshake time in ms)"""
+    sock = socket.create_connection((host, port))
+    incoming = ssl.MemoryBIO()
+    outgoing = ssl.MemoryBIO()
+    tls = context.wrap_bio(incoming, outgoing, server_hostname=host, session=session)
+    sent = received = 0
+    start = time.perf_counter()
+    while True:
+        try:
+            tls.do_handshake()
+            break
+        except ssl.SSLWantReadError:
+            pass
+        data = outgoing.read()
+        if data:
+            sock.sendall(data)
+            sent += len(data)
+        data = sock.recv(16384)
+        if not data:
+            raise ConnectionError("closed during the handshake")
+        incoming.write(data)
+        received += len(data)
+    data = outgoing.read()  # Finished of a resumed handshake
+    if data:
+        sock.sendall(data)
+        sent += len(data)
+    elapsed = (time.perf_counter() - start) * 1000
+    # TLS 1.2 tickets come with the handshake, keep the session for the next connection
+    result = (tls.session, tls.session_reused, sent, received, elapsed)
+    sock.close()
+    return result
+
+
+def main():
+    if len(sys.argv) < 4:
+        print("Usage: python tls_resume.py <host> <port> <ca.pem> [connections]")
+        sys.exit(1)
+    host, port, ca = sys.argv[1], int(sys.argv[2]), sys.argv[3]
+    count = int(sys.argv[4]) if len(sys.argv) > 4 else 10
+    context = ssl.create_default_context(cafile=ca)
+    context.maximum_version = ssl.TLSVersion.TLSv1_2  # like the firmware: CONFIG_MBEDTLS_SSL_PROTO_TLS1_3 is not set
+
+    totals = {False: [], True: []}
+    session = None
+    for i in range(count):
+        session, reused, sent, received, elapsed = handshake(host, port, context, session)
+        totals[reused].append((sent, received, elapsed))
+        print(f"{i:3} {'resumed' if reused else 'full   '} {sent:6} B sent {received:6} B received {elapsed:7.2f} ms")
+
+    for reused, values in totals.items():
+        if values:
+            sent = sum(v[0] for v in values) / len(values)
+            received = sum(v[1] for v in values) / len(values)
+            elapsed = sum(v[2] for v in values) / len(values)
+            name = "resumed" if reused else "full"
+            print(f"{name:8} x{len(values):3}: {sent:7.0f} B sent {received:7.0f} B received {elapsed:7.2f} ms")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,269 @@
+# Receive the TICMeter UDP datagrams (format in main/include/udp.h) and print the samples as json
+# Usage: python udp_listen.py listen [group] [port] [key]   join the group (or listen for broadcasts) and print the samples
+#        python udp_listen.py test                          datagrams of udp.c on loopback: copies, losses, HMAC, replays
+# Example: python udp_listen.py listen 239.255.84.73 8473 mysecret
+# The test needs gcc and the OpenSSL headers: udp.c, cbor.c, exporter.c and the label table of linky.c are built on the
+# host with build_host() of mqtt_commands.py, on the sockets of the host, and send the samples of ../tramesLinky.
+
+import hashlib
+import hmac
+import json
+import os
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+
+from cbor_payload import decode_cbor, load_captures, load_labels
+from exporter_bench import SAMPLE, write_fields
+from mqtt_commands import MODULES, build_host
+
+MAGIC = b"TI"
+VERSION = 1
+FLAG_SIGNED = 0x01
+HEADER = struct.Struct(">2sBBII")  # magic, version, flags, boot id, sequence
+MAC_SIZE = 16
+DEFAULT_GROUP = "239.255.84.73"
+DEFAULT_PORT = 8473
+TIMESTAMP = 1700000000
+
+# the sockets of the host for lwip, the HMAC of OpenSSL for mbedtls (shared with coap_server.py and modbus_map.py)
+SOCKET_MODULES = MODULES | {
+    "lwip/sockets.h": '#pragma once\n#include "host.h"\n#include <sys/socket.h>\n#include <netinet/in.h>\n'
+                      "#include <netinet/tcp.h>\n#include <arpa/inet.h>\n#include <unistd.h>\n#include <errno.h>\n",
+    "lwip/netdb.h": "#pragma once\n#include <netdb.h>\n",
+    "esp_random.h": '#pragma once\n#include "host.h"\nuint32_t esp_random(void);\nvoid esp_fill_random(void *buffer, size_t len);\n',
+    "mbedtls/md.h": '#pragma once\n#include "host.h"\ntypedef enum { MBEDTLS_MD_SHA256 = 9 } mbedtls_md_type_t;\n'
+                    "typedef struct mbedtls_md_info_t mbedtls_md_info_t;\n"
+                    "const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type);\n"
+                    "int mbedtls_md_hmac(const mbedtls_md_info_t *info, const unsigned char *key, size_t key_len,\n"
+                    "                    const unsigned char *input, size_t len, unsigned char *output);\n",
+}
+
+# esp_random and mbedtls on the host (shared with coap_server.py), the boot id of udp.c is random for each run
+DEVICE = r"""
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <sys/time.h>
+#include "config.h"
+#include "esp_random.h"
+#include "mbedtls/md.h"
+
+uint32_t esp_random(void)
+{
+    static bool seeded = false;
+    if (!seeded)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        srandom(now.tv_usec ^ getpid());
+        seeded = true;
+    }
+    return (uint32_t)random() << 16 ^ (uint32_t)random();
+}
+void esp_fill_random(void *buffer, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        ((uint8_t *)buffer)[i] = esp_random();
+}
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type) { return (const mbedtls_md_info_t *)1; }
+int mbedtls_md_hmac(const mbedtls_md_info_t *info, const unsigned char *key, size_t key_len, const unsigned char *input,
+                    size_t len, unsigned char *output)
+{
+    return HMAC(EVP_sha256(), key, key_len, input, len, output, NULL) ? 0 : -1;
+}
+"""
+
+# udp_send() of one sample of each capture given in argv, after the port and the key; the size of each text label is
+# printed first, fill() cuts the longer texts
+HARNESS = r"""
+#include "udp.h"
+#include "exporter.h"
+
+float gpio_get_vcondo(void) { return 4.5f; }
+int64_t esp_timer_get_time(void) { return 0; }
+TickType_t xTaskGetTickCount(void) { return 0; }
+void vTaskDelay(TickType_t ticks) { usleep(ticks * portTICK_PERIOD_MS * 1000); }
+""" + SAMPLE + r"""
+int main(int argc, char **argv)
+{
+    static linky_data_t sample;
+    strcpy(config_values.udp.host, "127.0.0.1");
+    config_values.udp.port = atoi(argv[1]);
+    strcpy(config_values.udp.key, argv[2]);
+    for (int32_t i = 0; i < linky_label_list_size; i++)
+        if (linky_label_list[i].type == STRING)
+            printf("size %s %d\n", linky_label_list[i].label, linky_label_list[i].size);
+    for (int i = 3; i < argc; i++)
+    {
+        int c = atoi(argv[i]);
+        linky_mode = captures[c].mode;
+        fill(&sample, captures[c].fields, captures[c].count);
+        sample.timestamp = TIMESTAMP;
+        printf("sent %d\n", udp_send(&sample));
+    }
+    return 0;
+}
+"""
+
+
+class Listener:
+    """check the datagrams: format, signature, duplicates, replays and losses"""
+
+    def __init__(self, labels_by_id, key=None):
+        self.labels_by_id = labels_by_id
+        self.key = key
+        self.last = {}  # sequence of the last sample of each boot id
+        self.lost = 0
+
+    def receive(self, datagram):
+        """return (status, sample): status is ok, duplicate, old, or the reason of the drop"""
+        if len(datagram) < HEADER.size:
+            return "short", None
+        magic, version, flags, boot_id, sequence = HEADER.unpack_from(datagram)
+        if magic != MAGIC or version != VERSION:
+            return "not a TICMeter datagram", None
+        payload = datagram[HEADER.size :]
+        if flags & FLAG_SIGNED:
+            if not self.key:
+                return "signed but no key", None
+            payload, mac = payload[:-MAC_SIZE], payload[-MAC_SIZE:]
+            expected = hmac.new(self.key, datagram[:-MAC_SIZE], hashlib.sha256).digest()[:MAC_SIZE]
+            if not hmac.compare_digest(mac, expected):
+                return "bad signature", None
+        elif self.key:
+            return "unsigned", None
+        last = self.last.get(boot_id)
+        if last is not None and sequence == last:
+            return "duplicate", None
+        if last is not None and sequence < last:
+            return "old", None
+        if last is not None:
+            self.lost += sequence - last - 1
+        self.last[boot_id] = sequence
+        try:
+            sample = decode_cbor(payload, self.labels_by_id)
+        except (ValueError, IndexError, KeyError) as e:
+            return f"bad payload: {e}", None
+        sample["boot"] = f"{boot_id:08x}"
+        sample["sequence"] = sequence
+        return "ok", sample
+
+
+def listen(group, port, key):
+    labels_by_id = {info["id"]: label for label, info in load_labels().items()}
+    listener = Listener(labels_by_id, key)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", port))
+    if socket.inet_aton(group)[0] >> 4 == 0xE:
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, socket.inet_aton(group) + socket.inet_aton("0.0.0.0"))
+    print(f"Listening on {group}:{port}{' (signed)' if key else ''}", file=sys.stderr)
+    while True:
+        datagram, source = sock.recvfrom(2048)
+        status, sample = listener.receive(datagram)
+        if status == "ok":
+            print(json.dumps(sample, ensure_ascii=False), flush=True)
+        elif status != "duplicate":
+            print(f"{source[0]}: dropped, {status} (lost so far: {listener.lost})", file=sys.stderr)
+
+
+def text_sizes(output):
+    """the sizes of the text labels printed by a harness"""
+    return {line.split()[1]: int(line.split()[2]) for line in output.splitlines() if line.startswith("size ")}
+
+
+def expected(values, data, labels_by_id, sizes):
+    """the sample of the values of a capture as decoded from data: texts cut to the size of their label, and the
+    "_time" labels, that read the date of a UINT32_TIME label, the captures do not list them and fill() dates them with
+    the sample"""
+    out = {"timestamp": TIMESTAMP}
+    for id, value in values:
+        label = labels_by_id[id]
+        out[label] = value[: sizes[label]] if isinstance(value, str) and label in sizes else value
+    out.update({label: TIMESTAMP for label in data if label.endswith("_time") and label not in out})
+    return out
+
+
+def build(work, captures, labels):
+    write_fields(os.path.join(work, "fields.h"), captures, labels)
+    code = DEVICE + f"#define TIMESTAMP {TIMESTAMP}\n" + HARNESS
+    return build_host(work, "device", code, ["udp.c", "cbor.c", "exporter.c"], SOCKET_MODULES, libs=["-lcrypto"])
+
+
+def test():
+    labels = load_labels()
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    key = b"secret"
+    captures = load_captures(labels)
+    receiver = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    receiver.bind(("127.0.0.1", 0))
+    work = tempfile.TemporaryDirectory()
+    program = build(work.name, captures, labels)
+
+    sizes = {}
+
+    def send(indexes, key=None):
+        """the datagrams sent by udp.c for the samples of the captures, in a new boot"""
+        output = subprocess.run(
+            [program, str(receiver.getsockname()[1]), (key or b"").decode()] + [str(i) for i in indexes],
+            check=True, capture_output=True, text=True,
+        ).stdout
+        sizes.update(text_sizes(output))
+        datagrams = []
+        receiver.settimeout(0.2)
+        try:
+            while True:
+                datagrams.append(receiver.recvfrom(2048)[0])
+        except socket.timeout:
+            return datagrams
+
+    failures = 0
+
+    def check(name, ok):
+        nonlocal failures
+        failures += not ok
+        print(f"{name:45} {'OK' if ok else 'FAILED'}")
+
+    lengths = []
+    for signed in (False, True):
+        listener = Listener(labels_by_id, key if signed else None)
+        datagrams = send(range(len(captures)), key if signed else None)
+        for n, (file, values) in enumerate(captures.items()):
+            # every sample is sent twice (UDP_COPIES)
+            results = [listener.receive(datagram) for datagram in datagrams[2 * n : 2 * n + 2]]
+            lengths += [len(datagram) for datagram in datagrams[2 * n : 2 * n + 2]]
+            ok = [r[0] for r in results] == ["ok", "duplicate"]
+            ok = ok and results[0][1]["data"] == [expected(values, results[0][1]["data"][0], labels_by_id, sizes)]
+            check(f"{file} {'signed' if signed else 'unsigned'} ({lengths[-1]} B)", ok)
+
+    datagrams = send([0] * 6, key)[::2]
+    listener = Listener(labels_by_id, key)
+    results = [listener.receive(datagrams[i]) for i in (0, 1, 4)]
+    check("sequence gap counted as 2 lost", [r[0] for r in results] == ["ok"] * 3 and listener.lost == 2)
+    check("replay of an older sequence dropped", listener.receive(datagrams[2])[0] == "old")
+    tampered = bytearray(datagrams[5])
+    tampered[HEADER.size + 5] ^= 1
+    check("tampered payload dropped", listener.receive(bytes(tampered))[0] == "bad signature")
+    check("wrong key dropped", Listener(labels_by_id, b"other").receive(datagrams[5])[0] == "bad signature")
+    check("unsigned datagram dropped with a key", listener.receive(send([0])[0])[0] == "unsigned")
+    check("new boot id restarts the sequence", listener.receive(send([0], key)[0])[0] == "ok")
+    receiver.close()
+    work.cleanup()
+    print(f"datagram sizes: {min(lengths)} to {max(lengths)} bytes")
+    print("FAILED" if failures else "All OK")
+    return failures
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2 or sys.argv[1] not in ("listen", "test"):
+        print("Usage: python udp_listen.py listen [group] [port] [key] | test")
+        sys.exit(1)
+    if sys.argv[1] == "listen":
+        group = sys.argv[2] if len(sys.argv) > 2 else DEFAULT_GROUP
+        port = int(sys.argv[3]) if len(sys.argv) > 3 else DEFAULT_PORT
+        key = sys.argv[4].encode("utf-8") if len(sys.argv) > 4 else None
+        listen(group, port, key)
+    else:
+        sys.exit(1 if test() else 0)
@@ -0,0 +1,258 @@
+# Host check of the HTTP batches by columns of main/web.c: the json body is valid json and gives back the texts of the
+# samples and the token, quotes, backslashes and control characters included, and it holds the same samples as the CBOR
+# body of the same batch.
+# Usage: python web_columns.py
+# Needs gcc. web.c, cbor.c, json_writer.c, json_reader.c, exporter.c and the label table of linky.c are built on the host
+# with build_host() of mqtt_commands.py, esp_http_client keeps the chunks written by wifi_send_to_server(). The bodies
+# are decoded with decode_json_columns() and decode_cbor() of cbor_payload.py.
+
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+from cbor_payload import decode_cbor, decode_json_columns, load_captures, load_labels
+from exporter_bench import SAMPLE, write_fields
+from json_bench import c_string
+from json_read import CORE_JSON_DIR
+from mqtt_commands import MODULES, build_host
+
+TOKEN = 'tok"en\\\x01'
+INJECTED = '"\\\x01'  # written at the start of each text of the first sample
+START_TIME = 1700000000
+
+# esp_http_client as seen by web.c, and the libc functions of newlib that glibc lacks
+HTTP_H = r"""
+#pragma once
+#include "host.h"
+typedef struct esp_http_client *esp_http_client_handle_t;
+typedef enum { HTTP_METHOD_GET, HTTP_METHOD_POST } esp_http_client_method_t;
+typedef enum { HTTP_EVENT_ERROR, HTTP_EVENT_ON_HEADER, HTTP_EVENT_ON_DATA } esp_http_client_event_id_t;
+typedef struct
+{
+    esp_http_client_event_id_t event_id;
+    char *header_key;
+    char *header_value;
+    void *data;
+    int data_len;
+} esp_http_client_event_t;
+typedef esp_http_client_event_t *esp_http_client_event_handle_t;
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *evt);
+typedef struct
+{
+    const char *url;
+    const char *cert_pem;
+    const char *common_name;
+    esp_http_client_method_t method;
+    http_event_handle_cb event_handler;
+    bool keep_alive_enable;
+    bool save_client_session;
+} esp_http_client_config_t;
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url);
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value);
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key);
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int esp_http_client_write(esp_http_client_handle_t client, const char *buffer, int len);
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int esp_http_client_flush_response(esp_http_client_handle_t client, int *len);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+const char *esp_err_to_name(esp_err_t code);
+size_t strlcpy(char *dst, const char *src, size_t size);
+size_t strlcat(char *dst, const char *src, size_t size);
+"""
+
+# the modules of web.c that need the network or the hardware
+WEB_MODULES = MODULES | {
+    "wifi.h": '#pragma once\n#include "config.h"\n#include "esp_http_client.h"\n'
+              "uint8_t wifi_send_to_server(linky_data_t *data, char count);\nvoid wifi_http_close();\n"
+              "void wifi_http_get_config_from_server();\n",
+    "gpio.h": "#pragma once\nfloat gpio_get_vcondo(void);\n",
+    "esp_http_client.h": HTTP_H,
+    "lwip/netdb.h": "#pragma once\n#include <netdb.h>\n",
+    "lwip/inet.h": "#pragma once\n#include <arpa/inet.h>\nchar *inet_ntoa_r(struct in_addr addr, char *buf, int size);\n",
+}
+
+# a client that keeps the chunked body of the POST
+CLIENT = r"""
+#include <arpa/inet.h>
+#include "web.h"
+#include "wifi.h"
+#include "led.h"
+#include "cbor.h"
+
+const char *const ENCODINGS[] = {"json", "cbor", "influx"};
+float gpio_get_vcondo(void) { return 4.5f; }
+int8_t config_write() { return 0; }
+char *config_read_cert(const char *name) { return NULL; }
+void led_start_pattern(led_pattern_t pattern) {}
+void led_stop_pattern(led_pattern_t pattern) {}
+int64_t esp_timer_get_time(void) { return 0; }
+const char *esp_err_to_name(esp_err_t code) { return "error"; }
+char *inet_ntoa_r(struct in_addr addr, char *buf, int size) { return strncpy(buf, inet_ntoa(addr), size); }
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    snprintf(dst, size, "%s", src);
+    return strlen(src);
+}
+size_t strlcat(char *dst, const char *src, size_t size)
+{
+    size_t len = strnlen(dst, size);
+    return len + strlcpy(dst + len, src, size - len);
+}
+
+static char body[65536];
+static size_t body_len;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) { return (esp_http_client_handle_t)1; }
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url) { return ESP_OK; }
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method) { return ESP_OK; }
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value) { return ESP_OK; }
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key) { return ESP_OK; }
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    body_len = 0;
+    return ESP_OK;
+}
+int esp_http_client_write(esp_http_client_handle_t client, const char *buffer, int len)
+{
+    if (body_len + len > sizeof(body))
+        return -1;
+    memcpy(body + body_len, buffer, len);
+    body_len += len;
+    return len;
+}
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client) { return 0; }
+int esp_http_client_flush_response(esp_http_client_handle_t client, int *len) { return 0; }
+int esp_http_client_get_status_code(esp_http_client_handle_t client) { return 204; }
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) { return ESP_OK; }
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) { return ESP_OK; }
+"""
+
+# each capture is sent by columns in json then in CBOR: its sample with the injected texts, the next one where the
+# measures moved, and the capture itself (argv: capture index of the injected texts, of the original texts); the size of
+# each text label is printed first, fill() cuts the longer texts
+HARNESS = SAMPLE + r"""
+static linky_data_t samples[3];
+
+static void post(const char *name, payload_encoding_t encoding, const char *path)
+{
+    config_values.encoding = encoding;
+    uint8_t sent = wifi_send_to_server(samples, 3);
+    FILE *f = fopen(path, "wb");
+    fwrite(body, 1, body_len, f);
+    fclose(f);
+    printf("%s %d %zu\n", name, sent, body_len);
+}
+
+int main(int argc, char **argv)
+{
+    strcpy(config_values.web.host, "192.168.1.10:3001");
+    strcpy(config_values.web.postUrl, "/post");
+    strcpy(config_values.web.token, TOKEN);
+    config_values.columns = 1;
+    int injected = atoi(argv[1]), original = atoi(argv[2]);
+    linky_mode = captures[injected].mode;
+    fill(&samples[0], captures[injected].fields, captures[injected].count);
+    samples[1] = samples[0];
+    step(&samples[1]);
+    fill(&samples[2], captures[original].fields, captures[original].count);
+    for (int i = 0; i < 3; i++)
+        samples[i].timestamp = START_TIME + 60 * i;
+    for (int32_t i = 0; i < linky_label_list_size; i++)
+        if (linky_label_list[i].type == STRING)
+            printf("size %s %d\n", linky_label_list[i].label, linky_label_list[i].size);
+    post("json", ENCODING_JSON, argv[3]);
+    post("cbor", ENCODING_CBOR, argv[4]);
+    return 0;
+}
+"""
+
+
+def dechunk(data):
+    """the body of a chunked transfer encoding"""
+    out, pos = bytearray(), 0
+    while True:
+        end = data.index(b"\r\n", pos)
+        size = int(data[pos:end], 16)
+        out += data[end + 2 : end + 2 + size]
+        pos = end + 4 + size
+        if size == 0:
+            return bytes(out)
+
+
+def build(work, captures, labels):
+    write_fields(os.path.join(work, "fields.h"), captures, labels)
+    code = f"#define TOKEN {c_string(TOKEN)}\n#define START_TIME {START_TIME}\n" + CLIENT + HARNESS
+    sources = ["web.c", "cbor.c", "json_writer.c", "json_reader.c", "exporter.c", os.path.join(CORE_JSON_DIR, "core_json.c")]
+    return build_host(work, "harness", code, sources, WEB_MODULES, [os.path.join(CORE_JSON_DIR, "include")], ["-lz"])
+
+
+def inject(values, labels_by_id, labels):
+    """the texts of 3 characters or more start with INJECTED, a C string stops at its first NUL"""
+    out = []
+    for id, value in values:
+        if isinstance(value, str):
+            value = value.split("\0")[0]
+            if len(value) >= len(INJECTED) and labels[labels_by_id[id]]["type"] == "STRING":
+                value = INJECTED + value[len(INJECTED) :]
+        out.append((id, value))
+    return out
+
+
+def check():
+    labels = load_labels()
+    labels_by_id = {info["id"]: label for label, info in labels.items()}
+    originals = load_captures(labels)
+    captures = {}
+    for file, values in originals.items():
+        captures[file + " injected"] = inject(values, labels_by_id, labels)
+        captures[file] = [(id, value.split("\0")[0] if isinstance(value, str) else value) for id, value in values]
+
+    failed = 0
+    print(f"{'capture':26} {'json':>5} {'cbor':>5} {'texts':>5}")
+    with tempfile.TemporaryDirectory() as work:
+        program = build(work, captures, labels)
+        for n, file in enumerate(originals):
+            json_path, cbor_path = os.path.join(work, "body.json"), os.path.join(work, "body.cbor")
+            output = subprocess.run(
+                [program, str(2 * n), str(2 * n + 1), json_path, cbor_path], check=True, capture_output=True, text=True
+            ).stdout
+            sizes = {line.split()[1]: int(line.split()[2]) for line in output.splitlines() if line.startswith("size ")}
+            with open(json_path, "rb") as f:
+                raw_json = dechunk(f.read())
+            with open(cbor_path, "rb") as f:
+                raw_cbor = dechunk(f.read())
+
+            error = ""
+            try:
+                body = json.loads(raw_json.decode("utf-8"))
+                from_json = decode_json_columns(body)
+                from_cbor = decode_cbor(raw_cbor, labels_by_id)
+            except ValueError as e:  # json.JSONDecodeError, a bad utf-8 or CBOR item
+                error = str(e)
+            texts = 0
+            if not error:
+                if body["TOKEN"] != TOKEN or from_cbor["TOKEN"] != TOKEN:
+                    error = f"token {body['TOKEN']!r} {from_cbor['TOKEN']!r}"
+                elif from_json != from_cbor["data"]:
+                    error = "json and CBOR samples differ"
+                for i, values in ((0, captures[file + " injected"]), (2, captures[file])):
+                    for id, value in values:
+                        label = labels_by_id[id]
+                        if isinstance(value, str) and value and labels[label]["type"] == "STRING":
+                            value = value[: sizes[label]]
+                            texts += 1
+                            if from_json[i].get(label) != value:
+                                error = error or f"sample {i} {label}: {from_json[i].get(label)!r} expected {value!r}"
+            print(f"{file:26} {len(raw_json):5} {len(raw_cbor):5} {texts:5}  {'FAILED ' + error if error else ''}")
+            failed += bool(error)
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(1 if check() else 0)
@@ -0,0 +1,357 @@
+# Host check and benchmark of main/ota_zlib.c: the compressed OTA file of create-ota.py, inflated to the storage and
+# OTA partitions, as received by HTTP, Zigbee or Tuya
+# Usage: python zlib_ota.py [TICMeter.bin storage.bin]    the images of a build, by default a host binary and src_data
+# Needs gcc, the zlib and OpenSSL headers. ota_zlib.c and storage_update.c are built on the host with the stubs of
+# storage_update.py; the flash is a file holding the storage and ota_1 partitions of ../partitions.csv.
+# Reported: download size against the images, inflate-to-partition throughput and peak heap, for each packet size.
+
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import zlib
+
+from delta_ota import host_binary
+from storage_update import HOST_H, SHA256_H, STUBS, partition_sizes, storage_partition_label
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+MAIN_DIR = os.path.join(SCRIPT_DIR, "../main")
+SRC_DATA = os.path.join(SCRIPT_DIR, "../src_data")
+
+ZIGBEE_MAGIC = 0x0BEEF11E
+TAG_APP, TAG_STORAGE = 0x0000, 0x0100
+
+OTA_H = r"""
+#pragma once
+#include <sys/param.h>
+#define ESP_ERR_INVALID_RESPONSE 0x108
+typedef uint32_t esp_ota_handle_t;
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size);
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+esp_err_t esp_ota_abort(esp_ota_handle_t handle);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+#define ESP_RETURN_ON_ERROR(x, tag, ...) do { esp_err_t err_rc_ = (x); if (err_rc_ != ESP_OK) return err_rc_; } while (0)
+#define portTICK_PERIOD_MS 1
+void vTaskDelay(uint32_t ticks);
+int xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *arg, int priority, void *handle);
+void esp_restart(void);
+"""
+
+HARNESS = r"""
+#include <fcntl.h>
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "ota_zlib.h"
+
+// ---- the flash: a file, the storage partition then ota_1
+static int flash;
+static esp_partition_t storage = {.erase_size = 4096, .label = STORAGE_PARTITION};
+static esp_partition_t ota = {.erase_size = 4096, .label = "ota_1"};
+static size_t heap_base, heap_peak;
+
+static void heap_sample(void)
+{
+    size_t used = mallinfo2().uordblks - heap_base;
+    heap_peak = used > heap_peak ? used : heap_peak;
+}
+
+const char *esp_err_to_name(esp_err_t err) { return "ERR"; }
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    return strcmp(label, storage.label) == 0 ? &storage : NULL;
+}
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start) { return &ota; }
+esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t *conf) { return ESP_OK; }
+esp_err_t esp_vfs_littlefs_unregister(const char *partition_label) { return ESP_OK; }
+esp_err_t esp_littlefs_format(const char *partition_label) { return ESP_OK; }
+#undef fopen
+FILE *host_fopen(const char *path, const char *mode) { return fopen(path, mode); }
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t size)
+{
+    pread(flash, dst, size, p->address + offset);
+    return ESP_OK;
+}
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t size)
+{
+    if (offset + size > p->size)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t *data = malloc(size + 1);
+    pread(flash, data, size, p->address + offset);
+    for (size_t i = 0; i < size; i++)
+        data[i] &= ((const uint8_t *)src)[i];
+    pwrite(flash, data, size, p->address + offset);
+    free(data);
+    heap_sample();
+    return ESP_OK;
+}
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size)
+{
+    if (offset % p->erase_size || size % p->erase_size)
+        return ESP_ERR_INVALID_ARG;
+    uint8_t *data = malloc(size + 1);
+    memset(data, 0xFF, size);
+    pwrite(flash, data, size, p->address + offset);
+    free(data);
+    return ESP_OK;
+}
+
+// ---- esp_ota_ops: sequential writes, a sector erased when the image reaches it
+static bool ota_open;
+static uint32_t ota_size;
+static const esp_partition_t *boot;
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+    ota_open = true, ota_size = 0, *out_handle = 1;
+    return ESP_OK;
+}
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    if (!ota_open)
+        return ESP_ERR_INVALID_STATE;
+    for (uint32_t sector = (ota_size + ota.erase_size - 1) / ota.erase_size * ota.erase_size; sector < ota_size + size;
+         sector += ota.erase_size)
+        esp_partition_erase_range(&ota, sector, ota.erase_size);
+    esp_err_t err = esp_partition_write(&ota, ota_size, data, size);
+    ota_size += size;
+    return err;
+}
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    bool open = ota_open;
+    ota_open = false;
+    return open && ota_size > 0 ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    ota_open = false;
+    return ESP_OK;
+}
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    boot = partition;
+    return ESP_OK;
+}
+void vTaskDelay(uint32_t ticks) {}
+int xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *arg, int priority, void *handle) { return 1; }
+void esp_restart(void) {}
+
+// ---- the run
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size + 1);
+    fread(data, 1, *size, f);
+    fclose(f);
+    return data;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static bool partition_is(const esp_partition_t *p, const uint8_t *image, size_t size)
+{
+    uint8_t *data = malloc(size + 1);
+    pread(flash, data, size, p->address);
+    bool same = memcmp(data, image, size) == 0;
+    free(data);
+    return same;
+}
+
+// what the OTA of HTTP, Zigbee or Tuya does: init, the packets, end
+static esp_err_t update(const uint8_t *file, size_t size, size_t packet)
+{
+    uint8_t *blank = malloc(storage.size);
+    memset(blank, 0, storage.size);
+    pwrite(flash, blank, storage.size, storage.address); // the old storage
+    free(blank);
+    boot = NULL;
+    heap_base = mallinfo2().uordblks;
+    heap_peak = 0;
+    esp_err_t err = ota_zlib_init();
+    heap_sample();
+    for (size_t done = 0; done < size && err == ESP_OK; done += packet)
+        err = ota_zlib_write(file + done, size - done < packet ? size - done : packet);
+    if (err != ESP_OK)
+    {
+        ota_zlib_abort();
+        return err;
+    }
+    return ota_zlib_end();
+}
+
+int main(int argc, char **argv)
+{
+    // harness <flash image> <storage size> <ota_1 size> <app image> <storage image> <file>...
+    flash = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    storage.size = strtoul(argv[2], NULL, 0);
+    ota.address = storage.size;
+    ota.size = strtoul(argv[3], NULL, 0);
+    size_t app_size, storage_size, file_size;
+    uint8_t *app = read_file(argv[4], &app_size);
+    uint8_t *image = read_file(argv[5], &storage_size);
+
+    // each file: <name> <path> <packet size>
+    for (int i = 6; i + 2 < argc; i += 3)
+    {
+        uint8_t *file = read_file(argv[i + 1], &file_size);
+        size_t packet = strtoul(argv[i + 2], NULL, 0);
+        int iterations = strncmp(argv[i], "bench", 5) == 0 ? 5 : 1;
+        double start = now_us();
+        esp_err_t err = ESP_OK;
+        for (int n = 0; n < iterations && err == ESP_OK; n++)
+            err = update(file, file_size, packet);
+        double time = (now_us() - start) / iterations;
+        printf("%s %zu %d %d %d %d %.0f %zu\n", argv[i], packet, err, boot == &ota, partition_is(&ota, app, app_size),
+               partition_is(&storage, image, storage_size), time, heap_peak);
+        free(file);
+    }
+    close(flash);
+    return 0;
+}
+"""
+
+# error codes of HOST_H
+OK = 0
+
+
+def zigbee_header(image_size):
+    """the OTA header of zigpy, as written by create-ota.py"""
+    header = struct.pack("<IHHHHHIH32sI", ZIGBEE_MAGIC, 0x0100, 56, 0, 65535, 200, 0x020100, 2, b"", image_size)
+    assert len(header) == 56
+    return header
+
+
+def element(tag, data):
+    return struct.pack("<HI", tag, len(data)) + data
+
+
+def ota_file(app, storage, header=True, extra=b"", storage_first=True):
+    """the file of create-ota.py: the compressed storage then the compressed app, extra sub-elements in between"""
+    elements = [element(TAG_STORAGE, zlib.compress(storage, 9)), extra, element(TAG_APP, zlib.compress(app, 9))]
+    elements = b"".join(elements if storage_first else reversed(elements))
+    return (zigbee_header(56 + len(elements)) if header else b"") + elements
+
+
+def storage_image(size):
+    """a LittleFS image is mostly erased blocks: the files of src_data, then 0xFF"""
+    data = b""
+    for name in sorted(os.listdir(SRC_DATA)):
+        with open(os.path.join(SRC_DATA, name), "rb") as f:
+            data += f.read()
+    return data[: size // 2] + b"\xff" * (size - min(len(data), size // 2))
+
+
+def build(work):
+    with open(os.path.join(work, "host.h"), "w", encoding="utf-8") as f:
+        f.write(HOST_H)
+        f.write(OTA_H)
+    for name in STUBS + ["esp_system.h", "esp_check.h"]:
+        with open(os.path.join(work, name), "w", encoding="utf-8") as f:
+            f.write('#pragma once\n#include "host.h"\n')
+    os.makedirs(os.path.join(work, "freertos"), exist_ok=True)
+    for name in ("freertos/FreeRTOS.h", "freertos/task.h"):
+        with open(os.path.join(work, name), "w", encoding="utf-8") as f:
+            f.write('#pragma once\n#include "host.h"\n')
+    with open(os.path.join(work, "config.h"), "w", encoding="utf-8") as f:
+        f.write(f"#pragma once\n#define STORAGE_PARTITION {storage_partition_label()}\n")
+        f.write(f'#define STORAGE_PATH "{os.path.join(work, "storage")}"\n')
+    os.makedirs(os.path.join(work, "mbedtls"), exist_ok=True)
+    with open(os.path.join(work, "mbedtls/sha256.h"), "w", encoding="utf-8") as f:
+        f.write(SHA256_H)
+    with open(os.path.join(work, "harness.c"), "w", encoding="utf-8") as f:
+        f.write(HARNESS)
+    program = os.path.join(work, "harness")
+    subprocess.run(
+        [
+            "gcc", "-O2", "-std=gnu17", "-w", "-I", work, "-I", os.path.join(MAIN_DIR, "include"), "-o", program,
+            os.path.join(work, "harness.c"), os.path.join(MAIN_DIR, "ota_zlib.c"),
+            os.path.join(MAIN_DIR, "storage_update.c"), "-lz", "-lcrypto",
+        ],
+        check=True,
+    )
+    return program
+
+
+def check():
+    storage_size, ota_size = partition_sizes()
+    if len(sys.argv) > 2:
+        with open(sys.argv[1], "rb") as f:
+            app = f.read()
+        with open(sys.argv[2], "rb") as f:
+            storage = f.read()
+        source = f"{os.path.basename(sys.argv[1])} and {os.path.basename(sys.argv[2])}"
+    else:
+        with open(host_binary(), "rb") as f:
+            app = f.read()[: ota_size - 2 * storage_size - 8192]  # room for the scratch area of the storage
+        storage = storage_image(storage_size)
+        source = f"{os.path.basename(host_binary())} and src_data"
+
+    full = ota_file(app, storage)
+    corrupted = bytearray(full)
+    corrupted[len(full) - len(app) // 4] ^= 0x10  # in the compressed app
+    signature = element(0x0001, random.Random(74).randbytes(80))  # a sub-element the device does not use
+    files = {
+        "zigbee": (full, 64),
+        "tuya": (ota_file(app, storage, header=False), 1024),
+        "skipped": (ota_file(app, storage, extra=signature), 777),
+        "truncated": (full[:-100], 1460),
+        "corrupted": (bytes(corrupted), 1460),
+        "storage-last": (ota_file(app, storage, storage_first=False), 1460),
+    }
+    for packet in (512, 1460, 4096):
+        files[f"bench-{packet}"] = (full, packet)
+
+    with tempfile.TemporaryDirectory() as work:
+        program = build(work)
+        paths = {}
+        for name, data in (("app", app), ("storage", storage)):
+            paths[name] = os.path.join(work, name + ".bin")
+            with open(paths[name], "wb") as f:
+                f.write(data)
+        args = []
+        for name, (data, packet) in files.items():
+            path = os.path.join(work, name + ".ota")
+            with open(path, "wb") as f:
+                f.write(data)
+            args += [name, path, str(packet)]
+        lines = subprocess.run(
+            [program, os.path.join(work, "flash.bin"), str(storage_size), str(ota_size), paths["app"],
+             paths["storage"]] + args,
+            check=True, capture_output=True, text=True,
+        ).stdout.splitlines()
+
+    images = len(app) + len(storage)
+    print(f"{source}: {len(app)} + {len(storage)} bytes")
+    print(f"download       {len(full)} bytes, {100 * len(full) / images:.1f}% of the images")
+    failed = 0
+    for line in lines:
+        name, packet, err, booted, app_ok, storage_ok, time_us, heap = line.split()
+        err, booted, app_ok, storage_ok, heap = int(err), int(booted), int(app_ok), int(storage_ok), int(heap)
+        time_us = float(time_us)
+        if name in ("truncated", "corrupted", "storage-last"):
+            ok = err != OK and not booted
+        else:
+            ok = err == OK and booted and app_ok and storage_ok
+        line = f"{name:14} {packet:>5} bytes packets: {err:#x}, boot {'new' if booted else 'old'}"
+        if name.startswith("bench"):
+            line += f", {time_us / 1000:.1f} ms, {images / time_us:.1f} MB/s, peak heap {heap} bytes"
+        print(line + ("" if ok else "  FAILED"))
+        failed += not ok
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(1 if check() else 0)
@@ -7,6 +7,9 @@ const mode_config_http = document.getElementById("http-conf");
 const mode_config_mqtt = document.getElementById("mqtt-conf");
 const mode_config_zigbee = document.getElementById("zigbee-conf");
 const mode_config_tuya = document.getElementById("tuya-conf");
+const mode_config_udp = document.getElementById("udp-conf");
+const mode_config_coap = document.getElementById("coap-conf");
+const mode_config_modbus = document.getElementById("modbus-conf");
 
 const wifi_configurator = document.getElementById("wifi-configurator");
 const wifi_password = document.getElementById("wifi-password");
@@ -45,6 +48,12 @@ const mqtt_password = document.getElementById("mqtt-password");
 const mqtt_password_svg = document.getElementById("mqtt-pw-svg");
 let mqtt_password_edited = false;
 
+const udp_key = document.getElementById("udp-key");
+let udp_key_edited = false;
+
+// sent as 0 or 1, an unchecked checkbox is not in the form data
+const config_switches = ["web-gzip", "web-columns"];
+
 const refresh_rate = document.getElementById("refresh-rate");
 const refresh_rate_number = document.getElementById("refresh-rate-number");
 
@@ -59,12 +68,15 @@ const MQTT = 2;
 const MQTT_HA = 3;
 const ZIGBEE = 4;
 const TUYA = 5;
+const UDP = 6;
+const COAP = 7;
+const MODBUS = 8;
 
 // prettier-ignore
 const tests_list = [
-  { id: 0, mode: [HTTP, MQTT, MQTT_HA, TUYA], text: " ",  state: PENDING,                         hide: true , retry: false, retry: 3, timeout: 10000, continue: true},
-  { id: 1, mode: [HTTP, MQTT, MQTT_HA, TUYA], text: "Connexion au réseau WiFi",  state: PENDING , hide: false, retry: true , retry: 10,timeout: 2000,  continue: false},
-  { id: 2, mode: [HTTP, MQTT, MQTT_HA, TUYA], text: "Test du réseau WiFi",       state: PENDING , hide: false, retry: false, retry: 3, timeout: 10000, continue: true},
+  { id: 0, mode: [HTTP, MQTT, MQTT_HA, TUYA, UDP, COAP, MODBUS], text: " ",  state: PENDING,                         hide: true , retry: false, retry: 3, timeout: 10000, continue: true},
+  { id: 1, mode: [HTTP, MQTT, MQTT_HA, TUYA, UDP, COAP, MODBUS], text: "Connexion au réseau WiFi",  state: PENDING , hide: false, retry: true , retry: 10,timeout: 2000,  continue: false},
+  { id: 2, mode: [HTTP, MQTT, MQTT_HA, TUYA, UDP, COAP, MODBUS], text: "Test du réseau WiFi",       state: PENDING , hide: false, retry: false, retry: 3, timeout: 10000, continue: true},
 
   { id: 3, mode: [MQTT, MQTT_HA],             text: "Connexion au serveur MQTT", state: PENDING , hide: false, retry: false, retry: 3, timeout: 10000, continue: false},
   { id: 4, mode: [MQTT, MQTT_HA],             text: "Envoi des données MQTT",    state: PENDING , hide: false, retry: false, retry: 3, timeout: 10000, continue: true},
@@ -82,6 +94,9 @@ function update_config_view(mode) {
   mode_config_mqtt.classList.add("hide");
   mode_config_zigbee.classList.add("hide");
   mode_config_tuya.classList.add("hide");
+  mode_config_udp.classList.add("hide");
+  mode_config_coap.classList.add("hide");
+  mode_config_modbus.classList.add("hide");
   wifi_configurator.classList.add("hide");
   switch (mode) {
     case 1:
@@ -105,6 +120,18 @@ function update_config_view(mode) {
       mode_config_tuya.classList.remove("hide");
       wifi_configurator.classList.remove("hide");
       break;
+    case 6:
+      mode_config_udp.classList.remove("hide");
+      wifi_configurator.classList.remove("hide");
+      break;
+    case 7:
+      mode_config_coap.classList.remove("hide");
+      wifi_configurator.classList.remove("hide");
+      break;
+    case 8:
+      mode_config_modbus.classList.remove("hide");
+      wifi_configurator.classList.remove("hide");
+      break;
   }
 }
 
@@ -472,6 +499,14 @@ function handleSubmit(event) {
     delete config["mqtt-password"];
   }
 
+  if (!udp_key_edited) {
+    delete config["udp-key"];
+  }
+
+  config_switches.forEach((key) => {
+    config[key] = document.querySelector(`[name="${key}"]`).checked ? "1" : "0";
+  });
+
   if (config["server-mode"] == 2 && mqtt_ha_discovery.checked) {
     config["server-mode"] = "3";
   }
@@ -575,6 +610,11 @@ window.addEventListener("load", function () {
     console.log("MQTT password edited");
   });
 
+  udp_key.addEventListener("input", (event) => {
+    udp_key_edited = true;
+    console.log("UDP key edited");
+  });
+
   refresh_rate.addEventListener("input", (event) => {
     set_refresh_rate(event.target.value);
   });
@@ -614,6 +654,15 @@ window.addEventListener("load", function () {
             tuya_device_auth.value = "*".repeat(element);
             continue;
           }
+          if (key == "udp-key") {
+            // generate a fake key of data["udp-key"]
+            udp_key.value = "*".repeat(element);
+            continue;
+          }
+          if (config_switches.includes(key)) {
+            document.querySelector(`[name="${key}"]`).checked = element != 0;
+            continue;
+          }
 
           if (key == "refresh-rate") {
             set_refresh_rate(element);
@@ -9,7 +9,24 @@ var TOKEN = "1234"; //token to authenticate the TICMeter
 const app = express();
 const server = createServer(app);
 
-app.use(bodyParser.json()); //parse json body
+app.use(bodyParser.json({ inflate: true })); //parse json body, inflate "Content-Encoding: gzip" bodies
+
+//count the requests per socket to check that the TICMeter reuses its connection
+let socketCount = 0;
+let reusedCount = 0;
+server.on("connection", (socket) => {
+  socket.id = ++socketCount;
+  socket.requests = 0;
+});
+app.use((req, res, next) => {
+  const socket = req.socket;
+  socket.requests++;
+  if (socket.requests > 1) {
+    reusedCount++;
+  }
+  console.log(`${req.method} ${req.path}: socket #${socket.id}, request ${socket.requests} (${reusedCount} reused / ${socketCount} sockets)`);
+  next();
+});
 
 app.get("/", (req, res) => {
   res.send("Hello World");
@@ -0,0 +1,48 @@
+import { createHash } from "crypto";
+
+export const DEVICE_CONFIG = { //config props sent to the TICMeter: prop in database (set by the web client) -> TICMeter key
+    REFRESH_RATE: "refresh_rate",
+    DATA_COUNT: "store_before_send",
+    ENCODING: "encoding",
+    GZIP: "gzip",
+    COLUMNS: "columns",
+};
+
+export async function saveConfig(prisma, config) { //update the config props of the database, return the errors
+    var strError = "";
+    for (const [key, value] of Object.entries(config)) { //loop through config object and update database
+        await prisma.config.update({
+            where: {
+                prop: key
+            },
+            data: {
+                value: value.toString()
+            }
+        }).catch((error) => {
+            console.log(error);
+            strError += error + "\n";
+        });
+    }
+    return strError;
+}
+
+export async function sendDeviceConfig(prisma, req, res, unchangedStatus) { //send the TICMeter config with its ETag, nothing if the TICMeter already has it
+    const result = await prisma.config.findMany({
+        where: {
+            prop: { in: Object.keys(DEVICE_CONFIG) }
+        },
+        orderBy: {
+            prop: "asc"
+        }
+    });
+    var config = {};
+    result.forEach((element) => { //convert array to object, with the keys of the TICMeter
+        config[DEVICE_CONFIG[element.prop]] = Number(element.value);
+    });
+    const etag = '"' + createHash("sha1").update(JSON.stringify(config)).digest("hex").substring(0, 16) + '"';
+    if (req.headers["if-none-match"] === etag) { //config unchanged: empty response
+        res.status(unchangedStatus).end();
+        return;
+    }
+    res.set("ETag", etag).send(config);
+}
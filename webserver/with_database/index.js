@@ -5,6 +5,7 @@ import cors from 'cors'
 import { PrismaClient } from "@prisma/client"
 import { Server } from "socket.io";
 import sass from 'node-sass';
+import { saveConfig, sendDeviceConfig } from "./device_config.js";
 
 
 const prisma = new PrismaClient(); //create prisma client to connect to database
@@ -99,20 +100,7 @@ io.on("connection", (socket) => { //connection event
     });
 
     socket.on("set_config", async(config) => { //set_config event from web client to set config in database
-        var strError = "";
-        for (const [key, value] of Object.entries(config)) { //loop through config object and update database
-            await prisma.config.update({
-                where: {
-                    prop: key
-                },
-                data: {
-                    value: value.toString()
-                }
-            }).catch((error) => {
-                console.log(error);
-                strError += error + "\n";
-            });
-        }
+        const strError = await saveConfig(prisma, config);
         if (strError != "") { //if there is an error, send it to web client
             socket.emit("error", strError);
         } else {
@@ -136,6 +124,30 @@ function bigIntToString(object) { //convert bigint (from database) to string (JS
     return object;
 }
 
+function columnsToData(body) { //rebuild one object per sample from a batch sent by columns (see firmware/main/include/cbor.h)
+    const data = [];
+    let timestamp = 0;
+    body.time.forEach((delta) => { //first timestamp, then the delta from the previous one
+        timestamp += delta;
+        data.push({ timestamp: timestamp });
+    });
+    body.labels.forEach((label, i) => {
+        let previous = null;
+        body.columns[i].forEach((value, j) => {
+            if (value === null) { //cleared value
+                return;
+            }
+            if (typeof value === 'string') { //text: "" if unchanged
+                previous = (value === "") ? previous : value;
+            } else { //number: delta from the previous value of the column
+                previous = (previous === null ? 0 : previous) + value;
+            }
+            data[j][label] = previous;
+        });
+    });
+    return data;
+}
+
 function arrayBigIntToString(array) { //convert array of bigint (from database) to array of string (JSON.stringify can't handle bigint)
     for (let i = 0; i < array.length; i++) {
         array[i] = bigIntToString(array[i]);
@@ -144,7 +156,7 @@ function arrayBigIntToString(array) { //convert array of bigint (from database)
 }
 
 app.use(cors()); //allow cors for all origins
-app.use(bodyParser.json()); //parse json body
+app.use(bodyParser.json({ inflate: true })); //parse json body, inflate "Content-Encoding: gzip" bodies
 app.use(bodyParser.urlencoded({ extended: true })); //parse urlencoded body
 
 app.get('/index.css', (req, res) => {
@@ -184,6 +196,15 @@ app.post("/post", async(req, res) => { //post request from esp32 to insert data
         return;
     }
 
+    if ("columns" in body) { //batch sent by columns
+        if (!Array.isArray(body.labels) || !Array.isArray(body.time) || !Array.isArray(body.columns) || body.labels.length != body.columns.length) {
+            console.log("Post Config: invalid columns");
+            res.status(400).send("invalid columns");
+            return;
+        }
+        body.data = columnsToData(body);
+    }
+
     if (!("data" in body)) {
         console.log("Post Config: data is missing");
         res.status(400).send("data is missing");
@@ -258,7 +279,10 @@ app.post("/post", async(req, res) => { //post request from esp32 to insert data
             VCONDO: body.VCONDO,
         },
     });
-    res.send("OK");
+    await sendDeviceConfig(prisma, req, res, 204).catch((error) => { //the TICMeter gets its config in the response
+        console.log(error);
+        res.send("OK");
+    });
 });
 
 
@@ -289,17 +313,10 @@ app.get("/config", async(req, res) => { //get config from database (only for esp
     const token = req.query.token;
 
     if (token == TOKEN) { //check if token is valid
-        const result = await prisma.config.findMany() //get config from database
-            .then((result) => {
-                var toSend = {};
-                result.forEach((element) => { //convert array to object
-                    toSend[element.prop] = element.value;
-                });
-                res.send(toSend); //send config to esp32
-            }).catch((error) => {
-                console.log(error);
-                res.status(500).send(error);
-            });
+        await sendDeviceConfig(prisma, req, res, 304).catch((error) => { //send config to esp32
+            console.log(error);
+            res.status(500).send(error);
+        });
     } else {
         res.status(401).send("TOKEN is invalid"); //send error if token is invalid
     }
@@ -0,0 +1,62 @@
+import { test } from "node:test";
+import assert from "node:assert";
+import { saveConfig, sendDeviceConfig } from "../device_config.js";
+
+function createPrisma(rows) { //the config table in memory
+    return {
+        config: {
+            findMany: async(query) => Object.entries(rows)
+                .filter(([prop]) => query.where.prop.in.includes(prop))
+                .sort(([a], [b]) => a.localeCompare(b))
+                .map(([prop, value]) => ({ prop: prop, value: value })),
+            update: async(query) => {
+                if (!(query.where.prop in rows)) {
+                    throw new Error("Record to update not found: " + query.where.prop);
+                }
+                rows[query.where.prop] = query.data.value;
+            },
+        },
+    };
+}
+
+async function post(prisma, etag) { //the config part of the response of POST /post
+    const req = { headers: etag ? { "if-none-match": etag } : {} };
+    const res = {
+        status(code) { this.code = code; return this; },
+        set(name, value) { this.headers[name] = value; return this; },
+        send(body) { this.body = body; return this; },
+        end() { return this; },
+        code: 200,
+        headers: {},
+        body: undefined,
+    };
+    await sendDeviceConfig(prisma, req, res, 204);
+    return res;
+}
+
+test("the refresh rate set from the web client is sent in the POST response", async() => {
+    const prisma = createPrisma({ TOKEN: "abc", REFRESH_RATE: "60", DATA_COUNT: "2", SSID: "home", MODE: "BASE" });
+
+    const first = await post(prisma);
+    assert.strictEqual(first.code, 200);
+    assert.deepStrictEqual(first.body, { store_before_send: 2, refresh_rate: 60 });
+
+    const unchanged = await post(prisma, first.headers.ETag);
+    assert.strictEqual(unchanged.code, 204);
+    assert.strictEqual(unchanged.body, undefined);
+
+    // the settings window sends the whole config, numbers as typed in the inputs
+    const error = await saveConfig(prisma, { TOKEN: "abc", REFRESH_RATE: 120, DATA_COUNT: "2", SSID: "home", MODE: "BASE" });
+    assert.strictEqual(error, "");
+
+    const changed = await post(prisma, first.headers.ETag);
+    assert.strictEqual(changed.code, 200);
+    assert.deepStrictEqual(changed.body, { store_before_send: 2, refresh_rate: 120 });
+    assert.notStrictEqual(changed.headers.ETag, first.headers.ETag);
+});
+
+test("the TOKEN and the props of the web client are not sent", async() => {
+    const prisma = createPrisma({ TOKEN: "abc", REFRESH_RATE: "30", DATA_COUNT: "5", ENCODING: "1", GZIP: "1", COLUMNS: "0", PRIX_BASE: "0.2" });
+    const res = await post(prisma);
+    assert.deepStrictEqual(res.body, { columns: 0, store_before_send: 5, encoding: 1, gzip: 1, refresh_rate: 30 });
+});